@@ -1,17 +1,235 @@
 #include <iostream>
+#include <map>
 
+#include "event_cache.hpp"
+#include "file_reader.hpp"
 #include "generator.hpp"
 #include "mcstas_reader.hpp"
+#include "memory_transmitter.hpp"
+#include "multi_source.hpp"
 #include "nexus_reader.hpp"
 
 using StreamFormat = SINQAmorSim::ESSformat;
 
 using Instrument = SINQAmorSim::Amor;
 using Source = SINQAmorSim::NeXusSource<Instrument, StreamFormat>;
+using StreamSource = SINQAmorSim::NeXusStreamSource<Instrument, StreamFormat>;
 using Control = SINQAmorSim::CommandlineControl;
 
-using Serialiser = SINQAmorSim::FlatBufferSerialiser;
-using Communication = SINQAmorSim::KafkaTransmitter<Serialiser>;
+// time_binning is converted to the stream ToF as in Amor::toEventFmt
+const double TofScale = 0.1;
+
+using PulseFill = std::function<void(std::vector<StreamFormat::value_type> &)>;
+using EventData = SINQAmorSim::EventStore<StreamFormat::value_type>;
+using EventStore = std::shared_ptr<const EventData>;
+/// Reports of the transport added to the statistics, by field
+using Reports = std::map<std::string, std::function<nlohmann::json()>>;
+
+/// Single source generator, run by dispatch() with the chosen transport
+/// and serialiser
+struct RunGenerator {
+  SINQAmorSim::Configuration &config;
+  EventData &data;
+  std::shared_ptr<const SINQAmorSim::SynthesisTables> tables;
+  PulseFill fill;
+  const Reports &reports;
+
+  template <class Communication, class Serialiser> void run() {
+    Generator<Communication, Control, Serialiser> g(config);
+    if (tables) {
+      g.setSynthesis(tables, data.size() / 2, TofScale);
+    }
+    for (auto &report : reports) {
+      g.addReport(report.first, report.second);
+    }
+    g.template run<StreamFormat::value_type>(data.events(), fill);
+  }
+};
+
+/// Generator of Configuration::sources, run by dispatch()
+struct RunMultiSource {
+  SINQAmorSim::Configuration &config;
+  const std::vector<EventStore> &stores;
+  const Reports &reports;
+
+  template <class Communication, class Serialiser> void run() {
+    SINQAmorSim::MultiSourceGenerator<Communication, Control, Serialiser> g(
+        config);
+    for (auto &report : reports) {
+      g.addReport(report.first, report.second);
+    }
+    g.template run<StreamFormat::value_type>(stores);
+  }
+};
+
+template <template <class> class Transmitter, class Runner>
+void dispatchSerialiser(const SINQAmorSim::Configuration &config,
+                        Runner &runner) {
+  using namespace SINQAmorSim;
+  if (config.serialiser == "pooled") {
+    runner.template run<Transmitter<PooledFlatBufferSerialiser>,
+                        PooledFlatBufferSerialiser>();
+  } else if (config.serialiser == "template") {
+    runner.template run<Transmitter<TemplateFlatBufferSerialiser>,
+                        TemplateFlatBufferSerialiser>();
+  } else {
+    runner.template run<Transmitter<FlatBufferSerialiser>,
+                        FlatBufferSerialiser>();
+  }
+}
+
+/// Run with the transport and serialiser of the configuration
+template <class Runner>
+void dispatch(const SINQAmorSim::Configuration &config, Runner &runner) {
+  if (config.transport == "null") {
+    dispatchSerialiser<SINQAmorSim::NullTransmitter>(config, runner);
+  } else if (config.transport == "memory") {
+    dispatchSerialiser<SINQAmorSim::MemoryTransmitter>(config, runner);
+  } else if (config.transport == "file") {
+    dispatchSerialiser<SINQAmorSim::FileTransmitter>(config, runner);
+  } else if (config.transport == "shm") {
+    dispatchSerialiser<SINQAmorSim::ShmTransmitter>(config, runner);
+  } else if (config.transport == "udp") {
+    dispatchSerialiser<SINQAmorSim::UdpTransmitter>(config, runner);
+  } else if (config.transport == "zmq") {
+#if HAVE_ZMQ
+    dispatchSerialiser<SINQAmorSim::ZmqTransmitter>(config, runner);
+#else
+    throw std::runtime_error("Built without 0MQ support");
+#endif
+  } else {
+    dispatchSerialiser<SINQAmorSim::KafkaTransmitter>(config, runner);
+  }
+}
+
+/// The consumer of the memory transport, if used
+std::unique_ptr<SINQAmorSim::MemoryDrain>
+makeDrain(const SINQAmorSim::Configuration &config) {
+  std::unique_ptr<SINQAmorSim::MemoryDrain> drain{nullptr};
+  if (config.transport == "memory") {
+    drain.reset(new SINQAmorSim::MemoryDrain);
+  }
+  return drain;
+}
+
+/// The statistics of the consumer of the memory transport and of the UDP
+/// senders, if used
+Reports makeReports(const SINQAmorSim::Configuration &config,
+                    SINQAmorSim::MemoryDrain *drain) {
+  Reports reports;
+  if (drain) {
+    reports["memory"] = [drain]() { return drain->report(); };
+  }
+  if (config.transport == "udp") {
+    reports["udp"] = []() {
+      return SINQAmorSim::UdpCounters::instance().report();
+    };
+  }
+  return reports;
+}
+
+template <class Communication>
+void replayRecording(const SINQAmorSim::Configuration &config) {
+  SINQAmorSim::RecordingReplay<Communication> replay(
+      config.replay_recording, config.replay_speed, config.producer.broker,
+      config.options, config.max_inflight,
+      size_t(config.max_inflight_mb) * 1000000);
+  replay.run();
+}
+
+/// Send a recording of the file transport again, unchanged
+int runReplay(const SINQAmorSim::Configuration &config) {
+  using Serialiser = SINQAmorSim::FlatBufferSerialiser;
+  try {
+    auto drain = makeDrain(config);
+    if (config.transport == "null") {
+      replayRecording<SINQAmorSim::NullTransmitter<Serialiser>>(config);
+    } else if (config.transport == "memory") {
+      replayRecording<SINQAmorSim::MemoryTransmitter<Serialiser>>(config);
+      std::cout << "memory: " << drain->report() << "\n";
+    } else if (config.transport == "shm") {
+      replayRecording<SINQAmorSim::ShmTransmitter<Serialiser>>(config);
+    } else if (config.transport == "udp") {
+      replayRecording<SINQAmorSim::UdpTransmitter<Serialiser>>(config);
+      std::cout << "udp: " << SINQAmorSim::UdpCounters::instance().report()
+                << "\n";
+    } else if (config.transport == "zmq") {
+#if HAVE_ZMQ
+      replayRecording<SINQAmorSim::ZmqTransmitter<Serialiser>>(config);
+#else
+      throw std::runtime_error("Built without 0MQ support");
+#endif
+    } else {
+      replayRecording<SINQAmorSim::KafkaTransmitter<Serialiser>>(config);
+    }
+  } catch (std::exception &e) {
+    std::cout << e.what() << "\n";
+    return -1;
+  }
+  return 0;
+}
+
+/// Events of file repeated multiplier times, mapped from the cache if
+/// enabled
+EventData loadEvents(const SINQAmorSim::Configuration &config,
+                     const std::string &file, const int multiplier) {
+  EventData data;
+  std::unique_ptr<SINQAmorSim::EventCache<StreamFormat>> cache{nullptr};
+  if (!config.cache_dir.empty()) {
+    cache.reset(new SINQAmorSim::EventCache<StreamFormat>(
+        config.cache_dir, SINQAmorSim::histogramHash<Instrument>(file),
+        Instrument::name(), multiplier));
+  }
+  if (cache && cache->load(data)) {
+    std::cout << "Events loaded from " << cache->filename() << "\n";
+  } else {
+    Source stream(file, multiplier);
+    data = EventData(stream.get());
+    if (cache) {
+      try {
+        cache->store(data.events());
+      } catch (std::exception &e) {
+        std::cout << "Warning: " << e.what() << "\n";
+      }
+    }
+  }
+  if (config.bytes > 0) {
+    data.resize(config.bytes / sizeof(StreamFormat::value_type));
+  }
+  return data;
+}
+
+/// One store per source; the sources with the same file and multiplier
+/// share it
+int runSources(SINQAmorSim::Configuration &config) {
+  std::map<std::pair<std::string, int>, EventStore> loaded;
+  std::vector<EventStore> stores;
+  try {
+    for (auto &source : config.sources) {
+      auto &store = loaded[{source.source, source.multiplier}];
+      if (!store) {
+        store = std::make_shared<const EventData>(
+            loadEvents(config, source.source, source.multiplier));
+      }
+      stores.push_back(store);
+    }
+  } catch (std::exception &e) {
+    std::cout << e.what() << "\n";
+    return -1;
+  }
+  std::cout << config.sources.size() << " sources, " << loaded.size()
+            << " event stores\n";
+  try {
+    auto drain = makeDrain(config);
+    auto reports = makeReports(config, drain.get());
+    RunMultiSource runner{config, stores, reports};
+    dispatch(config, runner);
+  } catch (std::exception &e) {
+    std::cout << e.what() << "\n";
+    return -1;
+  }
+  return 0;
+}
 
 int main(int argc, char **argv) {
 
@@ -36,22 +254,76 @@ int main(int argc, char **argv) {
         "Conflict between parameters `bytes` and `multiplier`");
   }
 
-  std::vector<StreamFormat::value_type> data;
-
-  try {
-    Source stream(config.source, config.multiplier);
-    data = stream.get();
-  } catch (std::exception &e) {
-    std::cout << e.what() << "\n";
-    return -1;
+  // the 0MQ streams take the endpoint in place of the broker
+  if (config.transport == "zmq") {
+    config.producer.broker = config.zmq_endpoint;
+    config.options.emplace_back("zmq.pattern", config.zmq_pattern);
   }
-  if (config.bytes > 0) {
-    data.resize(config.bytes / sizeof(StreamFormat::value_type));
+  // and the UDP streams the address of the readout receiver
+  if (config.transport == "udp") {
+    config.producer.broker = config.udp_endpoint;
+    config.options.emplace_back("udp.packet.bytes",
+                                std::to_string(config.udp_packet_bytes));
+  }
+  if (!config.replay_recording.empty()) {
+    return runReplay(config);
+  }
+  // the streams take the directory of the recording in place of the broker
+  if (config.transport == "file") {
+    config.producer.broker = config.record_dir;
+  }
+  if (!config.sources.empty()) {
+    return runSources(config);
+  }
+
+  EventData data;
+  std::shared_ptr<const SINQAmorSim::SynthesisTables> tables{nullptr};
+  std::unique_ptr<StreamSource> streamSource{nullptr};
+  PulseFill fill{nullptr};
+
+  if (config.source_mode == "stream") {
+    try {
+      streamSource.reset(new StreamSource(
+          config.source, size_t(config.memory_budget) * 1000000));
+    } catch (std::exception &e) {
+      std::cout << e.what() << "\n";
+      return -1;
+    }
+    size_t eventsPerPulse =
+        config.bytes / (2 * sizeof(StreamFormat::value_type));
+    auto source = streamSource.get();
+    fill = [source, eventsPerPulse](
+        std::vector<StreamFormat::value_type> &events) {
+      source->next(events, eventsPerPulse);
+    };
+  } else {
+    try {
+      // the synthesis tables need the histogram, only replay uses the cache
+      if (config.event_synthesis == "stochastic") {
+        Source stream(config.source, config.multiplier);
+        data = EventData(stream.get());
+        tables = std::make_shared<const SINQAmorSim::SynthesisTables>(
+            stream.instrument().histogram());
+        if (!config.seed) {
+          config.seed = std::random_device{}();
+        }
+        if (config.bytes > 0) {
+          data.resize(config.bytes / sizeof(StreamFormat::value_type));
+        }
+      } else {
+        data = loadEvents(config, config.source, config.multiplier);
+      }
+    } catch (std::exception &e) {
+      std::cout << e.what() << "\n";
+      return -1;
+    }
   }
 
   try {
-    Generator<Communication, Control, Serialiser> g(config);
-    g.run<StreamFormat::value_type>(data);
+    auto drain = makeDrain(config);
+    auto reports = makeReports(config, drain.get());
+    RunGenerator runner{config, data, tables, fill, reports};
+    dispatch(config, runner);
   } catch (std::exception e) {
     std::cout << e.what() << "\n";
   }
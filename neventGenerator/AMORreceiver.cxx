@@ -9,7 +9,14 @@ using Instrument = SINQAmorSim::Amor;
 using Source = SINQAmorSim::NeXusSource<Instrument, SINQAmorSim::PSIformat>;
 using Control = SINQAmorSim::NoControl;
 using Serialiser = SINQAmorSim::FlatBufferSerialiser;
-using Communication = SINQAmorSim::KafkaListener<Serialiser>;
+
+template <class Communication>
+void runListener(SINQAmorSim::Configuration &config) {
+  Generator<Communication, Control, Serialiser> g(config);
+
+  std::vector<Source::value_type> stream;
+  g.listen(stream);
+}
 
 int main(int argc, char **argv) {
 
@@ -22,11 +29,37 @@ int main(int argc, char **argv) {
     return -1;
   }
   auto &config = parser.config;
+  if (config.bench) {
+    // read what is already in the topics, as fast as possible
+    config.options.emplace_back("auto.offset.reset", "earliest");
+  }
+  if (config.single_topic) {
+    // a single consumer group: the partitions are split among the threads.
+    // Inserted first, so that a group.id in the options wins
+    config.options.insert(
+        config.options.begin(),
+        {"group.id",
+         "AMORreceiver-" + std::to_string(SINQAmorSim::getCurrentTimestamp())});
+  }
 
-  Generator<Communication, Control, Serialiser> g(config);
-
-  std::vector<Source::value_type> stream;
-  g.listen(stream);
+  if (config.transport == "udp") {
+    std::cout << "The udp transport sends readout packets, not messages\n";
+    return -1;
+  } else if (config.transport == "shm") {
+    runListener<SINQAmorSim::ShmListener<Serialiser>>(config);
+  } else if (config.transport == "zmq") {
+#if HAVE_ZMQ
+    // the listener binds the endpoint the generators connect to
+    config.producer.broker = config.zmq_endpoint;
+    config.options.emplace_back("zmq.pattern", config.zmq_pattern);
+    runListener<SINQAmorSim::ZmqListener<Serialiser>>(config);
+#else
+    std::cout << "Built without 0MQ support\n";
+    return -1;
+#endif
+  } else {
+    runListener<SINQAmorSim::KafkaListener<Serialiser>>(config);
+  }
 
   return 0;
 }
@@ -1,4 +1,5 @@
 #include "Configuration.hpp"
+#include "affinity.hpp"
 
 #include <fstream>
 #include <getopt.h>
@@ -95,11 +96,23 @@ void SINQAmorSim::ConfigurationParser::parse_configuration_file_impl(
     }
   }
   {
-    auto x = find<int>("rate", Configuration);
+    auto x = find<double>("rate", Configuration);
     if (x) {
       config.rate = x.inner();
     }
   }
+  {
+    auto x = find<int>("spin_time", Configuration);
+    if (x) {
+      config.spin_time = x.inner();
+    }
+  }
+  {
+    auto x = find<std::string>("late_pulse_policy", Configuration);
+    if (x) {
+      config.late_pulse_policy = x.inner();
+    }
+  }
   {
     auto x = find<int>("bytes", Configuration);
     if (x) {
@@ -124,6 +137,186 @@ void SINQAmorSim::ConfigurationParser::parse_configuration_file_impl(
       config.timestamp_generator = x.inner();
     }
   }
+  {
+    auto x = find<std::string>("event_synthesis", Configuration);
+    if (x) {
+      config.event_synthesis = x.inner();
+    }
+  }
+  {
+    auto x = find<std::string>("source_mode", Configuration);
+    if (x) {
+      config.source_mode = x.inner();
+    }
+  }
+  {
+    auto x = find<std::string>("cache_dir", Configuration);
+    if (x) {
+      config.cache_dir = x.inner();
+    }
+  }
+  {
+    auto x = find<bool>("bench", Configuration);
+    if (x) {
+      config.bench = x.inner();
+    }
+  }
+  {
+    auto x = find<std::string>("stats_file", Configuration);
+    if (x) {
+      config.stats_file = x.inner();
+    }
+  }
+  {
+    auto x = find<bool>("single_topic", Configuration);
+    if (x) {
+      config.single_topic = x.inner();
+    }
+  }
+  {
+    auto x = find<std::string>("partitioning", Configuration);
+    if (x) {
+      config.partitioning = x.inner();
+    }
+  }
+  {
+    auto x = find<int>("sticky_pulses", Configuration);
+    if (x) {
+      config.sticky_pulses = x.inner();
+    }
+  }
+  {
+    auto x = find<double>("rate_limit", Configuration);
+    if (x) {
+      config.rate_limit = x.inner();
+    }
+  }
+  {
+    auto x = find<std::string>("rate_limit_unit", Configuration);
+    if (x) {
+      config.rate_limit_unit = x.inner();
+    }
+  }
+  {
+    auto x = find<std::string>("load_profile", Configuration);
+    if (x) {
+      config.load_profile = x.inner();
+    }
+  }
+  {
+    auto x = find<std::string>("transport", Configuration);
+    if (x) {
+      config.transport = x.inner();
+    }
+  }
+  {
+    auto x = find<std::string>("record_dir", Configuration);
+    if (x) {
+      config.record_dir = x.inner();
+    }
+  }
+  {
+    auto x = find<std::string>("replay_recording", Configuration);
+    if (x) {
+      config.replay_recording = x.inner();
+    }
+  }
+  {
+    auto x = find<double>("replay_speed", Configuration);
+    if (x) {
+      config.replay_speed = x.inner();
+    }
+  }
+  {
+    auto x = find<std::string>("zmq_endpoint", Configuration);
+    if (x) {
+      config.zmq_endpoint = x.inner();
+    }
+  }
+  {
+    auto x = find<std::string>("zmq_pattern", Configuration);
+    if (x) {
+      config.zmq_pattern = x.inner();
+    }
+  }
+  {
+    auto x = find<std::string>("udp_endpoint", Configuration);
+    if (x) {
+      config.udp_endpoint = x.inner();
+    }
+  }
+  {
+    auto x = find<int>("udp_packet_bytes", Configuration);
+    if (x) {
+      config.udp_packet_bytes = x.inner();
+    }
+  }
+  {
+    auto x = find<int>("pipeline_workers", Configuration);
+    if (x) {
+      config.pipeline_workers = x.inner();
+    }
+  }
+  {
+    auto x = find<int>("pipeline_depth", Configuration);
+    if (x) {
+      config.pipeline_depth = x.inner();
+    }
+  }
+  {
+    auto x = find<std::string>("cpu_affinity", Configuration);
+    if (x) {
+      config.cpu_affinity = x.inner();
+    }
+  }
+  {
+    auto x = find<std::string>("reporter_cpus", Configuration);
+    if (x) {
+      config.reporter_cpus = x.inner();
+    }
+  }
+  {
+    auto x = find<std::string>("kafka_cpus", Configuration);
+    if (x) {
+      config.kafka_cpus = x.inner();
+    }
+  }
+  {
+    auto x = find<bool>("numa_local", Configuration);
+    if (x) {
+      config.numa_local = x.inner();
+    }
+  }
+  {
+    auto x = find<int>("max_inflight", Configuration);
+    if (x) {
+      config.max_inflight = x.inner();
+    }
+  }
+  {
+    auto x = find<int>("max_inflight_mb", Configuration);
+    if (x) {
+      config.max_inflight_mb = x.inner();
+    }
+  }
+  {
+    auto x = find<int>("memory_budget", Configuration);
+    if (x) {
+      config.memory_budget = x.inner();
+    }
+  }
+  {
+    auto x = find<int>("seed", Configuration);
+    if (x) {
+      config.seed = x.inner();
+    }
+  }
+  {
+    auto x = find<std::string>("serialiser", Configuration);
+    if (x) {
+      config.serialiser = x.inner();
+    }
+  }
   {
     auto x = find<int>("report_time", Configuration);
     if (x) {
@@ -135,6 +328,27 @@ void SINQAmorSim::ConfigurationParser::parse_configuration_file_impl(
     nlohmann::json kafka = x.inner();
     get_kafka_options(kafka);
   }
+  auto y = find<nlohmann::json>("sources", Configuration);
+  if (y) {
+    nlohmann::json sources = y.inner();
+    get_sources(sources);
+  }
+}
+
+void SINQAmorSim::ConfigurationParser::get_sources(nlohmann::json &sources) {
+  if (!sources.is_array()) {
+    throw std::runtime_error("Error: sources must be a list");
+  }
+  config.sources.clear();
+  for (auto &item : sources) {
+    SourceConfiguration source;
+    source.source_name = item.value("source_name", "");
+    source.topic = item.value("topic", "");
+    source.source = item.value("source", "");
+    source.rate = item.value("rate", 0.0);
+    source.multiplier = item.value("multiplier", 0);
+    config.sources.push_back(source);
+  }
 }
 
 void SINQAmorSim::ConfigurationParser::get_kafka_options(
@@ -195,7 +409,39 @@ SINQAmorSim::ConfigurationParser::parse_command_line(int argc, char **argv) {
       {"num-threads", required_argument, nullptr, 0},
       {"bytes", required_argument, nullptr, 0},
       {"rate", required_argument, nullptr, 0},
+      {"spin-time", required_argument, nullptr, 0},
+      {"late-pulse-policy", required_argument, nullptr, 0},
       {"timestamp-generator", required_argument, nullptr, 0},
+      {"serialiser", required_argument, nullptr, 0},
+      {"event-synthesis", required_argument, nullptr, 0},
+      {"seed", required_argument, nullptr, 0},
+      {"source-mode", required_argument, nullptr, 0},
+      {"memory-budget", required_argument, nullptr, 0},
+      {"cache-dir", required_argument, nullptr, 0},
+      {"stats-file", required_argument, nullptr, 0},
+      {"bench", no_argument, nullptr, 0},
+      {"single-topic", no_argument, nullptr, 0},
+      {"partitioning", required_argument, nullptr, 0},
+      {"sticky-pulses", required_argument, nullptr, 0},
+      {"rate-limit", required_argument, nullptr, 0},
+      {"rate-limit-unit", required_argument, nullptr, 0},
+      {"load-profile", required_argument, nullptr, 0},
+      {"max-inflight", required_argument, nullptr, 0},
+      {"max-inflight-mb", required_argument, nullptr, 0},
+      {"transport", required_argument, nullptr, 0},
+      {"record-dir", required_argument, nullptr, 0},
+      {"replay-recording", required_argument, nullptr, 0},
+      {"replay-speed", required_argument, nullptr, 0},
+      {"zmq-endpoint", required_argument, nullptr, 0},
+      {"zmq-pattern", required_argument, nullptr, 0},
+      {"udp-endpoint", required_argument, nullptr, 0},
+      {"udp-packet-bytes", required_argument, nullptr, 0},
+      {"pipeline-workers", required_argument, nullptr, 0},
+      {"pipeline-depth", required_argument, nullptr, 0},
+      {"cpu-affinity", required_argument, nullptr, 0},
+      {"reporter-cpus", required_argument, nullptr, 0},
+      {"kafka-cpus", required_argument, nullptr, 0},
+      {"numa-local", no_argument, nullptr, 0},
       {nullptr, 0, nullptr, 0},
   };
   std::string cmd;
@@ -214,7 +460,7 @@ SINQAmorSim::ConfigurationParser::parse_command_line(int argc, char **argv) {
       break;
     case 0:
       auto lname = long_options[option_index].name;
-      CommandLineOptions[lname] = optarg;
+      CommandLineOptions[lname] = optarg ? optarg : "true";
       break;
     }
   }
@@ -242,6 +488,13 @@ int to_int(const std::string &Text) {
   return Value;
 }
 
+double to_double(const std::string &Text) {
+  std::stringstream Stream(Text);
+  double Value;
+  Stream >> Value;
+  return Value;
+}
+
 void SINQAmorSim::ConfigurationParser::override_configuration_with(
     std::map<std::string, std::string> &CommandLineOptions) {
   std::string Value = findMap("producer-uri", CommandLineOptions);
@@ -266,7 +519,15 @@ void SINQAmorSim::ConfigurationParser::override_configuration_with(
   }
   Value = findMap("rate", CommandLineOptions);
   if (!Value.empty()) {
-    config.rate = to_int(Value);
+    config.rate = to_double(Value);
+  }
+  Value = findMap("spin-time", CommandLineOptions);
+  if (!Value.empty()) {
+    config.spin_time = to_int(Value);
+  }
+  Value = findMap("late-pulse-policy", CommandLineOptions);
+  if (!Value.empty()) {
+    config.late_pulse_policy = Value;
   }
   Value = findMap("bytes", CommandLineOptions);
   if (!Value.empty()) {
@@ -276,6 +537,151 @@ void SINQAmorSim::ConfigurationParser::override_configuration_with(
   if (!Value.empty()) {
     config.timestamp_generator = Value;
   }
+  Value = findMap("serialiser", CommandLineOptions);
+  if (!Value.empty()) {
+    config.serialiser = Value;
+  }
+  Value = findMap("event-synthesis", CommandLineOptions);
+  if (!Value.empty()) {
+    config.event_synthesis = Value;
+  }
+  Value = findMap("seed", CommandLineOptions);
+  if (!Value.empty()) {
+    config.seed = to_int(Value);
+  }
+  Value = findMap("source-mode", CommandLineOptions);
+  if (!Value.empty()) {
+    config.source_mode = Value;
+  }
+  Value = findMap("memory-budget", CommandLineOptions);
+  if (!Value.empty()) {
+    config.memory_budget = to_int(Value);
+  }
+  Value = findMap("cache-dir", CommandLineOptions);
+  if (!Value.empty()) {
+    config.cache_dir = Value;
+  }
+  Value = findMap("stats-file", CommandLineOptions);
+  if (!Value.empty()) {
+    config.stats_file = Value;
+  }
+  Value = findMap("bench", CommandLineOptions);
+  if (!Value.empty()) {
+    config.bench = true;
+  }
+  Value = findMap("single-topic", CommandLineOptions);
+  if (!Value.empty()) {
+    config.single_topic = true;
+  }
+  Value = findMap("partitioning", CommandLineOptions);
+  if (!Value.empty()) {
+    config.partitioning = Value;
+  }
+  Value = findMap("sticky-pulses", CommandLineOptions);
+  if (!Value.empty()) {
+    config.sticky_pulses = to_int(Value);
+  }
+  Value = findMap("rate-limit", CommandLineOptions);
+  if (!Value.empty()) {
+    config.rate_limit = to_double(Value);
+  }
+  Value = findMap("rate-limit-unit", CommandLineOptions);
+  if (!Value.empty()) {
+    config.rate_limit_unit = Value;
+  }
+  Value = findMap("load-profile", CommandLineOptions);
+  if (!Value.empty()) {
+    config.load_profile = Value;
+  }
+  Value = findMap("max-inflight", CommandLineOptions);
+  if (!Value.empty()) {
+    config.max_inflight = to_int(Value);
+  }
+  Value = findMap("max-inflight-mb", CommandLineOptions);
+  if (!Value.empty()) {
+    config.max_inflight_mb = to_int(Value);
+  }
+  Value = findMap("transport", CommandLineOptions);
+  if (!Value.empty()) {
+    config.transport = Value;
+  }
+  Value = findMap("record-dir", CommandLineOptions);
+  if (!Value.empty()) {
+    config.record_dir = Value;
+  }
+  Value = findMap("replay-recording", CommandLineOptions);
+  if (!Value.empty()) {
+    config.replay_recording = Value;
+  }
+  Value = findMap("replay-speed", CommandLineOptions);
+  if (!Value.empty()) {
+    config.replay_speed = to_double(Value);
+  }
+  Value = findMap("zmq-endpoint", CommandLineOptions);
+  if (!Value.empty()) {
+    config.zmq_endpoint = Value;
+  }
+  Value = findMap("zmq-pattern", CommandLineOptions);
+  if (!Value.empty()) {
+    config.zmq_pattern = Value;
+  }
+  Value = findMap("udp-endpoint", CommandLineOptions);
+  if (!Value.empty()) {
+    config.udp_endpoint = Value;
+  }
+  Value = findMap("udp-packet-bytes", CommandLineOptions);
+  if (!Value.empty()) {
+    config.udp_packet_bytes = to_int(Value);
+  }
+  Value = findMap("pipeline-workers", CommandLineOptions);
+  if (!Value.empty()) {
+    config.pipeline_workers = to_int(Value);
+  }
+  Value = findMap("pipeline-depth", CommandLineOptions);
+  if (!Value.empty()) {
+    config.pipeline_depth = to_int(Value);
+  }
+  Value = findMap("cpu-affinity", CommandLineOptions);
+  if (!Value.empty()) {
+    config.cpu_affinity = Value;
+  }
+  Value = findMap("reporter-cpus", CommandLineOptions);
+  if (!Value.empty()) {
+    config.reporter_cpus = Value;
+  }
+  Value = findMap("kafka-cpus", CommandLineOptions);
+  if (!Value.empty()) {
+    config.kafka_cpus = Value;
+  }
+  Value = findMap("numa-local", CommandLineOptions);
+  if (!Value.empty()) {
+    config.numa_local = true;
+  }
+}
+
+// The sources without topic write to <topic>-<source_name>
+void fill_source_defaults(SINQAmorSim::Configuration &config) {
+  for (auto &source : config.sources) {
+    if (source.source_name.empty()) {
+      throw std::runtime_error("Error: source without source_name");
+    }
+    if (source.topic.empty()) {
+      source.topic = config.producer.topic + "-" + source.source_name;
+    }
+    if (source.source.empty()) {
+      source.source = config.source;
+    }
+    if (source.rate == 0) {
+      source.rate = config.rate;
+    }
+    if (source.multiplier == 0) {
+      source.multiplier = config.multiplier;
+    }
+    if (source.rate < 0 || source.multiplier < 0) {
+      throw std::runtime_error("Error: negative rate or multiplier in source " +
+                               source.source_name);
+    }
+  }
 }
 
 void SINQAmorSim::ConfigurationParser::validate() {
@@ -288,7 +694,8 @@ void SINQAmorSim::ConfigurationParser::validate() {
   if (config.source_name.empty()) {
     throw std::runtime_error("Error: empty source name");
   }
-  if (config.source.empty()) {
+  if (config.source.empty() && config.sources.empty() &&
+      config.replay_recording.empty()) {
     throw std::runtime_error("Error: empty source");
   }
   if (config.multiplier <= 0) {
@@ -303,6 +710,122 @@ void SINQAmorSim::ConfigurationParser::validate() {
   if (config.bytes <= 0) {
     throw std::runtime_error("Error: bytes <= 0");
   }
+  if (config.spin_time < 0) {
+    throw std::runtime_error("Error: spin_time < 0");
+  }
+  if (config.late_pulse_policy != "catch_up" &&
+      config.late_pulse_policy != "skip") {
+    throw std::runtime_error("Error: unknown late pulse policy " +
+                             config.late_pulse_policy);
+  }
+  if (config.serialiser != "flatbuffers" && config.serialiser != "pooled" &&
+      config.serialiser != "template") {
+    throw std::runtime_error("Error: unknown serialiser " + config.serialiser);
+  }
+  if (config.event_synthesis != "replay" &&
+      config.event_synthesis != "stochastic") {
+    throw std::runtime_error("Error: unknown event synthesis " +
+                             config.event_synthesis);
+  }
+  if (config.source_mode != "memory" && config.source_mode != "stream") {
+    throw std::runtime_error("Error: unknown source mode " +
+                             config.source_mode);
+  }
+  if (config.source_mode == "stream" && config.event_synthesis != "replay") {
+    throw std::runtime_error(
+        "Error: event synthesis requires source mode memory");
+  }
+  if (config.partitioning != "random" && config.partitioning != "round_robin" &&
+      config.partitioning != "bank" && config.partitioning != "sticky") {
+    throw std::runtime_error("Error: unknown partitioning " +
+                             config.partitioning);
+  }
+  if (config.sticky_pulses <= 0) {
+    throw std::runtime_error("Error: sticky_pulses <= 0");
+  }
+  if (config.rate_limit < 0) {
+    throw std::runtime_error("Error: rate_limit < 0");
+  }
+  if (config.rate_limit_unit != "messages" &&
+      config.rate_limit_unit != "bytes" && config.rate_limit_unit != "events") {
+    throw std::runtime_error("Error: unknown rate limit unit " +
+                             config.rate_limit_unit);
+  }
+  if (config.max_inflight < 0 || config.max_inflight_mb < 0) {
+    throw std::runtime_error("Error: in flight budget < 0");
+  }
+  if (config.transport != "kafka" && config.transport != "null" &&
+      config.transport != "memory" && config.transport != "file" &&
+      config.transport != "zmq" && config.transport != "shm" &&
+      config.transport != "udp") {
+    throw std::runtime_error("Error: unknown transport " + config.transport);
+  }
+  if (config.transport == "shm" && config.single_topic &&
+      config.num_threads > 1) {
+    throw std::runtime_error("Error: a shared memory ring has a single "
+                             "producer, single_topic requires num_threads 1");
+  }
+  if (config.zmq_pattern != "push" && config.zmq_pattern != "pub") {
+    throw std::runtime_error("Error: unknown zmq_pattern " +
+                             config.zmq_pattern);
+  }
+  // a header of 40 bytes and one event, up to the largest UDP payload
+  if (config.udp_packet_bytes < 48 || config.udp_packet_bytes > 65507) {
+    throw std::runtime_error("Error: udp_packet_bytes out of [48, 65507]");
+  }
+  if (config.replay_speed < 0) {
+    throw std::runtime_error("Error: replay_speed < 0");
+  }
+  if (!config.replay_recording.empty() && config.transport == "file") {
+    throw std::runtime_error("Error: can't replay a recording to the file "
+                             "transport");
+  }
+  if (config.pipeline_workers < 0 || config.pipeline_depth <= 0) {
+    throw std::runtime_error("Error: pipeline_workers < 0 or "
+                             "pipeline_depth <= 0");
+  }
+  if (config.pipeline_workers > 0 &&
+      (config.event_synthesis != "replay" || config.source_mode != "memory" ||
+       config.timestamp_generator != "none" || !config.load_profile.empty() ||
+       !config.sources.empty())) {
+    throw std::runtime_error("Error: the pipeline requires replayed events "
+                             "from memory, timestamp_generator none, no load "
+                             "profile and no sources");
+  }
+  // the workers share the buffer pool, released once delivered
+  if (config.pipeline_workers > 0 && config.serialiser != "pooled") {
+    throw std::runtime_error("Error: the pipeline requires the pooled "
+                             "serialiser");
+  }
+  // throws on a malformed list or a CPU the process can't run on
+  availableCpus(config.cpu_affinity);
+  availableCpus(config.reporter_cpus);
+  availableCpus(config.kafka_cpus);
+  fill_source_defaults(config);
+  for (auto &source : config.sources) {
+    if (source.source.empty()) {
+      throw std::runtime_error("Error: empty source in source " +
+                               source.source_name);
+    }
+  }
+  if (!config.sources.empty() &&
+      (config.event_synthesis != "replay" || config.source_mode != "memory" ||
+       config.timestamp_generator != "none" || !config.load_profile.empty() ||
+       config.rate_limit > 0)) {
+    throw std::runtime_error("Error: sources require replayed events from "
+                             "memory, timestamp_generator none, no load "
+                             "profile and no rate limit");
+  }
+  if (config.memory_budget <= 0) {
+    throw std::runtime_error("Error: memory_budget <= 0");
+  }
+  if (config.serialiser == "template" &&
+      (config.event_synthesis != "replay" || config.source_mode != "memory" ||
+       config.timestamp_generator != "none")) {
+    throw std::runtime_error("Error: template serialiser requires replayed "
+                             "events from memory and timestamp_generator "
+                             "none");
+  }
 }
 
 void SINQAmorSim::ConfigurationParser::print() {
@@ -315,7 +838,46 @@ void SINQAmorSim::ConfigurationParser::print() {
             << "num-threads: " << config.num_threads << "\n"
             << "bytes: " << config.bytes << "\n"
             << "rate: " << config.rate << "\n"
-            << "timestamp_generator: " << config.timestamp_generator << "\n";
+            << "spin_time: " << config.spin_time << "\n"
+            << "late_pulse_policy: " << config.late_pulse_policy << "\n"
+            << "timestamp_generator: " << config.timestamp_generator << "\n"
+            << "serialiser: " << config.serialiser << "\n"
+            << "event_synthesis: " << config.event_synthesis << "\n"
+            << "seed: " << config.seed << "\n"
+            << "source_mode: " << config.source_mode << "\n"
+            << "memory_budget: " << config.memory_budget << "\n"
+            << "cache_dir: " << config.cache_dir << "\n"
+            << "stats_file: " << config.stats_file << "\n"
+            << "bench: " << config.bench << "\n"
+            << "single_topic: " << config.single_topic << "\n"
+            << "partitioning: " << config.partitioning << "\n"
+            << "sticky_pulses: " << config.sticky_pulses << "\n"
+            << "rate_limit: " << config.rate_limit << "\n"
+            << "rate_limit_unit: " << config.rate_limit_unit << "\n"
+            << "load_profile: " << config.load_profile << "\n"
+            << "max_inflight: " << config.max_inflight << "\n"
+            << "max_inflight_mb: " << config.max_inflight_mb << "\n"
+            << "transport: " << config.transport << "\n"
+            << "record_dir: " << config.record_dir << "\n"
+            << "replay_recording: " << config.replay_recording << "\n"
+            << "replay_speed: " << config.replay_speed << "\n"
+            << "zmq_endpoint: " << config.zmq_endpoint << "\n"
+            << "zmq_pattern: " << config.zmq_pattern << "\n"
+            << "udp_endpoint: " << config.udp_endpoint << "\n"
+            << "udp_packet_bytes: " << config.udp_packet_bytes << "\n"
+            << "pipeline_workers: " << config.pipeline_workers << "\n"
+            << "pipeline_depth: " << config.pipeline_depth << "\n"
+            << "cpu_affinity: " << config.cpu_affinity << "\n"
+            << "reporter_cpus: " << config.reporter_cpus << "\n"
+            << "kafka_cpus: " << config.kafka_cpus << "\n"
+            << "numa_local: " << config.numa_local << "\n";
+  for (auto &source : config.sources) {
+    std::cout << "source " << source.source_name << ":\n"
+              << "\ttopic: " << source.topic << "\n"
+              << "\tsource: " << source.source << "\n"
+              << "\trate: " << source.rate << "\n"
+              << "\tmultiplier: " << source.multiplier << "\n";
+  }
   std::cout << "kafka:\n";
   for (auto &o : config.options) {
     std::cout << "\t" << o.first << ": " << o.second << "\n";
@@ -332,8 +894,40 @@ void usage(const std::string &exe) {
             << "\t--multiplier:\n"
             << "\t--threads:\n"
             << "\t--rate:\n"
+            << "\t--spin-time:\n"
+            << "\t--late-pulse-policy:\n"
             << "\t--bytes:\n"
             << "\t--timestamp-generator\n"
+            << "\t--serialiser\n"
+            << "\t--event-synthesis\n"
+            << "\t--seed\n"
+            << "\t--source-mode\n"
+            << "\t--memory-budget\n"
+            << "\t--cache-dir\n"
+            << "\t--stats-file\n"
+            << "\t--bench\n"
+            << "\t--single-topic\n"
+            << "\t--partitioning\n"
+            << "\t--sticky-pulses\n"
+            << "\t--rate-limit\n"
+            << "\t--rate-limit-unit\n"
+            << "\t--load-profile\n"
+            << "\t--max-inflight\n"
+            << "\t--max-inflight-mb\n"
+            << "\t--transport\n"
+            << "\t--record-dir\n"
+            << "\t--replay-recording\n"
+            << "\t--replay-speed\n"
+            << "\t--zmq-endpoint\n"
+            << "\t--zmq-pattern\n"
+            << "\t--udp-endpoint\n"
+            << "\t--udp-packet-bytes\n"
+            << "\t--pipeline-workers\n"
+            << "\t--pipeline-depth\n"
+            << "\t--cpu-affinity\n"
+            << "\t--reporter-cpus\n"
+            << "\t--kafka-cpus\n"
+            << "\t--numa-local\n"
             << "\n";
   exit(0);
 }
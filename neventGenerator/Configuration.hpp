@@ -13,6 +13,17 @@ public:
   std::string topic{""};
 };
 
+/// A logical source of the multi-source generator. Empty or zero fields
+/// take the value of the main configuration.
+class SourceConfiguration {
+public:
+  std::string source_name{""};
+  std::string topic{""};
+  std::string source{""};
+  double rate{0};
+  int multiplier{0};
+};
+
 class Configuration {
 
 public:
@@ -21,13 +32,46 @@ public:
   std::string source{""};
   std::string source_name{"AMOR.event.stream"};
   std::string timestamp_generator{"none"};
+  std::string serialiser{"flatbuffers"};
+  std::string late_pulse_policy{"catch_up"};
+  std::string event_synthesis{"replay"};
+  std::string source_mode{"memory"};
+  std::string cache_dir{""};
+  std::string stats_file{""};
+  std::string partitioning{"random"};
+  std::string rate_limit_unit{"messages"};
+  std::string load_profile{""};
+  std::string cpu_affinity{""};
+  std::string reporter_cpus{""};
+  std::string kafka_cpus{""};
+  std::string transport{"kafka"};
+  std::string record_dir{"."};
+  std::string replay_recording{""};
+  std::string zmq_endpoint{"tcp://localhost:5555"};
+  std::string zmq_pattern{"push"};
+  std::string udp_endpoint{"localhost:9000"};
   int multiplier{0};
   int bytes{0};
-  int rate{0};
+  double rate{0};
+  double rate_limit{0};
+  double replay_speed{1.0};
+  int spin_time{0};
   int report_time{10};
+  int seed{0};
+  int memory_budget{256};
+  int udp_packet_bytes{1472};
   int num_threads{0};
+  int sticky_pulses{100};
+  int max_inflight{10000};
+  int max_inflight_mb{512};
+  int pipeline_workers{0};
+  int pipeline_depth{64};
+  bool bench{false};
+  bool single_topic{false};
+  bool numa_local{false};
   bool valid{true};
   KafkaOptions options;
+  std::vector<SourceConfiguration> sources;
 };
 
 class ConfigurationParser {
@@ -49,6 +93,7 @@ private:
   KafkaConfiguration parse_string_uri(const std::string &uri,
                                       const bool use_defaults = false);
   void get_kafka_options(nlohmann::json &);
+  void get_sources(nlohmann::json &);
 
   void override_configuration_with(std::map<std::string, std::string> &);
 
@@ -1,88 +1,530 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <atomic>
 #include <chrono>
-#include <condition_variable>
+#include <cstring>
+#include <fstream>
+#include <functional>
 #include <iostream>
-#include <mutex>
-#include <numeric>
+#include <map>
+#include <memory>
+#include <stdexcept>
 #include <string>
 #include <thread>
 #include <vector>
 
 #include <nlohmann/json.hpp>
 
+#include "hdr_histogram.hpp"
+#include "load_profile.hpp"
+#include "sequence_tracker.hpp"
+
+inline uint64_t nowNanoseconds() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+inline nlohmann::json
+histogramToJson(const SINQAmorSim::HdrHistogram &Histogram) {
+  nlohmann::json Result;
+  Result["count"] = Histogram.count();
+  Result["mean_us"] = Histogram.mean() * 1e-3;
+  Result["p50_us"] = Histogram.percentile(0.5) * 1e-3;
+  Result["p99_us"] = Histogram.percentile(0.99) * 1e-3;
+  Result["p999_us"] = Histogram.percentile(0.999) * 1e-3;
+  Result["max_us"] = Histogram.max() * 1e-3;
+  return Result;
+}
+
+/// Running totals of the message sequence of each "<topic>/<source>"
+inline nlohmann::json
+sequenceToJson(const std::map<std::string, SINQAmorSim::SequenceCounts> &All) {
+  nlohmann::json Result = nlohmann::json::object();
+  for (auto &Item : All) {
+    auto &Counts = Item.second;
+    Result[Item.first] = {{"received", Counts.Received},
+                          {"missing", Counts.Missing},
+                          {"duplicates", Counts.Duplicates},
+                          {"reordered", Counts.Reordered},
+                          {"late", Counts.Late},
+                          {"restarts", Counts.Restarts}};
+  }
+  return Result;
+}
+
+/// Counters of a single generator thread. Only the owning thread writes
+/// them (the delivery reports are served by the same thread in poll), the
+/// reporter reads them without locking. Each thread allocates its own
+/// instance, padded so that no cache line is shared with other data.
+/// Deliveries are also counted per partition, for the first MaxPartitions.
+struct ThreadStats {
+  static const int MaxPartitions = 256;
+
+  char PaddingBefore[64];
+  std::atomic<uint64_t> Pulses{0};
+  std::atomic<uint64_t> Events{0};
+  std::atomic<uint64_t> Messages{0};
+  std::atomic<uint64_t> Bytes{0};
+  std::atomic<uint64_t> Errors{0};
+  std::atomic<uint64_t> Sent{0};
+  std::atomic<uint64_t> SentBytes{0};
+  std::atomic<uint64_t> TimestampEvents{0};
+  std::atomic<uint64_t> TimestampNs{0};
+  std::atomic<uint64_t> Backpressure{0};
+  std::atomic<uint64_t> BlockedNs{0};
+  SINQAmorSim::AtomicHdrHistogram SendTime;
+  SINQAmorSim::AtomicHdrHistogram DeliveryLatency;
+  SINQAmorSim::AtomicHdrHistogram Lateness;
+  std::array<std::atomic<uint64_t>, MaxPartitions> PartitionMessages{};
+  std::array<std::atomic<uint64_t>, MaxPartitions> PartitionBytes{};
+  char PaddingAfter[64];
+
+  static void increment(std::atomic<uint64_t> &Counter, const uint64_t Value) {
+    Counter.store(Counter.load(std::memory_order_relaxed) + Value,
+                  std::memory_order_relaxed);
+  }
+};
+
+/// Plain copy of the counters of one thread at a given time
+struct ThreadSnapshot {
+  uint64_t Pulses{0};
+  uint64_t Events{0};
+  uint64_t Messages{0};
+  uint64_t Bytes{0};
+  uint64_t Errors{0};
+  uint64_t Sent{0};
+  uint64_t SentBytes{0};
+  uint64_t TimestampEvents{0};
+  uint64_t TimestampNs{0};
+  uint64_t Backpressure{0};
+  uint64_t BlockedNs{0};
+  SINQAmorSim::HdrHistogram SendTime;
+  SINQAmorSim::HdrHistogram DeliveryLatency;
+  SINQAmorSim::HdrHistogram Lateness;
+  std::vector<uint64_t> PartitionMessages;
+  std::vector<uint64_t> PartitionBytes;
+};
+
 template <typename Control> class Stats {
 
-  using system_clock = std::chrono::system_clock;
+  using steady_clock = std::chrono::steady_clock;
+  using nanoseconds = std::chrono::nanoseconds;
 
 public:
   void setNumThreads(const int NumThreads) {
-    NumMessages.resize(NumThreads);
-    MBytes.resize(NumThreads);
+    Threads.clear();
+    for (int i = 0; i < NumThreads; ++i) {
+      Threads.emplace_back(new ThreadStats);
+    }
+    Previous.assign(NumThreads, ThreadSnapshot{});
+    Placement.assign(NumThreads, {-1, -1});
+    for (auto &Snapshot : Previous) {
+      Snapshot.PartitionMessages.assign(ThreadStats::MaxPartitions, 0);
+      Snapshot.PartitionBytes.assign(ThreadStats::MaxPartitions, 0);
+    }
   }
 
-  void add(const int Messages, const int MB, const int ThreadId) {
-    NumMessages[ThreadId] += Messages;
-    MBytes[ThreadId] += MB;
-    ThreadCount++;
-    if (ThreadCount == NumMessages.size()) {
-      WaitUntilReady.notify_all();
-      ThreadCount = 0;
+  /// CPU and NUMA node (-1 if not known) a thread is pinned to, reported
+  /// with its throughput
+  void setPlacement(const int ThreadId, const int Cpu, const int Node) {
+    Placement[ThreadId] = {Cpu, Node};
+  }
+
+  void setTimestampPolicy(const std::string &Policy) {
+    TimestampPolicy = Policy;
+  }
+
+  void setReportTime(const int Seconds) { ReportTime = Seconds; }
+
+  /// Compare the achieved load with the one requested by Profile, for
+  /// BaseEvents events per pulse at level 1 (0 if not known)
+  void setProfile(std::shared_ptr<const SINQAmorSim::LoadProfile> Value,
+                  std::shared_ptr<SINQAmorSim::ProfileClock> Clock,
+                  const double BaseEvents) {
+    Profile = std::move(Value);
+    Time = std::move(Clock);
+    ProfileEvents = BaseEvents;
+  }
+
+  /// Add the result of Report() as field Key of each report, e.g. for the
+  /// statistics of another component. Called by the reporting thread.
+  void setExtra(const std::string &Key,
+                std::function<nlohmann::json()> Report) {
+    Extra.emplace_back(Key, std::move(Report));
+  }
+
+  /// Write the reports as JSON lines in Filename instead of stdout
+  void setOutput(const std::string &Filename) {
+    if (Filename.empty()) {
+      Output.reset();
+      return;
+    }
+    Output.reset(new std::ofstream(Filename, std::ios::app));
+    if (!*Output) {
+      throw std::runtime_error("Can't open statistics file " + Filename);
     }
   }
 
+  /// A pulse of NumEvents events has been handed to the transport in
+  /// SendTime, Lateness after its deadline
+  void pulse(const int ThreadId, const nanoseconds &SendTime,
+             const nanoseconds &Lateness, const uint64_t NumEvents = 0) {
+    auto &Thread = *Threads[ThreadId];
+    ThreadStats::increment(Thread.Pulses, 1);
+    ThreadStats::increment(Thread.Events, NumEvents);
+    Thread.SendTime.record(SendTime);
+    Thread.Lateness.record(Lateness);
+  }
+
+  /// A message of Bytes bytes has been delivered to Partition (negative
+  /// if not known) Latency after produce
+  void delivered(const int ThreadId, const uint64_t Bytes,
+                 const nanoseconds &Latency, const int32_t Partition = -1) {
+    auto &Thread = *Threads[ThreadId];
+    ThreadStats::increment(Thread.Messages, 1);
+    ThreadStats::increment(Thread.Bytes, Bytes);
+    Thread.DeliveryLatency.record(Latency);
+    if (Partition >= 0 && Partition < ThreadStats::MaxPartitions) {
+      ThreadStats::increment(Thread.PartitionMessages[Partition], 1);
+      ThreadStats::increment(Thread.PartitionBytes[Partition], Bytes);
+    }
+  }
+
+  /// A message of Bytes bytes has been handed to a transport that reports
+  /// no delivery (e.g. 0MQ PUB, which drops at the high water mark)
+  void sent(const int ThreadId, const uint64_t Bytes) {
+    auto &Thread = *Threads[ThreadId];
+    ThreadStats::increment(Thread.Sent, 1);
+    ThreadStats::increment(Thread.SentBytes, Bytes);
+  }
+
+  void failed(const int ThreadId) {
+    ThreadStats::increment(Threads[ThreadId]->Errors, 1);
+  }
+
+  /// The producer waited Elapsed for the in-flight budget or a full queue
+  void blocked(const int ThreadId, const nanoseconds &Elapsed) {
+    auto &Thread = *Threads[ThreadId];
+    ThreadStats::increment(Thread.Backpressure, 1);
+    ThreadStats::increment(Thread.BlockedNs, Elapsed.count());
+  }
+
+  /// Time spent applying the timestamp policy to NumEvents events
+  void addTimestamping(const uint64_t NumEvents, const nanoseconds &Elapsed,
+                       const int ThreadId) {
+    auto &Thread = *Threads[ThreadId];
+    ThreadStats::increment(Thread.TimestampEvents, NumEvents);
+    ThreadStats::increment(Thread.TimestampNs, Elapsed.count());
+  }
+
+  /// Every ReportTime seconds aggregate the counters of all the threads and
+  /// write one JSON line. Never waits for the generator threads: a stalled
+  /// thread simply shows no progress.
   void report() {
     while (Ctrl->stop()) {
       std::this_thread::sleep_for(std::chrono::milliseconds(100));
     }
+    auto StartTime = steady_clock::now();
+    takeSnapshot(Previous);
 
     while (Ctrl->run() || Ctrl->pause()) {
-      if (Ctrl->pause()) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      auto Now = steady_clock::now();
+      if (Ctrl->pause() || Now - StartTime < std::chrono::seconds(ReportTime)) {
         continue;
       }
-      std::chrono::time_point<std::chrono::system_clock> StartTime =
-          system_clock::now();
-      std::unique_lock<std::mutex> Lock(CountGuard);
-      WaitUntilReady.wait(Lock);
-      std::chrono::time_point<std::chrono::system_clock> Now =
-          system_clock::now();
-
-      int Messages = std::accumulate(NumMessages.begin(), NumMessages.end(), 0);
-      int MB = std::accumulate(MBytes.begin(), MBytes.end(), 0);
-
-      std::fill(NumMessages.begin(), NumMessages.end(), 0);
-      std::fill(MBytes.begin(), MBytes.end(), 0);
-
-      nlohmann::json Message;
-      Message["packets"] = Messages;
-      Message["MB"] = MB;
-      Message["MB/s"] =
-          1e3 * MB /
-          std::chrono::duration_cast<std::chrono::milliseconds>(Now - StartTime)
-              .count();
-      Message["timestamp"] = getCurrentTimestamp();
-      Message["num_threads"] = MBytes.size();
-      std::cout << Message.dump(4) << "\n";
+      std::vector<ThreadSnapshot> Current;
+      takeSnapshot(Current);
+      auto Message =
+          toJson(Current, std::chrono::duration<double>(Now - StartTime));
+      if (Profile) {
+        Message["profile"] = profileToJson(Message, Now);
+      }
+      for (auto &Item : Extra) {
+        Message[Item.first] = Item.second();
+      }
+      write(Message);
+      Previous.swap(Current);
       StartTime = Now;
     }
   }
 
   void setControl(std::shared_ptr<Control> &Control_) { Ctrl = Control_; }
 
+  /// Write a report line to the statistics output
+  void write(const nlohmann::json &Message) {
+    if (Output) {
+      *Output << Message.dump() << std::endl;
+    } else {
+      std::cout << Message.dump() << std::endl;
+    }
+  }
+
 private:
   std::shared_ptr<Control> Ctrl;
+  std::vector<std::unique_ptr<ThreadStats>> Threads;
+  std::vector<ThreadSnapshot> Previous;
+  std::vector<std::pair<int, int>> Placement;
+  std::vector<std::pair<std::string, std::function<nlohmann::json()>>> Extra;
+  std::string TimestampPolicy;
+  std::unique_ptr<std::ofstream> Output{nullptr};
+  int ReportTime{10};
+  std::shared_ptr<const SINQAmorSim::LoadProfile> Profile{nullptr};
+  std::shared_ptr<SINQAmorSim::ProfileClock> Time{nullptr};
+  double ProfileEvents{0};
 
-  uint64_t getCurrentTimestamp() {
-    return std::chrono::duration_cast<std::chrono::nanoseconds>(
-               std::chrono::system_clock::now().time_since_epoch())
-        .count();
+  /// Requested (mean over the interval) and achieved load
+  nlohmann::json profileToJson(const nlohmann::json &Message,
+                               const steady_clock::time_point &To) {
+    double Interval = Message["interval_s"];
+    double End = Time->seconds(To);
+    auto Mean = Profile->mean(End - Interval, End);
+    nlohmann::json Result;
+    Result["t_s"] = End;
+    Result["pulses/s"] = Message["pulses"].get<double>() / Interval;
+    Result["events/s"] = Message["events"].get<double>() / Interval;
+    if (Ctrl->rateLimit() > 0) {
+      Result["requested_rate_limit"] = Ctrl->rateLimit() * Mean.Rate;
+      return Result;
+    }
+    double Pulses = Ctrl->rate() * Threads.size();
+    Result["requested_pulses/s"] = Pulses * Mean.Rate;
+    if (ProfileEvents > 0) {
+      Result["requested_events/s"] = Pulses * ProfileEvents * Mean.Events;
+    }
+    return Result;
+  }
+
+  void takeSnapshot(std::vector<ThreadSnapshot> &Snapshot) {
+    Snapshot.resize(Threads.size());
+    for (size_t i = 0; i < Threads.size(); ++i) {
+      auto &Thread = *Threads[i];
+      auto &Result = Snapshot[i];
+      Result.Pulses = Thread.Pulses.load(std::memory_order_relaxed);
+      Result.Events = Thread.Events.load(std::memory_order_relaxed);
+      Result.Messages = Thread.Messages.load(std::memory_order_relaxed);
+      Result.Bytes = Thread.Bytes.load(std::memory_order_relaxed);
+      Result.Errors = Thread.Errors.load(std::memory_order_relaxed);
+      Result.Sent = Thread.Sent.load(std::memory_order_relaxed);
+      Result.SentBytes = Thread.SentBytes.load(std::memory_order_relaxed);
+      Result.TimestampEvents =
+          Thread.TimestampEvents.load(std::memory_order_relaxed);
+      Result.TimestampNs = Thread.TimestampNs.load(std::memory_order_relaxed);
+      Result.Backpressure = Thread.Backpressure.load(std::memory_order_relaxed);
+      Result.BlockedNs = Thread.BlockedNs.load(std::memory_order_relaxed);
+      Result.SendTime = Thread.SendTime.snapshot();
+      Result.DeliveryLatency = Thread.DeliveryLatency.snapshot();
+      Result.Lateness = Thread.Lateness.snapshot();
+      Result.PartitionMessages.resize(ThreadStats::MaxPartitions);
+      Result.PartitionBytes.resize(ThreadStats::MaxPartitions);
+      for (int p = 0; p < ThreadStats::MaxPartitions; ++p) {
+        Result.PartitionMessages[p] =
+            Thread.PartitionMessages[p].load(std::memory_order_relaxed);
+        Result.PartitionBytes[p] =
+            Thread.PartitionBytes[p].load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  nlohmann::json toJson(const std::vector<ThreadSnapshot> &Current,
+                        const std::chrono::duration<double> &Elapsed) {
+    using SINQAmorSim::AtomicHdrHistogram;
+    uint64_t Pulses{0}, Events{0}, Messages{0}, Bytes{0}, Errors{0};
+    uint64_t Sent{0}, SentBytes{0};
+    uint64_t Timestamped{0}, TimestampNs{0};
+    uint64_t Backpressure{0}, BlockedNs{0};
+    SINQAmorSim::HdrHistogram SendTime, DeliveryLatency, Lateness;
+    std::vector<uint64_t> PartitionMessages(ThreadStats::MaxPartitions, 0);
+    std::vector<uint64_t> PartitionBytes(ThreadStats::MaxPartitions, 0);
+    nlohmann::json PerThread = nlohmann::json::array();
+    nlohmann::json Throughput = nlohmann::json::array();
+    for (size_t i = 0; i < Current.size(); ++i) {
+      auto &Now = Current[i];
+      auto &Before = Previous[i];
+      Pulses += Now.Pulses - Before.Pulses;
+      Events += Now.Events - Before.Events;
+      Messages += Now.Messages - Before.Messages;
+      Bytes += Now.Bytes - Before.Bytes;
+      Errors += Now.Errors - Before.Errors;
+      Sent += Now.Sent - Before.Sent;
+      SentBytes += Now.SentBytes - Before.SentBytes;
+      Timestamped += Now.TimestampEvents - Before.TimestampEvents;
+      TimestampNs += Now.TimestampNs - Before.TimestampNs;
+      Backpressure += Now.Backpressure - Before.Backpressure;
+      BlockedNs += Now.BlockedNs - Before.BlockedNs;
+      SendTime.merge(AtomicHdrHistogram::delta(Now.SendTime, Before.SendTime));
+      DeliveryLatency.merge(AtomicHdrHistogram::delta(Now.DeliveryLatency,
+                                                      Before.DeliveryLatency));
+      Lateness.merge(AtomicHdrHistogram::delta(Now.Lateness, Before.Lateness));
+      PerThread.push_back(Now.Messages - Before.Messages);
+      Throughput.push_back(threadToJson(i, Now, Before, Elapsed));
+      for (int p = 0; p < ThreadStats::MaxPartitions; ++p) {
+        PartitionMessages[p] +=
+            Now.PartitionMessages[p] - Before.PartitionMessages[p];
+        PartitionBytes[p] += Now.PartitionBytes[p] - Before.PartitionBytes[p];
+      }
+    }
+    nlohmann::json PerPartition = nlohmann::json::object();
+    for (int p = 0; p < ThreadStats::MaxPartitions; ++p) {
+      if (PartitionMessages[p]) {
+        PerPartition[std::to_string(p)] = {
+            {"packets", PartitionMessages[p]},
+            {"MB/s", PartitionBytes[p] * 1e-6 / Elapsed.count()}};
+      }
+    }
+
+    nlohmann::json Message;
+    Message["timestamp"] = nowNanoseconds();
+    Message["interval_s"] = Elapsed.count();
+    Message["num_threads"] = Current.size();
+    Message["pulses"] = Pulses;
+    Message["events"] = Events;
+    Message["packets"] = Messages;
+    Message["errors"] = Errors;
+    Message["backpressure"] = Backpressure;
+    Message["blocked_s"] = BlockedNs * 1e-9;
+    Message["MB"] = Bytes * 1e-6;
+    Message["MB/s"] = Bytes * 1e-6 / Elapsed.count();
+    if (Sent) {
+      // not confirmed by the transport: never counted as packets
+      Message["sent_packets"] = Sent;
+      Message["sent_MB"] = SentBytes * 1e-6;
+      Message["sent_MB/s"] = SentBytes * 1e-6 / Elapsed.count();
+    }
+    Message["packets_per_thread"] = PerThread;
+    Message["threads"] = Throughput;
+    if (!PerPartition.empty()) {
+      Message["partitions"] = PerPartition;
+    }
+    Message["send_time"] = toJson(SendTime);
+    Message["delivery_latency"] = toJson(DeliveryLatency);
+    Message["lateness"] = toJson(Lateness);
+    Message["timestamp_policy"] = TimestampPolicy;
+    if (Timestamped) {
+      Message["timestamp_ns/event"] = double(TimestampNs) / Timestamped;
+      Message["timestamp_Mevents/s"] =
+          1e3 * Timestamped / std::max<uint64_t>(TimestampNs, 1);
+    }
+    return Message;
+  }
+
+  /// Throughput of thread i, with its placement if pinned
+  nlohmann::json threadToJson(const size_t i, const ThreadSnapshot &Now,
+                              const ThreadSnapshot &Before,
+                              const std::chrono::duration<double> &Elapsed) {
+    nlohmann::json Result;
+    Result["pulses/s"] = (Now.Pulses - Before.Pulses) / Elapsed.count();
+    Result["events/s"] = (Now.Events - Before.Events) / Elapsed.count();
+    Result["MB/s"] = (Now.Bytes - Before.Bytes) * 1e-6 / Elapsed.count();
+    if (Placement[i].first >= 0) {
+      Result["cpu"] = Placement[i].first;
+      Result["node"] = Placement[i].second;
+    }
+    return Result;
+  }
+
+  nlohmann::json toJson(const SINQAmorSim::HdrHistogram &Histogram) {
+    return histogramToJson(Histogram);
   }
+};
+
+/// Statistics of the receiver: throughput and latency of the messages of
+/// each source. Latencies are measured at reception against the ev42
+/// pulse_time and against the Kafka message timestamp, so they include the
+/// clock offset between the hosts. Used by a single thread.
+class ReceiverStats {
+  using nanoseconds = std::chrono::nanoseconds;
+
+public:
+  struct SourceStats {
+    uint64_t Messages{0};
+    uint64_t Bytes{0};
+    SINQAmorSim::HdrHistogram PulseLatency;
+    SINQAmorSim::HdrHistogram KafkaLatency;
+  };
 
-  std::vector<int> NumMessages;
-  std::vector<int> MBytes;
-  std::mutex CountGuard;
-  std::condition_variable WaitUntilReady;
-  std::atomic<size_t> ThreadCount{0};
+  /// A message of Bytes bytes received at ReceiveTime. KafkaTime is zero
+  /// if the message has no timestamp.
+  void add(const char *Source, const size_t SourceSize, const uint64_t Bytes,
+           const nanoseconds &PulseTime, const nanoseconds &KafkaTime,
+           const nanoseconds &ReceiveTime) {
+    auto &Stats = find(Source, SourceSize);
+    ++Stats.Messages;
+    Stats.Bytes += Bytes;
+    Stats.PulseLatency.record(ReceiveTime - PulseTime);
+    if (KafkaTime.count()) {
+      Stats.KafkaLatency.record(ReceiveTime - KafkaTime);
+    }
+  }
+
+  void add(const std::string &Source, const uint64_t Bytes,
+           const nanoseconds &PulseTime, const nanoseconds &KafkaTime,
+           const nanoseconds &ReceiveTime) {
+    add(Source.data(), Source.size(), Bytes, PulseTime, KafkaTime,
+        ReceiveTime);
+  }
+
+  const std::map<std::string, SourceStats> &sources() const { return Sources; }
+
+  /// Move the counts of Other into this
+  void merge(ReceiverStats &Other) {
+    for (auto &Source : Other.Sources) {
+      auto &Stats = Sources[Source.first];
+      Stats.Messages += Source.second.Messages;
+      Stats.Bytes += Source.second.Bytes;
+      Stats.PulseLatency.merge(Source.second.PulseLatency);
+      Stats.KafkaLatency.merge(Source.second.KafkaLatency);
+    }
+    Other.Sources.clear();
+    Other.Last = nullptr;
+  }
+
+  /// Report of the messages received in the last Elapsed, then reset
+  nlohmann::json report(const std::chrono::duration<double> &Elapsed) {
+    uint64_t Messages{0}, Bytes{0};
+    nlohmann::json PerSource = nlohmann::json::object();
+    for (auto &Source : Sources) {
+      auto &Stats = Source.second;
+      Messages += Stats.Messages;
+      Bytes += Stats.Bytes;
+      nlohmann::json Item;
+      Item["packets"] = Stats.Messages;
+      Item["MB"] = Stats.Bytes * 1e-6;
+      Item["MB/s"] = Stats.Bytes * 1e-6 / Elapsed.count();
+      Item["pulse_latency"] = histogramToJson(Stats.PulseLatency);
+      Item["kafka_latency"] = histogramToJson(Stats.KafkaLatency);
+      PerSource[Source.first] = Item;
+    }
+    Sources.clear();
+    Last = nullptr;
+
+    nlohmann::json Message;
+    Message["timestamp"] = nowNanoseconds();
+    Message["interval_s"] = Elapsed.count();
+    Message["packets"] = Messages;
+    Message["MB"] = Bytes * 1e-6;
+    Message["MB/s"] = Bytes * 1e-6 / Elapsed.count();
+    Message["packets/s"] = Messages / Elapsed.count();
+    Message["sources"] = PerSource;
+    return Message;
+  }
+
+private:
+  std::map<std::string, SourceStats> Sources;
+  std::string LastSource;
+  SourceStats *Last{nullptr};
+
+  // consecutive messages usually come from the same source: skip the map
+  // lookup (and the key allocation) if it doesn't change
+  SourceStats &find(const char *Source, const size_t Size) {
+    if (!Last || LastSource.size() != Size ||
+        std::memcmp(LastSource.data(), Source, Size)) {
+      LastSource.assign(Source, Size);
+      Last = &Sources[LastSource];
+    }
+    return *Last;
+  }
 };
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace SINQAmorSim {
+
+/// CPUs of a list in the Linux format, e.g. "0-3,8,10-11". An empty list
+/// means no restriction.
+inline std::vector<int> parseCpuList(const std::string &List) {
+  std::vector<int> Result;
+  std::stringstream Stream(List);
+  std::string Range;
+  while (std::getline(Stream, Range, ',')) {
+    if (Range.empty()) {
+      continue;
+    }
+    char *End{nullptr};
+    long First = std::strtol(Range.c_str(), &End, 10);
+    long Last = First;
+    if (*End == '-') {
+      const char *Upper = End + 1;
+      Last = std::strtol(Upper, &End, 10);
+      if (End == Upper) {
+        throw std::runtime_error("Invalid CPU list: " + List);
+      }
+    }
+    if (End == Range.c_str() || *End != '\0' || First < 0 || Last < First) {
+      throw std::runtime_error("Invalid CPU list: " + List);
+    }
+    for (long Cpu = First; Cpu <= Last; ++Cpu) {
+      Result.push_back(int(Cpu));
+    }
+  }
+  return Result;
+}
+
+#ifdef __linux__
+
+/// CPUs the calling thread may run on
+inline std::vector<int> threadCpus() {
+  cpu_set_t Set;
+  CPU_ZERO(&Set);
+  if (pthread_getaffinity_np(pthread_self(), sizeof(Set), &Set)) {
+    throw std::runtime_error("Can't get the CPU affinity");
+  }
+  std::vector<int> Result;
+  for (int Cpu = 0; Cpu < CPU_SETSIZE; ++Cpu) {
+    if (CPU_ISSET(Cpu, &Set)) {
+      Result.push_back(Cpu);
+    }
+  }
+  return Result;
+}
+
+/// Restrict the calling thread to Cpus, nothing to do if empty. The
+/// threads it creates afterwards inherit the restriction.
+inline void pinThread(const std::vector<int> &Cpus) {
+  if (Cpus.empty()) {
+    return;
+  }
+  cpu_set_t Set;
+  CPU_ZERO(&Set);
+  for (auto Cpu : Cpus) {
+    if (Cpu >= CPU_SETSIZE) {
+      throw std::runtime_error("CPU " + std::to_string(Cpu) + " out of range");
+    }
+    CPU_SET(Cpu, &Set);
+  }
+  if (pthread_setaffinity_np(pthread_self(), sizeof(Set), &Set)) {
+    throw std::runtime_error("Can't set the CPU affinity");
+  }
+}
+
+/// NUMA node of Cpu, -1 if not known
+inline int cpuNode(const int Cpu) {
+  auto Path = "/sys/devices/system/cpu/cpu" + std::to_string(Cpu);
+  DIR *Directory = opendir(Path.c_str());
+  if (!Directory) {
+    return -1;
+  }
+  int Result{-1};
+  while (dirent *Entry = readdir(Directory)) {
+    std::string Name(Entry->d_name);
+    if (Name.compare(0, 4, "node") == 0 && Name.size() > 4) {
+      Result = std::atoi(Name.c_str() + 4);
+      break;
+    }
+  }
+  closedir(Directory);
+  return Result;
+}
+
+#else
+
+inline std::vector<int> threadCpus() { return {}; }
+
+inline void pinThread(const std::vector<int> &Cpus) {
+  if (!Cpus.empty()) {
+    throw std::runtime_error("CPU affinity not supported on this platform");
+  }
+}
+
+inline int cpuNode(const int) { return -1; }
+
+#endif
+
+/// CPUs of List, which must all be available to the calling thread, e.g.
+/// not outside the cpuset of a container
+inline std::vector<int> availableCpus(const std::string &List) {
+  auto Result = parseCpuList(List);
+  if (Result.empty()) {
+    return Result;
+  }
+  auto Allowed = threadCpus();
+  for (auto Cpu : Result) {
+    if (std::find(Allowed.begin(), Allowed.end(), Cpu) == Allowed.end()) {
+      throw std::runtime_error("CPU " + std::to_string(Cpu) +
+                               " is not available to this process");
+    }
+  }
+  return Result;
+}
+
+/// pinThread for the threads of a running generator: the CPU lists are
+/// checked by availableCpus when the configuration is validated, a
+/// failure afterwards leaves the thread unpinned with a warning
+inline void pinThreadOrWarn(const std::vector<int> &Cpus) {
+  try {
+    pinThread(Cpus);
+  } catch (std::exception &e) {
+    std::cout << "Warning: " << e.what() << "\n";
+  }
+}
+
+/// Restrict the calling thread to Cpus while in scope, e.g. to place the
+/// threads started by a library, which inherit the mask of their creator
+class ScopedAffinity {
+public:
+  explicit ScopedAffinity(const std::vector<int> &Cpus) {
+    if (!Cpus.empty()) {
+      Saved = threadCpus();
+      pinThread(Cpus);
+    }
+  }
+  ScopedAffinity(const ScopedAffinity &) = delete;
+  ScopedAffinity &operator=(const ScopedAffinity &) = delete;
+  ~ScopedAffinity() {
+    try {
+      pinThread(Saved);
+    } catch (std::exception &) {
+    }
+  }
+
+private:
+  std::vector<int> Saved;
+};
+
+} // namespace SINQAmorSim
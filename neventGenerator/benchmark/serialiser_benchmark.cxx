@@ -0,0 +1,106 @@
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "../serialiser.hpp"
+#include "../utils.hpp"
+
+// Compares the cost of handing one ev42 message to the transport with the
+// default FlatBufferSerialiser (fresh builder, copy into the serialiser
+// buffer, copy by librdkafka because of RK_MSG_COPY), the
+// PooledFlatBufferSerialiser (reused builder, no copy) and the
+// TemplateFlatBufferSerialiser (patched template, no copy). The librdkafka
+// copy is emulated with a malloc + memcpy, the delivery report with a FIFO
+// of in-flight buffers.
+
+using value_type = SINQAmorSim::ESSformat::value_type;
+using system_clock = std::chrono::steady_clock;
+
+static const size_t InFlight = 16;
+
+double copyPath(const std::vector<value_type> &Events, const int Iterations) {
+  SINQAmorSim::FlatBufferSerialiser Serialiser;
+  size_t Total{0};
+  auto Start = system_clock::now();
+  for (int i = 0; i < Iterations; ++i) {
+    auto &Buffer =
+        Serialiser.serialise(i, std::chrono::nanoseconds(i), Events);
+    std::unique_ptr<char[]> KafkaCopy{new char[Buffer.size()]};
+    std::memcpy(KafkaCopy.get(), Buffer.data(), Buffer.size());
+    Total += Buffer.size() + KafkaCopy[0];
+  }
+  std::chrono::duration<double> Elapsed = system_clock::now() - Start;
+  return Total * 1e-6 / Elapsed.count();
+}
+
+double pooledPath(const std::vector<value_type> &Events,
+                  const int Iterations) {
+  SINQAmorSim::PooledFlatBufferSerialiser Serialiser;
+  std::deque<SINQAmorSim::PooledFlatBufferSerialiser::builder_t *> Pending;
+  size_t Total{0};
+  auto Start = system_clock::now();
+  for (int i = 0; i < Iterations; ++i) {
+    auto Builder = Serialiser.serialise(i, std::chrono::nanoseconds(i), Events);
+    Total += Builder->GetSize();
+    Pending.push_back(Builder);
+    if (Pending.size() > InFlight) {
+      Serialiser.release(Pending.front());
+      Pending.pop_front();
+    }
+  }
+  std::chrono::duration<double> Elapsed = system_clock::now() - Start;
+  for (auto &Builder : Pending) {
+    Serialiser.release(Builder);
+  }
+  return Total * 1e-6 / Elapsed.count();
+}
+
+double templatePath(const std::vector<value_type> &Events,
+                    const int Iterations) {
+  SINQAmorSim::TemplateFlatBufferSerialiser Serialiser;
+  std::deque<SINQAmorSim::TemplateFlatBufferSerialiser::TemplateBuffer *>
+      Pending;
+  size_t Total{0};
+  auto Start = system_clock::now();
+  for (int i = 0; i < Iterations; ++i) {
+    auto Buffer = Serialiser.serialise(i, std::chrono::nanoseconds(i), Events);
+    Total += Buffer->size();
+    Pending.push_back(Buffer);
+    if (Pending.size() > InFlight) {
+      Serialiser.release(Pending.front());
+      Pending.pop_front();
+    }
+  }
+  std::chrono::duration<double> Elapsed = system_clock::now() - Start;
+  for (auto &Buffer : Pending) {
+    Serialiser.release(Buffer);
+  }
+  return Total * 1e-6 / Elapsed.count();
+}
+
+int main(int argc, char **argv) {
+  std::vector<size_t> MessageSize{10000, 100000, 1000000, 10000000};
+  const size_t BytesPerRun = 2000000000;
+
+  std::cout << std::setw(12) << "bytes" << std::setw(16) << "copy [MB/s]"
+            << std::setw(16) << "pooled [MB/s]" << std::setw(18)
+            << "template [MB/s]"
+            << "\n";
+  for (auto &Size : MessageSize) {
+    std::vector<value_type> Events(Size / sizeof(value_type));
+    for (size_t i = 0; i < Events.size(); ++i) {
+      Events[i] = i;
+    }
+    int Iterations = std::max<size_t>(BytesPerRun / Size, 10);
+    auto Copy = copyPath(Events, Iterations);
+    auto Pooled = pooledPath(Events, Iterations);
+    auto Template = templatePath(Events, Iterations);
+    std::cout << std::setw(12) << Size << std::setw(16) << Copy
+              << std::setw(16) << Pooled << std::setw(18) << Template << "\n";
+  }
+  return 0;
+}
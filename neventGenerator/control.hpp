@@ -38,12 +38,14 @@ struct NoControl {
 struct CommandlineControl {
   CommandlineControl(Configuration &configuration) : config{configuration} {
     status.store(int(RunStatus::stop));
+    limit.store(config.rate_limit);
   }
   CommandlineControl(const CommandlineControl &other) = default;
 
   CommandlineControl &operator=(CommandlineControl &other) {
     status.store(other.status);
     config.rate = other.config.rate;
+    limit.store(other.limit);
     return *this;
   }
 
@@ -59,15 +61,19 @@ struct CommandlineControl {
   bool stop() const { return status == int(RunStatus::stop); }
   bool pause() const { return status == int(RunStatus::pause); }
   bool exit() const { return status == int(RunStatus::exit); }
-  int rate() const { return config.rate; }
+  double rate() const { return config.rate; }
+  /// Total rate limit of the threads, in rate_limit_unit per second
+  double rateLimit() const { return limit; }
 
 private:
   std::atomic<int> status;
+  std::atomic<double> limit{0};
   SINQAmorSim::Configuration &config;
 
   int update_impl() {
     std::cout << "status : " << Status2Str(status) << "\t"
-              << "tr : " << std::to_string(config.rate) << "\n";
+              << "tr : " << std::to_string(config.rate) << "\t"
+              << "limit : " << std::to_string(limit) << "\n";
     std::string value;
     while (status != int(RunStatus::exit)) {
       std::cin >> value;
@@ -86,10 +92,17 @@ private:
       if (std::string(value) == "rate" || std::string(value) == "ra") {
         std::cout << "Insert the new transmission rate:" << std::endl;
         std::cin >> value;
-        config.rate = std::stoi(value);
+        config.rate = std::stod(value);
+      }
+      if (std::string(value) == "limit" || std::string(value) == "li") {
+        std::cout << "Insert the new rate limit (" << config.rate_limit_unit
+                  << "/s, 0 = none):" << std::endl;
+        std::cin >> value;
+        limit.store(std::stod(value));
       }
       std::cout << "status : " << Status2Str(status) << "\t"
-                << "tr : " << std::to_string(config.rate) << "\n";
+                << "tr : " << std::to_string(config.rate) << "\t"
+                << "limit : " << std::to_string(limit) << "\n";
     }
     return status.load();
   }
@@ -0,0 +1,203 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "event_view.hpp"
+#include "utils.hpp"
+
+namespace SINQAmorSim {
+
+template <typename Format> std::string formatName();
+template <> inline std::string formatName<ESSformat>() { return "ess"; }
+template <> inline std::string formatName<PSIformat>() { return "psi"; }
+
+/// 64 bit FNV-1a hash of Size bytes at Data, continuing from Hash
+inline uint64_t fnv1a(const void *Data, const size_t Size,
+                      uint64_t Hash = 0xcbf29ce484222325ULL) {
+  auto Bytes = static_cast<const unsigned char *>(Data);
+  for (size_t i = 0; i < Size; ++i) {
+    Hash ^= Bytes[i];
+    Hash *= 0x100000001b3ULL;
+  }
+  return Hash;
+}
+
+/// Read-only mapping of a file, unmapped on destruction
+class MappedFile {
+public:
+  MappedFile(const std::string &filename) {
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return;
+    }
+    struct stat info;
+    if (::fstat(fd, &info) == 0 && info.st_size > 0) {
+      void *address =
+          ::mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      if (address != MAP_FAILED) {
+        Address = static_cast<const char *>(address);
+        Size = info.st_size;
+      }
+    }
+    ::close(fd);
+  }
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  ~MappedFile() {
+    if (Address) {
+      ::munmap(const_cast<char *>(Address), Size);
+    }
+  }
+
+  const char *data() const { return Address; }
+  size_t size() const { return Size; }
+  explicit operator bool() const { return Address != nullptr; }
+
+private:
+  const char *Address{nullptr};
+  size_t Size{0};
+};
+
+/// Events to replay: owned, or read in place from a mapped event cache
+/// whose pages are shared by all the processes replaying it. The events
+/// are accessed through events(), valid as long as the store.
+template <class T> class EventStore {
+public:
+  EventStore() = default;
+  explicit EventStore(std::vector<T> &&Values)
+      : Owned{std::move(Values)}, View{Owned} {}
+  EventStore(std::unique_ptr<MappedFile> File, const T *Data,
+             const size_t Size)
+      : File{std::move(File)}, View{Data, Size} {}
+
+  const Span<T> &events() const { return View; }
+  size_t size() const { return View.size(); }
+  bool mapped() const { return File != nullptr; }
+
+  /// As std::vector::resize: the events are copied only if they grow
+  void resize(const size_t Size) {
+    if (Size <= View.size()) {
+      View = Span<T>(View.data(), Size);
+      return;
+    }
+    std::vector<T> Values(View.begin(), View.end());
+    Values.resize(Size);
+    *this = EventStore(std::move(Values));
+  }
+
+private:
+  std::vector<T> Owned;
+  std::unique_ptr<MappedFile> File{nullptr};
+  Span<T> View;
+};
+
+/// On-disk cache of the events expanded from a histogram file. The cache
+/// file name is made of instrument, format, multiplier and the hash of the
+/// histogram the events are expanded from (histogramHash), so that the
+/// same histogram hits the cache whatever the path or modification time of
+/// the file, and a modified histogram never hits a stale cache. The
+/// events are stored exactly as in memory (SoA [tof..., detector...] for the
+/// ESS format) after a fixed size header, and sent straight from a
+/// read-only mapping: the pages are shared by all the processes using the
+/// same cache. The file is written to a temporary name and renamed, so
+/// concurrent generators never see a partial cache.
+template <typename Format> class EventCache {
+public:
+  using value_type = typename Format::value_type;
+
+  struct Header {
+    char Magic[8];
+    uint32_t Version;
+    uint32_t ValueSize;
+    uint64_t SourceHash;
+    uint64_t Multiplier;
+    uint64_t Count;
+  };
+
+  EventCache(const std::string &directory, const uint64_t sourceHash,
+             const std::string &instrument, const int multiplier)
+      : SourceHash{sourceHash}, Multiplier(multiplier) {
+    std::stringstream name;
+    name << directory << "/" << instrument << "-" << formatName<Format>()
+         << "-x" << multiplier << "-" << std::hex << std::setw(16)
+         << std::setfill('0') << SourceHash << ".events";
+    Filename = name.str();
+  }
+
+  const std::string &filename() const { return Filename; }
+
+  /// Map the cache into events, without copying. Returns false if the
+  /// cache doesn't exist or its header doesn't match the source hash,
+  /// multiplier and format.
+  bool load(EventStore<value_type> &events) const {
+    std::unique_ptr<MappedFile> file(new MappedFile(Filename));
+    if (!*file || file->size() < sizeof(Header)) {
+      return false;
+    }
+    Header header;
+    std::memcpy(&header, file->data(), sizeof(Header));
+    Header expected = makeHeader(header.Count);
+    if (std::memcmp(&header, &expected, sizeof(Header)) ||
+        file->size() != sizeof(Header) + header.Count * sizeof(value_type)) {
+      return false;
+    }
+    // the header size keeps the events aligned in the page aligned mapping
+    auto first =
+        reinterpret_cast<const value_type *>(file->data() + sizeof(Header));
+    events = EventStore<value_type>(std::move(file), first, header.Count);
+    return true;
+  }
+
+  /// Write events in the cache
+  void store(const Span<value_type> &events) const {
+    std::string temporary = Filename + ".tmp." + std::to_string(::getpid());
+    {
+      std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+      Header header = makeHeader(events.size());
+      file.write(reinterpret_cast<const char *>(&header), sizeof(Header));
+      file.write(reinterpret_cast<const char *>(events.data()),
+                 events.size() * sizeof(value_type));
+      if (!file) {
+        std::remove(temporary.c_str());
+        throw std::runtime_error("Error writing the event cache " + temporary);
+      }
+    }
+    if (std::rename(temporary.c_str(), Filename.c_str())) {
+      std::remove(temporary.c_str());
+      throw std::runtime_error("Error writing the event cache " + Filename);
+    }
+  }
+
+private:
+  std::string Filename;
+  uint64_t SourceHash;
+  uint64_t Multiplier;
+
+  Header makeHeader(const uint64_t Count) const {
+    Header header;
+    std::memset(&header, 0, sizeof(Header));
+    std::memcpy(header.Magic, "AMOREVTS", sizeof(header.Magic));
+    header.Version = 3;
+    header.ValueSize = sizeof(value_type);
+    header.SourceHash = SourceHash;
+    header.Multiplier = Multiplier;
+    header.Count = Count;
+    return header;
+  }
+};
+
+} // namespace SINQAmorSim
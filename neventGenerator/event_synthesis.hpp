@@ -0,0 +1,224 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+namespace SINQAmorSim {
+
+/// (detector, ToF) histogram used as probability distribution of the events.
+/// Bin b = d * NumTof + t has Counts[b] counts, detector id DetectorId[d] and
+/// ToF in [TofLow[t], TofLow[t] + TofWidth[t]).
+struct EventHistogram {
+  std::vector<uint64_t> Counts;
+  std::vector<uint32_t> DetectorId;
+  std::vector<float> TofLow;
+  std::vector<float> TofWidth;
+  size_t NumTof{0};
+
+  uint64_t total() const {
+    uint64_t Result{0};
+    for (auto &Count : Counts) {
+      Result += Count;
+    }
+    return Result;
+  }
+};
+
+/// Walker/Vose alias table: draws a bin with probability proportional to its
+/// count in O(1) with two uniform numbers
+class AliasTable {
+public:
+  AliasTable(const std::vector<uint64_t> &Weights) {
+    auto Size = Weights.size();
+    if (!Size) {
+      throw std::runtime_error("Empty histogram");
+    }
+    double Total{0};
+    for (auto &Weight : Weights) {
+      Total += Weight;
+    }
+    if (Total <= 0) {
+      throw std::runtime_error("Histogram without counts");
+    }
+    Probability.resize(Size);
+    Alias.resize(Size);
+
+    std::vector<double> Scaled(Size);
+    std::vector<uint32_t> Small, Large;
+    for (size_t i = 0; i < Size; ++i) {
+      Scaled[i] = Weights[i] * Size / Total;
+      if (Scaled[i] < 1.0) {
+        Small.push_back(i);
+      } else {
+        Large.push_back(i);
+      }
+    }
+    while (!Small.empty() && !Large.empty()) {
+      auto Less = Small.back();
+      Small.pop_back();
+      auto More = Large.back();
+      Probability[Less] = Scaled[Less];
+      Alias[Less] = More;
+      Scaled[More] -= 1.0 - Scaled[Less];
+      if (Scaled[More] < 1.0) {
+        Large.pop_back();
+        Small.push_back(More);
+      }
+    }
+    // what is left has probability 1 up to rounding errors
+    for (auto &i : Large) {
+      Probability[i] = 1.0;
+      Alias[i] = i;
+    }
+    for (auto &i : Small) {
+      Probability[i] = 1.0;
+      Alias[i] = i;
+    }
+  }
+
+  size_t size() const { return Probability.size(); }
+  const float *probability() const { return Probability.data(); }
+  const uint32_t *alias() const { return Alias.data(); }
+
+private:
+  std::vector<float> Probability;
+  std::vector<uint32_t> Alias;
+};
+
+/// xorshift128 generators running in Lanes independent streams. The state is
+/// stored lane-wise so that the update of all the lanes vectorises.
+class LaneRandomEngine {
+public:
+  static const int Lanes = 8;
+
+  LaneRandomEngine(const uint64_t Seed) {
+    std::seed_seq Sequence{uint32_t(Seed), uint32_t(Seed >> 32)};
+    std::vector<uint32_t> State(4 * Lanes);
+    Sequence.generate(State.begin(), State.end());
+    for (int l = 0; l < Lanes; ++l) {
+      X[l] = State[l] | 1;
+      Y[l] = State[Lanes + l];
+      Z[l] = State[2 * Lanes + l];
+      W[l] = State[3 * Lanes + l];
+    }
+  }
+
+  /// Fill Output with Size uniform 32 bit numbers (Size multiple of Lanes)
+  void fill(uint32_t *Output, const size_t Size) {
+    for (size_t i = 0; i < Size; i += Lanes) {
+      for (int l = 0; l < Lanes; ++l) {
+        uint32_t T = X[l] ^ (X[l] << 11);
+        X[l] = Y[l];
+        Y[l] = Z[l];
+        Z[l] = W[l];
+        W[l] = W[l] ^ (W[l] >> 19) ^ T ^ (T >> 8);
+        Output[i + l] = W[l];
+      }
+    }
+  }
+
+private:
+  uint32_t X[Lanes], Y[Lanes], Z[Lanes], W[Lanes];
+};
+
+/// Sampling tables shared (read-only) by all the threads
+struct SynthesisTables {
+  SynthesisTables(const EventHistogram &Histogram)
+      : Table{Histogram.Counts}, NumTof{Histogram.NumTof} {
+    if (!NumTof || Histogram.Counts.size() % NumTof ||
+        Histogram.TofLow.size() != NumTof ||
+        Histogram.TofWidth.size() != NumTof ||
+        Histogram.DetectorId.size() != Histogram.Counts.size() / NumTof) {
+      throw std::runtime_error("Inconsistent histogram dimensions");
+    }
+    // per bin values, so that sampling needs a single gather per quantity
+    BinDetector.resize(Table.size());
+    BinTofLow.resize(Table.size());
+    BinTofWidth.resize(Table.size());
+    for (size_t b = 0; b < Table.size(); ++b) {
+      BinDetector[b] = Histogram.DetectorId[b / NumTof];
+      BinTofLow[b] = Histogram.TofLow[b % NumTof];
+      BinTofWidth[b] = Histogram.TofWidth[b % NumTof];
+    }
+  }
+
+  AliasTable Table;
+  size_t NumTof;
+  std::vector<uint32_t> BinDetector;
+  std::vector<float> BinTofLow;
+  std::vector<float> BinTofWidth;
+};
+
+/// Draws a new set of events for each pulse from the histogram: the number
+/// of events is Poisson distributed around MeanEvents, each event falls in a
+/// bin chosen with the alias method and gets a ToF uniformly distributed
+/// inside the bin. One instance per thread; the tables are shared.
+template <class T> class EventSynthesiser {
+public:
+  static const size_t BatchSize = 4096;
+
+  EventSynthesiser(std::shared_ptr<const SynthesisTables> Tables,
+                   const double MeanEvents, const uint64_t Seed,
+                   const double TofScale = 1.0)
+      : Tables{std::move(Tables)}, Engine{Seed},
+        PoissonEngine{Seed ^ 0x9e3779b97f4a7c15ULL},
+        NumEvents{MeanEvents > 0 ? MeanEvents : 1}, TofScale{TofScale},
+        Random(3 * BatchSize) {}
+
+  /// Fill Events with a new pulse in the [tof..., detector...] layout and
+  /// return the number of events
+  size_t generate(std::vector<T> &Events) {
+    size_t Size = NumEvents(PoissonEngine);
+    Events.resize(2 * Size);
+    generate(Events.data(), Events.data() + Size, Size);
+    return Size;
+  }
+
+  void generate(T *Tof, T *Detector, const size_t Size) {
+    const auto NumBins = Tables->Table.size();
+    const float *Probability = Tables->Table.probability();
+    const uint32_t *Alias = Tables->Table.alias();
+    const uint32_t *BinDetector = Tables->BinDetector.data();
+    const float *TofLow = Tables->BinTofLow.data();
+    const float *TofWidth = Tables->BinTofWidth.data();
+    const float ToUnit = 1.0f / 16777216.0f; // 2^-24
+    const float Scale = TofScale;
+
+    for (size_t Start = 0; Start < Size; Start += BatchSize) {
+      size_t Batch = Size - Start < BatchSize ? Size - Start : BatchSize;
+      Engine.fill(Random.data(), Random.size());
+      const uint32_t *R1 = Random.data();
+      const uint32_t *R2 = R1 + BatchSize;
+      const uint32_t *R3 = R2 + BatchSize;
+      T *BatchTof = Tof + Start;
+      T *BatchDetector = Detector + Start;
+      for (size_t i = 0; i < Batch; ++i) {
+        uint32_t Bin = (uint64_t(R1[i]) * NumBins) >> 32;
+        float U = (R2[i] >> 8) * ToUnit;
+        uint32_t Chosen = U < Probability[Bin] ? Bin : Alias[Bin];
+        float Jitter = (R3[i] >> 8) * ToUnit;
+        BatchTof[i] = T((TofLow[Chosen] + Jitter * TofWidth[Chosen]) * Scale);
+        BatchDetector[i] = BinDetector[Chosen];
+      }
+    }
+  }
+
+  void setMeanEvents(const double MeanEvents) {
+    NumEvents = std::poisson_distribution<size_t>{MeanEvents > 0 ? MeanEvents
+                                                                 : 1};
+  }
+
+private:
+  std::shared_ptr<const SynthesisTables> Tables;
+  LaneRandomEngine Engine;
+  std::mt19937_64 PoissonEngine;
+  std::poisson_distribution<size_t> NumEvents;
+  double TofScale;
+  std::vector<uint32_t> Random;
+};
+
+} // namespace SINQAmorSim
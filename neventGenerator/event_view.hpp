@@ -0,0 +1,106 @@
+#pragma once
+
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "schemas/ev42_events_generated.h"
+
+namespace SINQAmorSim {
+
+/// Non owning view of Size contiguous elements
+template <class T> class Span {
+public:
+  using value_type = T;
+
+  Span() = default;
+  Span(const T *Data, const size_t Size) : Data{Data}, Size{Size} {}
+  Span(const std::vector<T> &Values)
+      : Data{Values.data()}, Size{Values.size()} {}
+
+  const T *data() const { return Data; }
+  size_t size() const { return Size; }
+  bool empty() const { return !Size; }
+  const T *begin() const { return Data; }
+  const T *end() const { return Data + Size; }
+  const T &operator[](const size_t i) const { return Data[i]; }
+
+private:
+  const T *Data{nullptr};
+  size_t Size{0};
+};
+
+inline bool operator==(const Span<char> &View, const std::string &Text) {
+  return View.size() == Text.size() &&
+         !std::memcmp(View.data(), Text.data(), Text.size());
+}
+
+/// Content of an ev42 message read in place: the spans point into the
+/// message buffer and are valid as long as the buffer is.
+struct EventMessageView {
+  uint64_t MessageID{0};
+  std::chrono::nanoseconds PulseTime{0};
+  Span<char> Source;
+  Span<uint32_t> TimeOfFlight;
+  Span<uint32_t> DetectorId;
+};
+
+/// Fill View from the ev42 message in [Buffer, Buffer + Size) without
+/// copying. With Verify the buffer is checked first, and malformed messages
+/// or messages with different ToF and detector lengths are rejected.
+inline bool decodeView(const void *Buffer, const size_t Size,
+                       EventMessageView &View, const bool Verify = false) {
+  if (Verify) {
+    flatbuffers::Verifier Verifier(static_cast<const uint8_t *>(Buffer), Size);
+    if (!VerifyEventMessageBuffer(Verifier)) {
+      return false;
+    }
+  }
+  auto Event = GetEventMessage(Buffer);
+  View.MessageID = Event->message_id();
+  View.PulseTime = std::chrono::nanoseconds(Event->pulse_time());
+  auto Source = Event->source_name();
+  View.Source = Source ? Span<char>(Source->c_str(), Source->size())
+                       : Span<char>();
+  auto Tof = Event->time_of_flight();
+  View.TimeOfFlight =
+      Tof ? Span<uint32_t>(Tof->data(), Tof->size()) : Span<uint32_t>();
+  auto Detector = Event->detector_id();
+  View.DetectorId = Detector
+                        ? Span<uint32_t>(Detector->data(), Detector->size())
+                        : Span<uint32_t>();
+  return !Verify || View.TimeOfFlight.size() == View.DetectorId.size();
+}
+
+/// Smallest and largest value, {max, 0} for an empty view. Branchless so
+/// that the loop vectorises.
+inline std::pair<uint32_t, uint32_t> minMax(const Span<uint32_t> &Values) {
+  uint32_t Min = UINT32_MAX, Max = 0;
+  const uint32_t *Data = Values.data();
+  for (size_t i = 0; i < Values.size(); ++i) {
+    Min = Data[i] < Min ? Data[i] : Min;
+    Max = Data[i] > Max ? Data[i] : Max;
+  }
+  return {Min, Max};
+}
+
+/// Add the number of events of each pixel to Counts (indexed by detector
+/// id). Ids beyond Counts.size() are not counted; returns their number.
+inline size_t countPixels(const Span<uint32_t> &DetectorId,
+                          std::vector<uint64_t> &Counts) {
+  const uint32_t *Data = DetectorId.data();
+  const size_t NumPixels = Counts.size();
+  uint64_t *Count = Counts.data();
+  size_t OutOfRange{0};
+  for (size_t i = 0; i < DetectorId.size(); ++i) {
+    if (Data[i] < NumPixels) {
+      ++Count[Data[i]];
+    } else {
+      ++OutOfRange;
+    }
+  }
+  return OutOfRange;
+}
+
+} // namespace SINQAmorSim
@@ -0,0 +1,246 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <unistd.h>
+
+#include "event_cache.hpp"
+#include "file_writer.hpp"
+
+namespace SINQAmorSim {
+
+/// A record of a recording, pointing into the mapped segment
+struct RecordView {
+  const void *Data{nullptr};
+  size_t Size{0};
+  std::chrono::nanoseconds PulseTime{0};
+};
+
+/// Reads the records of a topic written by SegmentWriter, in order, from
+/// the memory mapped segments. The data stays valid as long as the reader.
+/// A truncated record (e.g. at the end of an interrupted recording) ends
+/// its segment.
+class SegmentReader {
+public:
+  SegmentReader(const std::string &Directory, const std::string &Topic) {
+    for (size_t Number = 0;; ++Number) {
+      auto Log = Recording::segmentName(Directory, Topic, Number, "log");
+      if (access(Log.c_str(), R_OK)) {
+        break;
+      }
+      Segments.emplace_back(new Segment(
+          Log, Recording::segmentName(Directory, Topic, Number, "idx")));
+    }
+    if (Segments.empty()) {
+      throw std::runtime_error("No recording of " + Topic + " in " +
+                               Directory);
+    }
+  }
+
+  /// Topics recorded in Directory
+  static std::vector<std::string> topics(const std::string &Directory) {
+    DIR *Handle = opendir(Directory.c_str());
+    if (!Handle) {
+      throw std::runtime_error("Can't open " + Directory);
+    }
+    const std::string First = ".000000.log";
+    std::set<std::string> Result;
+    while (dirent *Entry = readdir(Handle)) {
+      std::string Name(Entry->d_name);
+      size_t Length = Name.size() - First.size();
+      if (Name.size() > First.size() &&
+          Name.compare(Length, First.size(), First) == 0) {
+        Result.insert(Name.substr(0, Length));
+      }
+    }
+    closedir(Handle);
+    return std::vector<std::string>(Result.begin(), Result.end());
+  }
+
+  /// The next record, false at the end of the recording
+  bool next(RecordView &Record) {
+    while (Current < Segments.size()) {
+      auto &Log = Segments[Current]->Log;
+      if (Offset + sizeof(RecordHeader) <= Log.size()) {
+        RecordHeader Header;
+        std::memcpy(&Header, Log.data() + Offset, sizeof(Header));
+        size_t Total = Recording::recordSize(Header.Size);
+        if (Header.Magic == Recording::Magic &&
+            Offset + sizeof(Header) + Header.Size <= Log.size()) {
+          Record.Data = Log.data() + Offset + sizeof(Header);
+          Record.Size = Header.Size;
+          Record.PulseTime = std::chrono::nanoseconds(Header.PulseTime);
+          Offset += Total;
+          return true;
+        }
+      }
+      ++Current;
+      Offset = 0;
+    }
+    return false;
+  }
+
+  /// Continue from the first record with a pulse time not before PulseTime,
+  /// using the index (the pulse times of a topic increase)
+  void seek(const std::chrono::nanoseconds &PulseTime) {
+    const int64_t Time = PulseTime.count();
+    auto Less = [](const IndexEntry &Entry, const int64_t Value) {
+      return Entry.PulseTime < Value;
+    };
+    for (Current = 0; Current < Segments.size(); ++Current) {
+      auto &Index = Segments[Current]->Index;
+      auto Begin = reinterpret_cast<const IndexEntry *>(Index.data());
+      auto End = Begin + Index.size() / sizeof(IndexEntry);
+      auto Found = std::lower_bound(Begin, End, Time, Less);
+      if (Found != End) {
+        Offset = Found->Offset;
+        return;
+      }
+    }
+    Offset = 0;
+  }
+
+  /// Back to the first record
+  void rewind() {
+    Current = 0;
+    Offset = 0;
+  }
+
+private:
+  struct Segment {
+    Segment(const std::string &LogName, const std::string &IndexName)
+        : Log{LogName}, Index{IndexName} {}
+    MappedFile Log;
+    MappedFile Index;
+  };
+  std::vector<std::unique_ptr<Segment>> Segments;
+  size_t Current{0};
+  size_t Offset{0};
+};
+
+/// Sends a recording again, each topic from its own thread and to the topic
+/// of the same name, at the original cadence divided by Speed (0: as fast
+/// as possible). The deadlines of all the topics are relative to the
+/// earliest pulse time of the recording. The messages are sent straight
+/// from the mapped segments, unchanged.
+template <class Transmitter> class RecordingReplay {
+  using steady_clock = std::chrono::steady_clock;
+  using nanoseconds = std::chrono::nanoseconds;
+
+public:
+  RecordingReplay(const std::string &Directory, const double Speed,
+                  const std::string &Brokers, const KafkaOptions &Options,
+                  const size_t MaxInflight, const size_t MaxInflightBytes)
+      : Directory{Directory}, Speed{Speed}, Brokers{Brokers},
+        Options{Options}, MaxInflight{MaxInflight},
+        MaxInflightBytes{MaxInflightBytes} {
+    Topics = SegmentReader::topics(Directory);
+    if (Topics.empty()) {
+      throw std::runtime_error("No recording in " + Directory);
+    }
+    for (auto &Topic : Topics) {
+      Readers.emplace_back(new SegmentReader(Directory, Topic));
+    }
+  }
+
+  void run() {
+    Origin = nanoseconds::max();
+    for (auto &Reader : Readers) {
+      RecordView Record;
+      if (Reader->next(Record)) {
+        Origin = std::min(Origin, Record.PulseTime);
+      }
+      Reader->rewind();
+    }
+    Start = steady_clock::now();
+    std::vector<std::thread> Threads;
+    Results.assign(Topics.size(), Result());
+    for (size_t i = 0; i < Topics.size(); ++i) {
+      Threads.emplace_back([this, i]() {
+        try {
+          replay(i);
+        } catch (std::exception &e) {
+          Results[i].Error = e.what();
+        }
+      });
+    }
+    for (auto &Thread : Threads) {
+      Thread.join();
+    }
+    for (size_t i = 0; i < Topics.size(); ++i) {
+      auto &Item = Results[i];
+      std::cout << Topics[i] << ": " << Item.Messages << " messages, "
+                << Item.Bytes * 1e-6 << " MB in " << Item.Elapsed
+                << " s, max lateness "
+                << std::chrono::duration_cast<std::chrono::microseconds>(
+                       Item.MaxLateness)
+                       .count()
+                << " us";
+      if (!Item.Error.empty()) {
+        std::cout << ", stopped: " << Item.Error;
+      }
+      std::cout << "\n";
+    }
+  }
+
+private:
+  struct Result {
+    uint64_t Messages{0};
+    uint64_t Bytes{0};
+    double Elapsed{0};
+    nanoseconds MaxLateness{0};
+    std::string Error;
+  };
+
+  std::string Directory;
+  double Speed;
+  std::string Brokers;
+  KafkaOptions Options;
+  size_t MaxInflight;
+  size_t MaxInflightBytes;
+  std::vector<std::string> Topics;
+  std::vector<std::unique_ptr<SegmentReader>> Readers;
+  std::vector<Result> Results;
+  nanoseconds Origin{0};
+  steady_clock::time_point Start;
+
+  void replay(const size_t i) {
+    auto &Item = Results[i];
+    // destroyed (and flushed) before the segments are unmapped
+    Transmitter Stream(Brokers, Topics[i], "", Options);
+    Stream.setRelease([](void *) {});
+    Stream.setFlowControl(MaxInflight, MaxInflightBytes);
+    RecordView Record;
+    while (Readers[i]->next(Record)) {
+      if (Speed > 0) {
+        auto Deadline =
+            Start + std::chrono::duration_cast<steady_clock::duration>(
+                        (Record.PulseTime - Origin) / Speed);
+        std::this_thread::sleep_until(Deadline);
+        Item.MaxLateness = std::max(
+            Item.MaxLateness,
+            std::chrono::duration_cast<nanoseconds>(steady_clock::now() -
+                                                    Deadline));
+      }
+      Stream.sendSerialised(const_cast<void *>(Record.Data), Record.Size,
+                            Record.PulseTime, nullptr);
+      Stream.poll(0);
+      ++Item.Messages;
+      Item.Bytes += Record.Size;
+    }
+    Item.Elapsed =
+        std::chrono::duration<double>(steady_clock::now() - Start).count();
+  }
+};
+
+} // namespace SINQAmorSim
@@ -1,44 +1,252 @@
-#ifndef _FILE_WRITER_H
-#define _FILE_WRITER_H
+#pragma once
 
-#include <fstream>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
 #include <string>
+#include <vector>
 
-///  \author Michele Brambilla <mib.mic@gmail.com>
-///  \date Fri Jun 17 12:21:46 2016
-struct FileWriterGen {
+#include <fcntl.h>
+#include <unistd.h>
 
-  FileWriterGen() {
-    of.open("output.bin", std::ofstream::binary);
-    if (!of.good()) {
-      throw std::runtime_error("Error opening file");
+#include "memory_transmitter.hpp"
+#include "utils.hpp"
+
+namespace SINQAmorSim {
+
+/// Layout of a recording. Each topic is written to segments
+/// <directory>/<topic>.<number>.log, made of records: a RecordHeader, the
+/// serialised message, padding to a multiple of RecordAlignment. A record
+/// never spans two segments. <topic>.<number>.idx holds one IndexEntry per
+/// record of the segment, in the order they were written.
+struct RecordHeader {
+  uint32_t Magic;
+  uint32_t Size;
+  int64_t PulseTime;
+};
+
+struct IndexEntry {
+  int64_t PulseTime;
+  uint64_t Offset;
+};
+
+namespace Recording {
+const uint32_t Magic = 0x53524d41; // "AMRS"
+const size_t RecordAlignment = 8;
+const size_t BlockSize = 4096;
+
+inline size_t recordSize(const size_t Size) {
+  return (sizeof(RecordHeader) + Size + RecordAlignment - 1) /
+         RecordAlignment * RecordAlignment;
+}
+
+inline std::string segmentName(const std::string &Directory,
+                               const std::string &Topic, const size_t Number,
+                               const std::string &Extension) {
+  char Suffix[32];
+  std::snprintf(Suffix, sizeof(Suffix), ".%06zu.", Number);
+  return Directory + "/" + Topic + Suffix + Extension;
+}
+} // namespace Recording
+
+/// Appends the records of a topic to its segments. Records are gathered in
+/// a block aligned buffer written to the file when full, so the writes are
+/// large and fall on block boundaries; the index entries are buffered as
+/// well. Everything is written when the segment is closed, at the latest
+/// by the destructor. Thread safe: the transmitters writing to the same
+/// topic share the writer returned by shared().
+class SegmentWriter {
+public:
+  SegmentWriter(const std::string &Directory, const std::string &Topic,
+                const size_t SegmentBytes = size_t(1) << 30,
+                const size_t BufferBytes = size_t(4) << 20)
+      : Directory{Directory}, Topic{Topic},
+        SegmentBytes{std::max(SegmentBytes, BufferBytes)},
+        BufferBytes{BufferBytes} {
+    if (BufferBytes % Recording::BlockSize) {
+      throw std::runtime_error("Buffer size must be a multiple of " +
+                               std::to_string(Recording::BlockSize));
+    }
+    void *Memory{nullptr};
+    if (posix_memalign(&Memory, Recording::BlockSize, BufferBytes)) {
+      throw std::runtime_error("Can't allocate the record buffer");
+    }
+    Buffer.reset(static_cast<char *>(Memory));
+    open();
+  }
+  SegmentWriter(const SegmentWriter &) = delete;
+  SegmentWriter &operator=(const SegmentWriter &) = delete;
+
+  ~SegmentWriter() {
+    try {
+      close();
+    } catch (std::exception &e) {
+      std::cout << "Warning: " << e.what() << "\n";
+    }
+  }
+
+  /// The writer of Topic in Directory, created on first use
+  static std::shared_ptr<SegmentWriter>
+  shared(const std::string &Directory, const std::string &Topic,
+         const size_t SegmentBytes) {
+    static std::mutex Guard;
+    static std::map<std::string, std::weak_ptr<SegmentWriter>> Writers;
+    std::lock_guard<std::mutex> Lock(Guard);
+    auto &Entry = Writers[Directory + "/" + Topic];
+    auto Result = Entry.lock();
+    if (!Result) {
+      Result = std::make_shared<SegmentWriter>(Directory, Topic, SegmentBytes);
+      Entry = Result;
+    }
+    return Result;
+  }
+
+  void append(const void *Data, const size_t Size,
+              const std::chrono::nanoseconds &PulseTime) {
+    const size_t Total = Recording::recordSize(Size);
+    std::lock_guard<std::mutex> Lock(Guard);
+    if (SegmentOffset > 0 && SegmentOffset + Total > SegmentBytes) {
+      close();
+      ++Segment;
+      open();
+    }
+    Index.push_back(IndexEntry{int64_t(PulseTime.count()), SegmentOffset});
+    RecordHeader Header{Recording::Magic, uint32_t(Size),
+                        int64_t(PulseTime.count())};
+    const char Padding[Recording::RecordAlignment] = {0};
+    copy(&Header, sizeof(Header));
+    copy(Data, Size);
+    copy(Padding, Total - sizeof(Header) - Size);
+    SegmentOffset += Total;
+    if (Index.size() * sizeof(IndexEntry) >= BufferBytes / 16) {
+      writeIndex();
+    }
+  }
+
+  size_t segments() const { return Segment + 1; }
+
+private:
+  std::string Directory;
+  std::string Topic;
+  size_t SegmentBytes;
+  size_t BufferBytes;
+  struct Free {
+    void operator()(char *Memory) const { std::free(Memory); }
+  };
+  std::unique_ptr<char, Free> Buffer;
+  size_t Used{0};
+  std::vector<IndexEntry> Index;
+  std::mutex Guard;
+  size_t Segment{0};
+  uint64_t SegmentOffset{0};
+  int Log{-1};
+  int IndexFile{-1};
+
+  void open() {
+    Log = openFile(Recording::segmentName(Directory, Topic, Segment, "log"));
+    IndexFile =
+        openFile(Recording::segmentName(Directory, Topic, Segment, "idx"));
+    SegmentOffset = 0;
+  }
+
+  void close() {
+    if (Log < 0) {
+      return;
     }
+    writeBuffer();
+    writeIndex();
+    ::close(Log);
+    ::close(IndexFile);
+    Log = IndexFile = -1;
   }
 
-  ~FileWriterGen() { of.close(); }
+  static int openFile(const std::string &Name) {
+    int Result = ::open(Name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (Result < 0) {
+      throw std::runtime_error("Can't open " + Name + ": " +
+                               std::strerror(errno));
+    }
+    return Result;
+  }
 
-  template <typename T>
-  void send(const T *data, const int size, const int flag = 0) {
-    std::cout << "current position: " << of.tellp() << std::endl;
-    of.seekp(0);
-    std::cout << "intial position: " << of.tellp() << std::endl;
-    if (!of.good()) {
-      throw std::runtime_error("Error writing output");
+  /// Fill the buffer, writing it each time it is full
+  void copy(const void *Data, size_t Size) {
+    auto Source = static_cast<const char *>(Data);
+    while (Size > 0) {
+      size_t Chunk = std::min(Size, BufferBytes - Used);
+      std::memcpy(Buffer.get() + Used, Source, Chunk);
+      Used += Chunk;
+      Source += Chunk;
+      Size -= Chunk;
+      if (Used == BufferBytes) {
+        writeBuffer();
+      }
     }
-    std::cout << "data size is" << size << std::endl;
-    of.write(reinterpret_cast<const char *>(data), size);
-    if (of.rdstate() != std::ifstream::goodbit) {
-      std::cout << "eof" << (of.rdstate() != std::ofstream::eofbit) << "fail"
-                << (of.rdstate() != std::ofstream::failbit) << "bad"
-                << (of.rdstate() != std::ofstream::badbit) << std::endl;
-      throw std::runtime_error("Error writing output");
+  }
+
+  void writeBuffer() {
+    writeAll(Log, Buffer.get(), Used);
+    Used = 0;
+  }
+
+  void writeIndex() {
+    writeAll(IndexFile, Index.data(), Index.size() * sizeof(IndexEntry));
+    Index.clear();
+  }
+
+  void writeAll(const int File, const void *Data, size_t Size) {
+    auto Next = static_cast<const char *>(Data);
+    while (Size > 0) {
+      ssize_t Written = ::write(File, Next, Size);
+      if (Written < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        throw std::runtime_error("Error writing " + Topic + ": " +
+                                 std::strerror(errno));
+      }
+      Next += Written;
+      Size -= Written;
     }
-    std::cout << "final position: " << of.tellp() << std::endl;
-    of.flush();
+  }
+};
+
+/// Records the serialised messages to a SegmentWriter instead of sending
+/// them: the broker argument is the directory of the recording. The
+/// segment size is taken from the option segment.bytes, if given.
+template <class Serialiser>
+class FileTransmitter : public LocalTransmitter<Serialiser> {
+public:
+  FileTransmitter(const std::string &Directory, const std::string &TopicName,
+                  const std::string &SourceName,
+                  const KafkaOptions &Options = {})
+      : LocalTransmitter<Serialiser>(Directory, TopicName, SourceName,
+                                     Options),
+        Writer{SegmentWriter::shared(Directory, TopicName,
+                                     segmentBytes(Options))} {}
+
+protected:
+  bool write(const void *Data, const size_t Size,
+             const std::chrono::nanoseconds &PulseTime) override {
+    Writer->append(Data, Size, PulseTime);
+    return true;
   }
 
 private:
-  std::ofstream of;
+  std::shared_ptr<SegmentWriter> Writer;
+
+  static size_t segmentBytes(const KafkaOptions &Options) {
+    return findSizeOption(Options, "segment.bytes", size_t(1) << 30);
+  }
 };
 
-#endif // FILE_WRITER_H
+} // namespace SINQAmorSim
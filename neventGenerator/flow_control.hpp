@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace SINQAmorSim {
+
+/// Budget of messages produced but not yet reported as delivered (or
+/// failed). The producer asks admit() before each message and waits
+/// (serving delivery reports) while it is refused. A message is always
+/// admitted when nothing is in flight, whatever its size. Used by the
+/// producing thread only: delivery reports are served by poll() on the same
+/// thread.
+class FlowController {
+public:
+  FlowController() = default;
+  FlowController(const size_t MaxMessages, const size_t MaxBytes)
+      : MaxMessages{MaxMessages}, MaxBytes{MaxBytes} {}
+
+  bool admit(const size_t Size) const {
+    if (!Messages) {
+      return true;
+    }
+    return (!MaxMessages || Messages < MaxMessages) &&
+           (!MaxBytes || Bytes + Size <= MaxBytes);
+  }
+
+  void sent(const size_t Size) {
+    ++Messages;
+    Bytes += Size;
+  }
+
+  void completed(const size_t Size) {
+    if (Messages) {
+      --Messages;
+    }
+    Bytes = Bytes > Size ? Bytes - Size : 0;
+  }
+
+  /// Zero disables the corresponding limit
+  void setLimits(const size_t NewMaxMessages, const size_t NewMaxBytes) {
+    MaxMessages = NewMaxMessages;
+    MaxBytes = NewMaxBytes;
+  }
+
+  size_t messages() const { return Messages; }
+  size_t bytes() const { return Bytes; }
+
+private:
+  size_t MaxMessages{0};
+  size_t MaxBytes{0};
+  size_t Messages{0};
+  size_t Bytes{0};
+};
+
+} // namespace SINQAmorSim
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <ctime>
+#include <functional>
 #include <future>
 #include <random>
 
@@ -13,9 +14,18 @@
 
 #include "file_writer.hpp"
 #include "kafka_generator.hpp"
+#include "shm_ring.hpp"
+#include "udp_readout.hpp"
 
+#include "affinity.hpp"
 #include "control.hpp"
+#include "event_synthesis.hpp"
+#include "load_profile.hpp"
+#include "pipeline.hpp"
+#include "pulse_scheduler.hpp"
 #include "timestamp_generator.hpp"
+#include "token_bucket.hpp"
+#include "worker_pool.hpp"
 
 using milliseconds = std::chrono::milliseconds;
 using nanoseconds = std::chrono::nanoseconds;
@@ -26,20 +36,26 @@ using nanoseconds = std::chrono::nanoseconds;
 template <typename Streamer, typename Control, typename Serialiser>
 class Generator {
   using self_t = Generator<Streamer, Control, Serialiser>;
+  using steady_clock = std::chrono::steady_clock;
 
 public:
   Generator(SINQAmorSim::Configuration &configuration)
-      : Streaming{new Control(configuration)}, Config{configuration} {
+      : Streaming{new Control(configuration)}, Config{configuration},
+        Limit{configuration.rate_limit},
+        LimitUnit{SINQAmorSim::Str2RateUnit(configuration.rate_limit_unit)} {
 
-    SINQAmorSim::KafkaOptions Options;
-    for (int tid = 0; tid < Config.num_threads; ++tid) {
-      Stream.emplace_back(
-          new Streamer(Config.producer.broker,
-                       Config.producer.topic + "-" + std::to_string(tid),
-                       Config.source_name, Config.options));
-      if (!Stream[tid]) {
-        throw std::runtime_error("Error creating the stream instance");
-        return;
+    {
+      // the transport threads (e.g. librdkafka's) inherit the affinity of
+      // the thread creating them
+      SINQAmorSim::ScopedAffinity TransportCpus(
+          SINQAmorSim::parseCpuList(Config.kafka_cpus));
+      for (int tid = 0; tid < Config.num_threads; ++tid) {
+        Stream.emplace_back(new Streamer(Config.producer.broker, topic(tid),
+                                         Config.source_name, Config.options));
+        if (!Stream[tid]) {
+          throw std::runtime_error("Error creating the stream instance");
+          return;
+        }
       }
     }
     if (!Streaming) {
@@ -48,17 +64,72 @@ public:
     }
     Statistics.setNumThreads(Config.num_threads);
     Statistics.setControl(Streaming);
+    Statistics.setTimestampPolicy(Config.timestamp_generator);
+    Statistics.setReportTime(Config.report_time);
+    Statistics.setOutput(Config.stats_file);
+    Cpus = SINQAmorSim::parseCpuList(Config.cpu_affinity);
+    if (!Config.load_profile.empty()) {
+      Profile = std::make_shared<const SINQAmorSim::LoadProfile>(
+          SINQAmorSim::LoadProfile::fromFile(Config.load_profile));
+      ProfileTime = std::make_shared<SINQAmorSim::ProfileClock>();
+    }
   }
 
-  template <class T> void run(std::vector<T> &EventsData) {
+  /// Add Report() to the statistics as field Key, e.g. for the consumer of
+  /// an in-process transport
+  void addReport(const std::string &Key,
+                 std::function<nlohmann::json()> Report) {
+    Statistics.setExtra(Key, std::move(Report));
+  }
+
+  /// Fill the events of the next pulse, e.g. from a streaming source
+  template <class T> using PulseFill = std::function<void(std::vector<T> &)>;
+
+  /// Send EventsData ([tof..., detector...], e.g. mapped from the event
+  /// cache) at each pulse, or the events drawn or filled for the pulse
+  template <class T>
+  void run(const SINQAmorSim::Span<T> &EventsData,
+           PulseFill<T> Fill = nullptr) {
     std::vector<std::future<void>> Handle;
 
     for (int tid = 0; tid < Config.num_threads; ++tid) {
-      Handle.push_back(std::async(std::launch::async, &self_t::runImpl<T>, this,
-                                  std::ref(EventsData), tid));
+      Stream[tid]->setDeliveryHooks(
+          [this, tid](size_t Bytes, const nanoseconds &Latency,
+                      int32_t Partition) {
+            Statistics.delivered(tid, Bytes, Latency, Partition);
+          },
+          [this, tid]() { Statistics.failed(tid); },
+          [this, tid](size_t Bytes) { Statistics.sent(tid, Bytes); });
+      Stream[tid]->setFlowControl(
+          Config.max_inflight, size_t(Config.max_inflight_mb) * 1000000,
+          [this, tid](const nanoseconds &Blocked) {
+            Statistics.blocked(tid, Blocked);
+          });
+      setPartitioner(tid);
+      if (!Cpus.empty()) {
+        int Cpu = Cpus[tid % Cpus.size()];
+        Statistics.setPlacement(tid, Cpu, SINQAmorSim::cpuNode(Cpu));
+      }
     }
-    auto Report =
-        std::async(std::launch::async, [&]() { Statistics.report(); });
+    if (Profile) {
+      Statistics.setProfile(Profile, ProfileTime,
+                            Synthesis ? SynthesisMeanEvents
+                                      : EventsData.size() / 2);
+    }
+    if (Config.pipeline_workers > 0) {
+      startPipeline(EventsData, Handle);
+    } else {
+      for (int tid = 0; tid < Config.num_threads; ++tid) {
+        Handle.push_back(std::async(std::launch::async, &self_t::runImpl<T>,
+                                    this, std::cref(EventsData),
+                                    std::cref(Fill), tid));
+      }
+    }
+    auto Report = std::async(std::launch::async, [&]() {
+      SINQAmorSim::pinThreadOrWarn(
+          SINQAmorSim::parseCpuList(Config.reporter_cpus));
+      Statistics.report();
+    });
     Streaming->update();
     try {
       for (auto &h : Handle) {
@@ -71,45 +142,253 @@ public:
     }
   }
 
-  template <class T> void listen(std::vector<T> &EventsData) {
-    std::future<void> Handle;
-    Handle = std::async(std::launch::async, &self_t::listenImpl<T>, this,
-                        std::ref(EventsData));
-    try {
-      Handle.get();
-    } catch (std::exception e) {
-      std::cout << e.what() << "\n";
-      return;
+  /// Draw a new set of events for each pulse from the histogram instead of
+  /// sending the same events. TofScale converts the histogram time binning
+  /// into the stream ToF unit.
+  void setSynthesis(std::shared_ptr<const SINQAmorSim::SynthesisTables> Tables,
+                    const double MeanEvents, const double TofScale = 1.0) {
+    Synthesis = std::move(Tables);
+    SynthesisMeanEvents = MeanEvents;
+    SynthesisTofScale = TofScale;
+  }
+
+  /// Consume the topics of all the streams and decode the messages on a
+  /// pool of num_threads workers. In bench mode stop once the topics are
+  /// drained and report the rate of the whole run.
+  template <class T> void listen(std::vector<T> &) {
+    using Batch = typename Streamer::batch_t;
+    using steady_clock = std::chrono::steady_clock;
+
+    std::vector<std::unique_ptr<ListenWorker>> Workers;
+    for (int i = 0; i < Config.num_threads; ++i) {
+      Workers.emplace_back(new ListenWorker);
+    }
+    // the consumers of a single topic share its partitions, and so the
+    // message sequence
+    std::vector<std::unique_ptr<ListenSequence>> Sequences;
+    for (size_t i = 0; i < (Config.single_topic ? 1 : Stream.size()); ++i) {
+      Sequences.emplace_back(new ListenSequence);
+    }
+    std::atomic<int> Running{int(Stream.size())};
+    BenchClock Clock;
+    {
+      SINQAmorSim::WorkerPool<Batch> Pool(
+          Config.num_threads,
+          [&](Batch &Messages, const int Id) {
+            auto &Worker = *Workers[Id];
+            std::lock_guard<std::mutex> Lock(Worker.Guard);
+            SINQAmorSim::EventMessageView View;
+            for (auto &Message : Messages.Messages) {
+              if (!SINQAmorSim::decodeView(Message->payload(), Message->len(),
+                                           View) ||
+                  (!Config.source_name.empty() &&
+                   !(View.Source == Config.source_name))) {
+                continue;
+              }
+              Worker.Received.add(View.Source.data(), View.Source.size(),
+                                  Message->len(), View.PulseTime,
+                                  SINQAmorSim::kafkaTime(*Message),
+                                  Messages.ReceiveTime);
+            }
+            Clock.Last = steady_clock::now().time_since_epoch().count();
+          },
+          4 * Config.num_threads);
+
+      std::vector<std::future<void>> Handle;
+      for (size_t tid = 0; tid < Stream.size(); ++tid) {
+        auto &Sequence = *Sequences[tid % Sequences.size()];
+        Handle.push_back(std::async(std::launch::async,
+                                    &self_t::listenImpl<Batch>, this,
+                                    std::ref(Pool), tid, std::ref(Sequence),
+                                    std::ref(Clock), std::ref(Running)));
+      }
+      auto StartTime = steady_clock::now();
+      while (Running) {
+        std::this_thread::sleep_for(milliseconds(100));
+        auto Elapsed = steady_clock::now() - StartTime;
+        if (!Config.bench &&
+            Elapsed > std::chrono::seconds(Config.report_time)) {
+          auto Report = collect(Workers).report(Elapsed);
+          Report["sequence"] = sequenceToJson(collect(Sequences));
+          Statistics.write(Report);
+          StartTime = steady_clock::now();
+        }
+      }
+      for (auto &h : Handle) {
+        try {
+          h.get();
+        } catch (std::exception &e) {
+          std::cout << e.what() << "\n";
+        }
+      }
+    }
+    if (Config.bench) {
+      auto Report = collect(Workers).report(
+          nanoseconds(std::max<int64_t>(Clock.Last - Clock.First, 1)));
+      Report["sequence"] = sequenceToJson(collect(Sequences));
+      Report["bench"] = true;
+      Statistics.write(Report);
     }
   }
 
 private:
+  // outlives Stream, whose destruction releases the buffers in flight
+  std::unique_ptr<SINQAmorSim::PooledFlatBufferSerialiser> PipelineSerialiser{
+      nullptr};
+  // the streams report deliveries while flushing in their destructor
+  Stats<Control> Statistics;
   std::vector<std::unique_ptr<Streamer>> Stream;
   std::shared_ptr<Control> Streaming{nullptr};
   SINQAmorSim::Configuration Config;
-  Stats<Control> Statistics;
+  std::shared_ptr<const SINQAmorSim::SynthesisTables> Synthesis{nullptr};
+  double SynthesisMeanEvents{0};
+  double SynthesisTofScale{1.0};
+  // shared by all the threads
+  SINQAmorSim::TokenBucket Limit;
+  SINQAmorSim::RateUnit LimitUnit;
+  std::shared_ptr<const SINQAmorSim::LoadProfile> Profile{nullptr};
+  std::shared_ptr<SINQAmorSim::ProfileClock> ProfileTime{nullptr};
+  // generator thread tid runs on Cpus[tid % Cpus.size()], if not empty
+  std::vector<int> Cpus;
+  std::unique_ptr<SINQAmorSim::PulsePipeline> Pipeline{nullptr};
+  std::atomic<bool> SchedulerDone{false};
+  std::atomic<size_t> RunningWorkers{0};
+
+  /// Topic of thread tid: all the threads write to the same topic in
+  /// single topic mode, each one to <topic>-<tid> otherwise
+  std::string topic(const int tid) const {
+    if (Config.single_topic) {
+      return Config.producer.topic;
+    }
+    return Config.producer.topic + "-" + std::to_string(tid);
+  }
+
+  /// In single topic mode thread tid writes to its own partitions of the
+  /// topic, otherwise the partitioning applies to all the partitions of
+  /// <topic>-<tid>
+  void setPartitioner(const int tid) {
+    int NumPartitions = Stream[tid]->numPartitions();
+    if (!NumPartitions && Config.partitioning != "random") {
+      std::cout << "Warning: partitions of " << topic(tid)
+                << " unknown, using random partitioning\n";
+    }
+    Stream[tid]->setPartitioner(SINQAmorSim::Partitioner(
+        SINQAmorSim::Str2PartitionPolicy(Config.partitioning), NumPartitions,
+        Config.single_topic ? Config.num_threads : 1,
+        Config.single_topic ? tid : 0, Config.sticky_pulses));
+  }
+
+  /// Tokens taken from the rate limit by a message
+  uint64_t cost(const size_t Bytes, const size_t NumEvents) const {
+    switch (LimitUnit) {
+    case SINQAmorSim::RateUnit::bytes:
+      return Bytes;
+    case SINQAmorSim::RateUnit::events:
+      return NumEvents;
+    default:
+      return 1;
+    }
+  }
 
-  template <class T> void runImpl(std::vector<T> &Events, int tid) {
+  template <class T>
+  void runImpl(const SINQAmorSim::Span<T> &Events, const PulseFill<T> &Fill,
+               int tid) {
     using namespace std::chrono;
-    uint64_t PulseID = 0;
+    // the threads writing to a single topic interleave their ids, so that
+    // the topic has a single sequence
+    uint64_t PulseID = Config.single_topic ? tid : 0;
+    const uint64_t PulseStep = Config.single_topic ? Config.num_threads : 1;
+    if (!Cpus.empty()) {
+      SINQAmorSim::pinThreadOrWarn({Cpus[tid % Cpus.size()]});
+    }
 
-    using system_clock = std::chrono::system_clock;
-    auto StartTime = system_clock::now();
-    std::time_t to_time = system_clock::to_time_t(StartTime);
-    auto Timeout = std::localtime(&to_time);
+    SINQAmorSim::PulseScheduler Scheduler(
+        Streaming->rate(),
+        SINQAmorSim::Str2LatePulsePolicy(Config.late_pulse_policy),
+        microseconds(Config.spin_time));
+    SINQAmorSim::PulsePacer Pacer(Scheduler, Limit,
+                                  microseconds(Config.spin_time));
+    std::unique_ptr<SINQAmorSim::EventSynthesiser<T>> Synthesiser{nullptr};
+    std::vector<T> PulseEvents;
+    // events of the pulse scaled by the load profile
+    std::vector<T> Scaled;
+    if (Synthesis) {
+      Synthesiser.reset(new SINQAmorSim::EventSynthesiser<T>(
+          Synthesis, SynthesisMeanEvents, Config.seed + tid,
+          SynthesisTofScale));
+    }
+    SINQAmorSim::TimestampGenerator<T> Timestamps(
+        SINQAmorSim::Str2TimestampPolicy(Config.timestamp_generator),
+        Streaming->rate(), Config.seed + tid);
+    // the ToF of the shared events can't be modified, work on a copy
+    if (Timestamps.enabled() && !Synthesiser && !Fill) {
+      PulseEvents.assign(Events.begin(), Events.end());
+    }
+    // copied by the (pinned) thread, the pages of the replayed events are
+    // allocated on its NUMA node
+    std::vector<T> LocalEvents;
+    SINQAmorSim::Span<T> Replay = Events;
+    if (Config.numa_local && !Timestamps.enabled() && !Synthesiser && !Fill) {
+      LocalEvents.assign(Events.begin(), Events.end());
+      Replay = LocalEvents;
+    }
 
     while (!Streaming->exit()) {
       if (Streaming->stop()) {
         std::this_thread::sleep_for(milliseconds(100));
+        Scheduler.reset();
         continue;
       }
-
-      nanoseconds PulseTime =
-          duration_cast<nanoseconds>(system_clock::now().time_since_epoch());
+      SINQAmorSim::LoadLevel Level;
+      if (Profile) {
+        Level = Profile->at(ProfileTime->seconds());
+      }
+      // beam off: empty pulses, as when paused
+      const double PulseRate = Scheduler.rate();
+      const bool Empty = Pacer.wait(Level, Streaming->rate(),
+                                    Streaming->rateLimit(), Streaming->run());
+      if (Scheduler.rate() != PulseRate) {
+        Timestamps.setRate(Scheduler.rate());
+      }
+      nanoseconds PulseTime = Pacer.pulseTime();
+      nanoseconds Lateness = Pacer.lateness();
       try {
-        if (Streaming->run()) {
-
-          Stream[tid]->send(PulseID, PulseTime, Events, Events.size());
+        if (!Empty) {
+          // the events of the pulse, written in place by the timestamps
+          // unless they are the replayed ones
+          std::vector<T> *Owned{nullptr};
+          if (Synthesiser) {
+            Synthesiser->generate(PulseEvents);
+            Owned = &PulseEvents;
+          } else if (Fill) {
+            Fill(PulseEvents);
+            Owned = &PulseEvents;
+          }
+          if (Level.Events != 1.0) {
+            if (Owned) {
+              SINQAmorSim::scaleEvents(*Owned, Level.Events, Scaled);
+            } else {
+              SINQAmorSim::scaleEvents(Replay, Level.Events, Scaled);
+            }
+            Owned = &Scaled;
+          }
+          if (Timestamps.enabled()) {
+            if (!Owned) {
+              Owned = &PulseEvents;
+            }
+            auto Start = steady_clock::now();
+            Timestamps(Owned->data(), Owned->size() / 2, PulseTime);
+            Statistics.addTimestamping(Owned->size() / 2,
+                                       steady_clock::now() - Start, tid);
+          }
+          SINQAmorSim::Span<T> Payload =
+              Owned ? SINQAmorSim::Span<T>(*Owned) : Replay;
+          auto Start = steady_clock::now();
+          size_t Bytes =
+              Stream[tid]->send(PulseID, PulseTime, Payload, Payload.size());
+          Statistics.pulse(tid, steady_clock::now() - Start, Lateness,
+                           Payload.size() / 2);
+          Limit.take(cost(Bytes, Payload.size() / 2));
         } else {
           Stream[tid]->send(PulseID, PulseTime, Events, 0);
         }
@@ -117,72 +396,308 @@ private:
         std::cout << e.what() << "\n";
         break;
       }
-      // Make sure that messages have been sent to prevent queue full
-      if (PulseID % 1000 == 1) {
-        while (Stream[tid]->outqLen()) {
-          Stream[tid]->poll();
+      PulseID += PulseStep;
+      Stream[tid]->poll(0);
+    }
+  }
+
+  /// Run the pulses through three stages instead of one thread per stream:
+  /// a scheduler, pipeline_workers serialisation workers and one producer
+  /// thread per stream, connected by the rings of a PulsePipeline
+  template <class T>
+  void startPipeline(const SINQAmorSim::Span<T> &Events,
+                     std::vector<std::future<void>> &Handle) {
+    const size_t Workers = Config.pipeline_workers;
+    Pipeline.reset(new SINQAmorSim::PulsePipeline(Workers, Stream.size(),
+                                                  Config.pipeline_depth));
+    PipelineSerialiser.reset(
+        new SINQAmorSim::PooledFlatBufferSerialiser(Config.source_name));
+    for (auto &Item : Stream) {
+      Item->setRelease([this](void *Opaque) { releasePulse(Opaque); });
+    }
+    Statistics.setExtra("pipeline", [this]() { return Pipeline->report(); });
+    SchedulerDone = false;
+    RunningWorkers = Workers;
+    Handle.push_back(
+        std::async(std::launch::async, &self_t::schedulePulses, this));
+    for (size_t Worker = 0; Worker < Workers; ++Worker) {
+      Handle.push_back(std::async(std::launch::async,
+                                  &self_t::serialisePulses<T>, this,
+                                  std::cref(Events), Worker));
+    }
+    for (int tid = 0; tid < Config.num_threads; ++tid) {
+      Handle.push_back(
+          std::async(std::launch::async, &self_t::producePulses, this, tid));
+    }
+  }
+
+  /// Scheduler stage: at each deadline (or, with a rate limit, as soon as
+  /// the bucket allows) a work item for every stream
+  void schedulePulses() {
+    using namespace std::chrono;
+    SINQAmorSim::PulseScheduler Scheduler(
+        Streaming->rate(),
+        SINQAmorSim::Str2LatePulsePolicy(Config.late_pulse_policy),
+        microseconds(Config.spin_time));
+    SINQAmorSim::PulsePacer Pacer(Scheduler, Limit,
+                                  microseconds(Config.spin_time));
+    const uint64_t PulseStep = Config.single_topic ? Config.num_threads : 1;
+    std::vector<uint64_t> PulseID(Stream.size(), 0);
+    for (size_t i = 0; Config.single_topic && i < PulseID.size(); ++i) {
+      PulseID[i] = i;
+    }
+    SINQAmorSim::IdleBackoff Backoff;
+    while (!Streaming->exit()) {
+      if (Streaming->stop()) {
+        std::this_thread::sleep_for(milliseconds(100));
+        Scheduler.reset();
+        continue;
+      }
+      // the producers take the tokens of the pulses they send
+      const bool Send =
+          !Pacer.wait(SINQAmorSim::LoadLevel(), Streaming->rate(),
+                      Streaming->rateLimit(), Streaming->run());
+      for (size_t i = 0; i < Stream.size(); ++i) {
+        SINQAmorSim::PulseWork Item;
+        Item.Producer = i;
+        Item.PulseID = PulseID[i];
+        Item.PulseTime = Pacer.pulseTime();
+        Item.Lateness = Pacer.lateness();
+        Item.Scheduled = steady_clock::now();
+        Item.Send = Send;
+        bool Stalled{false};
+        Backoff.reset();
+        while (!Pipeline->work().push(std::move(Item))) {
+          if (Streaming->exit()) {
+            break;
+          }
+          if (!Stalled) {
+            Pipeline->schedulerStall();
+            Stalled = true;
+          }
+          Backoff.wait();
         }
+        PulseID[i] += PulseStep;
       }
-      ++PulseID;
-      if (PulseID % Streaming->rate() == 0) {
-        ++Timeout->tm_sec;
-        std::this_thread::sleep_until(
-            system_clock::from_time_t(mktime(Timeout)));
-        Stream[tid]->poll(0);
-      }
-
-      auto ElapsedTime = system_clock::now() - StartTime;
-      if (std::chrono::duration_cast<std::chrono::seconds>(ElapsedTime)
-              .count() > Config.report_time) {
-        // Make sure that messages have been sent before collecting stats and
-        // recompute (real) time
-        while (Stream[tid]->outqLen()) {
-          Stream[tid]->poll(-1);
+    }
+    SchedulerDone = true;
+  }
+
+  /// Serialisation stage: ev42 buffers from a pooled serialiser shared by
+  /// the workers, released once delivered
+  template <class T>
+  void serialisePulses(const SINQAmorSim::Span<T> &Events,
+                       const size_t Worker) {
+    SINQAmorSim::PulseWork Item;
+    SINQAmorSim::IdleBackoff Backoff;
+    while (true) {
+      // read before pop: once done, an empty queue stays empty
+      bool Done = SchedulerDone;
+      if (!Pipeline->work().pop(Item)) {
+        if (Done) {
+          break;
         }
-        // update stats
-        Statistics.add(Stream[tid]->getNumMessages(), Stream[tid]->getMbytes(),
-                       tid);
-        Stream[tid]->getNumMessages() = 0;
-        Stream[tid]->getMbytes() = 0;
-        StartTime = system_clock::now();
+        Backoff.wait();
+        continue;
+      }
+      Backoff.reset();
+      auto Start = steady_clock::now();
+      SINQAmorSim::SerialisedPulse Result;
+      Result.PulseID = Item.PulseID;
+      Result.PulseTime = Item.PulseTime;
+      Result.Lateness = Item.Lateness;
+      if (Item.Send) {
+        auto Builder = PipelineSerialiser->serialise(Item.PulseID,
+                                                     Item.PulseTime, Events);
+        Result.Buffer = Builder->GetBufferPointer();
+        Result.Size = Builder->GetSize();
+        Result.Opaque = Builder;
+        Result.Events = Events.size() / 2;
+      }
+      Result.Ready = steady_clock::now();
+      Pipeline->serialised(Worker, Start - Item.Scheduled,
+                           Result.Ready - Start);
+      auto &Output = Pipeline->output(Worker, Item.Producer);
+      bool Stalled{false};
+      while (!Output.push(std::move(Result))) {
+        if (Streaming->exit()) {
+          releasePulse(Result.Opaque);
+          break;
+        }
+        if (!Stalled) {
+          Pipeline->workerStall(Worker);
+          Stalled = true;
+        }
+        Backoff.wait();
+      }
+    }
+    --RunningWorkers;
+  }
+
+  /// Producer stage of stream tid: the workers may finish the pulses out of
+  /// order, they are sent by increasing id
+  void producePulses(const int tid) {
+    if (!Cpus.empty()) {
+      SINQAmorSim::pinThreadOrWarn({Cpus[tid % Cpus.size()]});
+    }
+    const uint64_t PulseStep = Config.single_topic ? Config.num_threads : 1;
+    SINQAmorSim::PulseReorder Order(*Pipeline, tid,
+                                    Config.single_topic ? tid : 0, PulseStep);
+    auto Release = [this](void *Opaque) { releasePulse(Opaque); };
+    SINQAmorSim::IdleBackoff Backoff;
+    bool Failed{false};
+    while (true) {
+      bool Done = !RunningWorkers;
+      bool Received{false};
+      SINQAmorSim::SerialisedPulse Item;
+      // after an error the stream only drains the pipeline
+      if (Failed) {
+        Received = Order.drain(Release) > 0;
+      }
+      while (!Failed && Order.next(Item)) {
+        Received = true;
+        Failed = !producePulse(tid, Item);
+      }
+      Stream[tid]->poll(0);
+      if (Received) {
+        Backoff.reset();
+      } else if (Done) {
+        break;
+      } else {
+        Backoff.wait();
       }
     }
+    Order.drain(Release);
   }
 
-  template <class T> void listenImpl(std::vector<T> &Events) {
+  bool producePulse(const int tid, SINQAmorSim::SerialisedPulse &Item) {
+    auto Start = steady_clock::now();
+    Pipeline->produced(tid, Start - Item.Ready);
+    if (!Item.Buffer) {
+      return true;
+    }
+    try {
+      Stream[tid]->sendSerialised(Item.Buffer, Item.Size, Item.PulseTime,
+                                  Item.Opaque);
+    } catch (std::exception &e) {
+      std::cout << e.what() << "\n";
+      return false;
+    }
+    Statistics.pulse(tid, steady_clock::now() - Start, Item.Lateness,
+                     Item.Events);
+    Limit.take(cost(Item.Size, Item.Events));
+    return true;
+  }
+
+  void releasePulse(void *Opaque) {
+    if (Opaque) {
+      PipelineSerialiser->release(
+          static_cast<SINQAmorSim::PooledFlatBufferSerialiser::builder_t *>(
+              Opaque));
+    }
+  }
 
-    int PulseID = -1, MessagesLost = -1;
-    uint64_t PacketID;
-    uint64_t ReceivedBytes = 0;
-    int MessagesReceived = 0;
+  /// State of a decoding worker, locked by the reporter to collect stats
+  struct ListenWorker {
+    std::mutex Guard;
+    ReceiverStats Received;
+  };
 
-    using system_clock = std::chrono::system_clock;
-    auto StartTime = system_clock::now();
+  /// Message ids seen by a consumer thread, in the order of arrival
+  struct ListenSequence {
+    std::mutex Guard;
+    SINQAmorSim::SequenceTracker Tracker;
+  };
 
-    while (true) {
+  /// Arrival of the first batch and end of the last decoded batch
+  struct BenchClock {
+    std::atomic<int64_t> First{0};
+    std::atomic<int64_t> Last{0};
+  };
 
-      auto Message = Stream[0]->recv(Events);
-      PacketID = Message.first;
-      if (PacketID - PulseID != 0) {
-        PulseID = PacketID;
-        ++MessagesLost;
-      } else {
-        ++MessagesReceived;
-        ReceivedBytes += Message.second;
-      }
-      if (std::chrono::duration_cast<std::chrono::seconds>(system_clock::now() -
-                                                           StartTime)
-              .count() > Config.report_time) {
-        std::cout << "Missed " << MessagesLost << " packets" << std::endl;
-        std::cout << "Received " << MessagesReceived << "packets"
-                  << " @ " << ReceivedBytes * 1e-1 * 1e-6 << "MB/s"
-                  << std::endl;
-        MessagesReceived = 0;
-        MessagesLost = 0;
-        ReceivedBytes = 0;
-        StartTime = system_clock::now();
-      }
-      PulseID++;
+  ReceiverStats collect(std::vector<std::unique_ptr<ListenWorker>> &Workers) {
+    ReceiverStats Result;
+    for (auto &Worker : Workers) {
+      std::lock_guard<std::mutex> Lock(Worker->Guard);
+      Result.merge(Worker->Received);
+    }
+    return Result;
+  }
+
+  std::map<std::string, SINQAmorSim::SequenceCounts>
+  collect(std::vector<std::unique_ptr<ListenSequence>> &Sequences) {
+    std::map<std::string, SINQAmorSim::SequenceCounts> Result;
+    for (auto &Sequence : Sequences) {
+      std::lock_guard<std::mutex> Lock(Sequence->Guard);
+      for (auto &Item : Sequence->Tracker.counts()) {
+        Result[Item.first] = Item.second;
+      }
+    }
+    return Result;
+  }
+
+  /// Consume batches from Stream[tid] and queue them for decoding. The
+  /// message ids are checked here, before the pool can reorder them. In
+  /// bench mode return when no message arrives for 2 s, or none at all in
+  /// the first 10 s (e.g. an empty or misspelt topic).
+  template <class Batch>
+  void listenImpl(SINQAmorSim::WorkerPool<Batch> &Pool, const size_t tid,
+                  ListenSequence &Sequence, BenchClock &Clock,
+                  std::atomic<int> &Running) {
+    using steady_clock = std::chrono::steady_clock;
+    const size_t BatchSize = 1000;
+    const int Timeout = 100;
+
+    Batch Messages;
+    bool Received{false};
+    auto LastMessage = steady_clock::now();
+    try {
+      while (true) {
+        if (!Stream[tid]->consume(Messages, BatchSize, Timeout)) {
+          if (Config.bench && Received &&
+              steady_clock::now() - LastMessage > std::chrono::seconds(2)) {
+            break;
+          }
+          if (Config.bench && !Received &&
+              steady_clock::now() - LastMessage > std::chrono::seconds(10)) {
+            std::cout << "Warning: no message received from "
+                      << topic(tid) << " in 10 s\n";
+            break;
+          }
+          continue;
+        }
+        LastMessage = steady_clock::now();
+        if (!Received) {
+          int64_t Unset{0};
+          Clock.First.compare_exchange_strong(
+              Unset, LastMessage.time_since_epoch().count());
+          Received = true;
+        }
+        track(Messages, Sequence);
+        Pool.push(std::move(Messages));
+        Messages = Batch{};
+      }
+    } catch (...) {
+      --Running;
+      throw;
+    }
+    --Running;
+  }
+
+  /// Only the header of each message is read: the cost does not depend on
+  /// the number of events
+  template <class Batch> void track(Batch &Messages, ListenSequence &Sequence) {
+    std::lock_guard<std::mutex> Lock(Sequence.Guard);
+    SINQAmorSim::EventMessageView View;
+    for (auto &Message : Messages.Messages) {
+      if (!SINQAmorSim::decodeView(Message->payload(), Message->len(), View) ||
+          (!Config.source_name.empty() &&
+           !(View.Source == Config.source_name))) {
+        continue;
+      }
+      Sequence.Tracker.add(Message->topic_name(), View.Source.data(),
+                           View.Source.size(), View.MessageID,
+                           View.PulseTime);
     }
   }
 };
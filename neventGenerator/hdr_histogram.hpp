@@ -0,0 +1,168 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace SINQAmorSim {
+
+/// Log-linear (HDR style) bucketing of non negative integer values: every
+/// power of two is split into SubBuckets linear sub-buckets, so the relative
+/// error of a recorded value is below 1 / SubBuckets (~6%) over the whole
+/// 64 bit range.
+struct HdrBuckets {
+  static const int SubBucketBits = 4;
+  static const int SubBuckets = 1 << SubBucketBits;
+  static const int NumBuckets = (64 - SubBucketBits + 1) * SubBuckets;
+
+  static int index(const uint64_t Value) {
+    if (Value < uint64_t(SubBuckets)) {
+      return Value;
+    }
+    int Msb = 63 - __builtin_clzll(Value);
+    int Shift = Msb - SubBucketBits;
+    return (Shift + 1) * SubBuckets + int(Value >> Shift) - SubBuckets;
+  }
+
+  /// Smallest value falling in bucket i
+  static uint64_t lowerBound(const int i) {
+    int Magnitude = i / SubBuckets;
+    uint64_t Sub = i % SubBuckets;
+    if (!Magnitude) {
+      return Sub;
+    }
+    return (SubBuckets + Sub) << (Magnitude - 1);
+  }
+
+  /// Largest value falling in bucket i
+  static uint64_t upperBound(const int i) {
+    return i + 1 < NumBuckets ? lowerBound(i + 1) - 1 : UINT64_MAX;
+  }
+};
+
+/// Plain histogram, used for snapshots and aggregation. Values are
+/// nanoseconds when recording durations.
+class HdrHistogram {
+public:
+  void record(const uint64_t Value, const uint64_t Count = 1) {
+    Counts[HdrBuckets::index(Value)] += Count;
+    Total += Count;
+    Sum += Value * Count;
+    Max = std::max(Max, Value);
+  }
+  void record(const std::chrono::nanoseconds &Value) {
+    record(Value.count() > 0 ? Value.count() : 0);
+  }
+
+  void merge(const HdrHistogram &Other) {
+    for (int i = 0; i < HdrBuckets::NumBuckets; ++i) {
+      Counts[i] += Other.Counts[i];
+    }
+    Total += Other.Total;
+    Sum += Other.Sum;
+    Max = std::max(Max, Other.Max);
+  }
+
+  void reset() {
+    Counts.fill(0);
+    Total = Sum = Max = 0;
+  }
+
+  uint64_t count() const { return Total; }
+  uint64_t max() const { return Max; }
+  double mean() const { return Total ? double(Sum) / Total : 0; }
+
+  /// Value below which lies the fraction Quantile of the recorded values
+  /// (upper bound of the bucket, clamped to the maximum)
+  uint64_t percentile(const double Quantile) const {
+    if (!Total) {
+      return 0;
+    }
+    uint64_t Rank = std::max<uint64_t>(1, uint64_t(Quantile * Total + 0.5));
+    uint64_t Seen{0};
+    for (int i = 0; i < HdrBuckets::NumBuckets; ++i) {
+      Seen += Counts[i];
+      if (Seen >= Rank) {
+        return std::min(HdrBuckets::upperBound(i), Max);
+      }
+    }
+    return Max;
+  }
+
+  const std::array<uint64_t, HdrBuckets::NumBuckets> &counts() const {
+    return Counts;
+  }
+
+private:
+  std::array<uint64_t, HdrBuckets::NumBuckets> Counts{};
+  uint64_t Total{0};
+  uint64_t Sum{0};
+  uint64_t Max{0};
+
+  friend class AtomicHdrHistogram;
+};
+
+/// Histogram written by a single thread and read at any time by others.
+/// The counters only grow: readers take a snapshot and subtract the
+/// previous one to get the values of an interval, nobody ever resets them.
+class AtomicHdrHistogram {
+public:
+  void record(const uint64_t Value) {
+    increment(Counts[HdrBuckets::index(Value)], 1);
+    increment(Total, 1);
+    increment(Sum, Value);
+    if (Value > Max.load(std::memory_order_relaxed)) {
+      Max.store(Value, std::memory_order_relaxed);
+    }
+  }
+  void record(const std::chrono::nanoseconds &Value) {
+    record(Value.count() > 0 ? Value.count() : 0);
+  }
+
+  /// Everything recorded so far
+  HdrHistogram snapshot() const {
+    HdrHistogram Result;
+    for (int i = 0; i < HdrBuckets::NumBuckets; ++i) {
+      Result.Counts[i] = Counts[i].load(std::memory_order_relaxed);
+    }
+    Result.Total = Total.load(std::memory_order_relaxed);
+    Result.Sum = Sum.load(std::memory_order_relaxed);
+    Result.Max = Max.load(std::memory_order_relaxed);
+    return Result;
+  }
+
+  /// Difference between two snapshots of the same histogram
+  static HdrHistogram delta(const HdrHistogram &Current,
+                            const HdrHistogram &Previous) {
+    HdrHistogram Result;
+    for (int i = 0; i < HdrBuckets::NumBuckets; ++i) {
+      Result.Counts[i] = Current.Counts[i] - Previous.Counts[i];
+    }
+    Result.Total = Current.Total - Previous.Total;
+    Result.Sum = Current.Sum - Previous.Sum;
+    // the maximum of the interval is not known, use the largest bucket
+    for (int i = HdrBuckets::NumBuckets - 1; i >= 0; --i) {
+      if (Result.Counts[i]) {
+        Result.Max = std::min(HdrBuckets::upperBound(i), Current.Max);
+        break;
+      }
+    }
+    return Result;
+  }
+
+private:
+  std::array<std::atomic<uint64_t>, HdrBuckets::NumBuckets> Counts{};
+  std::atomic<uint64_t> Total{0};
+  std::atomic<uint64_t> Sum{0};
+  std::atomic<uint64_t> Max{0};
+
+  // single writer: no need for a locked read-modify-write
+  static void increment(std::atomic<uint64_t> &Counter, const uint64_t Value) {
+    Counter.store(Counter.load(std::memory_order_relaxed) + Value,
+                  std::memory_order_relaxed);
+  }
+};
+
+} // namespace SINQAmorSim
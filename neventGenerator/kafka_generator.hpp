@@ -1,14 +1,21 @@
 #pragma once
 
+#include <algorithm>
 #include <cctype>
 #include <chrono>
+#include <functional>
+#include <memory>
 #include <sstream>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include <librdkafka/rdkafkacpp.h>
 
+#include "event_view.hpp"
+#include "flow_control.hpp"
 #include "header.hpp"
+#include "partitioner.hpp"
 #include "serialiser.hpp"
 #include "utils.hpp"
 
@@ -20,6 +27,11 @@ uint64_t getCurrentTimestamp() {
       .count();
 }
 
+/// Kafka message timestamps are in milliseconds since epoch
+inline int64_t kafkaTimestamp(const std::chrono::nanoseconds &Time) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(Time).count();
+}
+
 struct KafkaGeneratorInfo {
   double Mbytes{0};
   double NumMessages{0};
@@ -31,16 +43,49 @@ public:
     if (Message.errstr() == "Success") {
       Info.NumMessages++;
       Info.Mbytes += Message.len() * 1e-6;
+      if (Delivered) {
+        Delivered(Message.len(), std::chrono::microseconds(Message.latency()),
+                  Message.partition());
+      }
     } else {
       std::cout << Message.errstr() << std::endl;
+      if (Failed) {
+        Failed();
+      }
+    }
+    Flow.completed(Message.len());
+    // The payload of messages produced without RK_MSG_COPY belongs to us
+    // again once the report is delivered, whatever the outcome
+    if (Release && Message.msg_opaque()) {
+      Release(Message.msg_opaque());
     }
   }
 
   double &getNumMessages() { return Info.NumMessages; }
   double &getMbytes() { return Info.Mbytes; }
 
+  /// Messages in flight, released by each delivery report
+  FlowController &flow() { return Flow; }
+
+  void setRelease(std::function<void(void *)> Function) {
+    Release = std::move(Function);
+  }
+
+  /// Called for each delivered message with its size, the time elapsed
+  /// since produce() and its partition
+  using delivered_t =
+      std::function<void(size_t, const std::chrono::nanoseconds &, int32_t)>;
+  void setDelivered(delivered_t Function) { Delivered = std::move(Function); }
+  void setFailed(std::function<void()> Function) {
+    Failed = std::move(Function);
+  }
+
 private:
   KafkaGeneratorInfo Info;
+  FlowController Flow;
+  std::function<void(void *)> Release;
+  delivered_t Delivered;
+  std::function<void()> Failed;
 };
 
 ////////////////
@@ -99,56 +144,247 @@ public:
     Metadata.reset(md);
 
     SerialiserWorker.reset(new Serialiser{Source});
+    setupDeliveryRelease();
+  }
+
+  ~KafkaTransmitter() {
+    if (Producer) {
+      Producer->flush(1000);
+    }
   }
 
   template <typename T> size_t send(std::vector<T> &Data, const int nev = -1) {
-    RdKafka::ErrorCode resp = Producer->produce(
-        Topic, RdKafka::Topic::PARTITION_UA, RdKafka::Producer::RK_MSG_COPY,
-        &Data[0], Data.size() * sizeof(T), nullptr, 0, getCurrentTimestamp(),
-        nullptr);
+    RdKafka::ErrorCode resp =
+        produce(RdKafka::Topic::PARTITION_UA, RdKafka::Producer::RK_MSG_COPY,
+                &Data[0], Data.size() * sizeof(T),
+                kafkaTimestamp(std::chrono::nanoseconds(getCurrentTimestamp())),
+                nullptr);
     if (resp != RdKafka::ERR_NO_ERROR) {
       throw std::runtime_error(RdKafka::err2str(resp) + " : " + Topic);
     }
     return int(Producer->poll(10));
   }
 
-  template <typename T>
+  /// Serialise and send a pulse; Events is any contiguous array of events
+  /// [tof..., detector...], e.g. a vector or a Span over an event cache
+  template <class EventArray>
   size_t send(const uint64_t &, const std::chrono::nanoseconds &,
-              std::vector<T> &, const int = 1) {
+              const EventArray &, const int = 1) {
     return 0;
   }
 
+  /// Produce a message serialised by another thread, without copying. Data
+  /// must stay valid until the release hook is called with Opaque (by
+  /// poll(), or right away if produce fails). Returns the size sent.
+  size_t sendSerialised(void *Data, const size_t Size,
+                        const std::chrono::nanoseconds &PulseTime,
+                        void *Opaque) {
+    RdKafka::ErrorCode resp = produce(nextPartition(), 0, Data, Size,
+                                      kafkaTimestamp(PulseTime), Opaque);
+    if (resp != RdKafka::ERR_NO_ERROR) {
+      if (ReleaseHook) {
+        ReleaseHook(Opaque);
+      }
+      throw std::runtime_error(RdKafka::err2str(resp) + " : " + Topic);
+    }
+    return Size;
+  }
+
+  /// Hook releasing the buffers given to sendSerialised. It replaces the
+  /// release of the own serialiser: don't mix with send()
+  void setRelease(std::function<void(void *)> Release) {
+    ReleaseHook = Release;
+    DeliveryCallback.setRelease(std::move(Release));
+  }
+
   int poll(const int &Seconds = -1) { return Producer->poll(Seconds); }
   int outqLen() { return Producer->outq_len(); }
 
   double &getNumMessages() { return DeliveryCallback.getNumMessages(); }
   double &getMbytes() { return DeliveryCallback.getMbytes(); }
 
+  /// Number of partitions of the topic, 0 if the topic doesn't exist yet
+  int numPartitions() const {
+    if (!Metadata) {
+      return 0;
+    }
+    for (auto &TopicMetadata : *Metadata->topics()) {
+      if (TopicMetadata->topic() == Topic) {
+        return TopicMetadata->partitions()->size();
+      }
+    }
+    return 0;
+  }
+
+  /// Choose the partition of each message sent from now on
+  void setPartitioner(const Partitioner &Value) {
+    Partitioning = Value;
+    NumSent = 0;
+  }
+
+  /// Limit the messages and bytes in flight (zero: no limit). Blocked is
+  /// called with the time spent waiting each time the producer stops, for
+  /// the budget or because the librdkafka queue is full
+  void setFlowControl(const size_t MaxMessages, const size_t MaxBytes,
+                      std::function<void(const std::chrono::nanoseconds &)>
+                          Blocked = nullptr) {
+    DeliveryCallback.flow().setLimits(MaxMessages, MaxBytes);
+    BlockedHook = std::move(Blocked);
+  }
+
+  /// Hooks run by poll() for each delivery report. Sent is for the
+  /// transports that hand over messages without a delivery report, every
+  /// Kafka message gets one.
+  void setDeliveryHooks(DeliveryReport::delivered_t Delivered,
+                        std::function<void()> Failed,
+                        std::function<void(size_t)> = nullptr) {
+    DeliveryCallback.setDelivered(std::move(Delivered));
+    DeliveryCallback.setFailed(std::move(Failed));
+  }
+
 private:
+  // DeliveryCallback and SerialiserWorker must outlive Producer: pending
+  // zero-copy messages are reported (and their buffers released) when the
+  // producer is destroyed
+  DeliveryReport DeliveryCallback;
+  std::unique_ptr<Serialiser> SerialiserWorker{nullptr};
+
   std::unique_ptr<RdKafka::Metadata> Metadata{nullptr};
   std::unique_ptr<RdKafka::Producer> Producer{nullptr};
   std::string Topic;
   std::string Source;
+  Partitioner Partitioning;
+  uint64_t NumSent{0};
+
+  int32_t nextPartition() { return Partitioning(NumSent++); }
+
+  std::function<void(const std::chrono::nanoseconds &)> BlockedHook;
+  std::function<void(void *)> ReleaseHook;
+  // give up on a full queue after this time
+  const std::chrono::seconds QueueFullTimeout{10};
+  const int MaxBackoffMs{100};
+
+  /// Produce a message once the in-flight budget allows it. While the
+  /// librdkafka queue is full serve the delivery reports with an increasing
+  /// backoff and retry.
+  RdKafka::ErrorCode produce(const int32_t Partition, const int Flags,
+                             void *Payload, const size_t Size,
+                             const int64_t Timestamp, void *Opaque) {
+    using steady_clock = std::chrono::steady_clock;
+    auto &Flow = DeliveryCallback.flow();
+    steady_clock::time_point Start;
+    bool Blocked{false};
+    while (!Flow.admit(Size)) {
+      if (!Blocked) {
+        Start = steady_clock::now();
+        Blocked = true;
+      }
+      Producer->poll(1);
+    }
+    RdKafka::ErrorCode Result;
+    int Backoff{1};
+    while ((Result = Producer->produce(Topic, Partition, Flags, Payload, Size,
+                                       nullptr, 0, Timestamp, Opaque)) ==
+           RdKafka::ERR__QUEUE_FULL) {
+      if (!Blocked) {
+        Start = steady_clock::now();
+        Blocked = true;
+      }
+      if (steady_clock::now() - Start > QueueFullTimeout) {
+        break;
+      }
+      Producer->poll(Backoff);
+      Backoff = std::min(2 * Backoff, MaxBackoffMs);
+    }
+    if (Blocked && BlockedHook) {
+      BlockedHook(steady_clock::now() - Start);
+    }
+    if (Result == RdKafka::ERR_NO_ERROR) {
+      Flow.sent(Size);
+    }
+    return Result;
+  }
 
-  DeliveryReport DeliveryCallback;
-  std::unique_ptr<Serialiser> SerialiserWorker{nullptr};
+  void setupDeliveryRelease() {}
 };
 
 template <>
-template <typename T>
+inline void
+KafkaTransmitter<PooledFlatBufferSerialiser>::setupDeliveryRelease() {
+  auto Worker = SerialiserWorker.get();
+  DeliveryCallback.setRelease([Worker](void *Opaque) {
+    Worker->release(
+        static_cast<PooledFlatBufferSerialiser::builder_t *>(Opaque));
+  });
+}
+
+template <>
+template <class EventArray>
 size_t KafkaTransmitter<FlatBufferSerialiser>::send(
     const uint64_t &PacketID, const std::chrono::nanoseconds &PulseTime,
-    std::vector<T> &Events, const int NumEvents) {
+    const EventArray &Events, const int NumEvents) {
   size_t BufferSize{0};
   if (NumEvents) {
     SerialiserWorker->serialise(PacketID, PulseTime, Events);
     BufferSize = SerialiserWorker->size();
-    RdKafka::ErrorCode resp = Producer->produce(
-        Topic, RdKafka::Topic::PARTITION_UA, RdKafka::Producer::RK_MSG_COPY,
+    RdKafka::ErrorCode resp = produce(
+        nextPartition(), RdKafka::Producer::RK_MSG_COPY,
         reinterpret_cast<void *>(SerialiserWorker->get()),
-        SerialiserWorker->size(), nullptr, 0, // timestamp_now()
-        PulseTime.count(), nullptr);
+        SerialiserWorker->size(), kafkaTimestamp(PulseTime), nullptr);
+    if (resp != RdKafka::ERR_NO_ERROR) {
+      throw std::runtime_error(RdKafka::err2str(resp) + " : " + Topic);
+    }
+  }
+  return BufferSize;
+}
+
+template <>
+template <class EventArray>
+size_t KafkaTransmitter<PooledFlatBufferSerialiser>::send(
+    const uint64_t &PacketID, const std::chrono::nanoseconds &PulseTime,
+    const EventArray &Events, const int NumEvents) {
+  size_t BufferSize{0};
+  if (NumEvents) {
+    auto Builder = SerialiserWorker->serialise(PacketID, PulseTime, Events);
+    BufferSize = Builder->GetSize();
+    // No RK_MSG_COPY: librdkafka reads straight from the builder memory,
+    // the builder goes back to the pool in DeliveryReport::dr_cb
+    RdKafka::ErrorCode resp = produce(
+        nextPartition(), 0,
+        reinterpret_cast<void *>(Builder->GetBufferPointer()), BufferSize,
+        kafkaTimestamp(PulseTime), Builder);
     if (resp != RdKafka::ERR_NO_ERROR) {
+      SerialiserWorker->release(Builder);
+      throw std::runtime_error(RdKafka::err2str(resp) + " : " + Topic);
+    }
+  }
+  return BufferSize;
+}
+
+template <>
+inline void
+KafkaTransmitter<TemplateFlatBufferSerialiser>::setupDeliveryRelease() {
+  auto Worker = SerialiserWorker.get();
+  DeliveryCallback.setRelease([Worker](void *Opaque) {
+    Worker->release(
+        static_cast<TemplateFlatBufferSerialiser::TemplateBuffer *>(Opaque));
+  });
+}
+
+template <>
+template <class EventArray>
+size_t KafkaTransmitter<TemplateFlatBufferSerialiser>::send(
+    const uint64_t &PacketID, const std::chrono::nanoseconds &PulseTime,
+    const EventArray &Events, const int NumEvents) {
+  size_t BufferSize{0};
+  if (NumEvents) {
+    auto Buffer = SerialiserWorker->serialise(PacketID, PulseTime, Events);
+    BufferSize = Buffer->size();
+    RdKafka::ErrorCode resp =
+        produce(nextPartition(), 0, reinterpret_cast<void *>(Buffer->data()),
+                BufferSize, kafkaTimestamp(PulseTime), Buffer);
+    if (resp != RdKafka::ERR_NO_ERROR) {
+      SerialiserWorker->release(Buffer);
       throw std::runtime_error(RdKafka::err2str(resp) + " : " + Topic);
     }
   }
@@ -158,21 +394,87 @@ size_t KafkaTransmitter<FlatBufferSerialiser>::send(
 ////////////////
 // Consumer
 
+/// Metadata of a message returned by KafkaListener::recv
+struct ReceivedMessage {
+  bool Valid{false};
+  uint64_t MessageID{0};
+  uint64_t Bytes{0};
+  std::string Source;
+  std::chrono::nanoseconds PulseTime{0};
+  // Kafka timestamp (ms resolution), 0 if not available
+  std::chrono::nanoseconds KafkaTime{0};
+  // local system clock when the message was returned by the consumer
+  std::chrono::nanoseconds ReceiveTime{0};
+};
+
+/// Kafka timestamp of Message, 0 if not available
+inline std::chrono::nanoseconds kafkaTime(const RdKafka::Message &Message) {
+  auto Timestamp = Message.timestamp();
+  if (Timestamp.type ==
+      RdKafka::MessageTimestamp::MSG_TIMESTAMP_NOT_AVAILABLE) {
+    return std::chrono::nanoseconds(0);
+  }
+  return std::chrono::milliseconds(Timestamp.timestamp);
+}
+
+/// Messages returned by a single KafkaListener::consume call
+struct MessageBatch {
+  std::vector<std::unique_ptr<RdKafka::Message>> Messages;
+  std::chrono::nanoseconds ReceiveTime{0};
+};
+
+/// Decode an ev42 message into Events ([tof..., detector...]). Messages
+/// from a source other than SourceName (if not empty) are not valid.
+/// Message is a RdKafka::Message or has the same accessors.
+template <typename T, class M>
+ReceivedMessage decodeMessage(const M &Message,
+                              const std::chrono::nanoseconds &ReceiveTime,
+                              std::vector<T> &Events,
+                              const std::string &SourceName = "") {
+  ReceivedMessage Result;
+  EventMessageView View;
+  if (!decodeView(Message.payload(), Message.len(), View) ||
+      (!SourceName.empty() && !(View.Source == SourceName))) {
+    return Result;
+  }
+  Result.ReceiveTime = ReceiveTime;
+  Result.KafkaTime = kafkaTime(Message);
+  Result.MessageID = View.MessageID;
+  Result.PulseTime = View.PulseTime;
+  Result.Source.assign(View.Source.data(), View.Source.size());
+  Events.resize(View.TimeOfFlight.size() + View.DetectorId.size());
+  std::copy(View.TimeOfFlight.begin(), View.TimeOfFlight.end(),
+            Events.begin());
+  std::copy(View.DetectorId.begin(), View.DetectorId.end(),
+            Events.begin() + View.TimeOfFlight.size());
+  Result.Bytes = Message.len();
+  Result.Valid = true;
+  return Result;
+}
+
+/// Consumer of all the partitions of one or more topics (comma separated
+/// list). Uses the balanced KafkaConsumer: unless specified in the options
+/// each listener gets its own consumer group and starts from the end of
+/// the partitions.
 template <class Serialiser> struct KafkaListener {
+  using batch_t = MessageBatch;
 
   KafkaListener(const std::string &Brokers, const std::string &TopicName,
                 const std::string &SourceName, const KafkaOptions &Options)
       : Source{SourceName} {
     std::unique_ptr<RdKafka::Conf> Configuration{
         RdKafka::Conf::create(RdKafka::Conf::CONF_GLOBAL)};
-    std::unique_ptr<RdKafka::Conf> TopicConfiguration{
-        RdKafka::Conf::create(RdKafka::Conf::CONF_TOPIC)};
 
     std::string Error;
     Configuration->set("metadata.broker.list", Brokers, Error);
     if (!Error.empty()) {
       std::cerr << Error << std::endl;
     }
+    Configuration->set("group.id",
+                       "AMORreceiver-" + std::to_string(getCurrentTimestamp()),
+                       Error);
+    Configuration->set("auto.offset.reset", "latest", Error);
+    Configuration->set("enable.auto.commit", "false", Error);
     for (auto &Option : Options) {
       Configuration->set(Option.first, Option.second, Error);
       if (!Error.empty()) {
@@ -181,73 +483,71 @@ template <class Serialiser> struct KafkaListener {
     }
 
     if (TopicName.empty()) {
-      std::cerr << "Topic required." << std::endl;
-      exit(1);
+      throw std::runtime_error("Topic required");
     }
-    Consumer.reset(RdKafka::Consumer::create(Configuration.get(), Error));
+    Consumer.reset(RdKafka::KafkaConsumer::create(Configuration.get(), Error));
     if (!Consumer) {
-      std::cerr << "Failed to create consumer: " << Error << std::endl;
-      exit(1);
-    }
-    Topic.reset(RdKafka::Topic::create(Consumer.get(), TopicName,
-                                       TopicConfiguration.get(), Error));
-    if (!Topic) {
-      std::cerr << "Failed to create topic: " << Error << std::endl;
-      exit(1);
+      throw std::runtime_error("Failed to create consumer: " + Error);
     }
 
-    RdKafka::ErrorCode ErrorCode =
-        Consumer->start(Topic.get(), Partition, StartOffset);
+    std::vector<std::string> Topics;
+    std::stringstream Stream(TopicName);
+    std::string Name;
+    while (std::getline(Stream, Name, ',')) {
+      if (!Name.empty()) {
+        Topics.push_back(Name);
+      }
+    }
+    RdKafka::ErrorCode ErrorCode = Consumer->subscribe(Topics);
     if (ErrorCode != RdKafka::ERR_NO_ERROR) {
-      std::cerr << "Failed to start consumer: " << RdKafka::err2str(ErrorCode)
-                << std::endl;
-      exit(1);
+      throw std::runtime_error("Failed to subscribe: " +
+                               RdKafka::err2str(ErrorCode));
     }
   }
 
-  template <typename T>
-  std::pair<uint64_t, uint64_t> recv(std::vector<T> &data) {
-    return std::pair<uint64_t, uint64_t>{0, 0};
+  ~KafkaListener() {
+    if (Consumer) {
+      Consumer->close();
+    }
   }
 
-private:
-  int32_t Partition = 0;
-  int64_t StartOffset = RdKafka::Topic::OFFSET_END;
-  std::string Source;
-
-  std::unique_ptr<RdKafka::Consumer> Consumer{nullptr};
-  std::unique_ptr<RdKafka::Topic> Topic{nullptr};
-};
-
-template <>
-template <typename T>
-std::pair<uint64_t, uint64_t>
-KafkaListener<FlatBufferSerialiser>::recv(std::vector<T> &Events) {
-
-  std::unique_ptr<RdKafka::Message> Message{nullptr};
-  FlatBufferSerialiser SerialiserWorker;
-
-  do {
-    Message.reset(Consumer->consume(Topic.get(), Partition, 1000));
-    if ((Message->err() != RdKafka::ERR_NO_ERROR) &&
-        (Message->err() != RdKafka::ERR__TIMED_OUT) &&
-        (Message->err() != RdKafka::ERR__PARTITION_EOF)) {
-      std::cerr << "message error: " << RdKafka::err2str(Message->err())
-                << std::endl;
+  /// Wait up to Timeout ms for a message, then take without waiting the
+  /// messages already fetched, up to MaxSize. Returns the batch size.
+  size_t consume(MessageBatch &Batch, const size_t MaxSize,
+                 const int Timeout) {
+    Batch.Messages.clear();
+    int Wait = Timeout;
+    while (Batch.Messages.size() < MaxSize) {
+      std::unique_ptr<RdKafka::Message> Message{Consumer->consume(Wait)};
+      if (!Message || Message->err() == RdKafka::ERR__TIMED_OUT) {
+        break;
+      }
+      if (Message->err() == RdKafka::ERR_NO_ERROR) {
+        Batch.Messages.push_back(std::move(Message));
+        Wait = 0;
+      } else if (Message->err() != RdKafka::ERR__PARTITION_EOF) {
+        std::cerr << "message error: " << RdKafka::err2str(Message->err())
+                  << std::endl;
+      }
     }
-  } while (Message->err() != RdKafka::ERR_NO_ERROR);
+    Batch.ReceiveTime = std::chrono::nanoseconds(getCurrentTimestamp());
+    return Batch.Messages.size();
+  }
 
-  uint64_t MessageID = -1;
-  std::chrono::nanoseconds PulseTime{0};
-  std::string MessageSource;
-  SerialiserWorker.extract(reinterpret_cast<const char *>(Message->payload()),
-                           Events, MessageID, PulseTime, MessageSource);
-  if (!Source.empty()) {
-    if (Source != MessageSource) {
-      return std::pair<uint64_t, uint64_t>{0, 0};
+  const std::string &source() const { return Source; }
+
+  /// Wait for the next message and decode it in data
+  template <typename T> ReceivedMessage recv(std::vector<T> &data) {
+    MessageBatch Batch;
+    while (!consume(Batch, 1, 1000)) {
     }
+    return decodeMessage(*Batch.Messages.front(), Batch.ReceiveTime, data,
+                         Source);
   }
-  return std::pair<uint64_t, uint64_t>{MessageID, Message->len()};
-}
+
+private:
+  std::string Source;
+  std::unique_ptr<RdKafka::KafkaConsumer> Consumer{nullptr};
+};
 
 } // namespace SINQAmorSim
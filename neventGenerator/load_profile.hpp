@@ -0,0 +1,269 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+namespace SINQAmorSim {
+
+/// Load requested at a given time, relative to the configuration: Rate
+/// multiplies the pulse rate (or the rate limit), Events the events of
+/// each pulse. Events == 0 is beam off: the pulses are empty.
+struct LoadLevel {
+  LoadLevel() = default;
+  LoadLevel(const double Rate, const double Events)
+      : Rate{Rate}, Events{Events} {}
+
+  double Rate{1.0};
+  double Events{1.0};
+};
+
+/// Load that varies over time, read from a JSON file:
+///
+///     { "loop": true,
+///       "segments": [
+///         { "type": "step", "duration": 30, "rate": 2, "events": 0.5 },
+///         { "type": "ramp", "duration": 60, "rate_start": 1, "rate_end": 4,
+///           "events_start": 1, "events_end": 2 },
+///         { "type": "burst", "duration": 60, "period": 10,
+///           "burst_length": 1, "burst_rate": 10, "burst_events": 1 },
+///         { "type": "sine", "duration": 120, "period": 30,
+///           "amplitude": 0.5, "events_amplitude": 0 },
+///         { "type": "beam_off", "duration": 10 } ] }
+///
+/// Durations and periods are in seconds. Missing rate and events values
+/// default to 1, burst values to the base ones. Without loop the last
+/// level holds once the profile is over.
+class LoadProfile {
+public:
+  enum class Shape { step, ramp, burst, sine, beam_off };
+
+  struct Segment {
+    Shape Type{Shape::step};
+    double Duration{0};
+    LoadLevel Start;
+    LoadLevel End;
+    LoadLevel Burst;
+    double Period{0};
+    double BurstLength{0};
+    double Amplitude{0};
+    double EventsAmplitude{0};
+  };
+
+  LoadProfile() = default;
+  explicit LoadProfile(const nlohmann::json &Profile) { parse(Profile); }
+
+  static LoadProfile fromFile(const std::string &Filename) {
+    std::ifstream File(Filename);
+    if (!File) {
+      throw std::runtime_error("Can't open load profile " + Filename);
+    }
+    nlohmann::json Profile;
+    try {
+      File >> Profile;
+    } catch (const std::exception &Error) {
+      throw std::runtime_error("Invalid load profile " + Filename + ": " +
+                               Error.what());
+    }
+    return LoadProfile(Profile);
+  }
+
+  /// Level Seconds after the start of the profile
+  LoadLevel at(double Seconds) const {
+    if (Segments.empty()) {
+      return LoadLevel{};
+    }
+    if (Seconds < 0) {
+      Seconds = 0;
+    }
+    if (Seconds >= Duration) {
+      if (!Loop) {
+        return level(Segments.back(), Segments.back().Duration);
+      }
+      Seconds = std::fmod(Seconds, Duration);
+    }
+    for (auto &Item : Segments) {
+      if (Seconds < Item.Duration) {
+        return level(Item, Seconds);
+      }
+      Seconds -= Item.Duration;
+    }
+    return level(Segments.back(), Segments.back().Duration);
+  }
+
+  /// Average of the rate and of rate * events over [From, To), sampled
+  /// every 10 ms: the requested pulses and events relative to the
+  /// configuration
+  LoadLevel mean(const double From, const double To) const {
+    const double Step = 0.01;
+    LoadLevel Result{0, 0};
+    int Samples{0};
+    for (double t = From; t < To || !Samples; t += Step, ++Samples) {
+      auto Level = at(t);
+      Result.Rate += Level.Rate;
+      Result.Events += Level.Rate * Level.Events;
+    }
+    Result.Rate /= Samples;
+    Result.Events /= Samples;
+    return Result;
+  }
+
+  double duration() const { return Duration; }
+  bool empty() const { return Segments.empty(); }
+  const std::vector<Segment> &segments() const { return Segments; }
+
+private:
+  std::vector<Segment> Segments;
+  double Duration{0};
+  bool Loop{true};
+
+  static double value(const nlohmann::json &Item, const std::string &Key,
+                      const double Default) {
+    auto It = Item.find(Key);
+    return It != Item.end() ? It->get<double>() : Default;
+  }
+
+  static Shape shape(const std::string &Name) {
+    if (Name == "step") {
+      return Shape::step;
+    }
+    if (Name == "ramp") {
+      return Shape::ramp;
+    }
+    if (Name == "burst") {
+      return Shape::burst;
+    }
+    if (Name == "sine") {
+      return Shape::sine;
+    }
+    if (Name == "beam_off") {
+      return Shape::beam_off;
+    }
+    throw std::runtime_error("Unknown load profile segment: " + Name);
+  }
+
+  void parse(const nlohmann::json &Profile) {
+    Loop = Profile.value("loop", true);
+    auto It = Profile.find("segments");
+    if (It == Profile.end() || !It->is_array() || It->empty()) {
+      throw std::runtime_error("Load profile without segments");
+    }
+    for (auto &Item : *It) {
+      Segment Result;
+      Result.Type = shape(Item.at("type").get<std::string>());
+      Result.Duration = value(Item, "duration", 0);
+      Result.Start.Rate = value(Item, "rate", 1);
+      Result.Start.Events = value(Item, "events", 1);
+      if (Result.Type == Shape::ramp) {
+        Result.Start.Rate = value(Item, "rate_start", 1);
+        Result.Start.Events = value(Item, "events_start", 1);
+      }
+      if (Result.Type == Shape::beam_off) {
+        Result.Start.Events = 0;
+      }
+      Result.End.Rate = value(Item, "rate_end", Result.Start.Rate);
+      Result.End.Events = value(Item, "events_end", Result.Start.Events);
+      Result.Burst.Rate = value(Item, "burst_rate", Result.Start.Rate);
+      Result.Burst.Events = value(Item, "burst_events", Result.Start.Events);
+      Result.Period = value(Item, "period", 0);
+      Result.BurstLength = value(Item, "burst_length", 0);
+      Result.Amplitude = value(Item, "amplitude", 0);
+      Result.EventsAmplitude = value(Item, "events_amplitude", 0);
+      validate(Result);
+      Segments.push_back(Result);
+      Duration += Result.Duration;
+    }
+  }
+
+  static void validate(const Segment &Item) {
+    if (Item.Duration <= 0) {
+      throw std::runtime_error("Load profile segment duration <= 0");
+    }
+    if ((Item.Type == Shape::burst || Item.Type == Shape::sine) &&
+        Item.Period <= 0) {
+      throw std::runtime_error("Load profile segment period <= 0");
+    }
+    // the rate never reaches zero: pause with beam_off instead
+    double MinRate = std::min(Item.Start.Rate, Item.End.Rate);
+    if (Item.Type == Shape::burst) {
+      MinRate = std::min(MinRate, Item.Burst.Rate);
+    }
+    if (Item.Type == Shape::sine) {
+      MinRate *= 1 - std::fabs(Item.Amplitude);
+    }
+    if (MinRate <= 0) {
+      throw std::runtime_error("Load profile rate must stay positive");
+    }
+    if (Item.Start.Events < 0 || Item.End.Events < 0 ||
+        Item.Burst.Events < 0 || std::fabs(Item.EventsAmplitude) > 1) {
+      throw std::runtime_error("Load profile events must not be negative");
+    }
+  }
+
+  static LoadLevel level(const Segment &Item, const double t) {
+    switch (Item.Type) {
+    case Shape::ramp: {
+      double x = t / Item.Duration;
+      return LoadLevel{Item.Start.Rate + x * (Item.End.Rate - Item.Start.Rate),
+              Item.Start.Events + x * (Item.End.Events - Item.Start.Events)};
+    }
+    case Shape::burst:
+      return std::fmod(t, Item.Period) < Item.BurstLength ? Item.Burst
+                                                          : Item.Start;
+    case Shape::sine: {
+      double Phase = std::sin(2 * std::acos(-1.0) * t / Item.Period);
+      return {Item.Start.Rate * (1 + Item.Amplitude * Phase),
+              Item.Start.Events * (1 + Item.EventsAmplitude * Phase)};
+    }
+    default:
+      return Item.Start;
+    }
+  }
+};
+
+/// Time of a profile, shared by the threads: it starts at the first call
+/// of seconds()
+class ProfileClock {
+  using steady_clock = std::chrono::steady_clock;
+
+public:
+  double seconds(const steady_clock::time_point Now = steady_clock::now()) {
+    int64_t Time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       Now.time_since_epoch())
+                       .count();
+    int64_t Unset{0};
+    if (!Start.load(std::memory_order_relaxed)) {
+      Start.compare_exchange_strong(Unset, Time);
+    }
+    return (Time - Start.load()) * 1e-9;
+  }
+
+private:
+  std::atomic<int64_t> Start{0};
+};
+
+/// Events of In scaled by Scale into Out, for events stored as a block of
+/// ToF followed by a block of detector ids: the first events are kept, or
+/// repeated when Scale > 1. In is any contiguous array of events.
+template <class EventArray, class T>
+void scaleEvents(const EventArray &In, const double Scale,
+                 std::vector<T> &Out) {
+  size_t Size = In.size() / 2;
+  size_t NewSize = Size ? size_t(std::llround(Size * Scale)) : 0;
+  Out.resize(2 * NewSize);
+  for (size_t Done = 0; Done < NewSize; Done += Size) {
+    size_t Count = std::min(Size, NewSize - Done);
+    std::copy(In.begin(), In.begin() + Count, Out.begin() + Done);
+    std::copy(In.begin() + Size, In.begin() + Size + Count,
+              Out.begin() + NewSize + Done);
+  }
+}
+
+} // namespace SINQAmorSim
@@ -0,0 +1,404 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include "event_view.hpp"
+#include "flow_control.hpp"
+#include "partitioner.hpp"
+#include "ring_buffer.hpp"
+#include "serialiser.hpp"
+#include "utils.hpp"
+
+namespace SINQAmorSim {
+
+/// Transmitter that never leaves the process, with the interface of
+/// KafkaTransmitter. The messages are serialised as for Kafka and handed to
+/// write(); they are reported as delivered by the next poll(), which runs
+/// the delivery hooks and releases the buffers, so statistics, flow control
+/// and buffer pools behave as with a broker. A topic has one partition.
+template <class Serialiser> class LocalTransmitter {
+  using steady_clock = std::chrono::steady_clock;
+  using nanoseconds = std::chrono::nanoseconds;
+
+public:
+  using delivered_t = std::function<void(size_t, const nanoseconds &, int32_t)>;
+
+  LocalTransmitter(const std::string &, const std::string &TopicName,
+                   const std::string &SourceName,
+                   const KafkaOptions & = {})
+      : Topic{TopicName}, SerialiserWorker{new Serialiser{SourceName}} {
+    if (Topic.empty()) {
+      throw std::runtime_error("Topic not set");
+    }
+  }
+  LocalTransmitter(const LocalTransmitter &) = delete;
+  LocalTransmitter &operator=(const LocalTransmitter &) = delete;
+
+  /// The buffers still in flight are released without reporting them
+  virtual ~LocalTransmitter() {
+    for (auto &Message : InFlight) {
+      release(Message.Opaque);
+    }
+  }
+
+  template <typename T> size_t send(std::vector<T> &Data, const int = -1) {
+    return transmit(Data.data(), Data.size() * sizeof(T),
+                    nanoseconds(getTimestamp()), nullptr);
+  }
+
+  template <class EventArray>
+  size_t send(const uint64_t &PacketID, const nanoseconds &PulseTime,
+              const EventArray &Events, const int NumEvents = 1) {
+    if (!NumEvents) {
+      return 0;
+    }
+    auto Message =
+        serialiseMessage(*SerialiserWorker, PacketID, PulseTime, Events);
+    return transmit(Message.Data, Message.Size, PulseTime, Message.Opaque);
+  }
+
+  /// As KafkaTransmitter::sendSerialised
+  size_t sendSerialised(void *Data, const size_t Size,
+                        const nanoseconds &PulseTime, void *Opaque) {
+    return transmit(Data, Size, PulseTime, Opaque);
+  }
+
+  /// Report the messages written since the last call. Never waits.
+  int poll(const int = -1) {
+    auto Now = steady_clock::now();
+    for (auto &Message : InFlight) {
+      ++NumMessages;
+      Mbytes += Message.Size * 1e-6;
+      if (Delivered) {
+        Delivered(Message.Size, Now - Message.Produced, Message.Partition);
+      }
+      Flow.completed(Message.Size);
+      release(Message.Opaque);
+    }
+    int Result = InFlight.size();
+    InFlight.clear();
+    return Result;
+  }
+  int outqLen() { return InFlight.size(); }
+
+  double &getNumMessages() { return NumMessages; }
+  double &getMbytes() { return Mbytes; }
+
+  int numPartitions() const { return 1; }
+  void setPartitioner(const Partitioner &Value) {
+    Partitioning = Value;
+    NumSent = 0;
+  }
+
+  void setFlowControl(const size_t MaxMessages, const size_t MaxBytes,
+                      std::function<void(const nanoseconds &)> Blocked =
+                          nullptr) {
+    Flow.setLimits(MaxMessages, MaxBytes);
+    BlockedHook = std::move(Blocked);
+  }
+
+  /// As KafkaTransmitter::setDeliveryHooks: every message is delivered
+  void setDeliveryHooks(delivered_t DeliveredHook,
+                        std::function<void()> FailedHook,
+                        std::function<void(size_t)> = nullptr) {
+    Delivered = std::move(DeliveredHook);
+    Failed = std::move(FailedHook);
+  }
+
+  /// As KafkaTransmitter::setRelease
+  void setRelease(std::function<void(void *)> Release) {
+    ReleaseHook = std::move(Release);
+  }
+
+protected:
+  std::string Topic;
+
+  /// Take a message of Size bytes at Data (valid only during the call),
+  /// false if there is no room for it now
+  virtual bool write(const void *Data, const size_t Size,
+                     const nanoseconds &PulseTime) = 0;
+
+  /// Send a message of Size bytes with Write(), which returns false if
+  /// there is no room for it now: for transports writing the events of a
+  /// pulse without an ev42 message. Flow control, blocking and delivery
+  /// reports are those of the messages given to write().
+  template <class Function>
+  size_t transmit(const size_t Size, void *Opaque, Function &&Write) {
+    // completing the messages in flight always frees the budget
+    if (!Flow.admit(Size)) {
+      poll(0);
+    }
+    steady_clock::time_point Start;
+    bool Blocked{false};
+    IdleBackoff Backoff;
+    while (!Write()) {
+      if (!Blocked) {
+        Start = steady_clock::now();
+        Blocked = true;
+      }
+      if (steady_clock::now() - Start > QueueFullTimeout) {
+        release(Opaque);
+        throw std::runtime_error("Queue full : " + Topic);
+      }
+      poll(0);
+      Backoff.wait();
+    }
+    if (Blocked && BlockedHook) {
+      BlockedHook(steady_clock::now() - Start);
+    }
+    Flow.sent(Size);
+    int32_t Partition = Partitioning(NumSent++);
+    InFlight.push_back(Pending{Size, steady_clock::now(),
+                               Partition < 0 ? 0 : Partition, Opaque});
+    return Size;
+  }
+
+private:
+  struct Pending {
+    size_t Size;
+    steady_clock::time_point Produced;
+    int32_t Partition;
+    void *Opaque;
+  };
+
+  std::unique_ptr<Serialiser> SerialiserWorker{nullptr};
+  std::vector<Pending> InFlight;
+  FlowController Flow;
+  Partitioner Partitioning;
+  uint64_t NumSent{0};
+  double NumMessages{0};
+  double Mbytes{0};
+  delivered_t Delivered;
+  std::function<void()> Failed;
+  std::function<void(const nanoseconds &)> BlockedHook;
+  std::function<void(void *)> ReleaseHook;
+  // give up on a full queue after this time, as KafkaTransmitter
+  const std::chrono::seconds QueueFullTimeout{10};
+
+  static uint64_t getTimestamp() {
+    return std::chrono::duration_cast<nanoseconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+  }
+
+  void release(void *Opaque) {
+    if (!Opaque) {
+      return;
+    }
+    if (ReleaseHook) {
+      ReleaseHook(Opaque);
+    } else {
+      releaseMessage(*SerialiserWorker, Opaque);
+    }
+  }
+
+  size_t transmit(void *Data, const size_t Size, const nanoseconds &PulseTime,
+                  void *Opaque) {
+    return transmit(Size, Opaque,
+                    [&]() { return write(Data, Size, PulseTime); });
+  }
+};
+
+/// Discards the messages, to measure the generator without any transport
+template <class Serialiser>
+class NullTransmitter : public LocalTransmitter<Serialiser> {
+public:
+  using LocalTransmitter<Serialiser>::LocalTransmitter;
+
+protected:
+  bool write(const void *, const size_t,
+             const std::chrono::nanoseconds &) override {
+    return true;
+  }
+};
+
+/// A message in a MemoryTopic
+struct MemoryMessage {
+  std::vector<char> Payload;
+  std::chrono::nanoseconds Timestamp{0};
+};
+
+/// Bounded queue of the messages of a topic, written by any number of
+/// transmitters and read by any number of consumers. The payloads taken by
+/// the consumers can be given back with recycle() to avoid allocations.
+class MemoryTopic {
+public:
+  explicit MemoryTopic(const size_t Capacity)
+      : Queue{Capacity}, Free{Capacity} {}
+
+  /// Copy of the message, false if the topic is full
+  bool push(const void *Data, const size_t Size,
+            const std::chrono::nanoseconds &Timestamp) {
+    if (Queue.size() >= Queue.capacity()) {
+      return false;
+    }
+    MemoryMessage Message;
+    Free.pop(Message);
+    auto Begin = static_cast<const char *>(Data);
+    Message.Payload.assign(Begin, Begin + Size);
+    Message.Timestamp = Timestamp;
+    if (!Queue.push(std::move(Message))) {
+      recycle(std::move(Message));
+      return false;
+    }
+    return true;
+  }
+
+  bool pop(MemoryMessage &Message) { return Queue.pop(Message); }
+
+  void recycle(MemoryMessage &&Message) { Free.push(std::move(Message)); }
+
+  size_t size() const { return Queue.size(); }
+  size_t capacity() const { return Queue.capacity(); }
+
+private:
+  MpmcRing<MemoryMessage> Queue;
+  MpmcRing<MemoryMessage> Free;
+};
+
+/// Topics of the process, created on first use
+class MemoryBroker {
+public:
+  static const size_t DefaultCapacity = 1024;
+
+  static MemoryBroker &instance() {
+    static MemoryBroker Broker;
+    return Broker;
+  }
+
+  std::shared_ptr<MemoryTopic> topic(const std::string &Name) {
+    std::lock_guard<std::mutex> Lock(Guard);
+    auto &Result = Topics[Name];
+    if (!Result) {
+      Result = std::make_shared<MemoryTopic>(size_t(DefaultCapacity));
+    }
+    return Result;
+  }
+
+  std::map<std::string, std::shared_ptr<MemoryTopic>> topics() {
+    std::lock_guard<std::mutex> Lock(Guard);
+    return Topics;
+  }
+
+private:
+  std::mutex Guard;
+  std::map<std::string, std::shared_ptr<MemoryTopic>> Topics;
+};
+
+/// Writes the messages to a topic of the MemoryBroker, for a consumer in
+/// the same process. A full topic is handled as a full librdkafka queue.
+template <class Serialiser>
+class MemoryTransmitter : public LocalTransmitter<Serialiser> {
+public:
+  MemoryTransmitter(const std::string &Brokers, const std::string &TopicName,
+                    const std::string &SourceName,
+                    const KafkaOptions &Options = {})
+      : LocalTransmitter<Serialiser>(Brokers, TopicName, SourceName, Options),
+        Queue{MemoryBroker::instance().topic(TopicName)} {}
+
+protected:
+  bool write(const void *Data, const size_t Size,
+             const std::chrono::nanoseconds &PulseTime) override {
+    return Queue->push(Data, Size, PulseTime);
+  }
+
+private:
+  std::shared_ptr<MemoryTopic> Queue;
+};
+
+/// Consumer thread of all the topics of the MemoryBroker: decodes each
+/// message in place and counts it. report() returns what was consumed
+/// since the previous call.
+class MemoryDrain {
+  using steady_clock = std::chrono::steady_clock;
+
+public:
+  MemoryDrain() : Last{steady_clock::now()} {
+    Worker = std::thread(&MemoryDrain::consume, this);
+  }
+  MemoryDrain(const MemoryDrain &) = delete;
+  MemoryDrain &operator=(const MemoryDrain &) = delete;
+  ~MemoryDrain() {
+    Stopping = true;
+    Worker.join();
+  }
+
+  nlohmann::json report() {
+    auto Now = steady_clock::now();
+    double Elapsed = std::chrono::duration<double>(Now - Last).count();
+    Last = Now;
+    uint64_t NowMessages = Messages, NowBytes = Bytes, NowInvalid = Invalid;
+    nlohmann::json Result;
+    Result["packets"] = NowMessages - PreviousMessages;
+    Result["MB/s"] = (NowBytes - PreviousBytes) * 1e-6 / Elapsed;
+    Result["invalid"] = NowInvalid - PreviousInvalid;
+    size_t Depth{0};
+    for (auto &Topic : MemoryBroker::instance().topics()) {
+      Depth += Topic.second->size();
+    }
+    Result["queued"] = Depth;
+    PreviousMessages = NowMessages;
+    PreviousBytes = NowBytes;
+    PreviousInvalid = NowInvalid;
+    return Result;
+  }
+
+private:
+  std::thread Worker;
+  std::atomic<bool> Stopping{false};
+  std::atomic<uint64_t> Messages{0};
+  std::atomic<uint64_t> Bytes{0};
+  std::atomic<uint64_t> Invalid{0};
+  // used by report() only
+  steady_clock::time_point Last;
+  uint64_t PreviousMessages{0};
+  uint64_t PreviousBytes{0};
+  uint64_t PreviousInvalid{0};
+
+  void consume() {
+    const auto Refresh = std::chrono::milliseconds(100);
+    std::map<std::string, std::shared_ptr<MemoryTopic>> Topics;
+    auto Refreshed = steady_clock::now() - Refresh;
+    MemoryMessage Message;
+    EventMessageView View;
+    IdleBackoff Backoff;
+    while (!Stopping) {
+      // new topics appear as the transmitters are created
+      if (steady_clock::now() - Refreshed >= Refresh) {
+        Topics = MemoryBroker::instance().topics();
+        Refreshed = steady_clock::now();
+      }
+      bool Received{false};
+      for (auto &Topic : Topics) {
+        while (Topic.second->pop(Message)) {
+          Received = true;
+          if (!decodeView(Message.Payload.data(), Message.Payload.size(),
+                          View, true)) {
+            ++Invalid;
+          }
+          ++Messages;
+          Bytes += Message.Payload.size();
+          Topic.second->recycle(std::move(Message));
+        }
+      }
+      if (Received) {
+        Backoff.reset();
+      } else {
+        Backoff.wait();
+      }
+    }
+  }
+};
+
+} // namespace SINQAmorSim
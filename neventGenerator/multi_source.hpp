@@ -0,0 +1,231 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <vector>
+
+#include "Configuration.hpp"
+#include "Stats.hpp"
+#include "affinity.hpp"
+#include "control.hpp"
+#include "event_cache.hpp"
+#include "pulse_scheduler.hpp"
+#include "work_stealing_pool.hpp"
+
+namespace SINQAmorSim {
+
+/// Deadlines of the next pulse of each source. run() waits for the earliest
+/// one and hands the source to Due; the source is scheduled again only
+/// after its pulse has been sent, so a source is never sent concurrently.
+class PulseTimer {
+  using steady_clock = std::chrono::steady_clock;
+
+public:
+  void schedule(const size_t Source, const steady_clock::time_point When) {
+    {
+      std::lock_guard<std::mutex> Lock(Guard);
+      Deadlines.push(Entry{When, Source});
+    }
+    Changed.notify_one();
+  }
+
+  /// Dispatch the due sources until Exit() returns true (checked at least
+  /// every 100 ms)
+  void run(std::function<void(size_t)> Due, std::function<bool()> Exit) {
+    const auto Check = std::chrono::milliseconds(100);
+    std::unique_lock<std::mutex> Lock(Guard);
+    while (!Exit()) {
+      auto Now = steady_clock::now();
+      if (Deadlines.empty() || Deadlines.top().When > Now) {
+        auto Until = Now + Check;
+        if (!Deadlines.empty() && Deadlines.top().When < Until) {
+          Until = Deadlines.top().When;
+        }
+        Changed.wait_until(Lock, Until);
+        continue;
+      }
+      size_t Source = Deadlines.top().Source;
+      Deadlines.pop();
+      Lock.unlock();
+      Due(Source);
+      Lock.lock();
+    }
+  }
+
+private:
+  struct Entry {
+    steady_clock::time_point When;
+    size_t Source;
+    bool operator>(const Entry &Other) const { return When > Other.When; }
+  };
+  std::mutex Guard;
+  std::condition_variable Changed;
+  std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>>
+      Deadlines;
+};
+
+/// Many logical sources (Configuration::sources) sent from one process.
+/// Each source has its own source_name, topic, rate and events; the events
+/// are shared, read only, between the sources using the same data. A
+/// timer thread hands the due pulses to a pool of num_threads workers, the
+/// pulses of a source go to the queue of the same worker and idle workers
+/// steal them, so the number of threads doesn't grow with the sources.
+/// Statistics are reported per source.
+template <typename Streamer, typename Control, typename Serialiser>
+class MultiSourceGenerator {
+  using steady_clock = std::chrono::steady_clock;
+  using nanoseconds = std::chrono::nanoseconds;
+
+public:
+  template <class T> using store_t = std::shared_ptr<const EventStore<T>>;
+
+  MultiSourceGenerator(Configuration &configuration)
+      : Streaming{new Control(configuration)}, Config{configuration} {
+    {
+      ScopedAffinity TransportCpus(parseCpuList(Config.kafka_cpus));
+      for (auto &Source : Config.sources) {
+        Stream.emplace_back(new Streamer(Config.producer.broker, Source.topic,
+                                         Source.source_name, Config.options));
+      }
+    }
+    Statistics.setNumThreads(Stream.size());
+    Statistics.setControl(Streaming);
+    Statistics.setTimestampPolicy(Config.timestamp_generator);
+    Statistics.setReportTime(Config.report_time);
+    Statistics.setOutput(Config.stats_file);
+  }
+
+  /// As Generator::addReport
+  void addReport(const std::string &Key,
+                 std::function<nlohmann::json()> Report) {
+    Statistics.setExtra(Key, std::move(Report));
+  }
+
+  /// Send the events Stores[i] for source i until the exit command
+  template <class T> void run(const std::vector<store_t<T>> &Stores) {
+    if (Stores.size() != Stream.size()) {
+      throw std::runtime_error("One event store per source required");
+    }
+    std::vector<State> Sources;
+    Sources.reserve(Stream.size());
+    for (size_t i = 0; i < Stream.size(); ++i) {
+      Sources.emplace_back(Config);
+      Sources.back().Rate = Config.sources[i].rate;
+      Stream[i]->setDeliveryHooks(
+          [this, i](size_t Bytes, const nanoseconds &Latency,
+                    int32_t Partition) {
+            Statistics.delivered(i, Bytes, Latency, Partition);
+          },
+          [this, i]() { Statistics.failed(i); },
+          [this, i](size_t Bytes) { Statistics.sent(i, Bytes); });
+      Stream[i]->setFlowControl(
+          Config.max_inflight, size_t(Config.max_inflight_mb) * 1000000,
+          [this, i](const nanoseconds &Blocked) {
+            Statistics.blocked(i, Blocked);
+          });
+    }
+
+    PulseTimer Timer;
+    {
+      auto Cpus = parseCpuList(Config.cpu_affinity);
+      WorkStealingPool Pool(Config.num_threads, [&Cpus](size_t Id) {
+        if (!Cpus.empty()) {
+          pinThreadOrWarn({Cpus[Id % Cpus.size()]});
+        }
+      });
+      for (size_t i = 0; i < Sources.size(); ++i) {
+        Timer.schedule(i, steady_clock::now());
+      }
+      auto Dispatch = std::async(std::launch::async, [&]() {
+        Timer.run(
+            [&](size_t i) {
+              Pool.push(
+                  [&, i]() {
+                    if (pulse(Sources[i], i, Stores[i]->events())) {
+                      Timer.schedule(i, Sources[i].Next);
+                    }
+                  },
+                  i);
+            },
+            [this]() { return Streaming->exit(); });
+      });
+      auto Report = std::async(std::launch::async, [&]() {
+        pinThreadOrWarn(parseCpuList(Config.reporter_cpus));
+        Statistics.report();
+      });
+      Streaming->update();
+      Dispatch.get();
+      Report.get();
+      std::cout << "pulses stolen by idle workers: " << Pool.steals() << "\n";
+    }
+  }
+
+private:
+  // the streams report deliveries while flushing in their destructor
+  Stats<Control> Statistics;
+  std::vector<std::unique_ptr<Streamer>> Stream;
+  std::shared_ptr<Control> Streaming{nullptr};
+  Configuration Config;
+
+  /// Pacing of a source, only used by the worker running its pulse
+  struct State {
+    explicit State(const Configuration &Config)
+        : Scheduler(Config.rate,
+                    Str2LatePulsePolicy(Config.late_pulse_policy)) {}
+    PulseScheduler Scheduler;
+    double Rate{0};
+    uint64_t PulseID{0};
+    bool Stopped{true};
+    steady_clock::time_point Next;
+  };
+
+  /// Send the next pulse of a source and compute when the following one is
+  /// due. Returns false on exit or error.
+  template <class T>
+  bool pulse(State &Source, const size_t i, const Span<T> &Events) {
+    if (Streaming->exit()) {
+      return false;
+    }
+    if (Streaming->stop()) {
+      Source.Stopped = true;
+      Source.Next = steady_clock::now() + std::chrono::milliseconds(100);
+      return true;
+    }
+    // the rate command scales the rate of all the sources
+    double Rate = Source.Rate * Streaming->rate() / Config.rate;
+    if (Source.Stopped) {
+      Source.Scheduler.reset();
+      Source.Stopped = false;
+    }
+    if (Rate != Source.Scheduler.rate()) {
+      Source.Scheduler.setRate(Rate);
+    }
+    Source.Scheduler.release();
+    auto PulseTime = Source.Scheduler.pulseTime();
+    try {
+      if (Streaming->run()) {
+        auto Start = steady_clock::now();
+        Stream[i]->send(Source.PulseID, PulseTime, Events, Events.size());
+        Statistics.pulse(i, steady_clock::now() - Start,
+                         Source.Scheduler.lastLateness(), Events.size() / 2);
+      } else {
+        Stream[i]->send(Source.PulseID, PulseTime, Events, 0);
+      }
+    } catch (std::exception &e) {
+      // as a generator thread, a failing source stops
+      std::cout << Config.sources[i].source_name << ": " << e.what() << "\n";
+      return false;
+    }
+    ++Source.PulseID;
+    Stream[i]->poll(0);
+    Source.Next = Source.Scheduler.nextDeadline();
+    return true;
+  }
+};
+
+} // namespace SINQAmorSim
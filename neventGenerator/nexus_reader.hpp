@@ -1,7 +1,16 @@
 #pragma once
 
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
 #include "H5Cpp.h"
 
+#include "event_cache.hpp"
+#include "event_synthesis.hpp"
+
 namespace SINQAmorSim {
 
 ///  \author Michele Brambilla <mib.mic@gmail.com>
@@ -21,26 +30,154 @@ public:
   NeXusSource(const std::string &filename, const int multiplier = 1) {
     try {
       H5::H5File file(filename, H5F_ACC_RDONLY);
-      read(file);
+      read(file, multiplier);
     } catch (std::exception &e) {
       throw std::runtime_error(e.what());
     }
-
-    if (multiplier > 1) {
-      int nelem = data.size();
-      for (int m = 1; m < multiplier; ++m)
-        data.insert(data.end(), data.begin(), data.begin() + nelem);
-    }
   }
 
   int count() const { return data.size(); }
   std::vector<value_type> get() { return data; }
 
+  const Instrument &instrument() const { return instrum; }
+
 private:
   Instrument instrum;
   std::vector<value_type> data;
 
-  void read(H5::H5File &file) { instrum(file, data); }
+  void read(H5::H5File &file, const int multiplier) {
+    instrum(file, data, multiplier);
+  }
+};
+
+/// Streams the events of the histogram without loading the whole dataset.
+/// The counts are read in hyperslabs (whole detector planes, or part of a
+/// plane if a plane doesn't fit) no larger than MemoryBudget bytes, and
+/// converted to events only when a pulse asks for them. When the end of the
+/// dataset is reached the stream restarts from the beginning. Events use the
+/// ESS layout [tof..., detector...] with the same conversion as
+/// Amor::toEventFmt. Safe to share among threads.
+template <typename Instrument, typename Format> class NeXusStreamSource {
+public:
+  using value_type = typename Format::value_type;
+
+  NeXusStreamSource(const std::string &filename, const size_t MemoryBudget)
+      : MemoryBudget{MemoryBudget} {
+    Instrument instrum;
+    try {
+      File.reset(new H5::H5File(filename, H5F_ACC_RDONLY));
+      Dataset = File->openDataSet(instrum.path[0]);
+      H5::DataSpace DataSpace = Dataset.getSpace();
+      if (DataSpace.getSimpleExtentNdims() != 3) {
+        throw std::runtime_error("Histogram must have rank 3");
+      }
+      DataSpace.getSimpleExtentDims(dim, nullptr);
+
+      H5::DataSet TofDataset = File->openDataSet(instrum.path[1]);
+      H5::DataSpace TofSpace = TofDataset.getSpace();
+      hsize_t TofDim{0};
+      TofSpace.getSimpleExtentDims(&TofDim, nullptr);
+      if (TofDim != dim[2]) {
+        throw std::runtime_error(
+            "Time extent in histogram differs from ToF length");
+      }
+      std::vector<float> Tof(TofDim);
+      TofDataset.read(Tof.data(), H5::PredType::NATIVE_FLOAT);
+      for (auto &Value : Tof) {
+        TofValue.push_back(std::round(Value / 10.));
+      }
+    } catch (H5::Exception &e) {
+      throw std::runtime_error(e.getDetailMsg());
+    }
+  }
+
+  /// Fill Events with the next NumEvents events
+  size_t next(std::vector<value_type> &Events, const size_t NumEvents) {
+    std::lock_guard<std::mutex> Lock(Guard);
+    Events.resize(2 * NumEvents);
+    auto Tof = Events.data();
+    auto Detector = Events.data() + NumEvents;
+    size_t Filled{0};
+    while (Filled < NumEvents) {
+      if (Bin == Counts.size() && !readChunk()) {
+        // end of the dataset, restart from the first hyperslab
+        if (!EventsInPass) {
+          throw std::runtime_error("Histogram without counts");
+        }
+        ChunkI = ChunkJ = 0;
+        EventsInPass = 0;
+        continue;
+      }
+      if (!Remaining) {
+        Remaining = Counts[Bin];
+      }
+      auto Size = std::min<size_t>(Remaining, NumEvents - Filled);
+      auto Row = Bin / dim[2];
+      std::fill(Tof + Filled, Tof + Filled + Size, TofValue[Bin % dim[2]]);
+      std::fill(Detector + Filled, Detector + Filled + Size,
+                value_type(ChunkDetector[Row]));
+      Filled += Size;
+      Remaining -= Size;
+      EventsInPass += Size;
+      if (!Remaining) {
+        ++Bin;
+      }
+    }
+    return Filled;
+  }
+
+  /// Size of the last hyperslab read, in bytes
+  size_t chunkSize() const { return Counts.size() * sizeof(int32_t); }
+
+private:
+  size_t MemoryBudget;
+  std::unique_ptr<H5::H5File> File{nullptr};
+  H5::DataSet Dataset;
+  hsize_t dim[3];
+  std::vector<value_type> TofValue;
+
+  std::mutex Guard;
+  std::vector<int32_t> Counts;
+  std::vector<uint32_t> ChunkDetector;
+  hsize_t ChunkI{0}, ChunkJ{0};
+  size_t Bin{0};
+  size_t Remaining{0};
+  uint64_t EventsInPass{0};
+
+  /// Read the next hyperslab. Returns false at the end of the dataset.
+  bool readChunk() {
+    if (ChunkI == dim[0]) {
+      return false;
+    }
+    hsize_t Rows = std::max<hsize_t>(MemoryBudget / (dim[2] * sizeof(int32_t)),
+                                     1);
+    hsize_t Start[3] = {ChunkI, ChunkJ, 0};
+    hsize_t Count[3] = {1, std::min(Rows, dim[1] - ChunkJ), dim[2]};
+    if (!ChunkJ && Rows >= dim[1]) {
+      Count[0] = std::min(Rows / dim[1], dim[0] - ChunkI);
+      Count[1] = dim[1];
+    }
+    H5::DataSpace FileSpace = Dataset.getSpace();
+    FileSpace.selectHyperslab(H5S_SELECT_SET, Count, Start);
+    H5::DataSpace MemSpace(3, Count);
+    Counts.resize(Count[0] * Count[1] * Count[2]);
+    Dataset.read(Counts.data(), H5::PredType::NATIVE_INT, MemSpace, FileSpace);
+
+    ChunkDetector.clear();
+    for (hsize_t i = 0; i < Count[0]; ++i) {
+      for (hsize_t j = 0; j < Count[1]; ++j) {
+        ChunkDetector.push_back(ChunkI + i);
+      }
+    }
+    ChunkJ += Count[1];
+    if (ChunkJ == dim[1]) {
+      ChunkJ = 0;
+      ChunkI += Count[0];
+    }
+    Bin = 0;
+    Remaining = 0;
+    return true;
+  }
 };
 
 ///  \author Michele Brambilla <mib.mic@gmail.com>
@@ -50,7 +187,8 @@ public:
   Rita2() { path.emplace_back("/entry1/RITA-2/detector/counts"); }
 
   template <typename T>
-  void operator()(const H5::H5File &file, std::vector<T> &stream) {
+  void operator()(const H5::H5File &file, std::vector<T> &stream,
+                  const int multiplier = 1) {
 
     {
       H5::DataSet dataset = file.openDataSet(path[0]);
@@ -64,6 +202,11 @@ public:
     }
 
     toEventFmt<T>(stream);
+    if (multiplier > 1) {
+      size_t nelem = stream.size();
+      for (int m = 1; m < multiplier; ++m)
+        stream.insert(stream.end(), stream.begin(), stream.begin() + nelem);
+    }
   }
 
   std::vector<std::string> path;
@@ -103,6 +246,7 @@ private:
 ///  \date Thu Jun 09 16:43:08 2016
 struct Amor {
   static const int n_monitor = 2;
+  static std::string name() { return "amor"; }
   std::vector<std::string>::iterator begin() { return path.begin(); }
   std::vector<std::string>::iterator end() { return path.end(); }
   std::vector<std::string>::const_iterator begin() const {
@@ -115,8 +259,11 @@ struct Amor {
     path.emplace_back("/entry1/AMOR/area_detector/time_binning");
   }
 
+  /// Reads the histogram and expands it in stream, repeated multiplier times
   template <typename T>
-  void operator()(const H5::H5File &file, std::vector<T> &stream) {
+  void operator()(const H5::H5File &file, std::vector<T> &stream,
+                  const int multiplier = 1) {
+    this->multiplier = std::max(multiplier, 1);
 
     {
       H5::DataSet dataset = file.openDataSet(path[0]);
@@ -148,74 +295,188 @@ struct Amor {
     toEventFmt<T>(stream);
   }
 
+  /// Histogram used for the event synthesis. Detector ids follow the same
+  /// convention as the ESS format stream: one id per first index of the
+  /// area detector. time_binning is taken as bin centre.
+  EventHistogram histogram() const {
+    EventHistogram Result;
+    Result.NumTof = dim[2];
+    Result.Counts.assign(data.begin(), data.end());
+    for (hsize_t i = 0; i < dim[0]; ++i) {
+      for (hsize_t j = 0; j < dim[1]; ++j) {
+        Result.DetectorId.push_back(i);
+      }
+    }
+    for (hsize_t k = 0; k < dim[2]; ++k) {
+      float Width = k + 1 < dim[2] ? tof[k + 1] - tof[k]
+                                   : (k > 0 ? tof[k] - tof[k - 1] : 0);
+      Result.TofLow.push_back(std::max(0.0, tof[k] - 0.5 * Width));
+      Result.TofWidth.push_back(Width);
+    }
+    return Result;
+  }
+
   std::vector<std::string> path;
 
 private:
   std::vector<int32_t> data;
   std::vector<float> tof;
   std::vector<hsize_t> dim;
+  int multiplier{1};
+
+  /// Exclusive prefix sum of the events in each (i, j) row of the histogram:
+  /// the events of row r start at offset[r], the total is offset.back()
+  std::vector<uint64_t> rowOffsets() const {
+    size_t nRows = dim[0] * dim[1];
+    std::vector<uint64_t> offset(nRows + 1, 0);
+    for (size_t r = 0; r < nRows; ++r) {
+      uint64_t nCount{0};
+      for (hsize_t k = 0; k < dim[2]; ++k) {
+        nCount += data[r * dim[2] + k];
+      }
+      offset[r + 1] = offset[r] + nCount;
+    }
+    return offset;
+  }
+
+  /// ToF of each time bin in units of 10 ns
+  template <typename T> std::vector<T> tofValues() const {
+    std::vector<T> value(dim[2]);
+    for (hsize_t k = 0; k < dim[2]; ++k) {
+      value[k] = std::round(tof[k] / 10.);
+    }
+    return value;
+  }
 
   template <typename T> void toEventFmt(std::vector<T> &signal) {
     throw std::runtime_error("Error, stream format unknown");
   }
 };
 
+/// Hash of the datasets of filename the events of Instrument are expanded
+/// from: their dimensions and stored values. Reading them costs a fraction
+/// of the expansion, the event cache is keyed on it.
+template <typename Instrument>
+uint64_t histogramHash(const std::string &filename) {
+  try {
+    H5::H5File file(filename, H5F_ACC_RDONLY);
+    uint64_t Hash = fnv1a(nullptr, 0);
+    std::vector<char> Values;
+    for (auto &Path : Instrument().path) {
+      H5::DataSet dataset = file.openDataSet(Path);
+      H5::DataSpace dataspace = dataset.getSpace();
+      std::vector<hsize_t> dim(dataspace.getSimpleExtentNdims());
+      dataspace.getSimpleExtentDims(dim.data(), nullptr);
+      H5::DataType type = dataset.getDataType();
+      Values.resize(dataspace.getSelectNpoints() * type.getSize());
+      dataset.read(Values.data(), type);
+      Hash = fnv1a(Path.data(), Path.size(), Hash);
+      Hash = fnv1a(dim.data(), dim.size() * sizeof(hsize_t), Hash);
+      Hash = fnv1a(Values.data(), Values.size(), Hash);
+    }
+    return Hash;
+  } catch (H5::Exception &e) {
+    throw std::runtime_error("Can't read " + filename + ": " +
+                             e.getDetailMsg());
+  }
+}
+
+/// Calls fill(begin, end) on ranges of rows in parallel. The ranges are
+/// balanced on the number of events, offset being the rows prefix sum.
+template <typename F>
+void parallelRows(const std::vector<uint64_t> &offset, F fill) {
+  size_t nRows = offset.size() - 1;
+  size_t nThreads = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<std::thread> workers;
+  size_t begin = 0;
+  for (size_t t = 1; t <= nThreads && begin < nRows; ++t) {
+    size_t end = nRows;
+    if (t < nThreads) {
+      uint64_t target = offset.back() * t / nThreads;
+      end = std::lower_bound(offset.begin() + begin, offset.end() - 1, target) -
+            offset.begin();
+    }
+    if (end > begin) {
+      workers.emplace_back(fill, begin, end);
+      begin = end;
+    }
+  }
+  for (auto &w : workers) {
+    w.join();
+  }
+}
+
+/// Copies the first size elements of data into the following copies - 1
+/// blocks, in parallel
+template <typename T>
+void parallelRepeat(T *data, const size_t size, const int copies) {
+  std::vector<std::thread> workers;
+  for (int m = 1; m < copies; ++m) {
+    workers.emplace_back(
+        [=]() { std::copy(data, data + size, data + m * size); });
+  }
+  for (auto &w : workers) {
+    w.join();
+  }
+}
+
 template <>
-void Amor::toEventFmt<PSIformat::value_type>(
+inline void Amor::toEventFmt<PSIformat::value_type>(
     std::vector<PSIformat::value_type> &signal) {
-  // unsigned long nEvents = std::accumulate(data.begin(), data.end(), 0);
-  int offset, nCount;
-  int detID = 0;
-
-  union {
-    uint64_t value;
-    struct LoHi {
-      uint32_t low;
-      uint32_t high;
-    } part;
-  } x;
-
-  for (hsize_t i = 0; i < dim[0]; ++i) {
-    for (hsize_t j = 0; j < dim[1]; ++j) {
-      detID++;
-      offset = dim[2] * (j + dim[1] * i);
+  auto offset = rowOffsets();
+  uint64_t nEvents = offset.back();
+  auto tofValue = tofValues<uint32_t>();
+
+  signal.resize(nEvents * multiplier);
+  PSIformat::value_type *event = signal.data();
+  parallelRows(offset, [&](size_t begin, size_t end) {
+    union {
+      uint64_t value;
+      struct LoHi {
+        uint32_t low;
+        uint32_t high;
+      } part;
+    } x;
+    for (size_t r = begin; r < end; ++r) {
+      uint32_t detID = r + 1;
+      const int32_t *count = &data[r * dim[2]];
+      PSIformat::value_type *out = event + offset[r];
       for (hsize_t k = 0; k < dim[2]; ++k) {
-        nCount = data[offset + k];
-        x.part.high = std::round(tof[k] / 10.);
-        x.part.low = 1 << 31 | 1 << 30 | 1 << 29 | 1 << 28 | 2 << 24 | detID;
-        for (int l = 0; l < nCount; ++l) {
-          signal.push_back(x.value);
-        }
+        x.part.high = tofValue[k];
+        x.part.low = 1u << 31 | 1u << 30 | 1u << 29 | 1u << 28 | 2u << 24 |
+                     detID;
+        out = std::fill_n(out, count[k], x.value);
       }
     }
-  }
+  });
+  parallelRepeat(event, nEvents, multiplier);
 }
 
 template <>
-void Amor::toEventFmt<ESSformat::value_type>(
+inline void Amor::toEventFmt<ESSformat::value_type>(
     std::vector<ESSformat::value_type> &signal) {
-  unsigned long nEvents = std::accumulate(data.begin(), data.end(), 0);
-  uint32_t detID = 0;
-  int offset, nCount;
-  int counter = 0;
+  auto offset = rowOffsets();
+  uint64_t nEvents = offset.back();
+  uint64_t nTotal = nEvents * multiplier;
+  auto tofValue = tofValues<ESSformat::value_type>();
 
   std::cout << "ESSformat : " << nEvents << " events\n";
 
-  signal.resize(2 * nEvents);
-  for (hsize_t i = 0; i < dim[0]; ++i) {
-    for (hsize_t j = 0; j < dim[1]; ++j) {
-      offset = dim[2] * (j + dim[1] * i);
+  signal.resize(2 * nTotal);
+  ESSformat::value_type *tofOut = signal.data();
+  ESSformat::value_type *detOut = signal.data() + nTotal;
+  parallelRows(offset, [&](size_t begin, size_t end) {
+    for (size_t r = begin; r < end; ++r) {
+      const int32_t *count = &data[r * dim[2]];
+      ESSformat::value_type *out = tofOut + offset[r];
       for (hsize_t k = 0; k < dim[2]; ++k) {
-        nCount = data[offset + k];
-        for (int l = 0; l < nCount; ++l) {
-          signal[counter] = std::round(tof[k] / 10.);
-          signal[counter + nEvents] = detID;
-          counter++;
-        }
+        out = std::fill_n(out, count[k], tofValue[k]);
       }
+      std::fill(detOut + offset[r], detOut + offset[r + 1], r / dim[1]);
     }
-    detID++;
-  }
+  });
+  parallelRepeat(tofOut, nEvents, multiplier);
+  parallelRepeat(detOut, nEvents, multiplier);
 }
 
 } // namespace SINQAmorSim
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace SINQAmorSim {
+
+/// How the pulses of a thread are spread over the partitions of the topic:
+/// - random: left to librdkafka (unassigned partition)
+/// - round_robin: cycle over the partitions of the thread, one per pulse
+/// - bank: every thread emulates a detector bank, all the pulses of a bank
+///   go to the partition the bank key maps to
+/// - sticky: stay on a partition of the thread for StickyPulses pulses,
+///   then move to the next one (bigger producer batches)
+enum class PartitionPolicy { random, round_robin, bank, sticky };
+
+inline PartitionPolicy Str2PartitionPolicy(const std::string &Value) {
+  if (Value == "random") {
+    return PartitionPolicy::random;
+  }
+  if (Value == "round_robin") {
+    return PartitionPolicy::round_robin;
+  }
+  if (Value == "bank") {
+    return PartitionPolicy::bank;
+  }
+  if (Value == "sticky") {
+    return PartitionPolicy::sticky;
+  }
+  throw std::runtime_error("Unknown partitioning: " + Value);
+}
+
+/// Partition of each pulse of one generator thread. Thread tid owns the
+/// partitions p with p % NumThreads == tid; with fewer partitions than
+/// threads it shares partition tid % NumPartitions with other threads.
+class Partitioner {
+public:
+  /// Value meaning "let the producer choose" (RdKafka::Topic::PARTITION_UA)
+  static const int32_t Unassigned = -1;
+
+  Partitioner() = default;
+  Partitioner(const PartitionPolicy Policy, const int NumPartitions,
+              const int NumThreads, const int ThreadId,
+              const int StickyPulses = 1)
+      : Policy{Policy}, StickyPulses(StickyPulses > 0 ? StickyPulses : 1) {
+    if (NumPartitions <= 0 || NumThreads <= 0) {
+      this->Policy = PartitionPolicy::random;
+      return;
+    }
+    if (Policy == PartitionPolicy::bank) {
+      Owned.push_back(ThreadId % NumPartitions);
+      return;
+    }
+    for (int p = ThreadId % NumThreads; p < NumPartitions; p += NumThreads) {
+      Owned.push_back(p);
+    }
+    if (Owned.empty()) {
+      Owned.push_back(ThreadId % NumPartitions);
+    }
+  }
+
+  int32_t operator()(const uint64_t Pulse) const {
+    switch (Policy) {
+    case PartitionPolicy::round_robin:
+      return Owned[Pulse % Owned.size()];
+    case PartitionPolicy::bank:
+      return Owned.front();
+    case PartitionPolicy::sticky:
+      return Owned[Pulse / StickyPulses % Owned.size()];
+    default:
+      return Unassigned;
+    }
+  }
+
+  /// Partitions written by this thread, empty if random
+  const std::vector<int32_t> &partitions() const { return Owned; }
+
+private:
+  PartitionPolicy Policy{PartitionPolicy::random};
+  uint64_t StickyPulses{1};
+  std::vector<int32_t> Owned;
+};
+
+} // namespace SINQAmorSim
@@ -0,0 +1,227 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include "Stats.hpp"
+#include "ring_buffer.hpp"
+
+namespace SINQAmorSim {
+
+/// A pulse due for Producer, emitted by the scheduler stage
+struct PulseWork {
+  size_t Producer{0};
+  uint64_t PulseID{0};
+  std::chrono::nanoseconds PulseTime{0};
+  std::chrono::nanoseconds Lateness{0};
+  std::chrono::steady_clock::time_point Scheduled;
+  // false while paused: the id is used but nothing is sent
+  bool Send{false};
+};
+
+/// A pulse serialised by the worker stage. Buffer is null if there is
+/// nothing to send; Opaque identifies it for the release once sent.
+struct SerialisedPulse {
+  uint64_t PulseID{0};
+  std::chrono::nanoseconds PulseTime{0};
+  std::chrono::nanoseconds Lateness{0};
+  void *Buffer{nullptr};
+  size_t Size{0};
+  void *Opaque{nullptr};
+  uint64_t Events{0};
+  std::chrono::steady_clock::time_point Ready;
+};
+
+/// Queues and counters of a three stage pipeline: a scheduler pushes the
+/// due pulses into a MPMC ring read by the serialisation workers; each
+/// worker has one SPSC ring per producer thread. A stage finding the next
+/// ring full spins (yielding) until there is room, counting a stall, so a
+/// slow stage slows down the ones before it. Each stage thread records in
+/// its own counters; report() is called by the statistics thread.
+class PulsePipeline {
+  using steady_clock = std::chrono::steady_clock;
+  using nanoseconds = std::chrono::nanoseconds;
+
+public:
+  PulsePipeline(const size_t NumWorkers, const size_t NumProducers,
+                const size_t Depth)
+      : Work{Depth * NumProducers}, NumProducers{NumProducers} {
+    for (size_t i = 0; i < NumWorkers * NumProducers; ++i) {
+      Output.emplace_back(new SpscRing<SerialisedPulse>(Depth));
+    }
+    for (size_t i = 0; i < NumWorkers + NumProducers + 1; ++i) {
+      Counters.emplace_back(new StageCounters);
+    }
+    Previous.resize(Counters.size());
+  }
+
+  MpmcRing<PulseWork> &work() { return Work; }
+  SpscRing<SerialisedPulse> &output(const size_t Worker,
+                                    const size_t Producer) {
+    return *Output[Worker * NumProducers + Producer];
+  }
+  size_t numWorkers() const { return Output.size() / NumProducers; }
+
+  /// The scheduler waited for room in the work ring
+  void schedulerStall() { StageCounters::increment(Counters[0]->Stalls); }
+
+  /// A worker took a pulse Wait after it was scheduled and serialised it
+  /// in Elapsed
+  void serialised(const size_t Worker, const nanoseconds &Wait,
+                  const nanoseconds &Elapsed) {
+    auto &Stage = *Counters[1 + Worker];
+    Stage.Wait.record(Wait);
+    Stage.Time.record(Elapsed);
+  }
+  void workerStall(const size_t Worker) {
+    StageCounters::increment(Counters[1 + Worker]->Stalls);
+  }
+
+  /// A producer took a serialised pulse Wait after it was ready
+  void produced(const size_t Producer, const nanoseconds &Wait) {
+    Counters[1 + numWorkers() + Producer]->Wait.record(Wait);
+  }
+
+  /// Depth of the queues now and activity of the stages since the last
+  /// call. Times are histograms, as in the rest of the statistics.
+  nlohmann::json report() {
+    const size_t Workers = numWorkers();
+    std::vector<Snapshot> Current(Counters.size());
+    for (size_t i = 0; i < Counters.size(); ++i) {
+      Current[i].Stalls = Counters[i]->Stalls.load(std::memory_order_relaxed);
+      Current[i].Wait = Counters[i]->Wait.snapshot();
+      Current[i].Time = Counters[i]->Time.snapshot();
+    }
+    HdrHistogram SerialiseWait, SerialiseTime, ProduceWait;
+    uint64_t WorkerStalls{0};
+    for (size_t i = 1; i <= Workers; ++i) {
+      SerialiseWait.merge(
+          AtomicHdrHistogram::delta(Current[i].Wait, Previous[i].Wait));
+      SerialiseTime.merge(
+          AtomicHdrHistogram::delta(Current[i].Time, Previous[i].Time));
+      WorkerStalls += Current[i].Stalls - Previous[i].Stalls;
+    }
+    for (size_t i = 1 + Workers; i < Current.size(); ++i) {
+      ProduceWait.merge(
+          AtomicHdrHistogram::delta(Current[i].Wait, Previous[i].Wait));
+    }
+    size_t OutputDepth{0}, MaxOutputDepth{0};
+    for (size_t p = 0; p < NumProducers; ++p) {
+      size_t Depth{0};
+      for (size_t w = 0; w < Workers; ++w) {
+        Depth += output(w, p).size();
+      }
+      OutputDepth += Depth;
+      MaxOutputDepth = std::max(MaxOutputDepth, Depth);
+    }
+
+    nlohmann::json Result;
+    Result["workers"] = Workers;
+    Result["work_queue"] = {{"depth", Work.size()},
+                            {"capacity", Work.capacity()}};
+    Result["output_queues"] = {
+        {"depth", OutputDepth},
+        {"max_producer_depth", MaxOutputDepth},
+        {"capacity_per_producer", Workers * Output.front()->capacity()}};
+    Result["scheduler_stalls"] = Current[0].Stalls - Previous[0].Stalls;
+    Result["serialiser_stalls"] = WorkerStalls;
+    Result["serialise_wait"] = histogramToJson(SerialiseWait);
+    Result["serialise_time"] = histogramToJson(SerialiseTime);
+    Result["produce_wait"] = histogramToJson(ProduceWait);
+    Previous.swap(Current);
+    return Result;
+  }
+
+private:
+  struct StageCounters {
+    char PaddingBefore[64];
+    std::atomic<uint64_t> Stalls{0};
+    AtomicHdrHistogram Wait;
+    AtomicHdrHistogram Time;
+    char PaddingAfter[64];
+
+    static void increment(std::atomic<uint64_t> &Counter) {
+      Counter.store(Counter.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_relaxed);
+    }
+  };
+
+  struct Snapshot {
+    uint64_t Stalls{0};
+    HdrHistogram Wait;
+    HdrHistogram Time;
+  };
+
+  MpmcRing<PulseWork> Work;
+  std::vector<std::unique_ptr<SpscRing<SerialisedPulse>>> Output;
+  size_t NumProducers;
+  // scheduler, then the workers, then the producers
+  std::vector<std::unique_ptr<StageCounters>> Counters;
+  std::vector<Snapshot> Previous;
+};
+
+/// Sequence of the pulses of one producer by increasing id. The workers
+/// take the work in order, so the output ring of each worker is sorted and
+/// the next pulse is at the head of one of them: only the head of each ring
+/// is held here, the rest waits in the (bounded) rings.
+class PulseReorder {
+public:
+  PulseReorder(PulsePipeline &Pipeline, const size_t Producer,
+               const uint64_t First, const uint64_t Step)
+      : Pipeline(Pipeline), Producer{Producer}, Expected{First}, Step{Step},
+        Heads(Pipeline.numWorkers()), Held(Pipeline.numWorkers(), false) {}
+
+  /// Move the next pulse into Item. Returns false if it is not serialised
+  /// yet.
+  bool next(SerialisedPulse &Item) {
+    for (size_t Worker = 0; Worker < Heads.size(); ++Worker) {
+      if (!Held[Worker]) {
+        Held[Worker] = Pipeline.output(Worker, Producer).pop(Heads[Worker]);
+      }
+      if (Held[Worker] && Heads[Worker].PulseID == Expected) {
+        Item = Heads[Worker];
+        Held[Worker] = false;
+        Expected += Step;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /// Pass the buffers of the pulses held or queued to Release, e.g. after
+  /// an error. Returns the number of pulses dropped.
+  template <class Function> size_t drain(Function Release) {
+    size_t Dropped{0};
+    for (size_t Worker = 0; Worker < Heads.size(); ++Worker) {
+      if (Held[Worker]) {
+        Release(Heads[Worker].Opaque);
+        Held[Worker] = false;
+        ++Dropped;
+      }
+      while (Pipeline.output(Worker, Producer).pop(Heads[Worker])) {
+        Release(Heads[Worker].Opaque);
+        ++Dropped;
+      }
+    }
+    return Dropped;
+  }
+
+  /// Id of the next pulse to send
+  uint64_t expected() const { return Expected; }
+
+private:
+  PulsePipeline &Pipeline;
+  size_t Producer;
+  uint64_t Expected;
+  uint64_t Step;
+  std::vector<SerialisedPulse> Heads;
+  std::vector<bool> Held;
+};
+
+} // namespace SINQAmorSim
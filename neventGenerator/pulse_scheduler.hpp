@@ -0,0 +1,187 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+namespace SINQAmorSim {
+
+/// Distribution of the delay between the scheduled and the actual pulse
+/// time. Bucket 0 counts pulses late by less than 1 us, bucket i pulses late
+/// by [2^(i-1), 2^i) us; the last bucket collects everything beyond.
+class LatenessHistogram {
+public:
+  static const int NumBuckets = 32;
+
+  void add(const std::chrono::nanoseconds &Lateness) {
+    uint64_t Micro = Lateness.count() > 0 ? Lateness.count() / 1000 : 0;
+    int Bucket = 0;
+    while (Micro && Bucket < NumBuckets - 1) {
+      Micro >>= 1;
+      ++Bucket;
+    }
+    ++Counts[Bucket];
+    ++Total;
+    Sum += Lateness.count() > 0 ? Lateness.count() : 0;
+    if (Lateness.count() > Max) {
+      Max = Lateness.count();
+    }
+  }
+
+  void merge(const LatenessHistogram &Other) {
+    for (int i = 0; i < NumBuckets; ++i) {
+      Counts[i] += Other.Counts[i];
+    }
+    Total += Other.Total;
+    Sum += Other.Sum;
+    Max = std::max(Max, Other.Max);
+  }
+
+  void reset() {
+    Counts.fill(0);
+    Total = Sum = 0;
+    Max = 0;
+  }
+
+  /// Upper bound of bucket i, in microseconds
+  static uint64_t upperBound(const int i) { return uint64_t(1) << i; }
+
+  const std::array<uint64_t, NumBuckets> &counts() const { return Counts; }
+  uint64_t total() const { return Total; }
+  double mean() const { return Total ? double(Sum) / Total : 0; }
+  int64_t max() const { return Max; }
+
+private:
+  std::array<uint64_t, NumBuckets> Counts{};
+  uint64_t Total{0};
+  uint64_t Sum{0};
+  int64_t Max{0};
+};
+
+/// What to do when a pulse deadline has already passed by more than one
+/// period: emit the missed pulses back to back (catch_up) or drop them and
+/// resume at the next deadline in the future (skip)
+enum class LatePulsePolicy { catch_up, skip };
+
+inline LatePulsePolicy Str2LatePulsePolicy(const std::string &Value) {
+  if (Value == "catch_up") {
+    return LatePulsePolicy::catch_up;
+  }
+  if (Value == "skip") {
+    return LatePulsePolicy::skip;
+  }
+  throw std::runtime_error("Unknown late pulse policy: " + Value);
+}
+
+/// Paces pulses at a fixed rate (Hz, not necessarily integer). Deadlines are
+/// absolute, computed from the start time on the monotonic clock, so errors
+/// don't accumulate. The last SpinTime before a deadline is busy-waited
+/// instead of slept to get sub-millisecond accuracy.
+class PulseScheduler {
+  using steady_clock = std::chrono::steady_clock;
+  using system_clock = std::chrono::system_clock;
+  using nanoseconds = std::chrono::nanoseconds;
+
+public:
+  PulseScheduler(const double Rate,
+                 const LatePulsePolicy Policy = LatePulsePolicy::catch_up,
+                 const nanoseconds SpinTime = nanoseconds(0))
+      : Policy{Policy}, SpinTime{SpinTime} {
+    setRate(Rate);
+    reset();
+  }
+
+  /// Restart the sequence of deadlines from now, e.g. after a pause
+  void reset() {
+    Start = steady_clock::now();
+    SystemStart = system_clock::now();
+    NextPulse = 0;
+  }
+
+  /// Change the rate keeping the next deadline where it is
+  void setRate(const double Value) {
+    if (Value <= 0) {
+      throw std::runtime_error("Pulse rate must be positive");
+    }
+    if (Period.count() > 0) {
+      auto Next = deadline(NextPulse);
+      SystemStart += std::chrono::duration_cast<system_clock::duration>(
+          Next - Start);
+      Start = Next;
+      NextPulse = 0;
+    }
+    Rate = Value;
+    Period = std::chrono::duration<double, std::nano>(1e9 / Rate);
+  }
+  double rate() const { return Rate; }
+
+  /// Block until the next pulse is due. Returns the number of pulses
+  /// dropped because of the skip policy.
+  uint64_t wait() {
+    auto Deadline = deadline(NextPulse);
+    auto Now = steady_clock::now();
+    if (Now < Deadline) {
+      if (Deadline - Now > SpinTime) {
+        std::this_thread::sleep_until(Deadline - SpinTime);
+      }
+      while ((Now = steady_clock::now()) < Deadline) {
+      }
+    }
+    return release(Now);
+  }
+
+  /// Deadline of the next pulse, for callers waiting on their own
+  steady_clock::time_point nextDeadline() const { return deadline(NextPulse); }
+
+  /// Release the next pulse at Now, once its deadline is reached, without
+  /// waiting. Returns the number of pulses dropped because of the skip
+  /// policy.
+  uint64_t release(const steady_clock::time_point Now = steady_clock::now()) {
+    auto Deadline = deadline(NextPulse);
+    Last = std::chrono::duration_cast<nanoseconds>(Now - Deadline);
+    Lateness.add(Last);
+
+    uint64_t Skipped{0};
+    if (Policy == LatePulsePolicy::skip && Now - Deadline > Period) {
+      Skipped = uint64_t((Now - Deadline) / Period);
+      NextPulse += Skipped;
+    }
+    Current = NextPulse++;
+    return Skipped;
+  }
+
+  /// Scheduled time of the pulse released by the last wait()
+  nanoseconds pulseTime() const {
+    return std::chrono::duration_cast<nanoseconds>(
+        SystemStart.time_since_epoch() + offset(Current));
+  }
+
+  LatenessHistogram &lateness() { return Lateness; }
+  /// Delay of the pulse released by the last wait()
+  nanoseconds lastLateness() const { return Last; }
+
+private:
+  LatePulsePolicy Policy;
+  nanoseconds SpinTime;
+  double Rate{0};
+  std::chrono::duration<double, std::nano> Period{0};
+  steady_clock::time_point Start;
+  system_clock::time_point SystemStart;
+  uint64_t NextPulse{0};
+  uint64_t Current{0};
+  nanoseconds Last{0};
+  LatenessHistogram Lateness;
+
+  nanoseconds offset(const uint64_t Pulse) const {
+    return nanoseconds(std::llround(Pulse * Period.count()));
+  }
+  steady_clock::time_point deadline(const uint64_t Pulse) const {
+    return Start + offset(Pulse);
+  }
+};
+
+} // namespace SINQAmorSim
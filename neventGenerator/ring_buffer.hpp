@@ -0,0 +1,199 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+namespace SINQAmorSim {
+
+/// Smallest power of two >= Value
+inline size_t ringCapacity(const size_t Value) {
+  if (!Value) {
+    throw std::runtime_error("Ring capacity must be positive");
+  }
+  size_t Result{1};
+  while (Result < Value) {
+    Result <<= 1;
+  }
+  return Result;
+}
+
+/// Bounded lock-free queue with a single producer and a single consumer.
+/// The capacity is rounded up to a power of two. Head and tail live on
+/// different cache lines, each side caches the index of the other to avoid
+/// reading it on every operation.
+template <class T> class SpscRing {
+public:
+  explicit SpscRing(const size_t Capacity)
+      : Mask{ringCapacity(Capacity) - 1}, Slots{new T[Mask + 1]} {}
+  SpscRing(const SpscRing &) = delete;
+  SpscRing &operator=(const SpscRing &) = delete;
+
+  /// Producer only. False if full.
+  bool push(T &&Value) {
+    size_t Tail = TailIndex.load(std::memory_order_relaxed);
+    if (Tail - HeadCache > Mask) {
+      HeadCache = HeadIndex.load(std::memory_order_acquire);
+      if (Tail - HeadCache > Mask) {
+        return false;
+      }
+    }
+    Slots[Tail & Mask] = std::move(Value);
+    TailIndex.store(Tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// Consumer only. False if empty.
+  bool pop(T &Value) {
+    size_t Head = HeadIndex.load(std::memory_order_relaxed);
+    if (Head == TailCache) {
+      TailCache = TailIndex.load(std::memory_order_acquire);
+      if (Head == TailCache) {
+        return false;
+      }
+    }
+    Value = std::move(Slots[Head & Mask]);
+    HeadIndex.store(Head + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// Approximate number of queued items, from any thread
+  size_t size() const {
+    return TailIndex.load(std::memory_order_acquire) -
+           HeadIndex.load(std::memory_order_acquire);
+  }
+  size_t capacity() const { return Mask + 1; }
+
+private:
+  const size_t Mask;
+  std::unique_ptr<T[]> Slots;
+  char PaddingHead[64];
+  std::atomic<size_t> HeadIndex{0};
+  size_t TailCache{0};
+  char PaddingTail[64];
+  std::atomic<size_t> TailIndex{0};
+  size_t HeadCache{0};
+  char PaddingAfter[64];
+};
+
+/// Bounded lock-free queue for any number of producers and consumers
+/// (D. Vyukov's): each slot carries a sequence number telling whether it
+/// is free for the producer of a given turn or full for its consumer. The
+/// capacity is rounded up to a power of two.
+template <class T> class MpmcRing {
+public:
+  explicit MpmcRing(const size_t Capacity)
+      : Mask{ringCapacity(Capacity) - 1}, Slots{new Slot[Mask + 1]} {
+    for (size_t i = 0; i <= Mask; ++i) {
+      Slots[i].Sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+  MpmcRing(const MpmcRing &) = delete;
+  MpmcRing &operator=(const MpmcRing &) = delete;
+
+  /// False if full
+  bool push(T &&Value) {
+    size_t Position = TailIndex.load(std::memory_order_relaxed);
+    while (true) {
+      auto &Target = Slots[Position & Mask];
+      size_t Sequence = Target.Sequence.load(std::memory_order_acquire);
+      auto Difference = std::ptrdiff_t(Sequence) - std::ptrdiff_t(Position);
+      if (Difference == 0) {
+        if (TailIndex.compare_exchange_weak(Position, Position + 1,
+                                            std::memory_order_relaxed)) {
+          Target.Value = std::move(Value);
+          Target.Sequence.store(Position + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (Difference < 0) {
+        return false;
+      } else {
+        Position = TailIndex.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  /// False if empty
+  bool pop(T &Value) {
+    size_t Position = HeadIndex.load(std::memory_order_relaxed);
+    while (true) {
+      auto &Source = Slots[Position & Mask];
+      size_t Sequence = Source.Sequence.load(std::memory_order_acquire);
+      auto Difference =
+          std::ptrdiff_t(Sequence) - std::ptrdiff_t(Position + 1);
+      if (Difference == 0) {
+        if (HeadIndex.compare_exchange_weak(Position, Position + 1,
+                                            std::memory_order_relaxed)) {
+          Value = std::move(Source.Value);
+          Source.Sequence.store(Position + Mask + 1,
+                                std::memory_order_release);
+          return true;
+        }
+      } else if (Difference < 0) {
+        return false;
+      } else {
+        Position = HeadIndex.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  /// Approximate number of queued items
+  size_t size() const {
+    size_t Tail = TailIndex.load(std::memory_order_acquire);
+    size_t Head = HeadIndex.load(std::memory_order_acquire);
+    return Tail > Head ? Tail - Head : 0;
+  }
+  size_t capacity() const { return Mask + 1; }
+
+private:
+  struct Slot {
+    std::atomic<size_t> Sequence{0};
+    T Value;
+  };
+
+  const size_t Mask;
+  std::unique_ptr<Slot[]> Slots;
+  char PaddingHead[64];
+  std::atomic<size_t> HeadIndex{0};
+  char PaddingTail[64];
+  std::atomic<size_t> TailIndex{0};
+  char PaddingAfter[64];
+};
+
+/// Wait of a thread finding its rings empty (or full): yield a few times,
+/// then sleep for doubling times up to MaxSleep, so that idle stages don't
+/// take a whole core
+class IdleBackoff {
+public:
+  explicit IdleBackoff(const std::chrono::microseconds MaxSleep =
+                           std::chrono::microseconds(100))
+      : MaxSleep{MaxSleep} {}
+
+  void wait() {
+    if (Yields < MaxYields) {
+      ++Yields;
+      std::this_thread::yield();
+      return;
+    }
+    std::this_thread::sleep_for(Sleep);
+    Sleep = std::min(2 * Sleep, MaxSleep);
+  }
+
+  void reset() {
+    Yields = 0;
+    Sleep = std::chrono::microseconds(1);
+  }
+
+private:
+  static const int MaxYields = 64;
+  std::chrono::microseconds MaxSleep;
+  std::chrono::microseconds Sleep{1};
+  int Yields{0};
+};
+
+} // namespace SINQAmorSim
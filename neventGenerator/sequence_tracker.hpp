@@ -0,0 +1,168 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace SINQAmorSim {
+
+/// Running totals of a message id sequence
+struct SequenceCounts {
+  uint64_t Received{0};
+  // ids skipped and not (yet) received
+  uint64_t Missing{0};
+  uint64_t Duplicates{0};
+  // ids received after a larger one, filling a gap
+  uint64_t Reordered{0};
+  // ids older than the window, e.g. from a partition lagging behind the
+  // others; taken as filling a gap
+  uint64_t Late{0};
+  // ids far behind the sequence with a newer pulse time: the producer
+  // restarted
+  uint64_t Restarts{0};
+};
+
+/// Classifies the ids of a sequence using a window of the last WindowSize
+/// ids: a jump forward opens a gap (the skipped ids count as missing), an id
+/// inside the window fills the gap (reordered) or was already received
+/// (duplicate). Ids older than the window are late, unless their pulse time
+/// is newer than any seen so far: only a restarted producer numbers a new
+/// pulse below the sequence, so the sequence restarts there. O(1) per id, no
+/// allocation after construction.
+class SequenceWindow {
+public:
+  static const uint64_t WindowSize = 1 << 16;
+
+  SequenceWindow() : Bits(WindowSize / 64, 0) {}
+
+  void add(const uint64_t Id, const std::chrono::nanoseconds &PulseTime,
+           SequenceCounts &Counts) {
+    ++Counts.Received;
+    const bool Newest = !Started || PulseTime > LastPulse;
+    if (Newest) {
+      LastPulse = PulseTime;
+    }
+    if (!Started || Id + WindowSize <= Highest) {
+      if (Started && !Newest) {
+        ++Counts.Late;
+        if (Id > First && Counts.Missing) {
+          --Counts.Missing;
+        }
+        return;
+      }
+      Counts.Restarts += Started;
+      restart(Id);
+      return;
+    }
+    if (Id > Highest) {
+      uint64_t Gap = Id - Highest - 1;
+      Counts.Missing += Gap;
+      advance(Id);
+      return;
+    }
+    if (test(Id)) {
+      ++Counts.Duplicates;
+      return;
+    }
+    set(Id);
+    ++Counts.Reordered;
+    // ids before the first one received were never counted as missing
+    if (Id > First) {
+      --Counts.Missing;
+    }
+  }
+
+private:
+  std::vector<uint64_t> Bits;
+  uint64_t Highest{0};
+  uint64_t First{0};
+  std::chrono::nanoseconds LastPulse{0};
+  bool Started{false};
+
+  bool test(const uint64_t Id) const {
+    uint64_t Bit = Id % WindowSize;
+    return Bits[Bit / 64] >> (Bit % 64) & 1;
+  }
+  void set(const uint64_t Id) {
+    uint64_t Bit = Id % WindowSize;
+    Bits[Bit / 64] |= uint64_t(1) << (Bit % 64);
+  }
+  void clear(const uint64_t Id) {
+    uint64_t Bit = Id % WindowSize;
+    Bits[Bit / 64] &= ~(uint64_t(1) << (Bit % 64));
+  }
+
+  void restart(const uint64_t Id) {
+    std::fill(Bits.begin(), Bits.end(), 0);
+    Started = true;
+    Highest = First = Id;
+    set(Id);
+  }
+
+  // the ids between Highest and Id enter the window as not received
+  void advance(const uint64_t Id) {
+    if (Id - Highest >= WindowSize) {
+      std::fill(Bits.begin(), Bits.end(), 0);
+    } else {
+      for (uint64_t i = Highest + 1; i < Id; ++i) {
+        clear(i);
+      }
+    }
+    Highest = Id;
+    set(Id);
+  }
+};
+
+/// Sequence of message ids of each (topic, source) stream. The generator
+/// numbers the pulses of each topic, the partitions of a topic share the
+/// sequence (reordering across partitions is handled by the window, a
+/// partition lagging further behind by the pulse times).
+class SequenceTracker {
+public:
+  struct Stream {
+    SequenceWindow Window;
+    SequenceCounts Counts;
+  };
+
+  void add(const std::string &Topic, const char *Source,
+           const size_t SourceSize, const uint64_t Id,
+           const std::chrono::nanoseconds &PulseTime) {
+    auto &Entry = find(Topic, Source, SourceSize);
+    Entry.Window.add(Id, PulseTime, Entry.Counts);
+  }
+
+  /// Running totals, keyed by "<topic>/<source>"
+  std::map<std::string, SequenceCounts> counts() const {
+    std::map<std::string, SequenceCounts> Result;
+    for (auto &Entry : Streams) {
+      Result[Entry.first] = Entry.second.Counts;
+    }
+    return Result;
+  }
+
+private:
+  std::map<std::string, Stream> Streams;
+  std::string Key;
+  Stream *Last{nullptr};
+  size_t LastTopicSize{0};
+
+  Stream &find(const std::string &Topic, const char *Source,
+               const size_t SourceSize) {
+    // consecutive messages usually belong to the same stream
+    if (!Last || LastTopicSize != Topic.size() ||
+        Key.size() != Topic.size() + 1 + SourceSize ||
+        Key.compare(0, Topic.size(), Topic) ||
+        std::memcmp(&Key[Topic.size() + 1], Source, SourceSize)) {
+      Key.assign(Topic).append("/").append(Source, SourceSize);
+      LastTopicSize = Topic.size();
+      Last = &Streams[Key];
+    }
+    return *Last;
+  }
+};
+
+} // namespace SINQAmorSim
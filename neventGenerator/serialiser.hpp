@@ -1,5 +1,11 @@
 #pragma once
 
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
 #include "schemas/ev42_events_generated.h"
 
 // WARNING:
@@ -18,16 +24,24 @@ public:
   FlatBufferSerialiser(FlatBufferSerialiser &&other) = default;
   ~FlatBufferSerialiser() = default;
 
-  // WARNING: template parameter has to match schema data type
+  // WARNING: the element type has to match schema data type
   template <class T>
+  std::vector<char> &serialise(const int &message_id,
+                               const std::chrono::nanoseconds &pulse_time) {
+    return serialise(message_id, pulse_time, std::vector<T>{});
+  }
+
+  /// message is any contiguous array of events (e.g. a vector, or a Span
+  /// over a mapped event cache): [tof..., detector...]
+  template <class EventArray>
   std::vector<char> &serialise(const int &message_id,
                                const std::chrono::nanoseconds &pulse_time,
-                               const std::vector<T> &message = {}) {
+                               const EventArray &message) {
     auto nev = message.size() / 2;
     flatbuffers::FlatBufferBuilder builder;
     auto source_name = builder.CreateString(source);
-    auto time_of_flight = builder.CreateVector(&message[0], nev);
-    auto detector_id = builder.CreateVector(&message[nev], nev);
+    auto time_of_flight = builder.CreateVector(message.data(), nev);
+    auto detector_id = builder.CreateVector(message.data() + nev, nev);
     auto event =
         CreateEventMessage(builder, source_name, message_id, pulse_time.count(),
                            time_of_flight, detector_id);
@@ -85,13 +99,239 @@ private:
     pid = event->message_id();
     size_t timestamp = event->pulse_time();
     pulse_time = std::chrono::nanoseconds(timestamp);
-    source_name = std::string{event->source_name()->c_str()};
+    source_name.assign(event->source_name()->c_str(),
+                       event->source_name()->size());
   }
 
   std::vector<char> buffer_;
   std::string source;
 };
 
+/// Set of reusable buffers owned by a single transmitter. Buffers keep
+/// their memory between uses, so after the first few pulses no allocation
+/// is needed. A buffer stays checked out until the transport is done with
+/// it (for Kafka, until the delivery report).
+template <class Buffer> class BufferPool {
+public:
+  using factory_t = std::function<Buffer *()>;
+
+  BufferPool(factory_t Factory = []() { return new Buffer; })
+      : Factory{std::move(Factory)} {}
+  BufferPool(const BufferPool &other) = delete;
+  BufferPool &operator=(const BufferPool &other) = delete;
+
+  Buffer *acquire() {
+    std::lock_guard<std::mutex> Lock(Guard);
+    if (Free.empty()) {
+      Buffers.emplace_back(Factory());
+      return Buffers.back().get();
+    }
+    auto Result = Free.back();
+    Free.pop_back();
+    return Result;
+  }
+
+  void release(Buffer *Released) {
+    std::lock_guard<std::mutex> Lock(Guard);
+    Free.push_back(Released);
+  }
+
+  size_t size() const { return Buffers.size(); }
+  size_t available() {
+    std::lock_guard<std::mutex> Lock(Guard);
+    return Free.size();
+  }
+
+private:
+  factory_t Factory;
+  std::mutex Guard;
+  std::vector<std::unique_ptr<Buffer>> Buffers;
+  std::vector<Buffer *> Free;
+};
+
+using BuilderPool = BufferPool<flatbuffers::FlatBufferBuilder>;
+
+/// Serialise into builders taken from a BuilderPool instead of a fresh
+/// builder per message. The finished buffer is not copied: the caller
+/// hands the builder to the transport and calls release() once the
+/// transport doesn't need the buffer anymore.
+class PooledFlatBufferSerialiser {
+public:
+  using builder_t = flatbuffers::FlatBufferBuilder;
+
+  PooledFlatBufferSerialiser(
+      const std::string &source_name = "AMOR.event.stream")
+      : source{source_name} {}
+
+  template <class EventArray>
+  builder_t *serialise(const uint64_t &message_id,
+                       const std::chrono::nanoseconds &pulse_time,
+                       const EventArray &message) {
+    auto nev = message.size() / 2;
+    auto builder = Pool.acquire();
+    builder->Clear();
+    auto source_name = builder->CreateString(source);
+    auto time_of_flight = builder->CreateVector(message.data(), nev);
+    auto detector_id = builder->CreateVector(message.data() + nev, nev);
+    auto event =
+        CreateEventMessage(*builder, source_name, message_id,
+                           pulse_time.count(), time_of_flight, detector_id);
+    FinishEventMessageBuffer(*builder, event);
+    return builder;
+  }
+
+  void release(builder_t *builder) { Pool.release(builder); }
+
+  BuilderPool &pool() { return Pool; }
+
+private:
+  BuilderPool Pool;
+  std::string source;
+};
+
+/// Serialise the events once and reuse the result for every pulse. Only
+/// message_id and pulse_time change between pulses: they are patched in
+/// place in a copy of the template taken from a BufferPool, so the steady
+/// state neither serialises nor copies. The template is rebuilt if the
+/// caller passes a different event vector; changes to the content of the
+/// same vector are not detected.
+class TemplateFlatBufferSerialiser {
+public:
+  struct TemplateBuffer {
+    std::vector<char> Data;
+    size_t Generation{0};
+    char *data() { return Data.data(); }
+    size_t size() const { return Data.size(); }
+  };
+
+  TemplateFlatBufferSerialiser(
+      const std::string &source_name = "AMOR.event.stream")
+      : source{source_name} {}
+
+  template <class EventArray>
+  TemplateBuffer *serialise(const uint64_t &message_id,
+                            const std::chrono::nanoseconds &pulse_time,
+                            const EventArray &message) {
+    if (message.data() != TemplateSource ||
+        message.size() * sizeof(*message.data()) != TemplateBytes ||
+        !Generation) {
+      build(message);
+    }
+    auto Buffer = Pool.acquire();
+    if (Buffer->Generation != Generation) {
+      Buffer->Data = Template;
+      Buffer->Generation = Generation;
+    }
+    auto Data = reinterpret_cast<uint8_t *>(Buffer->data());
+    flatbuffers::WriteScalar<uint64_t>(Data + MessageIdOffset, message_id);
+    flatbuffers::WriteScalar<uint64_t>(Data + PulseTimeOffset,
+                                       pulse_time.count());
+    return Buffer;
+  }
+
+  void release(TemplateBuffer *Buffer) { Pool.release(Buffer); }
+
+  BufferPool<TemplateBuffer> &pool() { return Pool; }
+
+private:
+  template <class EventArray> void build(const EventArray &message) {
+    auto nev = message.size() / 2;
+    flatbuffers::FlatBufferBuilder builder;
+    // scalars equal to the default value would not be stored, leaving
+    // nothing to patch
+    builder.ForceDefaults(true);
+    auto source_name = builder.CreateString(source);
+    auto time_of_flight = builder.CreateVector(message.data(), nev);
+    auto detector_id = builder.CreateVector(message.data() + nev, nev);
+    auto event = CreateEventMessage(builder, source_name, 0, 0,
+                                    time_of_flight, detector_id);
+    FinishEventMessageBuffer(builder, event);
+    Template.assign(builder.GetBufferPointer(),
+                    builder.GetBufferPointer() + builder.GetSize());
+
+    auto Base = reinterpret_cast<const uint8_t *>(Template.data());
+    // EventMessage privately inherits from Table and adds no data member
+    auto Table = reinterpret_cast<const flatbuffers::Table *>(
+        GetEventMessage(Template.data()));
+    MessageIdOffset = Table->GetAddressOf(EventMessage::VT_MESSAGE_ID) - Base;
+    PulseTimeOffset = Table->GetAddressOf(EventMessage::VT_PULSE_TIME) - Base;
+
+    TemplateSource = message.data();
+    TemplateBytes = message.size() * sizeof(*message.data());
+    ++Generation;
+  }
+
+  BufferPool<TemplateBuffer> Pool;
+  std::vector<char> Template;
+  const void *TemplateSource{nullptr};
+  size_t TemplateBytes{0};
+  size_t Generation{0};
+  size_t MessageIdOffset{0};
+  size_t PulseTimeOffset{0};
+  std::string source;
+};
+
+/// A serialised message as seen by a transport: Data stays valid until
+/// releaseMessage() is called with Opaque
+struct SerialisedMessage {
+  void *Data{nullptr};
+  size_t Size{0};
+  void *Opaque{nullptr};
+};
+
+// Same access to all the serialisers, for the transports that don't need
+// to tell them apart. The buffer of FlatBufferSerialiser is reused by the
+// next message: it must be consumed (e.g. copied) before.
+
+template <class EventArray>
+SerialisedMessage serialiseMessage(FlatBufferSerialiser &Serialiser,
+                                   const uint64_t MessageId,
+                                   const std::chrono::nanoseconds &PulseTime,
+                                   const EventArray &Events) {
+  Serialiser.serialise(MessageId, PulseTime, Events);
+  SerialisedMessage Result;
+  Result.Data = Serialiser.get();
+  Result.Size = Serialiser.size();
+  return Result;
+}
+inline void releaseMessage(FlatBufferSerialiser &, void *) {}
+
+template <class EventArray>
+SerialisedMessage serialiseMessage(PooledFlatBufferSerialiser &Serialiser,
+                                   const uint64_t MessageId,
+                                   const std::chrono::nanoseconds &PulseTime,
+                                   const EventArray &Events) {
+  auto Builder = Serialiser.serialise(MessageId, PulseTime, Events);
+  SerialisedMessage Result;
+  Result.Data = Builder->GetBufferPointer();
+  Result.Size = Builder->GetSize();
+  Result.Opaque = Builder;
+  return Result;
+}
+inline void releaseMessage(PooledFlatBufferSerialiser &Serialiser,
+                           void *Opaque) {
+  Serialiser.release(
+      static_cast<PooledFlatBufferSerialiser::builder_t *>(Opaque));
+}
+
+template <class EventArray>
+SerialisedMessage serialiseMessage(TemplateFlatBufferSerialiser &Serialiser,
+                                   const uint64_t MessageId,
+                                   const std::chrono::nanoseconds &PulseTime,
+                                   const EventArray &Events) {
+  auto Buffer = Serialiser.serialise(MessageId, PulseTime, Events);
+  SerialisedMessage Result;
+  Result.Data = Buffer->data();
+  Result.Size = Buffer->size();
+  Result.Opaque = Buffer;
+  return Result;
+}
+inline void releaseMessage(TemplateFlatBufferSerialiser &Serialiser,
+                           void *Opaque) {
+  Serialiser.release(
+      static_cast<TemplateFlatBufferSerialiser::TemplateBuffer *>(Opaque));
+}
+
 ///  \author Michele Brambilla <mib.mic@gmail.com>
 ///  \date Fri Jun 17 12:22:01 2016
 class NoSerialiser {
@@ -0,0 +1,464 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "kafka_generator.hpp"
+#include "memory_transmitter.hpp"
+#include "ring_buffer.hpp"
+#include "utils.hpp"
+
+namespace SINQAmorSim {
+
+/// Layout of a shared memory ring: the header, Slots descriptors, then
+/// DataBytes of message data. Message n is described by slot n % Slots,
+/// whose Sequence is n + 1 once the message is complete (0 while it is
+/// written). The data of the messages follow each other in the data area,
+/// wrapping around; WritePosition is the (never wrapping) end of the data
+/// being written, so the data at position p is valid while
+/// WritePosition <= p + DataBytes.
+struct ShmRingHeader {
+  std::atomic<uint64_t> Magic;
+  uint64_t Slots;
+  uint64_t DataBytes;
+  char Padding0[40];
+  // number of messages published
+  std::atomic<uint64_t> Head;
+  char Padding1[56];
+  std::atomic<uint64_t> WritePosition;
+  char Padding2[56];
+};
+
+struct ShmSlot {
+  std::atomic<uint64_t> Sequence;
+  uint64_t Offset;
+  uint64_t Size;
+  int64_t PulseTime;
+};
+
+namespace ShmRingLayout {
+const uint64_t Magic = 0x474e495253524d41; // "AMRSRING"
+const size_t Alignment = 64;
+
+inline size_t dataOffset(const size_t Slots) {
+  size_t End = sizeof(ShmRingHeader) + Slots * sizeof(ShmSlot);
+  return (End + Alignment - 1) / Alignment * Alignment;
+}
+
+/// /dev/shm name of the ring of Topic
+inline std::string name(const std::string &Topic) { return "/amor-" + Topic; }
+} // namespace ShmRingLayout
+
+/// Mapping of a ring. create() makes a new ring for its only producer,
+/// attach() maps the existing ring of a consumer read only.
+class ShmRing {
+public:
+  ShmRing(const ShmRing &) = delete;
+  ShmRing &operator=(const ShmRing &) = delete;
+  ~ShmRing() {
+    if (Memory) {
+      munmap(Memory, Bytes);
+    }
+    if (Owner) {
+      shm_unlink(Name.c_str());
+    }
+  }
+
+  /// Replace the ring Name with an empty one. Slots and DataBytes are
+  /// rounded up to powers of two. The ring is removed by the destructor.
+  static std::unique_ptr<ShmRing> create(const std::string &Name,
+                                         const size_t Slots,
+                                         const size_t DataBytes) {
+    std::unique_ptr<ShmRing> Result{new ShmRing(Name)};
+    const size_t NumSlots = ringCapacity(Slots);
+    const size_t NumBytes = ringCapacity(DataBytes);
+    shm_unlink(Name.c_str());
+    int File = shm_open(Name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (File < 0) {
+      throw std::runtime_error("Can't create " + Name + ": " +
+                               std::strerror(errno));
+    }
+    Result->Owner = true;
+    Result->Bytes = ShmRingLayout::dataOffset(NumSlots) + NumBytes;
+    if (ftruncate(File, Result->Bytes) < 0) {
+      ::close(File);
+      throw std::runtime_error("Can't size " + Name + ": " +
+                               std::strerror(errno));
+    }
+    Result->map(File, PROT_READ | PROT_WRITE);
+    // a new mapping is zero filled: slots are empty and counters 0
+    auto Header = Result->header();
+    Header->Slots = NumSlots;
+    Header->DataBytes = NumBytes;
+    Header->Magic.store(ShmRingLayout::Magic, std::memory_order_release);
+    return Result;
+  }
+
+  /// Open the ring Name, nullptr if it doesn't exist (yet)
+  static std::unique_ptr<const ShmRing> attach(const std::string &Name) {
+    int File = shm_open(Name.c_str(), O_RDONLY, 0);
+    if (File < 0) {
+      return nullptr;
+    }
+    struct stat Status;
+    if (fstat(File, &Status) < 0 ||
+        size_t(Status.st_size) < sizeof(ShmRingHeader)) {
+      ::close(File);
+      return nullptr;
+    }
+    std::unique_ptr<ShmRing> Result{new ShmRing(Name)};
+    Result->Bytes = Status.st_size;
+    Result->map(File, PROT_READ);
+    auto Header = Result->header();
+    if (Header->Magic.load(std::memory_order_acquire) !=
+            ShmRingLayout::Magic ||
+        ShmRingLayout::dataOffset(Header->Slots) + Header->DataBytes !=
+            Result->Bytes) {
+      return nullptr;
+    }
+    return Result;
+  }
+
+  /// Identifies the ring currently named Name, 0 if there is none: a new
+  /// producer replaces the ring
+  static uint64_t identity(const std::string &Name) {
+    int File = shm_open(Name.c_str(), O_RDONLY, 0);
+    if (File < 0) {
+      return 0;
+    }
+    struct stat Status;
+    uint64_t Result = fstat(File, &Status) < 0 ? 0 : Status.st_ino;
+    ::close(File);
+    return Result;
+  }
+  uint64_t identity() const { return Inode; }
+
+  ShmRingHeader *header() { return static_cast<ShmRingHeader *>(Memory); }
+  const ShmRingHeader *header() const {
+    return static_cast<const ShmRingHeader *>(Memory);
+  }
+  ShmSlot *slots() {
+    return reinterpret_cast<ShmSlot *>(static_cast<char *>(Memory) +
+                                       sizeof(ShmRingHeader));
+  }
+  const ShmSlot *slots() const {
+    return reinterpret_cast<const ShmSlot *>(
+        static_cast<const char *>(Memory) + sizeof(ShmRingHeader));
+  }
+  char *data() {
+    return static_cast<char *>(Memory) +
+           ShmRingLayout::dataOffset(header()->Slots);
+  }
+  const char *data() const {
+    return static_cast<const char *>(Memory) +
+           ShmRingLayout::dataOffset(header()->Slots);
+  }
+
+private:
+  explicit ShmRing(const std::string &Name) : Name{Name} {}
+
+  std::string Name;
+  void *Memory{nullptr};
+  size_t Bytes{0};
+  uint64_t Inode{0};
+  bool Owner{false};
+
+  void map(const int File, const int Protection) {
+    struct stat Status;
+    if (fstat(File, &Status) == 0) {
+      Inode = Status.st_ino;
+    }
+    void *Address = mmap(nullptr, Bytes, Protection, MAP_SHARED, File, 0);
+    ::close(File);
+    if (Address == MAP_FAILED) {
+      throw std::runtime_error("Can't map " + Name + ": " +
+                               std::strerror(errno));
+    }
+    Memory = Address;
+  }
+};
+
+/// Producer of a ring. It never waits for the consumers: a message
+/// overwrites the oldest ones, and slow consumers detect the overrun.
+class ShmRingWriter {
+public:
+  ShmRingWriter(const std::string &Name, const size_t Slots,
+                const size_t DataBytes)
+      : Ring{ShmRing::create(Name, Slots, DataBytes)} {}
+
+  void write(const void *Data, const size_t Size,
+             const std::chrono::nanoseconds &PulseTime) {
+    auto Header = Ring->header();
+    const uint64_t DataBytes = Header->DataBytes;
+    if (Size > DataBytes) {
+      throw std::runtime_error("Message larger than the shared memory ring");
+    }
+    // messages are contiguous and start on a cache line
+    uint64_t Start = Position;
+    if (Start % DataBytes + Size > DataBytes) {
+      Start = (Start / DataBytes + 1) * DataBytes;
+    }
+    uint64_t End = Start + Size;
+    auto &Slot = Ring->slots()[Sequence & (Header->Slots - 1)];
+    // announce what is overwritten before writing it
+    Header->WritePosition.store(End, std::memory_order_relaxed);
+    Slot.Sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(Ring->data() + Start % DataBytes, Data, Size);
+    Slot.Offset = Start;
+    Slot.Size = Size;
+    Slot.PulseTime = PulseTime.count();
+    Slot.Sequence.store(Sequence + 1, std::memory_order_release);
+    Header->Head.store(++Sequence, std::memory_order_release);
+    Position = (End + ShmRingLayout::Alignment - 1) /
+               ShmRingLayout::Alignment * ShmRingLayout::Alignment;
+  }
+
+private:
+  std::unique_ptr<ShmRing> Ring;
+  uint64_t Sequence{0};
+  uint64_t Position{0};
+};
+
+/// Consumer of a ring, starting from the next message published. Any
+/// number of readers, in any process, read the same messages; they only
+/// load from the ring, mapped read only. The ring may
+/// be created after the reader; when a new producer replaces it, the reader
+/// moves to the new one.
+class ShmRingReader {
+  using steady_clock = std::chrono::steady_clock;
+
+public:
+  explicit ShmRingReader(const std::string &Name)
+      : Name{Name}, Checked{steady_clock::now()} {
+    open(false);
+  }
+
+  /// Copy the next message, false if there is none. The messages
+  /// overwritten before being read are counted by lost().
+  bool read(std::vector<char> &Message, std::chrono::nanoseconds &PulseTime) {
+    if (!Ring || !next(Message, PulseTime)) {
+      // look for a new ring from time to time, while idle
+      if (steady_clock::now() - Checked > std::chrono::seconds(1)) {
+        Checked = steady_clock::now();
+        auto Current = ShmRing::identity(Name);
+        if (Current && (!Ring || Current != Ring->identity())) {
+          open(true);
+        }
+      }
+      return false;
+    }
+    return true;
+  }
+
+  uint64_t lost() const { return Lost; }
+
+private:
+  std::string Name;
+  std::unique_ptr<const ShmRing> Ring;
+  uint64_t Next{0};
+  uint64_t Lost{0};
+  steady_clock::time_point Checked;
+
+  /// From the next message of the ring, or from the first one if the ring
+  /// is new to the reader
+  void open(const bool FromStart) {
+    auto Opened = ShmRing::attach(Name);
+    if (!Opened) {
+      return;
+    }
+    Ring = std::move(Opened);
+    auto Header = Ring->header();
+    uint64_t Head = Header->Head.load(std::memory_order_acquire);
+    Next = Head;
+    if (FromStart) {
+      Next = Head > Header->Slots ? Head - Header->Slots : 0;
+    }
+  }
+
+  bool next(std::vector<char> &Message, std::chrono::nanoseconds &PulseTime) {
+    auto Header = Ring->header();
+    const uint64_t Slots = Header->Slots;
+    const uint64_t DataBytes = Header->DataBytes;
+    while (true) {
+      uint64_t Head = Header->Head.load(std::memory_order_acquire);
+      if (Head <= Next) {
+        return false;
+      }
+      if (Head - Next > Slots) {
+        Lost += Head - Slots - Next;
+        Next = Head - Slots;
+      }
+      auto &Slot = Ring->slots()[Next & (Slots - 1)];
+      if (Slot.Sequence.load(std::memory_order_acquire) == Next + 1) {
+        uint64_t Offset = Slot.Offset;
+        uint64_t Size = Slot.Size;
+        int64_t Time = Slot.PulseTime;
+        bool Valid = Offset % DataBytes + Size <= DataBytes;
+        if (Valid) {
+          auto Begin = Ring->data() + Offset % DataBytes;
+          Message.assign(Begin, Begin + Size);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        // the copy is good if neither the slot nor the data were reused
+        if (Valid &&
+            Slot.Sequence.load(std::memory_order_relaxed) == Next + 1 &&
+            Header->WritePosition.load(std::memory_order_relaxed) <=
+                Offset + DataBytes) {
+          PulseTime = std::chrono::nanoseconds(Time);
+          ++Next;
+          return true;
+        }
+      }
+      // published (Head > Next) but no longer there
+      ++Lost;
+      ++Next;
+    }
+  }
+};
+
+/// Writes the messages of a topic to the shared memory ring
+/// /dev/shm/amor-<topic>, created by the transmitter. The options
+/// shm.slots (default 4096) and shm.mb (default 256) size the ring. A
+/// ring has a single producer: the threads need their own topics.
+template <class Serialiser>
+class ShmTransmitter : public LocalTransmitter<Serialiser> {
+public:
+  ShmTransmitter(const std::string &Brokers, const std::string &TopicName,
+                 const std::string &SourceName,
+                 const KafkaOptions &Options = {})
+      : LocalTransmitter<Serialiser>(Brokers, TopicName, SourceName, Options),
+        Writer{ShmRingLayout::name(TopicName),
+               findSizeOption(Options, "shm.slots", 4096),
+               findSizeOption(Options, "shm.mb", 256) * 1000000} {}
+
+protected:
+  bool write(const void *Data, const size_t Size,
+             const std::chrono::nanoseconds &PulseTime) override {
+    Writer.write(Data, Size, PulseTime);
+    return true;
+  }
+
+private:
+  ShmRingWriter Writer;
+};
+
+/// A message read by ShmListener, with the accessors of RdKafka::Message
+/// used by the listeners
+class ShmMessage {
+public:
+  const void *payload() const { return Data.data(); }
+  size_t len() const { return Data.size(); }
+  const std::string &topic_name() const { return *Topic; }
+
+private:
+  template <class> friend struct ShmListener;
+  std::vector<char> Data;
+  const std::string *Topic{nullptr};
+};
+
+/// There is no broker timestamp in shared memory
+inline std::chrono::nanoseconds kafkaTime(const ShmMessage &) {
+  return std::chrono::nanoseconds(0);
+}
+
+struct ShmMessageBatch {
+  std::vector<std::unique_ptr<ShmMessage>> Messages;
+  std::chrono::nanoseconds ReceiveTime{0};
+};
+
+/// Reads the rings of the topics of a comma separated list, with the
+/// interface of KafkaListener. The rings may be created later. Overruns
+/// show up as gaps in the message ids, their number is printed at exit.
+template <class Serialiser> struct ShmListener {
+  using batch_t = ShmMessageBatch;
+
+  ShmListener(const std::string &, const std::string &TopicName,
+              const std::string &SourceName, const KafkaOptions &)
+      : Source{SourceName} {
+    std::stringstream Stream(TopicName);
+    std::string Name;
+    while (std::getline(Stream, Name, ',')) {
+      if (!Name.empty()) {
+        Topics.push_back(Name);
+        Readers.emplace_back(new ShmRingReader(ShmRingLayout::name(Name)));
+      }
+    }
+    if (Topics.empty()) {
+      throw std::runtime_error("Topic required");
+    }
+  }
+
+  ~ShmListener() {
+    for (size_t i = 0; i < Topics.size(); ++i) {
+      if (Readers[i]->lost()) {
+        std::cout << Topics[i] << ": " << Readers[i]->lost()
+                  << " messages overwritten before being read\n";
+      }
+    }
+  }
+
+  /// Wait up to Timeout ms for a message, then take without waiting the
+  /// messages already published, up to MaxSize. Returns the batch size.
+  size_t consume(ShmMessageBatch &Batch, const size_t MaxSize,
+                 const int Timeout) {
+    using steady_clock = std::chrono::steady_clock;
+    Batch.Messages.clear();
+    auto Deadline = steady_clock::now() + std::chrono::milliseconds(Timeout);
+    IdleBackoff Backoff;
+    std::unique_ptr<ShmMessage> Message{new ShmMessage};
+    std::chrono::nanoseconds PulseTime;
+    while (Batch.Messages.size() < MaxSize) {
+      bool Received{false};
+      for (size_t i = 0; i < Readers.size(); ++i) {
+        if (Batch.Messages.size() < MaxSize &&
+            Readers[i]->read(Message->Data, PulseTime)) {
+          Message->Topic = &Topics[i];
+          Batch.Messages.push_back(std::move(Message));
+          Message.reset(new ShmMessage);
+          Received = true;
+        }
+      }
+      if (!Received) {
+        if (!Batch.Messages.empty() || steady_clock::now() >= Deadline) {
+          break;
+        }
+        Backoff.wait();
+      }
+    }
+    Batch.ReceiveTime = std::chrono::nanoseconds(getCurrentTimestamp());
+    return Batch.Messages.size();
+  }
+
+  const std::string &source() const { return Source; }
+
+  /// Wait for the next message and decode it in data
+  template <typename T> ReceivedMessage recv(std::vector<T> &data) {
+    ShmMessageBatch Batch;
+    while (!consume(Batch, 1, 1000)) {
+    }
+    return decodeMessage(*Batch.Messages.front(), Batch.ReceiveTime, data,
+                         Source);
+  }
+
+private:
+  std::string Source;
+  std::vector<std::string> Topics;
+  std::vector<std::unique_ptr<ShmRingReader>> Readers;
+};
+
+} // namespace SINQAmorSim
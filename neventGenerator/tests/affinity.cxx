@@ -0,0 +1,44 @@
+#include "../affinity.hpp"
+
+#include <gtest/gtest.h>
+
+TEST(Affinity, parse_cpu_list) {
+  EXPECT_TRUE(SINQAmorSim::parseCpuList("").empty());
+  EXPECT_EQ(SINQAmorSim::parseCpuList("3"), std::vector<int>({3}));
+  EXPECT_EQ(SINQAmorSim::parseCpuList("0-3,8,10-11"),
+            std::vector<int>({0, 1, 2, 3, 8, 10, 11}));
+  EXPECT_ANY_THROW(SINQAmorSim::parseCpuList("a"));
+  EXPECT_ANY_THROW(SINQAmorSim::parseCpuList("3-1"));
+  EXPECT_ANY_THROW(SINQAmorSim::parseCpuList("1-"));
+  EXPECT_ANY_THROW(SINQAmorSim::parseCpuList("0-"));
+  EXPECT_ANY_THROW(SINQAmorSim::parseCpuList("0-,2"));
+  EXPECT_ANY_THROW(SINQAmorSim::parseCpuList("-1"));
+}
+
+#ifdef __linux__
+TEST(Affinity, available_cpus_are_those_of_the_thread) {
+  auto Initial = SINQAmorSim::threadCpus();
+  ASSERT_FALSE(Initial.empty());
+  EXPECT_TRUE(SINQAmorSim::availableCpus("").empty());
+  auto First = std::to_string(Initial.front());
+  EXPECT_EQ(SINQAmorSim::availableCpus(First),
+            std::vector<int>({Initial.front()}));
+  {
+    // e.g. a CPU outside the cpuset of a container
+    SINQAmorSim::ScopedAffinity Scope({Initial.front()});
+    EXPECT_THROW(SINQAmorSim::availableCpus(
+                     std::to_string(Initial.front() + 1)),
+                 std::runtime_error);
+  }
+}
+
+TEST(Affinity, scoped_affinity_restores_the_mask) {
+  auto Initial = SINQAmorSim::threadCpus();
+  ASSERT_FALSE(Initial.empty());
+  {
+    SINQAmorSim::ScopedAffinity Scope({Initial.front()});
+    EXPECT_EQ(SINQAmorSim::threadCpus(), std::vector<int>({Initial.front()}));
+  }
+  EXPECT_EQ(SINQAmorSim::threadCpus(), Initial);
+}
+#endif
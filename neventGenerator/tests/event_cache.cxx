@@ -0,0 +1,129 @@
+#include "../event_cache.hpp"
+#include "../nexus_reader.hpp"
+
+#include <fcntl.h>
+
+#include <gtest/gtest.h>
+
+extern std::string source_dir;
+
+using Cache = SINQAmorSim::EventCache<SINQAmorSim::ESSformat>;
+using Store = SINQAmorSim::EventStore<uint32_t>;
+
+namespace {
+std::vector<uint32_t> copy(const Store &Events) {
+  return std::vector<uint32_t>(Events.events().begin(),
+                               Events.events().end());
+}
+
+void copyFile(const std::string &From, const std::string &To) {
+  std::ofstream(To, std::ios::binary)
+      << std::ifstream(From, std::ios::binary).rdbuf();
+}
+} // namespace
+
+class EventCacheTest : public ::testing::Test {
+protected:
+  std::string directory{"."};
+  std::string source{source_dir + "/../files/amor2015n001774.hdf"};
+  uint64_t hash{SINQAmorSim::histogramHash<SINQAmorSim::Amor>(source)};
+  std::vector<uint32_t> events{1, 2, 3, 4, 10, 20, 30, 40};
+
+  void TearDown() override {
+    for (int m = 1; m <= 2; ++m) {
+      std::remove(Cache(directory, hash, "amor", m).filename().c_str());
+    }
+  }
+};
+
+TEST_F(EventCacheTest, missing_cache_is_a_miss) {
+  Cache cache(directory, hash, "amor", 1);
+  Store loaded;
+  EXPECT_FALSE(cache.load(loaded));
+}
+
+TEST_F(EventCacheTest, load_maps_stored_events) {
+  Cache(directory, hash, "amor", 1).store(events);
+  Store loaded;
+  EXPECT_TRUE(Cache(directory, hash, "amor", 1).load(loaded));
+  EXPECT_TRUE(loaded.mapped());
+  EXPECT_EQ(copy(loaded), events);
+}
+
+TEST_F(EventCacheTest, resize_keeps_the_mapping_unless_growing) {
+  Cache(directory, hash, "amor", 1).store(events);
+  Store loaded;
+  ASSERT_TRUE(Cache(directory, hash, "amor", 1).load(loaded));
+  auto data = loaded.events().data();
+  loaded.resize(4);
+  EXPECT_EQ(loaded.events().data(), data);
+  EXPECT_EQ(copy(loaded), std::vector<uint32_t>({1, 2, 3, 4}));
+  loaded.resize(6);
+  EXPECT_FALSE(loaded.mapped());
+  EXPECT_EQ(copy(loaded), std::vector<uint32_t>({1, 2, 3, 4, 0, 0}));
+}
+
+TEST_F(EventCacheTest, key_includes_multiplier_and_instrument) {
+  Cache cache(directory, hash, "amor", 1);
+  cache.store(events);
+  EXPECT_NE(cache.filename(), Cache(directory, hash, "amor", 2).filename());
+  EXPECT_NE(cache.filename(), Cache(directory, hash, "rita2", 1).filename());
+  Store loaded;
+  EXPECT_FALSE(Cache(directory, hash, "amor", 2).load(loaded));
+}
+
+TEST_F(EventCacheTest, truncated_cache_is_a_miss) {
+  Cache cache(directory, hash, "amor", 1);
+  cache.store(events);
+  ASSERT_EQ(::truncate(cache.filename().c_str(), 50), 0);
+  Store loaded;
+  EXPECT_FALSE(cache.load(loaded));
+}
+
+TEST_F(EventCacheTest, same_histogram_under_another_path_hits) {
+  Cache(directory, hash, "amor", 1).store(events);
+  copyFile(source, "cache_source.hdf");
+  auto copied = SINQAmorSim::histogramHash<SINQAmorSim::Amor>(
+      "cache_source.hdf");
+  std::remove("cache_source.hdf");
+  EXPECT_EQ(copied, hash);
+  Store loaded;
+  EXPECT_TRUE(Cache(directory, copied, "amor", 1).load(loaded));
+}
+
+TEST_F(EventCacheTest, rewritten_histogram_is_a_miss) {
+  const std::string rewritten{"cache_source.hdf"};
+  copyFile(source, rewritten);
+  Cache(directory, hash, "amor", 1).store(events);
+  struct stat before;
+  ASSERT_EQ(::stat(rewritten.c_str(), &before), 0);
+  {
+    // rewrite one bin in place, then restore the modification time as
+    // cp -p or rsync -a would
+    H5::H5File file(rewritten, H5F_ACC_RDWR);
+    H5::DataSet dataset = file.openDataSet(SINQAmorSim::Amor().path[1]);
+    std::vector<double> bins(dataset.getSpace().getSelectNpoints());
+    dataset.read(bins.data(), H5::PredType::NATIVE_DOUBLE);
+    bins[0] += 1;
+    dataset.write(bins.data(), H5::PredType::NATIVE_DOUBLE);
+  }
+  struct timespec times[] = {before.st_atim, before.st_mtim};
+  ASSERT_EQ(::utimensat(AT_FDCWD, rewritten.c_str(), times, 0), 0);
+  struct stat after;
+  ASSERT_EQ(::stat(rewritten.c_str(), &after), 0);
+  EXPECT_EQ(after.st_size, before.st_size);
+  EXPECT_EQ(after.st_mtim.tv_sec, before.st_mtim.tv_sec);
+  EXPECT_EQ(after.st_mtim.tv_nsec, before.st_mtim.tv_nsec);
+
+  auto modified =
+      SINQAmorSim::histogramHash<SINQAmorSim::Amor>(rewritten);
+  std::remove(rewritten.c_str());
+  EXPECT_NE(modified, hash);
+  Store loaded;
+  EXPECT_FALSE(Cache(directory, modified, "amor", 1).load(loaded));
+}
+
+TEST(EventCache, missing_source_throws) {
+  EXPECT_THROW(SINQAmorSim::histogramHash<SINQAmorSim::Amor>("no_such.hdf"),
+               std::runtime_error);
+}
@@ -0,0 +1,66 @@
+#include "../event_synthesis.hpp"
+
+#include <gtest/gtest.h>
+
+SINQAmorSim::EventHistogram make_histogram() {
+  // two detectors x three ToF bins
+  SINQAmorSim::EventHistogram histogram;
+  histogram.Counts = {10, 0, 30, 0, 60, 0};
+  histogram.DetectorId = {7, 9};
+  histogram.TofLow = {0, 100, 200};
+  histogram.TofWidth = {100, 100, 100};
+  histogram.NumTof = 3;
+  return histogram;
+}
+
+TEST(AliasTable, reject_empty_histogram) {
+  EXPECT_ANY_THROW(SINQAmorSim::AliasTable({}));
+  EXPECT_ANY_THROW(SINQAmorSim::AliasTable({0, 0}));
+}
+
+TEST(AliasTable, probabilities_sum_to_weights) {
+  std::vector<uint64_t> weights{1, 2, 3, 4};
+  SINQAmorSim::AliasTable table(weights);
+  std::vector<double> mass(weights.size(), 0);
+  for (size_t i = 0; i < table.size(); ++i) {
+    mass[i] += table.probability()[i];
+    mass[table.alias()[i]] += 1 - table.probability()[i];
+  }
+  for (size_t i = 0; i < weights.size(); ++i) {
+    EXPECT_NEAR(mass[i] / weights.size(), weights[i] / 10.0, 1e-6);
+  }
+}
+
+TEST(EventSynthesiser, events_follow_histogram) {
+  auto tables =
+      std::make_shared<const SINQAmorSim::SynthesisTables>(make_histogram());
+  SINQAmorSim::EventSynthesiser<uint32_t> synthesiser(tables, 100000, 1);
+  std::vector<uint32_t> events;
+  auto size = synthesiser.generate(events);
+  ASSERT_EQ(events.size(), 2 * size);
+  EXPECT_NEAR(size, 100000, 2000);
+
+  std::vector<size_t> counts(6, 0);
+  for (size_t i = 0; i < size; ++i) {
+    auto tof = events[i];
+    auto detector = events[size + i];
+    ASSERT_TRUE(detector == 7 || detector == 9);
+    ASSERT_LT(tof, 300);
+    ++counts[(detector == 9) * 3 + tof / 100];
+  }
+  EXPECT_EQ(counts[1], 0);
+  EXPECT_EQ(counts[3], 0);
+  EXPECT_NEAR(counts[0] / double(size), 0.1, 0.01);
+  EXPECT_NEAR(counts[2] / double(size), 0.3, 0.01);
+  EXPECT_NEAR(counts[4] / double(size), 0.6, 0.01);
+}
+
+TEST(EventSynthesiser, pulses_are_not_repeated) {
+  auto tables =
+      std::make_shared<const SINQAmorSim::SynthesisTables>(make_histogram());
+  SINQAmorSim::EventSynthesiser<uint32_t> synthesiser(tables, 1000, 1);
+  std::vector<uint32_t> first, second;
+  synthesiser.generate(first);
+  synthesiser.generate(second);
+  EXPECT_FALSE(first == second);
+}
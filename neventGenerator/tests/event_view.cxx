@@ -0,0 +1,55 @@
+#include "../event_view.hpp"
+#include "../serialiser.hpp"
+
+#include <gtest/gtest.h>
+
+using namespace SINQAmorSim;
+
+TEST(EventView, view_matches_serialised_events) {
+  FlatBufferSerialiser serialiser("view.test");
+  std::vector<uint32_t> input;
+  for (uint32_t i = 0; i < 1000; ++i) {
+    input.push_back(i);
+  }
+  auto &buffer =
+      serialiser.serialise(11, std::chrono::nanoseconds(37), input);
+
+  EventMessageView view;
+  ASSERT_TRUE(decodeView(buffer.data(), buffer.size(), view, true));
+  EXPECT_EQ(view.MessageID, 11);
+  EXPECT_EQ(view.PulseTime.count(), 37);
+  EXPECT_TRUE(view.Source == std::string("view.test"));
+  ASSERT_EQ(view.TimeOfFlight.size(), 500);
+  ASSERT_EQ(view.DetectorId.size(), 500);
+  EXPECT_TRUE(std::equal(view.TimeOfFlight.begin(), view.TimeOfFlight.end(),
+                         input.begin()));
+  EXPECT_TRUE(std::equal(view.DetectorId.begin(), view.DetectorId.end(),
+                         input.begin() + 500));
+  // no copy: the spans point into the buffer
+  auto first = reinterpret_cast<const char *>(view.TimeOfFlight.data());
+  EXPECT_TRUE(first > buffer.data() && first < buffer.data() + buffer.size());
+}
+
+TEST(EventView, verification_rejects_garbage) {
+  std::vector<char> garbage(128, 'x');
+  EventMessageView view;
+  EXPECT_FALSE(decodeView(garbage.data(), garbage.size(), view, true));
+}
+
+TEST(EventView, min_max) {
+  std::vector<uint32_t> values{7, 3, 9, 100, 1, 42};
+  auto range = minMax(Span<uint32_t>(values.data(), values.size()));
+  EXPECT_EQ(range.first, 1);
+  EXPECT_EQ(range.second, 100);
+  auto empty = minMax(Span<uint32_t>());
+  EXPECT_GT(empty.first, empty.second);
+}
+
+TEST(EventView, count_pixels) {
+  std::vector<uint32_t> detector{0, 1, 1, 3, 3, 3, 10};
+  std::vector<uint64_t> counts(4, 0);
+  auto outside = countPixels(Span<uint32_t>(detector.data(), detector.size()),
+                             counts);
+  EXPECT_EQ(outside, 1);
+  EXPECT_EQ(counts, std::vector<uint64_t>({1, 2, 0, 3}));
+}
@@ -0,0 +1,99 @@
+#include "../file_reader.hpp"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using namespace SINQAmorSim;
+
+class FileWriterTest : public ::testing::Test {
+protected:
+  std::string directory{"."};
+  std::string topic{"file-writer-test"};
+
+  /// Message i: i + 1 bytes of value i
+  void record(SegmentWriter &Writer, const int Count) {
+    for (int i = 0; i < Count; ++i) {
+      std::vector<char> Message(i + 1, char(i));
+      Writer.append(Message.data(), Message.size(),
+                    std::chrono::nanoseconds(1000 * i));
+    }
+  }
+
+  void TearDown() override {
+    for (size_t n = 0; n < 10; ++n) {
+      std::remove(Recording::segmentName(directory, topic, n, "log").c_str());
+      std::remove(Recording::segmentName(directory, topic, n, "idx").c_str());
+    }
+  }
+};
+
+TEST_F(FileWriterTest, records_are_read_back_in_order) {
+  {
+    SegmentWriter Writer(directory, topic);
+    record(Writer, 100);
+  }
+  SegmentReader Reader(directory, topic);
+  RecordView Record;
+  for (int i = 0; i < 100; ++i) {
+    ASSERT_TRUE(Reader.next(Record));
+    ASSERT_EQ(Record.Size, size_t(i + 1));
+    EXPECT_EQ(Record.PulseTime.count(), 1000 * i);
+    auto Data = static_cast<const char *>(Record.Data);
+    EXPECT_EQ(Data[0], char(i));
+    EXPECT_EQ(Data[i], char(i));
+  }
+  EXPECT_FALSE(Reader.next(Record));
+}
+
+TEST_F(FileWriterTest, records_are_split_in_segments) {
+  size_t Segments{0};
+  {
+    SegmentWriter Writer(directory, topic, 4096, 4096);
+    record(Writer, 200);
+    Segments = Writer.segments();
+  }
+  EXPECT_GT(Segments, 1u);
+  EXPECT_EQ(SegmentReader::topics(directory),
+            std::vector<std::string>{topic});
+  SegmentReader Reader(directory, topic);
+  RecordView Record;
+  int Count{0};
+  while (Reader.next(Record)) {
+    EXPECT_EQ(Record.Size, size_t(Count + 1));
+    ++Count;
+  }
+  EXPECT_EQ(Count, 200);
+}
+
+TEST_F(FileWriterTest, seek_uses_the_pulse_time) {
+  {
+    SegmentWriter Writer(directory, topic, 4096, 4096);
+    record(Writer, 200);
+  }
+  SegmentReader Reader(directory, topic);
+  RecordView Record;
+  Reader.seek(std::chrono::nanoseconds(150500));
+  ASSERT_TRUE(Reader.next(Record));
+  EXPECT_EQ(Record.PulseTime.count(), 151000);
+  Reader.seek(std::chrono::nanoseconds(1000000));
+  EXPECT_FALSE(Reader.next(Record));
+  Reader.rewind();
+  ASSERT_TRUE(Reader.next(Record));
+  EXPECT_EQ(Record.PulseTime.count(), 0);
+}
+
+TEST_F(FileWriterTest, replay_sends_the_recorded_messages) {
+  {
+    SegmentWriter Writer(directory, topic);
+    record(Writer, 10);
+  }
+  RecordingReplay<NullTransmitter<FlatBufferSerialiser>> Replay(
+      directory, 0, "", {}, 0, 0);
+  testing::internal::CaptureStdout();
+  Replay.run();
+  auto Output = testing::internal::GetCapturedStdout();
+  EXPECT_NE(Output.find(topic + ": 10 messages"), std::string::npos);
+}
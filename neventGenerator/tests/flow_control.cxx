@@ -0,0 +1,43 @@
+#include "../flow_control.hpp"
+
+#include <gtest/gtest.h>
+
+using namespace SINQAmorSim;
+
+TEST(FlowController, no_limits_admits_everything) {
+  FlowController Flow;
+  for (int i = 0; i < 1000; ++i) {
+    EXPECT_TRUE(Flow.admit(1 << 20));
+    Flow.sent(1 << 20);
+  }
+  EXPECT_EQ(Flow.messages(), 1000u);
+}
+
+TEST(FlowController, message_budget) {
+  FlowController Flow(2, 0);
+  Flow.sent(10);
+  Flow.sent(10);
+  EXPECT_FALSE(Flow.admit(10));
+  Flow.completed(10);
+  EXPECT_TRUE(Flow.admit(10));
+}
+
+TEST(FlowController, byte_budget) {
+  FlowController Flow(0, 100);
+  Flow.sent(60);
+  EXPECT_TRUE(Flow.admit(40));
+  EXPECT_FALSE(Flow.admit(41));
+  Flow.completed(60);
+  EXPECT_EQ(Flow.bytes(), 0u);
+  EXPECT_TRUE(Flow.admit(100));
+}
+
+TEST(FlowController, oversized_message_admitted_when_idle) {
+  FlowController Flow(10, 100);
+  EXPECT_TRUE(Flow.admit(1000));
+  Flow.sent(1000);
+  EXPECT_FALSE(Flow.admit(1));
+  Flow.completed(1000);
+  EXPECT_EQ(Flow.messages(), 0u);
+  EXPECT_TRUE(Flow.admit(1));
+}
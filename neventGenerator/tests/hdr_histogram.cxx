@@ -0,0 +1,54 @@
+#include "../hdr_histogram.hpp"
+
+#include <gtest/gtest.h>
+
+using namespace SINQAmorSim;
+
+TEST(HdrHistogram, buckets_are_contiguous) {
+  for (int i = 0; i + 1 < HdrBuckets::NumBuckets; ++i) {
+    EXPECT_EQ(HdrBuckets::upperBound(i) + 1, HdrBuckets::lowerBound(i + 1));
+    EXPECT_EQ(HdrBuckets::index(HdrBuckets::lowerBound(i)), i);
+    EXPECT_EQ(HdrBuckets::index(HdrBuckets::upperBound(i)), i);
+  }
+  EXPECT_EQ(HdrBuckets::index(UINT64_MAX), HdrBuckets::NumBuckets - 1);
+}
+
+TEST(HdrHistogram, relative_error_is_bounded) {
+  for (uint64_t Value = 1; Value < (uint64_t(1) << 40); Value = Value * 3 + 1) {
+    int i = HdrBuckets::index(Value);
+    double Width = HdrBuckets::upperBound(i) - HdrBuckets::lowerBound(i) + 1;
+    if (Value < HdrBuckets::SubBuckets) {
+      EXPECT_EQ(Width, 1);
+    } else {
+      EXPECT_LE(Width / Value, 1.0 / HdrBuckets::SubBuckets);
+    }
+  }
+}
+
+TEST(HdrHistogram, percentiles) {
+  HdrHistogram Histogram;
+  for (uint64_t Value = 1; Value <= 100000; ++Value) {
+    Histogram.record(Value);
+  }
+  EXPECT_EQ(Histogram.count(), 100000);
+  EXPECT_EQ(Histogram.max(), 100000);
+  EXPECT_DOUBLE_EQ(Histogram.mean(), 50000.5);
+  EXPECT_NEAR(Histogram.percentile(0.5), 50000, 50000 / 16);
+  EXPECT_NEAR(Histogram.percentile(0.99), 99000, 99000 / 16);
+  EXPECT_EQ(Histogram.percentile(1.0), 100000);
+  EXPECT_EQ(HdrHistogram().percentile(0.5), 0);
+}
+
+TEST(HdrHistogram, atomic_snapshot_delta) {
+  AtomicHdrHistogram Histogram;
+  Histogram.record(10);
+  Histogram.record(std::chrono::nanoseconds(1000));
+  auto First = Histogram.snapshot();
+  EXPECT_EQ(First.count(), 2);
+
+  Histogram.record(20);
+  auto Interval = AtomicHdrHistogram::delta(Histogram.snapshot(), First);
+  EXPECT_EQ(Interval.count(), 1);
+  EXPECT_EQ(Interval.max(), 20);
+  EXPECT_DOUBLE_EQ(Interval.mean(), 20);
+}
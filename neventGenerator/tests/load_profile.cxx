@@ -0,0 +1,127 @@
+#include "../load_profile.hpp"
+#include "../token_bucket.hpp"
+
+#include <gtest/gtest.h>
+
+using namespace SINQAmorSim;
+
+namespace {
+LoadProfile profile(const std::string &Text) {
+  return LoadProfile(nlohmann::json::parse(Text));
+}
+} // namespace
+
+TEST(LoadProfile, step_and_beam_off) {
+  auto Profile = profile(R"({"segments": [
+      {"type": "step", "duration": 10, "rate": 2, "events": 0.5},
+      {"type": "beam_off", "duration": 5}]})");
+  EXPECT_DOUBLE_EQ(Profile.duration(), 15);
+  EXPECT_DOUBLE_EQ(Profile.at(3).Rate, 2);
+  EXPECT_DOUBLE_EQ(Profile.at(3).Events, 0.5);
+  EXPECT_DOUBLE_EQ(Profile.at(12).Rate, 1);
+  EXPECT_DOUBLE_EQ(Profile.at(12).Events, 0);
+  // loops by default
+  EXPECT_DOUBLE_EQ(Profile.at(18).Rate, 2);
+}
+
+TEST(LoadProfile, ramp_and_hold) {
+  auto Profile = profile(R"({"loop": false, "segments": [
+      {"type": "ramp", "duration": 10, "rate_start": 1, "rate_end": 3,
+       "events_start": 2, "events_end": 0}]})");
+  EXPECT_DOUBLE_EQ(Profile.at(5).Rate, 2);
+  EXPECT_DOUBLE_EQ(Profile.at(5).Events, 1);
+  EXPECT_DOUBLE_EQ(Profile.at(100).Rate, 3);
+  EXPECT_DOUBLE_EQ(Profile.at(100).Events, 0);
+}
+
+TEST(LoadProfile, burst) {
+  auto Profile = profile(R"({"segments": [
+      {"type": "burst", "duration": 30, "period": 10, "burst_length": 2,
+       "burst_rate": 5}]})");
+  EXPECT_DOUBLE_EQ(Profile.at(1).Rate, 5);
+  EXPECT_DOUBLE_EQ(Profile.at(5).Rate, 1);
+  EXPECT_DOUBLE_EQ(Profile.at(11).Rate, 5);
+  EXPECT_DOUBLE_EQ(Profile.at(11).Events, 1);
+}
+
+TEST(LoadProfile, sine) {
+  auto Profile = profile(R"({"segments": [
+      {"type": "sine", "duration": 40, "period": 20, "rate": 2,
+       "amplitude": 0.5}]})");
+  EXPECT_NEAR(Profile.at(0).Rate, 2, 1e-9);
+  EXPECT_NEAR(Profile.at(5).Rate, 3, 1e-9);
+  EXPECT_NEAR(Profile.at(15).Rate, 1, 1e-9);
+  EXPECT_NEAR(Profile.mean(0, 20).Rate, 2, 1e-3);
+}
+
+TEST(LoadProfile, mean_of_rate_times_events) {
+  auto Profile = profile(R"({"segments": [
+      {"type": "step", "duration": 1, "rate": 2, "events": 3},
+      {"type": "beam_off", "duration": 1, "rate": 2}]})");
+  auto Mean = Profile.mean(0, 2);
+  EXPECT_NEAR(Mean.Rate, 2, 1e-9);
+  EXPECT_NEAR(Mean.Events, 3, 1e-9);
+}
+
+TEST(LoadProfile, invalid_profiles) {
+  EXPECT_THROW(profile(R"({"segments": []})"), std::runtime_error);
+  EXPECT_THROW(profile(R"({"segments": [{"type": "square", "duration": 1}]})"),
+               std::runtime_error);
+  EXPECT_THROW(profile(R"({"segments": [{"type": "step"}]})"),
+               std::runtime_error);
+  EXPECT_THROW(profile(R"({"segments": [{"type": "step", "duration": 1,
+                                        "rate": 0}]})"),
+               std::runtime_error);
+  EXPECT_THROW(profile(R"({"segments": [{"type": "sine", "duration": 1,
+                                        "period": 1, "amplitude": 1}]})"),
+               std::runtime_error);
+  EXPECT_THROW(LoadProfile::fromFile("/nonexistent/profile.json"),
+               std::runtime_error);
+}
+
+TEST(LoadProfile, scale_events) {
+  // ToF block followed by the detector block
+  std::vector<uint32_t> Events{10, 11, 12, 1, 2, 3};
+  std::vector<uint32_t> Scaled;
+  scaleEvents(Events, 2.0 / 3, Scaled);
+  EXPECT_EQ(Scaled, std::vector<uint32_t>({10, 11, 1, 2}));
+  scaleEvents(Events, 5.0 / 3, Scaled);
+  EXPECT_EQ(Scaled,
+            std::vector<uint32_t>({10, 11, 12, 10, 11, 1, 2, 3, 1, 2}));
+  scaleEvents(Events, 0, Scaled);
+  EXPECT_TRUE(Scaled.empty());
+}
+
+TEST(LoadProfile, beam_off_keeps_the_pulse_rate_under_a_limit) {
+  using namespace std::chrono;
+  auto Profile = profile(R"({"segments": [{"type": "beam_off",
+                                           "duration": 10}]})");
+  PulseScheduler Scheduler(1);
+  TokenBucket Limit;
+  PulsePacer Pacer(Scheduler, Limit);
+  uint64_t PulseID{0};
+  auto Start = steady_clock::now();
+  // as the generator threads: pulse rate 100 Hz, rate limit 1e9
+  while (steady_clock::now() - Start < milliseconds(100)) {
+    EXPECT_TRUE(Pacer.wait(Profile.at(0), 100, 1e9, true));
+    ++PulseID;
+  }
+  EXPECT_DOUBLE_EQ(Scheduler.rate(), 100);
+  EXPECT_DOUBLE_EQ(Limit.rate(), 1e9);
+  // 10 pulses due in 100 ms at 100 Hz, plus the one released at once
+  EXPECT_LE(PulseID, 12u);
+}
+
+TEST(LoadProfile, pacer_applies_the_level_to_both_rates) {
+  auto Profile = profile(R"({"segments": [{"type": "step",
+                                           "duration": 10, "rate": 2,
+                                           "events": 0.5}]})");
+  PulseScheduler Scheduler(1);
+  TokenBucket Limit;
+  PulsePacer Pacer(Scheduler, Limit);
+  EXPECT_FALSE(Pacer.wait(Profile.at(0), 100, 1e9, true));
+  EXPECT_DOUBLE_EQ(Scheduler.rate(), 200);
+  EXPECT_DOUBLE_EQ(Limit.rate(), 2e9);
+  // paused: empty whatever the level
+  EXPECT_TRUE(Pacer.wait(Profile.at(0), 100, 1e9, false));
+}
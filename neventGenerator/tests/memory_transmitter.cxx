@@ -0,0 +1,84 @@
+#include "../memory_transmitter.hpp"
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+/// Buffers are counted instead of serialised
+struct CountingSerialiser {
+  explicit CountingSerialiser(const std::string &) {}
+  int Released{0};
+};
+
+void releaseMessage(CountingSerialiser &Serialiser, void *) {
+  ++Serialiser.Released;
+}
+
+using Null = SINQAmorSim::NullTransmitter<CountingSerialiser>;
+using Memory = SINQAmorSim::MemoryTransmitter<CountingSerialiser>;
+
+} // namespace
+
+TEST(MemoryTransmitter, deliveries_are_reported_on_poll) {
+  Null Transmitter("", "null-topic", "source");
+  size_t Delivered{0}, Bytes{0};
+  Transmitter.setDeliveryHooks(
+      [&](size_t Size, const std::chrono::nanoseconds &, int32_t Partition) {
+        ++Delivered;
+        Bytes += Size;
+        EXPECT_EQ(Partition, 0);
+      },
+      nullptr);
+  std::vector<char> Data(100);
+  EXPECT_EQ(Transmitter.send(Data), 100u);
+  EXPECT_EQ(Transmitter.send(Data), 100u);
+  EXPECT_EQ(Transmitter.outqLen(), 2);
+  EXPECT_EQ(Delivered, 0u);
+  EXPECT_EQ(Transmitter.poll(0), 2);
+  EXPECT_EQ(Delivered, 2u);
+  EXPECT_EQ(Bytes, 200u);
+  EXPECT_EQ(Transmitter.outqLen(), 0);
+  EXPECT_EQ(Transmitter.getNumMessages(), 2);
+}
+
+TEST(MemoryTransmitter, buffers_are_released_once_delivered) {
+  Null Transmitter("", "null-topic", "source");
+  std::vector<void *> Released;
+  Transmitter.setRelease([&](void *Opaque) { Released.push_back(Opaque); });
+  char Buffer[16];
+  int Token;
+  Transmitter.sendSerialised(Buffer, sizeof(Buffer),
+                             std::chrono::nanoseconds(1), &Token);
+  EXPECT_TRUE(Released.empty());
+  Transmitter.poll(0);
+  ASSERT_EQ(Released.size(), 1u);
+  EXPECT_EQ(Released.front(), &Token);
+}
+
+TEST(MemoryTransmitter, messages_reach_the_topic) {
+  Memory Transmitter("", "memory-topic", "source");
+  std::vector<char> Data{'a', 'b', 'c'};
+  Transmitter.send(Data);
+  auto Topic = SINQAmorSim::MemoryBroker::instance().topic("memory-topic");
+  SINQAmorSim::MemoryMessage Message;
+  ASSERT_TRUE(Topic->pop(Message));
+  EXPECT_EQ(Message.Payload, Data);
+  EXPECT_FALSE(Topic->pop(Message));
+}
+
+TEST(MemoryTopic, refuses_messages_when_full) {
+  SINQAmorSim::MemoryTopic Topic(2);
+  char Data[4] = {0};
+  const std::chrono::nanoseconds Time(0);
+  EXPECT_TRUE(Topic.push(Data, sizeof(Data), Time));
+  EXPECT_TRUE(Topic.push(Data, sizeof(Data), Time));
+  EXPECT_FALSE(Topic.push(Data, sizeof(Data), Time));
+  SINQAmorSim::MemoryMessage Message;
+  ASSERT_TRUE(Topic.pop(Message));
+  EXPECT_EQ(Message.Payload.size(), sizeof(Data));
+  Topic.recycle(std::move(Message));
+  EXPECT_TRUE(Topic.push(Data, sizeof(Data), Time));
+}
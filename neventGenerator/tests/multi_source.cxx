@@ -0,0 +1,180 @@
+#include "../multi_source.hpp"
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using namespace SINQAmorSim;
+using namespace std::chrono;
+
+namespace {
+
+/// Pulse sent by a RecordingStreamer
+struct SentPulse {
+  uint64_t PulseID;
+  nanoseconds PulseTime;
+  size_t NumEvents;
+};
+
+/// Pulses sent to each topic, in the order of sending
+class SentPulses {
+public:
+  static SentPulses &instance() {
+    static SentPulses Instance;
+    return Instance;
+  }
+  void add(const std::string &Topic, const SentPulse &Pulse) {
+    std::lock_guard<std::mutex> Lock(Guard);
+    Pulses[Topic].push_back(Pulse);
+  }
+  std::map<std::string, std::vector<SentPulse>> take() {
+    std::lock_guard<std::mutex> Lock(Guard);
+    std::map<std::string, std::vector<SentPulse>> Result;
+    Result.swap(Pulses);
+    return Result;
+  }
+
+private:
+  std::mutex Guard;
+  std::map<std::string, std::vector<SentPulse>> Pulses;
+};
+
+/// Records the pulses instead of sending them
+struct RecordingStreamer {
+  RecordingStreamer(const std::string &, const std::string &Topic,
+                    const std::string &, const KafkaOptions &)
+      : Topic{Topic} {}
+
+  template <class EventArray>
+  size_t send(const uint64_t PulseID, const nanoseconds &PulseTime,
+              const EventArray &, const size_t NumEvents) {
+    SentPulses::instance().add(Topic, {PulseID, PulseTime, NumEvents});
+    return NumEvents * sizeof(uint32_t);
+  }
+  int poll(int) { return 0; }
+  template <class Delivered, class Failed, class Sent>
+  void setDeliveryHooks(Delivered, Failed, Sent) {}
+  template <class Blocked> void setFlowControl(int, size_t, Blocked) {}
+
+  std::string Topic;
+};
+
+/// Runs for 200 ms from the call of update()
+struct TimedControl {
+  explicit TimedControl(Configuration &configuration)
+      : config(configuration) {}
+
+  int update() {
+    std::this_thread::sleep_for(milliseconds(200));
+    status = int(RunStatus::exit);
+    return status;
+  }
+  bool run() const { return status == int(RunStatus::run); }
+  bool stop() const { return status == int(RunStatus::stop); }
+  bool pause() const { return status == int(RunStatus::pause); }
+  bool exit() const { return status == int(RunStatus::exit); }
+  double rate() const { return config.rate; }
+  double rateLimit() const { return 0; }
+
+  std::atomic<int> status{int(RunStatus::run)};
+  Configuration &config;
+};
+
+using Generator = MultiSourceGenerator<RecordingStreamer, TimedControl, void>;
+
+Configuration configuration(const std::vector<double> &Rates,
+                            const int NumThreads) {
+  Configuration Config;
+  Config.rate = 10;
+  Config.num_threads = NumThreads;
+  for (size_t i = 0; i < Rates.size(); ++i) {
+    SourceConfiguration Source;
+    Source.source_name = "source" + std::to_string(i);
+    Source.topic = "topic" + std::to_string(i);
+    Source.rate = Rates[i];
+    Config.sources.push_back(Source);
+  }
+  return Config;
+}
+
+} // namespace
+
+TEST(PulseTimer, sources_share_one_timer_at_their_own_rate) {
+  const std::vector<milliseconds> Periods{milliseconds(5), milliseconds(20)};
+  PulseTimer Timer;
+  std::vector<int> Pulses(Periods.size(), 0);
+  std::vector<steady_clock::time_point> Deadline(Periods.size());
+  auto Start = steady_clock::now();
+  for (size_t i = 0; i < Periods.size(); ++i) {
+    Deadline[i] = Start;
+    Timer.schedule(i, Start);
+  }
+  steady_clock::time_point Last;
+  Timer.run(
+      [&](size_t i) {
+        auto Now = steady_clock::now();
+        // a source is never handed out before its deadline
+        EXPECT_GE(Now, Deadline[i]);
+        EXPECT_GE(Now, Last);
+        Last = Now;
+        ++Pulses[i];
+        Deadline[i] += Periods[i];
+        Timer.schedule(i, Deadline[i]);
+      },
+      [&]() { return steady_clock::now() - Start >= milliseconds(200); });
+  // 40 and 10 pulses due in 200 ms, plus the one at the start
+  EXPECT_NEAR(Pulses[0], 41, 3);
+  EXPECT_NEAR(Pulses[1], 11, 2);
+}
+
+TEST(PulseTimer, exits_without_pending_deadlines) {
+  PulseTimer Timer;
+  auto Start = steady_clock::now();
+  Timer.run([](size_t) { FAIL(); },
+            [&]() { return steady_clock::now() - Start >= milliseconds(10); });
+  EXPECT_LT(steady_clock::now() - Start, milliseconds(500));
+}
+
+TEST(MultiSourceGenerator, each_source_has_its_own_pulse_ids_and_rate) {
+  SentPulses::instance().take();
+  auto Config = configuration({200, 50, 50}, 2);
+  std::vector<Generator::store_t<uint32_t>> Stores{
+      std::make_shared<EventStore<uint32_t>>(std::vector<uint32_t>(20)),
+      std::make_shared<EventStore<uint32_t>>(std::vector<uint32_t>(4)),
+      std::make_shared<EventStore<uint32_t>>(std::vector<uint32_t>(4))};
+  {
+    Generator Multi(Config);
+    Multi.run(Stores);
+  }
+  auto Sent = SentPulses::instance().take();
+  ASSERT_EQ(Sent.size(), 3u);
+  for (size_t i = 0; i < Stores.size(); ++i) {
+    auto &Pulses = Sent["topic" + std::to_string(i)];
+    ASSERT_FALSE(Pulses.empty());
+    for (size_t n = 0; n < Pulses.size(); ++n) {
+      // ids start at 0 in each source and are sent in order
+      EXPECT_EQ(Pulses[n].PulseID, n);
+      EXPECT_EQ(Pulses[n].NumEvents, Stores[i]->size());
+      if (n > 0) {
+        EXPECT_GT(Pulses[n].PulseTime, Pulses[n - 1].PulseTime);
+      }
+    }
+  }
+  // 200 ms at 200 and 50 Hz
+  EXPECT_NEAR(Sent["topic0"].size(), 41, 6);
+  EXPECT_NEAR(Sent["topic1"].size(), 11, 3);
+  EXPECT_NEAR(Sent["topic2"].size(), 11, 3);
+}
+
+TEST(MultiSourceGenerator, one_event_store_per_source) {
+  auto Config = configuration({10, 10}, 1);
+  std::vector<Generator::store_t<uint32_t>> Stores{
+      std::make_shared<EventStore<uint32_t>>(std::vector<uint32_t>(2))};
+  Generator Multi(Config);
+  EXPECT_THROW(Multi.run(Stores), std::runtime_error);
+}
@@ -17,3 +17,66 @@ TEST(NexusReader,long_test) {
 
   
 }
+
+using AmorStream =
+    SINQAmorSim::NeXusStreamSource<SINQAmorSim::Amor, SINQAmorSim::ESSformat>;
+using AmorSource =
+    SINQAmorSim::NeXusSource<SINQAmorSim::Amor, SINQAmorSim::ESSformat>;
+
+TEST(NexusStreamSource, stream_matches_full_source) {
+  auto nexusfile = source_dir + "/../files/amor2015n001774.hdf";
+  AmorSource source(nexusfile);
+  auto expected = source.get();
+  auto num_events = expected.size() / 2;
+
+  // budget smaller than a detector plane
+  AmorStream stream(nexusfile, 1000000);
+  std::vector<SINQAmorSim::ESSformat::value_type> events;
+  stream.next(events, num_events);
+  EXPECT_LE(stream.chunkSize(), 1000000);
+  EXPECT_TRUE(events == expected);
+}
+
+TEST(NexusStreamSource, stream_restarts_at_end_of_file) {
+  auto nexusfile = source_dir + "/../files/amor2015n001774.hdf";
+  AmorSource source(nexusfile);
+  auto num_events = source.count() / 2;
+
+  AmorStream stream(nexusfile, 10000000);
+  std::vector<SINQAmorSim::ESSformat::value_type> first, second;
+  stream.next(first, 1000);
+  stream.next(second, num_events - 1000);
+  stream.next(second, 1000);
+  EXPECT_TRUE(first == second);
+}
+
+TEST(NexusSource, multiplier_repeats_tof_and_detector_blocks) {
+  auto nexusfile = source_dir + "/../files/amor2015n001774.hdf";
+  auto single = AmorSource(nexusfile).get();
+  auto doubled = AmorSource(nexusfile, 2).get();
+  auto n = single.size() / 2;
+  ASSERT_EQ(doubled.size(), 2 * single.size());
+
+  for (size_t m = 0; m < 2; ++m) {
+    EXPECT_TRUE(std::equal(single.begin(), single.begin() + n,
+                           doubled.begin() + m * n));
+    EXPECT_TRUE(std::equal(single.begin() + n, single.end(),
+                           doubled.begin() + (2 + m) * n));
+  }
+  // detectors are sorted, as the histogram rows
+  EXPECT_TRUE(std::is_sorted(single.begin() + n, single.end()));
+}
+
+TEST(NexusSource, psi_format_matches_ess_format) {
+  auto nexusfile = source_dir + "/../files/amor2015n001774.hdf";
+  auto ess = AmorSource(nexusfile).get();
+  auto psi = SINQAmorSim::NeXusSource<SINQAmorSim::Amor,
+                                      SINQAmorSim::PSIformat>(nexusfile)
+                 .get();
+  auto n = ess.size() / 2;
+  ASSERT_EQ(psi.size(), n);
+  for (size_t e = 0; e < n; ++e) {
+    ASSERT_EQ(psi[e] >> 32, ess[e]);
+    ASSERT_EQ(psi[e] >> 24 & 0xff, 0xf2);
+  }
+}
@@ -0,0 +1,71 @@
+#include "../partitioner.hpp"
+
+#include <gtest/gtest.h>
+
+#include <set>
+
+using namespace SINQAmorSim;
+
+TEST(Partitioner, parse_policy) {
+  EXPECT_EQ(Str2PartitionPolicy("random"), PartitionPolicy::random);
+  EXPECT_EQ(Str2PartitionPolicy("round_robin"), PartitionPolicy::round_robin);
+  EXPECT_EQ(Str2PartitionPolicy("bank"), PartitionPolicy::bank);
+  EXPECT_EQ(Str2PartitionPolicy("sticky"), PartitionPolicy::sticky);
+  EXPECT_THROW(Str2PartitionPolicy("hash"), std::runtime_error);
+}
+
+TEST(Partitioner, random_leaves_the_choice_to_the_producer) {
+  Partitioner Partitions(PartitionPolicy::random, 8, 2, 0);
+  EXPECT_EQ(Partitions(0), int32_t(Partitioner::Unassigned));
+  EXPECT_EQ(Partitions(7), int32_t(Partitioner::Unassigned));
+}
+
+TEST(Partitioner, unknown_partitions_fall_back_to_random) {
+  Partitioner Partitions(PartitionPolicy::round_robin, 0, 2, 0);
+  EXPECT_EQ(Partitions(3), int32_t(Partitioner::Unassigned));
+}
+
+TEST(Partitioner, threads_own_disjoint_partitions) {
+  const int NumPartitions = 10, NumThreads = 3;
+  std::set<int32_t> All;
+  for (int tid = 0; tid < NumThreads; ++tid) {
+    Partitioner Partitions(PartitionPolicy::round_robin, NumPartitions,
+                           NumThreads, tid);
+    for (auto p : Partitions.partitions()) {
+      EXPECT_EQ(p % NumThreads, tid);
+      EXPECT_TRUE(All.insert(p).second);
+    }
+  }
+  EXPECT_EQ(All.size(), size_t(NumPartitions));
+}
+
+TEST(Partitioner, round_robin_cycles_over_the_thread_partitions) {
+  Partitioner Partitions(PartitionPolicy::round_robin, 6, 2, 1);
+  std::vector<int32_t> Sequence;
+  for (uint64_t i = 0; i < 6; ++i) {
+    Sequence.push_back(Partitions(i));
+  }
+  EXPECT_EQ(Sequence, std::vector<int32_t>({1, 3, 5, 1, 3, 5}));
+}
+
+TEST(Partitioner, more_threads_than_partitions_share) {
+  Partitioner Partitions(PartitionPolicy::round_robin, 2, 5, 3);
+  EXPECT_EQ(Partitions(0), 1);
+  EXPECT_EQ(Partitions(1), 1);
+}
+
+TEST(Partitioner, bank_uses_a_single_partition) {
+  Partitioner Partitions(PartitionPolicy::bank, 4, 6, 5);
+  for (uint64_t i = 0; i < 10; ++i) {
+    EXPECT_EQ(Partitions(i), 1);
+  }
+}
+
+TEST(Partitioner, sticky_changes_partition_every_n_pulses) {
+  Partitioner Partitions(PartitionPolicy::sticky, 4, 1, 0, 3);
+  std::vector<int32_t> Sequence;
+  for (uint64_t i = 0; i < 9; ++i) {
+    Sequence.push_back(Partitions(i));
+  }
+  EXPECT_EQ(Sequence, std::vector<int32_t>({0, 0, 0, 1, 1, 1, 2, 2, 2}));
+}
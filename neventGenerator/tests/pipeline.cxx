@@ -0,0 +1,115 @@
+#include "../pipeline.hpp"
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using namespace SINQAmorSim;
+
+namespace {
+
+SerialisedPulse pulse(const uint64_t PulseID) {
+  SerialisedPulse Result;
+  Result.PulseID = PulseID;
+  Result.Opaque = reinterpret_cast<void *>(PulseID + 1);
+  return Result;
+}
+
+/// Ids of the pulses available in order
+std::vector<uint64_t> sequence(PulseReorder &Order) {
+  std::vector<uint64_t> Result;
+  SerialisedPulse Item;
+  while (Order.next(Item)) {
+    Result.push_back(Item.PulseID);
+  }
+  return Result;
+}
+
+} // namespace
+
+TEST(PulsePipeline, rings_are_sized_by_depth) {
+  PulsePipeline Pipeline(3, 2, 8);
+  EXPECT_EQ(Pipeline.numWorkers(), 3u);
+  EXPECT_GE(Pipeline.work().capacity(), 16u);
+  EXPECT_GE(Pipeline.output(2, 1).capacity(), 8u);
+  auto Report = Pipeline.report();
+  EXPECT_EQ(Report["workers"].get<size_t>(), 3u);
+  EXPECT_EQ(Report["output_queues"]["depth"].get<size_t>(), 0u);
+}
+
+TEST(PulsePipeline, report_counts_stalls_since_the_last_one) {
+  PulsePipeline Pipeline(1, 1, 4);
+  Pipeline.schedulerStall();
+  Pipeline.workerStall(0);
+  Pipeline.workerStall(0);
+  ASSERT_TRUE(Pipeline.output(0, 0).push(pulse(0)));
+  auto Report = Pipeline.report();
+  EXPECT_EQ(Report["scheduler_stalls"].get<uint64_t>(), 1u);
+  EXPECT_EQ(Report["serialiser_stalls"].get<uint64_t>(), 2u);
+  EXPECT_EQ(Report["output_queues"]["depth"].get<size_t>(), 1u);
+  Report = Pipeline.report();
+  EXPECT_EQ(Report["scheduler_stalls"].get<uint64_t>(), 0u);
+  EXPECT_EQ(Report["serialiser_stalls"].get<uint64_t>(), 0u);
+}
+
+TEST(PulseReorder, merges_the_workers_by_increasing_id) {
+  PulsePipeline Pipeline(3, 1, 8);
+  PulseReorder Order(Pipeline, 0, 0, 1);
+  // the work is taken in order, each worker finishes at its own pace
+  for (uint64_t Id : {1, 4, 5}) {
+    Pipeline.output(0, 0).push(pulse(Id));
+  }
+  for (uint64_t Id : {2, 3}) {
+    Pipeline.output(2, 0).push(pulse(Id));
+  }
+  // 0 is still being serialised by worker 1
+  EXPECT_TRUE(sequence(Order).empty());
+  Pipeline.output(1, 0).push(pulse(0));
+  Pipeline.output(1, 0).push(pulse(7));
+  EXPECT_EQ(sequence(Order), (std::vector<uint64_t>{0, 1, 2, 3, 4, 5}));
+  EXPECT_EQ(Order.expected(), 6u);
+  Pipeline.output(2, 0).push(pulse(6));
+  EXPECT_EQ(sequence(Order), (std::vector<uint64_t>{6, 7}));
+}
+
+TEST(PulseReorder, holds_one_pulse_per_worker) {
+  PulsePipeline Pipeline(2, 1, 4);
+  PulseReorder Order(Pipeline, 0, 0, 1);
+  auto &Late = Pipeline.output(0, 0);
+  auto &Early = Pipeline.output(1, 0);
+  for (uint64_t Id = 1; Early.push(pulse(Id)); ++Id) {
+  }
+  SerialisedPulse Item;
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_FALSE(Order.next(Item));
+  }
+  // only the head is taken, the other pulses wait in the ring
+  EXPECT_EQ(Early.size(), Early.capacity() - 1);
+  Late.push(pulse(0));
+  EXPECT_EQ(sequence(Order).size(), Early.capacity() + 1);
+}
+
+TEST(PulseReorder, interleaved_ids_of_a_single_topic) {
+  PulsePipeline Pipeline(2, 2, 8);
+  // producer 1 of 2 sends the ids 1, 3, 5, ...
+  PulseReorder Order(Pipeline, 1, 1, 2);
+  Pipeline.output(1, 1).push(pulse(3));
+  Pipeline.output(0, 1).push(pulse(1));
+  Pipeline.output(0, 1).push(pulse(5));
+  EXPECT_EQ(sequence(Order), (std::vector<uint64_t>{1, 3, 5}));
+}
+
+TEST(PulseReorder, drain_releases_held_and_queued_pulses) {
+  PulsePipeline Pipeline(2, 1, 8);
+  PulseReorder Order(Pipeline, 0, 0, 1);
+  Pipeline.output(0, 0).push(pulse(2));
+  Pipeline.output(0, 0).push(pulse(3));
+  Pipeline.output(1, 0).push(pulse(4));
+  SerialisedPulse Item;
+  EXPECT_FALSE(Order.next(Item));
+  std::vector<void *> Released;
+  EXPECT_EQ(Order.drain([&](void *Opaque) { Released.push_back(Opaque); }),
+            3u);
+  EXPECT_EQ(Released.size(), 3u);
+  EXPECT_EQ(Pipeline.output(0, 0).size(), 0u);
+}
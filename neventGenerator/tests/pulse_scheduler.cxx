@@ -0,0 +1,61 @@
+#include "../pulse_scheduler.hpp"
+
+#include <gtest/gtest.h>
+
+using namespace std::chrono;
+
+TEST(PulseScheduler, pulse_time_is_evenly_spaced) {
+  SINQAmorSim::PulseScheduler scheduler(14.0);
+  scheduler.wait();
+  auto first = scheduler.pulseTime();
+  for (int i = 1; i < 5; ++i) {
+    scheduler.wait();
+    EXPECT_NEAR((scheduler.pulseTime() - first).count(), i * 1e9 / 14.0, 1);
+  }
+}
+
+TEST(PulseScheduler, wait_until_deadline) {
+  SINQAmorSim::PulseScheduler scheduler(100.0,
+                                        SINQAmorSim::LatePulsePolicy::catch_up,
+                                        microseconds(500));
+  scheduler.wait();
+  auto start = steady_clock::now();
+  for (int i = 0; i < 10; ++i) {
+    scheduler.wait();
+  }
+  auto elapsed = duration_cast<milliseconds>(steady_clock::now() - start);
+  EXPECT_GE(elapsed.count(), 99);
+  EXPECT_EQ(scheduler.lateness().total(), 11);
+}
+
+TEST(PulseScheduler, skip_late_pulses) {
+  SINQAmorSim::PulseScheduler scheduler(1000.0,
+                                        SINQAmorSim::LatePulsePolicy::skip);
+  scheduler.wait();
+  std::this_thread::sleep_for(milliseconds(20));
+  EXPECT_GE(scheduler.wait(), 10);
+  EXPECT_EQ(scheduler.wait(), 0);
+}
+
+TEST(PulseScheduler, catch_up_late_pulses) {
+  SINQAmorSim::PulseScheduler scheduler(1000.0,
+                                        SINQAmorSim::LatePulsePolicy::catch_up);
+  scheduler.wait();
+  std::this_thread::sleep_for(milliseconds(20));
+  EXPECT_EQ(scheduler.wait(), 0);
+  EXPECT_GE(scheduler.lateness().max(), 10000000);
+}
+
+TEST(PulseScheduler, lateness_histogram_buckets) {
+  SINQAmorSim::LatenessHistogram histogram;
+  histogram.add(nanoseconds(500));
+  histogram.add(microseconds(1));
+  histogram.add(microseconds(3));
+  histogram.add(seconds(10000));
+  EXPECT_EQ(histogram.counts()[0], 1);
+  EXPECT_EQ(histogram.counts()[1], 1);
+  EXPECT_EQ(histogram.counts()[2], 1);
+  EXPECT_EQ(histogram.counts()[SINQAmorSim::LatenessHistogram::NumBuckets - 1],
+            1);
+  EXPECT_EQ(histogram.total(), 4);
+}
@@ -0,0 +1,34 @@
+#include "../Stats.hpp"
+
+#include <gtest/gtest.h>
+
+using namespace std::chrono;
+
+TEST(ReceiverStats, latency_per_source) {
+  ReceiverStats Stats;
+  for (int i = 1; i <= 100; ++i) {
+    Stats.add("a", 1000, nanoseconds(0), milliseconds(1), microseconds(i));
+  }
+  Stats.add("b", 500, nanoseconds(0), nanoseconds(0), milliseconds(5));
+
+  auto &Sources = Stats.sources();
+  ASSERT_EQ(Sources.size(), 2);
+  auto &A = Sources.at("a");
+  EXPECT_EQ(A.Messages, 100);
+  EXPECT_EQ(A.PulseLatency.max(), 100000);
+  EXPECT_NEAR(A.PulseLatency.percentile(0.5), 50000, 50000 / 16);
+  // received before the Kafka timestamp (clock offset): clamped to 0
+  EXPECT_EQ(A.KafkaLatency.max(), 0);
+  // no Kafka timestamp
+  EXPECT_EQ(Sources.at("b").KafkaLatency.count(), 0);
+}
+
+TEST(ReceiverStats, report_uses_interval_and_resets) {
+  ReceiverStats Stats;
+  Stats.add("a", 2000000, nanoseconds(0), nanoseconds(0), milliseconds(1));
+  auto Report = Stats.report(duration<double>(2.0));
+  EXPECT_DOUBLE_EQ(Report["MB/s"].get<double>(), 1.0);
+  EXPECT_EQ(Report["packets"].get<uint64_t>(), 1);
+  EXPECT_EQ(Report["sources"]["a"]["packets"].get<uint64_t>(), 1);
+  EXPECT_TRUE(Stats.sources().empty());
+}
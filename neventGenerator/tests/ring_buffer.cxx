@@ -0,0 +1,90 @@
+#include "../ring_buffer.hpp"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+TEST(RingBuffer, capacity_is_a_power_of_two) {
+  SINQAmorSim::SpscRing<int> Spsc(5);
+  SINQAmorSim::MpmcRing<int> Mpmc(8);
+  EXPECT_EQ(Spsc.capacity(), 8u);
+  EXPECT_EQ(Mpmc.capacity(), 8u);
+  EXPECT_ANY_THROW(SINQAmorSim::SpscRing<int>(0));
+}
+
+TEST(RingBuffer, spsc_full_and_empty) {
+  SINQAmorSim::SpscRing<int> Ring(4);
+  int Value{0};
+  EXPECT_FALSE(Ring.pop(Value));
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_TRUE(Ring.push(std::move(i)));
+  }
+  EXPECT_FALSE(Ring.push(4));
+  EXPECT_EQ(Ring.size(), 4u);
+  for (int i = 0; i < 4; ++i) {
+    ASSERT_TRUE(Ring.pop(Value));
+    EXPECT_EQ(Value, i);
+  }
+  EXPECT_FALSE(Ring.pop(Value));
+}
+
+TEST(RingBuffer, spsc_keeps_the_order_across_threads) {
+  const int Count = 100000;
+  SINQAmorSim::SpscRing<int> Ring(16);
+  std::thread Producer([&]() {
+    for (int i = 0; i < Count; ++i) {
+      int Value = i;
+      while (!Ring.push(std::move(Value))) {
+        std::this_thread::yield();
+      }
+    }
+  });
+  int Expected{0}, Value{0};
+  while (Expected < Count) {
+    if (Ring.pop(Value)) {
+      ASSERT_EQ(Value, Expected);
+      ++Expected;
+    } else {
+      std::this_thread::yield();
+    }
+  }
+  Producer.join();
+}
+
+TEST(RingBuffer, mpmc_delivers_every_item_once) {
+  const int Count = 20000;
+  const int Threads = 4;
+  SINQAmorSim::MpmcRing<int> Ring(64);
+  std::vector<std::atomic<int>> Seen(Threads * Count);
+  std::atomic<int> Popped{0};
+  std::vector<std::thread> All;
+  for (int t = 0; t < Threads; ++t) {
+    All.emplace_back([&, t]() {
+      for (int i = 0; i < Count; ++i) {
+        int Value = t * Count + i;
+        while (!Ring.push(std::move(Value))) {
+          std::this_thread::yield();
+        }
+      }
+    });
+    All.emplace_back([&]() {
+      int Value{0};
+      while (Popped < Threads * Count) {
+        if (Ring.pop(Value)) {
+          ++Seen[Value];
+          ++Popped;
+        } else {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+  for (auto &Thread : All) {
+    Thread.join();
+  }
+  for (auto &Count : Seen) {
+    EXPECT_EQ(Count, 1);
+  }
+}
@@ -0,0 +1,101 @@
+#include "../sequence_tracker.hpp"
+
+#include <gtest/gtest.h>
+
+using namespace SINQAmorSim;
+
+class SequenceTrackerTest : public ::testing::Test {
+protected:
+  SequenceTracker tracker;
+  int64_t clock{0};
+  // each message carries a newer pulse time than the previous one
+  void add(const uint64_t id, const std::string &topic = "topic") {
+    addAt(id, ++clock, topic);
+  }
+  void addAt(const uint64_t id, const int64_t pulse_time,
+             const std::string &topic = "topic") {
+    tracker.add(topic, "source", 6, id, std::chrono::nanoseconds(pulse_time));
+  }
+  SequenceCounts counts(const std::string &topic = "topic") {
+    return tracker.counts()[topic + "/source"];
+  }
+};
+
+TEST_F(SequenceTrackerTest, contiguous_sequence) {
+  for (uint64_t id = 10; id < 1010; ++id) {
+    add(id);
+  }
+  auto c = counts();
+  EXPECT_EQ(c.Received, 1000);
+  EXPECT_EQ(c.Missing, 0);
+  EXPECT_EQ(c.Duplicates, 0);
+  EXPECT_EQ(c.Reordered, 0);
+}
+
+TEST_F(SequenceTrackerTest, gap_duplicate_and_reorder) {
+  add(0);
+  add(1);
+  add(4); // 2, 3 missing
+  add(4); // duplicate
+  add(2); // fills the gap
+  add(1); // duplicate
+  auto c = counts();
+  EXPECT_EQ(c.Received, 6);
+  EXPECT_EQ(c.Missing, 1);
+  EXPECT_EQ(c.Duplicates, 2);
+  EXPECT_EQ(c.Reordered, 1);
+}
+
+TEST_F(SequenceTrackerTest, streams_are_independent) {
+  add(0, "a");
+  add(0, "b");
+  add(1, "a");
+  add(5, "b");
+  EXPECT_EQ(counts("a").Missing, 0);
+  EXPECT_EQ(counts("b").Missing, 4);
+  EXPECT_EQ(counts("a").Duplicates, 0);
+}
+
+TEST_F(SequenceTrackerTest, restart_of_the_producer) {
+  add(1000000);
+  add(0);
+  add(1);
+  auto c = counts();
+  EXPECT_EQ(c.Restarts, 1);
+  EXPECT_EQ(c.Missing, 0);
+  EXPECT_EQ(c.Duplicates, 0);
+}
+
+TEST_F(SequenceTrackerTest, late_id_before_the_first_one) {
+  add(100);
+  add(99);
+  auto c = counts();
+  EXPECT_EQ(c.Reordered, 1);
+  EXPECT_EQ(c.Missing, 0);
+}
+
+TEST_F(SequenceTrackerTest, gap_larger_than_window) {
+  add(0);
+  add(3 * SequenceWindow::WindowSize);
+  add(3 * SequenceWindow::WindowSize - 1);
+  auto c = counts();
+  EXPECT_EQ(c.Missing, 3 * SequenceWindow::WindowSize - 2);
+  EXPECT_EQ(c.Reordered, 1);
+  EXPECT_EQ(c.Restarts, 0);
+}
+
+TEST_F(SequenceTrackerTest, lagging_partition_is_late_not_a_restart) {
+  const uint64_t skew = 2 * SequenceWindow::WindowSize;
+  // partition 0 carries the even ids, partition 1 lags behind by skew
+  for (uint64_t id = 0; id < skew; id += 2) {
+    addAt(id, id);
+  }
+  for (uint64_t id = 1; id < 1001; id += 2) {
+    addAt(id, id);
+  }
+  auto c = counts();
+  EXPECT_EQ(c.Restarts, 0);
+  EXPECT_EQ(c.Late, 500);
+  EXPECT_EQ(c.Missing, skew / 2 - 1 - 500);
+  EXPECT_EQ(c.Duplicates, 0);
+}
@@ -1,4 +1,5 @@
 #include "../serialiser.hpp"
+#include "../utils.hpp"
 
 #include <gtest/gtest.h>
 
@@ -52,3 +53,81 @@ TEST(flatbuffer_serialiser, serialise_empty_array_ess_format) {
 //   EXPECT_TRUE(buffer.size() > 0);
 //   EXPECT_TRUE(EventMessageBufferHasIdentifier(&buffer[0]));
 // }
+
+TEST(pooled_flatbuffer_serialiser, serialise_and_unserialise_ess_format) {
+  SINQAmorSim::PooledFlatBufferSerialiser serialiser;
+  std::vector<SINQAmorSim::ESSformat::value_type> input, output;
+  for (int i = 0; i < data_size; ++i) {
+    input.push_back(i);
+  }
+  auto builder = serialiser.serialise(11, std::chrono::nanoseconds(37), input);
+  EXPECT_TRUE(EventMessageBufferHasIdentifier(builder->GetBufferPointer()));
+
+  uint64_t packet_id;
+  std::chrono::nanoseconds timestamp;
+  std::string source_name;
+  SINQAmorSim::FlatBufferSerialiser reader;
+  reader.extract(reinterpret_cast<const char *>(builder->GetBufferPointer()),
+                 output, packet_id, timestamp, source_name);
+  EXPECT_TRUE(input == output);
+  EXPECT_EQ(packet_id, 11);
+  EXPECT_EQ(timestamp.count(), 37);
+  serialiser.release(builder);
+}
+
+TEST(pooled_flatbuffer_serialiser, reuse_released_builders) {
+  SINQAmorSim::PooledFlatBufferSerialiser serialiser;
+  std::vector<SINQAmorSim::ESSformat::value_type> input(data_size);
+  auto first = serialiser.serialise(1, std::chrono::nanoseconds(1), input);
+  auto second = serialiser.serialise(2, std::chrono::nanoseconds(2), input);
+  EXPECT_NE(first, second);
+  EXPECT_EQ(serialiser.pool().size(), 2);
+
+  serialiser.release(first);
+  auto third = serialiser.serialise(3, std::chrono::nanoseconds(3), input);
+  EXPECT_EQ(first, third);
+  EXPECT_EQ(serialiser.pool().size(), 2);
+  serialiser.release(second);
+  serialiser.release(third);
+  EXPECT_EQ(serialiser.pool().available(), 2);
+}
+
+TEST(template_flatbuffer_serialiser, patch_message_id_and_pulse_time) {
+  SINQAmorSim::TemplateFlatBufferSerialiser serialiser;
+  std::vector<SINQAmorSim::ESSformat::value_type> input, output;
+  for (int i = 0; i < data_size; ++i) {
+    input.push_back(i);
+  }
+  SINQAmorSim::FlatBufferSerialiser reader;
+  uint64_t packet_id;
+  std::chrono::nanoseconds timestamp;
+  std::string source_name;
+  for (uint64_t pulse = 0; pulse < 4; ++pulse) {
+    auto buffer = serialiser.serialise(
+        pulse, std::chrono::nanoseconds(1000 + pulse), input);
+    reader.extract(buffer->data(), output, packet_id, timestamp, source_name);
+    EXPECT_TRUE(input == output);
+    EXPECT_EQ(packet_id, pulse);
+    EXPECT_EQ(timestamp.count(), 1000 + pulse);
+    serialiser.release(buffer);
+  }
+  EXPECT_EQ(serialiser.pool().size(), 1);
+}
+
+TEST(template_flatbuffer_serialiser, rebuild_on_different_events) {
+  SINQAmorSim::TemplateFlatBufferSerialiser serialiser;
+  std::vector<SINQAmorSim::ESSformat::value_type> first(data_size, 1),
+      second(2 * data_size, 2), output;
+  auto buffer = serialiser.serialise(1, std::chrono::nanoseconds(1), first);
+  serialiser.release(buffer);
+  buffer = serialiser.serialise(2, std::chrono::nanoseconds(2), second);
+
+  SINQAmorSim::FlatBufferSerialiser reader;
+  uint64_t packet_id;
+  std::chrono::nanoseconds timestamp;
+  std::string source_name;
+  reader.extract(buffer->data(), output, packet_id, timestamp, source_name);
+  EXPECT_TRUE(second == output);
+  EXPECT_EQ(packet_id, 2);
+  serialiser.release(buffer);
+}
@@ -0,0 +1,128 @@
+#include "../shm_ring.hpp"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using namespace SINQAmorSim;
+
+namespace {
+
+const std::string Name{"/amor-shm-ring-test"};
+
+void write(ShmRingWriter &Writer, const int Value, const size_t Size = 100) {
+  std::vector<char> Message(Size, char(Value));
+  Writer.write(Message.data(), Message.size(),
+               std::chrono::nanoseconds(Value));
+}
+
+} // namespace
+
+TEST(ShmRing, every_reader_gets_every_message) {
+  ShmRingWriter Writer(Name, 16, 4096);
+  ShmRingReader First(Name), Second(Name);
+  for (int i = 0; i < 10; ++i) {
+    write(Writer, i);
+  }
+  std::vector<char> Message;
+  std::chrono::nanoseconds PulseTime;
+  for (auto Reader : {&First, &Second}) {
+    for (int i = 0; i < 10; ++i) {
+      ASSERT_TRUE(Reader->read(Message, PulseTime));
+      EXPECT_EQ(PulseTime.count(), i);
+      EXPECT_EQ(Message, std::vector<char>(100, char(i)));
+    }
+    EXPECT_FALSE(Reader->read(Message, PulseTime));
+    EXPECT_EQ(Reader->lost(), 0u);
+  }
+}
+
+TEST(ShmRing, readers_start_from_the_next_message) {
+  ShmRingWriter Writer(Name, 16, 4096);
+  write(Writer, 1);
+  ShmRingReader Reader(Name);
+  std::vector<char> Message;
+  std::chrono::nanoseconds PulseTime;
+  EXPECT_FALSE(Reader.read(Message, PulseTime));
+  write(Writer, 2);
+  ASSERT_TRUE(Reader.read(Message, PulseTime));
+  EXPECT_EQ(PulseTime.count(), 2);
+}
+
+TEST(ShmRing, overruns_are_detected) {
+  // 16 slots, but only 4096 / 1024 = 4 messages of data
+  ShmRingWriter Writer(Name, 16, 4096);
+  ShmRingReader Reader(Name);
+  for (int i = 0; i < 10; ++i) {
+    write(Writer, i, 1024);
+  }
+  std::vector<char> Message;
+  std::chrono::nanoseconds PulseTime;
+  std::vector<int> Received;
+  while (Reader.read(Message, PulseTime)) {
+    Received.push_back(PulseTime.count());
+    EXPECT_EQ(Message, std::vector<char>(1024, char(PulseTime.count())));
+  }
+  ASSERT_FALSE(Received.empty());
+  EXPECT_EQ(Received.back(), 9);
+  EXPECT_EQ(Received.size() + Reader.lost(), 10u);
+  EXPECT_GT(Reader.lost(), 0u);
+}
+
+TEST(ShmRing, concurrent_reader_sees_ordered_messages) {
+  const int Count = 20000;
+  ShmRingWriter Writer(Name, 64, 1 << 16);
+  ShmRingReader Reader(Name);
+  std::thread Producer([&]() {
+    for (int i = 0; i < Count; ++i) {
+      write(Writer, i, 64 + i % 200);
+      if (i % 16 == 0) {
+        std::this_thread::yield();
+      }
+    }
+  });
+  std::vector<char> Message;
+  std::chrono::nanoseconds PulseTime;
+  int Last{-1};
+  size_t Received{0};
+  while (Last < Count - 1) {
+    if (!Reader.read(Message, PulseTime)) {
+      std::this_thread::yield();
+      continue;
+    }
+    int Value = PulseTime.count();
+    ASSERT_GT(Value, Last);
+    ASSERT_EQ(Message.size(), size_t(64 + Value % 200));
+    ASSERT_EQ(Message.front(), char(Value));
+    ASSERT_EQ(Message.back(), char(Value));
+    Last = Value;
+    ++Received;
+  }
+  Producer.join();
+  EXPECT_EQ(Received + Reader.lost(), size_t(Count));
+}
+
+namespace {
+struct RawSerialiser {
+  explicit RawSerialiser(const std::string &) {}
+};
+void releaseMessage(RawSerialiser &, void *) {}
+} // namespace
+
+TEST(ShmRing, listener_reads_the_transmitted_messages) {
+  KafkaOptions Options{{"shm.slots", "16"}, {"shm.mb", "1"}};
+  ShmTransmitter<RawSerialiser> Sender("", "shm-ring-test", "source",
+                                       Options);
+  ShmListener<RawSerialiser> Receiver("", "shm-ring-test", "", Options);
+  std::vector<char> Data{'a', 'b', 'c'};
+  Sender.send(Data);
+  Sender.send(Data);
+  ShmMessageBatch Batch;
+  EXPECT_EQ(Receiver.consume(Batch, 10, 100), 2u);
+  ASSERT_EQ(Batch.Messages.size(), 2u);
+  EXPECT_EQ(Batch.Messages[0]->len(), 3u);
+  EXPECT_EQ(Batch.Messages[0]->topic_name(), "shm-ring-test");
+  EXPECT_EQ(Sender.poll(0), 2);
+}
@@ -0,0 +1,46 @@
+#include "../timestamp_generator.hpp"
+
+#include <gtest/gtest.h>
+
+using namespace std::chrono;
+
+TEST(TimestampGenerator, unknown_policy) {
+  EXPECT_ANY_THROW(SINQAmorSim::Str2TimestampPolicy("any_timestamp"));
+  EXPECT_NO_THROW(SINQAmorSim::Str2TimestampPolicy("none"));
+}
+
+TEST(TimestampGenerator, none_leaves_tof_untouched) {
+  SINQAmorSim::TimestampGenerator<uint32_t> generator(
+      SINQAmorSim::TimestampPolicy::none, 10);
+  std::vector<uint32_t> tof{1, 2, 3};
+  generator(tof.data(), tof.size(), nanoseconds(123));
+  EXPECT_FALSE(generator.enabled());
+  EXPECT_EQ(tof, std::vector<uint32_t>({1, 2, 3}));
+}
+
+TEST(TimestampGenerator, const_timestamp_uses_pulse_time) {
+  SINQAmorSim::TimestampGenerator<uint32_t> generator(
+      SINQAmorSim::TimestampPolicy::const_timestamp, 10);
+  std::vector<uint32_t> tof(100, 0);
+  generator(tof.data(), tof.size(), nanoseconds(123));
+  for (auto &t : tof) {
+    EXPECT_EQ(t, 123);
+  }
+}
+
+TEST(TimestampGenerator, random_timestamp_within_period) {
+  SINQAmorSim::TimestampGenerator<uint32_t> generator(
+      SINQAmorSim::TimestampPolicy::random_timestamp, 14, 1);
+  std::vector<uint32_t> tof(10000, 0);
+  generator(tof.data(), tof.size(), nanoseconds(123));
+  double sum = 0;
+  for (auto &t : tof) {
+    EXPECT_LT(t, 1e9 / 14);
+    sum += t;
+  }
+  EXPECT_NEAR(sum / tof.size(), 0.5e9 / 14, 0.02e9 / 14);
+
+  auto first = tof;
+  generator(tof.data(), tof.size(), nanoseconds(123));
+  EXPECT_FALSE(first == tof);
+}
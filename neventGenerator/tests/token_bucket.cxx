@@ -0,0 +1,120 @@
+#include "../token_bucket.hpp"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+using namespace std::chrono;
+
+TEST(TokenBucket, parse_unit) {
+  EXPECT_EQ(SINQAmorSim::Str2RateUnit("bytes"), SINQAmorSim::RateUnit::bytes);
+  EXPECT_EQ(SINQAmorSim::Str2RateUnit("events"),
+            SINQAmorSim::RateUnit::events);
+  EXPECT_THROW(SINQAmorSim::Str2RateUnit("packets"), std::runtime_error);
+}
+
+TEST(TokenBucket, disabled_does_not_wait) {
+  SINQAmorSim::TokenBucket bucket;
+  EXPECT_FALSE(bucket.enabled());
+  auto start = steady_clock::now();
+  for (int i = 0; i < 1000; ++i) {
+    bucket.wait();
+    bucket.take(1000000);
+  }
+  EXPECT_LT(steady_clock::now() - start, milliseconds(10));
+}
+
+TEST(TokenBucket, limits_the_rate) {
+  SINQAmorSim::TokenBucket bucket(1e6); // e.g. bytes/s
+  auto start = steady_clock::now();
+  for (int i = 0; i < 100; ++i) {
+    bucket.wait();
+    bucket.take(1000);
+  }
+  auto elapsed = duration_cast<milliseconds>(steady_clock::now() - start);
+  // the last message leaves the bucket in debt: 99 messages are paced;
+  // only a gross overshoot is an error, the scheduler may be late
+  EXPECT_GE(elapsed.count(), 98);
+  EXPECT_LT(elapsed.count(), 1000);
+}
+
+TEST(TokenBucket, slow_sender_is_not_late) {
+  // each send takes longer than its cost: the bucket never holds it back
+  SINQAmorSim::TokenBucket bucket(1e6, milliseconds(10));
+  for (int i = 0; i < 5; ++i) {
+    bucket.wait();
+    std::this_thread::sleep_for(milliseconds(2));
+    bucket.take(100);
+  }
+  // the burst and the send time are not lateness
+  EXPECT_EQ(bucket.wait(), nanoseconds(0));
+}
+
+TEST(TokenBucket, lateness_counts_from_the_release) {
+  SINQAmorSim::TokenBucket bucket(1000);
+  bucket.wait();
+  bucket.take(10); // 10 ms of debt
+  EXPECT_LT(bucket.wait(), milliseconds(5));
+}
+
+TEST(TokenBucket, shared_between_threads) {
+  SINQAmorSim::TokenBucket bucket(2000);
+  auto start = steady_clock::now();
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&bucket]() {
+      for (int i = 0; i < 50; ++i) {
+        bucket.wait();
+        bucket.take(1);
+      }
+    });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+  auto elapsed = duration_cast<milliseconds>(steady_clock::now() - start);
+  // 200 messages at 2000/s, less the messages let through concurrently
+  EXPECT_GE(elapsed.count(), 95);
+}
+
+TEST(TokenBucket, rate_change_converts_the_debt) {
+  SINQAmorSim::TokenBucket bucket(1);
+  bucket.take(10); // 10 s of debt
+  bucket.setRate(1e6); // 10 us
+  auto start = steady_clock::now();
+  bucket.wait();
+  EXPECT_LT(steady_clock::now() - start, milliseconds(10));
+}
+
+TEST(TokenBucket, starts_full_not_late) {
+  SINQAmorSim::TokenBucket bucket(1000);
+  EXPECT_LT(bucket.wait(), milliseconds(10));
+}
+
+TEST(PulsePacer, empty_pulses_follow_the_pulse_rate) {
+  SINQAmorSim::PulseScheduler scheduler(200);
+  SINQAmorSim::TokenBucket bucket(1e9);
+  SINQAmorSim::PulsePacer pacer(scheduler, bucket);
+  auto start = steady_clock::now();
+  for (int i = 0; i < 20; ++i) {
+    pacer.wait(true);
+  }
+  auto elapsed = duration_cast<milliseconds>(steady_clock::now() - start);
+  // the first pulse is due at once, the others every 5 ms
+  EXPECT_GE(elapsed.count(), 94);
+  EXPECT_LT(pacer.lateness(), milliseconds(10));
+}
+
+TEST(PulsePacer, pulses_with_events_follow_the_limit) {
+  SINQAmorSim::PulseScheduler scheduler(1);
+  SINQAmorSim::TokenBucket bucket(1e4);
+  SINQAmorSim::PulsePacer pacer(scheduler, bucket);
+  auto start = steady_clock::now();
+  for (int i = 0; i < 100; ++i) {
+    pacer.wait(false);
+    bucket.take(1);
+  }
+  auto elapsed = duration_cast<milliseconds>(steady_clock::now() - start);
+  EXPECT_GE(elapsed.count(), 8);
+  EXPECT_LT(elapsed.count(), 500);
+}
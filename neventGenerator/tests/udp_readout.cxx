@@ -0,0 +1,211 @@
+#include "../udp_readout.hpp"
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using namespace SINQAmorSim;
+
+namespace {
+
+/// NumEvents times of flight 0, 1, ... followed by detector ids 1000, ...
+std::vector<uint32_t> makeEvents(const size_t NumEvents) {
+  std::vector<uint32_t> Events(2 * NumEvents);
+  for (size_t i = 0; i < NumEvents; ++i) {
+    Events[i] = i;
+    Events[NumEvents + i] = 1000 + i;
+  }
+  return Events;
+}
+
+void send(UdpReadoutSender &Sender, const uint64_t PulseId,
+          const std::vector<uint32_t> &Events) {
+  const size_t NumEvents = Events.size() / 2;
+  Sender.send(PulseId, std::chrono::nanoseconds(PulseId * 1000),
+              Span<uint32_t>(Events.data(), NumEvents),
+              Span<uint32_t>(Events.data() + NumEvents, NumEvents));
+}
+
+std::string endpoint(const UdpReadoutReceiver &Receiver) {
+  return "127.0.0.1:" + std::to_string(Receiver.port());
+}
+
+} // namespace
+
+TEST(UdpReadout, events_per_packet) {
+  EXPECT_EQ(UdpReadout::eventsPerPacket(1472), (1472u - 40) / 8);
+  EXPECT_EQ(UdpReadout::eventsPerPacket(8972), (8972u - 40) / 8);
+  EXPECT_THROW(UdpReadout::eventsPerPacket(40), std::runtime_error);
+  EXPECT_THROW(UdpReadout::eventsPerPacket(65508), std::runtime_error);
+}
+
+TEST(UdpReadout, endpoint_must_have_a_port) {
+  EXPECT_THROW(UdpReadoutSender("localhost"), std::runtime_error);
+  EXPECT_THROW(UdpReadoutSender("localhost:"), std::runtime_error);
+}
+
+TEST(UdpReadout, pulses_are_split_into_packets) {
+  UdpReadoutReceiver Receiver("127.0.0.1:0");
+  UdpReadoutSender Sender(endpoint(Receiver));
+  const size_t PerPacket = Sender.eventsPerPacket();
+  const size_t NumEvents = 2 * PerPacket + 10;
+  auto Events = makeEvents(NumEvents);
+  send(Sender, 7, Events);
+  EXPECT_EQ(Sender.packets(), 3u);
+
+  std::vector<uint32_t> Tof, Detector;
+  size_t Received{0};
+  while (Received < 3) {
+    size_t Count = Receiver.receive(1000);
+    if (!Count) {
+      break;
+    }
+    for (size_t i = 0; i < Count; ++i, ++Received) {
+      auto &Packet = Receiver.packet(i);
+      EXPECT_EQ(Packet.Header.Sequence, Received);
+      EXPECT_EQ(Packet.Header.PulseId, 7u);
+      EXPECT_EQ(Packet.Header.PulseTime, 7000);
+      EXPECT_EQ(Packet.Header.Fragment, Received);
+      EXPECT_EQ(Packet.Header.Fragments, 3u);
+      Tof.insert(Tof.end(), Packet.TimeOfFlight.begin(),
+                 Packet.TimeOfFlight.end());
+      Detector.insert(Detector.end(), Packet.DetectorId.begin(),
+                      Packet.DetectorId.end());
+    }
+  }
+  ASSERT_EQ(Received, 3u);
+  EXPECT_EQ(Receiver.events(), NumEvents);
+  EXPECT_EQ(Receiver.lost(), 0u);
+  EXPECT_EQ(Tof, std::vector<uint32_t>(Events.begin(),
+                                       Events.begin() + NumEvents));
+  EXPECT_EQ(Detector,
+            std::vector<uint32_t>(Events.begin() + NumEvents, Events.end()));
+}
+
+TEST(UdpReadout, jumbo_packets_and_empty_pulses) {
+  UdpReadoutReceiver Receiver("127.0.0.1:0");
+  UdpReadoutSender Sender(endpoint(Receiver), 8972);
+  send(Sender, 1, makeEvents(1000));
+  send(Sender, 2, makeEvents(0));
+  while (Receiver.packets() < 2 && Receiver.receive(1000) > 0) {
+  }
+  ASSERT_EQ(Receiver.packets(), 2u);
+  EXPECT_EQ(Receiver.events(), 1000u);
+}
+
+TEST(UdpReadout, batches_larger_than_the_pulse_are_flushed) {
+  UdpReadoutReceiver Receiver("127.0.0.1:0", 256);
+  UdpReadoutSender Sender(endpoint(Receiver), 1472, 4);
+  for (uint64_t Pulse = 0; Pulse < 5; ++Pulse) {
+    send(Sender, Pulse, makeEvents(10 * Sender.eventsPerPacket()));
+  }
+  while (Receiver.packets() < 50 && Receiver.receive(1000) > 0) {
+  }
+  EXPECT_EQ(Receiver.packets(), 50u);
+  EXPECT_EQ(Receiver.lost(), 0u);
+}
+
+TEST(UdpReadout, gaps_in_the_sequence_are_lost_packets) {
+  UdpReadoutReceiver Receiver("127.0.0.1:0");
+  UdpReadoutHeader Header{UdpReadout::Magic, UdpReadout::Version, 0, 0, 0,
+                          0, 0, 1};
+  int Socket = UdpReadout::socket(endpoint(Receiver), false);
+  for (uint64_t Sequence : {0, 1, 5, 6}) {
+    Header.Sequence = Sequence;
+    ASSERT_EQ(::send(Socket, &Header, sizeof(Header), 0),
+              ssize_t(sizeof(Header)));
+  }
+  const char Garbage[] = "not a readout packet";
+  ::send(Socket, Garbage, sizeof(Garbage), 0);
+  ::close(Socket);
+  while (Receiver.packets() < 4 && Receiver.receive(1000) > 0) {
+  }
+  EXPECT_EQ(Receiver.packets(), 4u);
+  EXPECT_EQ(Receiver.lost(), 3u);
+  EXPECT_EQ(Receiver.invalid(), 1u);
+}
+
+TEST(UdpReadout, counters_report_the_packets_sent) {
+  UdpReadoutReceiver Receiver("127.0.0.1:0");
+  UdpReadoutSender Sender(endpoint(Receiver));
+  UdpCounters::instance().report();
+  send(Sender, 1, makeEvents(3 * Sender.eventsPerPacket()));
+  auto Report = UdpCounters::instance().report();
+  EXPECT_EQ(Report["packets"].get<uint64_t>(), 3u);
+  EXPECT_EQ(Report["dropped"].get<uint64_t>(), 0u);
+  EXPECT_GT(Report["Gbit/s"].get<double>(), 0);
+}
+
+TEST(UdpReadout, refused_packets_are_dropped) {
+  std::string Closed;
+  {
+    UdpReadoutReceiver Receiver("127.0.0.1:0");
+    Closed = endpoint(Receiver);
+  }
+  UdpReadoutSender Sender(Closed);
+  UdpCounters::instance().report();
+  for (uint64_t Pulse = 0; Pulse < 10; ++Pulse) {
+    EXPECT_NO_THROW(send(Sender, Pulse, makeEvents(100)));
+  }
+  auto Report = UdpCounters::instance().report();
+  EXPECT_GT(Report["dropped"].get<uint64_t>(), 0u);
+  EXPECT_EQ(Report["packets"].get<uint64_t>() +
+                Report["dropped"].get<uint64_t>(),
+            10u);
+}
+
+namespace {
+
+/// No ev42 message is built for the events
+struct UnusedSerialiser {
+  explicit UnusedSerialiser(const std::string &) {}
+};
+
+void releaseMessage(UnusedSerialiser &, void *) {}
+
+} // namespace
+
+TEST(UdpReadout, transmitter_sends_the_event_arrays) {
+  UdpReadoutReceiver Receiver("127.0.0.1:0");
+  UdpTransmitter<UnusedSerialiser> Transmitter(endpoint(Receiver), "topic",
+                                               "source");
+  size_t Delivered{0}, Bytes{0};
+  Transmitter.setDeliveryHooks(
+      [&](size_t Size, const std::chrono::nanoseconds &, int32_t) {
+        ++Delivered;
+        Bytes += Size;
+      },
+      nullptr);
+  const size_t NumEvents = 1000;
+  auto Events = makeEvents(NumEvents);
+  size_t Sent = Transmitter.send(3, std::chrono::nanoseconds(3000), Events,
+                                 Events.size());
+  EXPECT_EQ(Transmitter.send(4, std::chrono::nanoseconds(4000), Events, 0),
+            0u);
+  EXPECT_EQ(Transmitter.poll(0), 1);
+  EXPECT_EQ(Delivered, 1u);
+  EXPECT_EQ(Bytes, Sent);
+
+  std::vector<uint32_t> Tof, Detector;
+  while (Tof.size() < NumEvents) {
+    size_t Count = Receiver.receive(1000);
+    if (!Count) {
+      break;
+    }
+    for (size_t i = 0; i < Count; ++i) {
+      auto &Packet = Receiver.packet(i);
+      EXPECT_EQ(Packet.Header.PulseId, 3u);
+      Tof.insert(Tof.end(), Packet.TimeOfFlight.begin(),
+                 Packet.TimeOfFlight.end());
+      Detector.insert(Detector.end(), Packet.DetectorId.begin(),
+                      Packet.DetectorId.end());
+    }
+  }
+  EXPECT_EQ(Tof, std::vector<uint32_t>(Events.begin(),
+                                       Events.begin() + NumEvents));
+  EXPECT_EQ(Detector,
+            std::vector<uint32_t>(Events.begin() + NumEvents, Events.end()));
+  EXPECT_EQ(Sent, Receiver.packets() * sizeof(UdpReadoutHeader) +
+                      NumEvents * UdpReadout::EventBytes);
+}
@@ -0,0 +1,39 @@
+#include "../work_stealing_pool.hpp"
+
+#include <atomic>
+#include <gtest/gtest.h>
+
+TEST(WorkStealingPool, runs_every_task) {
+  std::atomic<int> Sum{0};
+  {
+    SINQAmorSim::WorkStealingPool Pool(4);
+    for (int i = 1; i <= 1000; ++i) {
+      Pool.push([&Sum, i]() { Sum += i; }, i);
+    }
+  }
+  // the destructor runs the tasks still queued
+  EXPECT_EQ(Sum, 500500);
+}
+
+TEST(WorkStealingPool, idle_workers_steal_from_a_busy_one) {
+  std::atomic<bool> Release{false};
+  std::atomic<int> Done{0};
+  SINQAmorSim::WorkStealingPool Pool(2);
+  // every task goes to worker 0, which may be blocked by the first one
+  Pool.push(
+      [&]() {
+        while (!Release) {
+          std::this_thread::yield();
+        }
+      },
+      0);
+  for (int i = 0; i < 10; ++i) {
+    Pool.push([&]() { ++Done; }, 0);
+  }
+  for (int i = 0; i < 100 && Done < 10; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  EXPECT_EQ(Done, 10);
+  EXPECT_GT(Pool.steals(), 0u);
+  Release = true;
+}
@@ -0,0 +1,50 @@
+#include "../worker_pool.hpp"
+
+#include <atomic>
+#include <gtest/gtest.h>
+
+TEST(WorkerPool, processes_every_item) {
+  std::atomic<int> Sum{0};
+  std::vector<std::atomic<int>> PerWorker(4);
+  {
+    SINQAmorSim::WorkerPool<int> Pool(4,
+                                      [&](int &Value, const int Id) {
+                                        Sum += Value;
+                                        ++PerWorker[Id];
+                                      },
+                                      2);
+    for (int i = 1; i <= 1000; ++i) {
+      Pool.push(std::move(i));
+    }
+  }
+  EXPECT_EQ(Sum, 500500);
+  int Total{0};
+  for (auto &Count : PerWorker) {
+    Total += Count;
+  }
+  EXPECT_EQ(Total, 1000);
+}
+
+TEST(WorkerPool, push_blocks_while_full) {
+  std::atomic<bool> Release{false};
+  std::atomic<int> Pushed{0};
+  SINQAmorSim::WorkerPool<int> Pool(1,
+                                    [&](int &, const int) {
+                                      while (!Release) {
+                                        std::this_thread::yield();
+                                      }
+                                    },
+                                    1);
+  std::thread Producer([&]() {
+    for (int i = 0; i < 3; ++i) {
+      Pool.push(std::move(i));
+      ++Pushed;
+    }
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  // one item in the handler, one queued, the third one waits
+  EXPECT_EQ(Pushed, 2);
+  Release = true;
+  Producer.join();
+  EXPECT_EQ(Pushed, 3);
+}
@@ -0,0 +1,124 @@
+#include "../zmq_generator.hpp"
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using namespace SINQAmorSim;
+
+namespace {
+
+/// Buffers taken from a thread safe pool, as the pooled serialisers
+struct PoolSerialiser {
+  explicit PoolSerialiser(const std::string &) {}
+};
+void releaseMessage(PoolSerialiser &, void *) {}
+
+using Transmitter = ZmqTransmitter<PoolSerialiser>;
+using Listener = ZmqListener<PoolSerialiser>;
+
+/// Receive Count messages, waiting at most 5 s
+std::vector<std::string> receive(Listener &Receiver, const size_t Count) {
+  std::vector<std::string> Result;
+  ZmqMessageBatch Batch;
+  for (int i = 0; i < 50 && Result.size() < Count; ++i) {
+    Receiver.consume(Batch, Count, 100);
+    for (auto &Message : Batch.Messages) {
+      auto Data = static_cast<const char *>(Message->payload());
+      Result.emplace_back(Data, Data + Message->len());
+      EXPECT_EQ(Message->topic_name(), "topic");
+    }
+  }
+  return Result;
+}
+
+} // namespace
+
+TEST(ZmqGenerator, push_pull_over_inproc) {
+  Listener Receiver("inproc://push-pull", "topic", "", {});
+  Transmitter Sender("inproc://push-pull", "topic", "source");
+  std::vector<char> Message{'a', 'b', 'c'};
+  Sender.send(Message);
+  Sender.send(Message);
+  auto Received = receive(Receiver, 2);
+  ASSERT_EQ(Received.size(), 2u);
+  EXPECT_EQ(Received[0], "abc");
+}
+
+TEST(ZmqGenerator, pooled_buffers_are_released_and_reported) {
+  Listener Receiver("inproc://zero-copy", "topic", "", {});
+  Transmitter Sender("inproc://zero-copy", "topic", "source");
+  std::atomic<int> Released{0};
+  Sender.setRelease([&](void *) { ++Released; });
+  size_t Delivered{0};
+  Sender.setDeliveryHooks(
+      [&](size_t Size, const std::chrono::nanoseconds &, int32_t) {
+        Delivered += Size;
+      },
+      nullptr);
+  std::string Buffer(100, 'x');
+  int Token;
+  Sender.sendSerialised(&Buffer[0], Buffer.size(),
+                        std::chrono::nanoseconds(0), &Token);
+  auto Received = receive(Receiver, 1);
+  ASSERT_EQ(Received.size(), 1u);
+  EXPECT_EQ(Received[0], Buffer);
+  for (int i = 0; i < 1000 && Sender.outqLen(); ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_EQ(Sender.poll(0), 1);
+  EXPECT_EQ(Released, 1);
+  EXPECT_EQ(Delivered, Buffer.size());
+}
+
+TEST(ZmqGenerator, unconfirmed_messages_are_only_sent) {
+  KafkaOptions Options{{"zmq.pattern", "pub"}};
+  Listener Receiver("inproc://unconfirmed", "topic", "", Options);
+  Listener Puller("inproc://unconfirmed-push", "topic", "", {});
+  Transmitter Publisher("inproc://unconfirmed", "topic", "source", Options);
+  Transmitter Copier("inproc://unconfirmed-push", "topic", "source");
+  size_t Delivered{0}, Sent{0};
+  for (auto Sender : {&Publisher, &Copier}) {
+    Sender->setDeliveryHooks(
+        [&](size_t Size, const std::chrono::nanoseconds &, int32_t) {
+          Delivered += Size;
+        },
+        nullptr, [&](size_t Size) { Sent += Size; });
+  }
+  // PUB may drop a buffer sent without copy, PUSH copies the others
+  std::string Buffer(100, 'x');
+  int Token;
+  Publisher.sendSerialised(&Buffer[0], Buffer.size(),
+                           std::chrono::nanoseconds(0), &Token);
+  std::vector<char> Message{'a', 'b', 'c'};
+  Copier.send(Message);
+  for (int i = 0; i < 1000 && Publisher.outqLen(); ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_EQ(Publisher.poll(0) + Copier.poll(0), 2);
+  EXPECT_EQ(Delivered, 0u);
+  EXPECT_EQ(Sent, Buffer.size() + Message.size());
+}
+
+TEST(ZmqGenerator, subscribers_get_their_topics_only) {
+  KafkaOptions Options{{"zmq.pattern", "pub"}};
+  Listener Receiver("inproc://pub-sub", "topic", "", Options);
+  Transmitter Other("inproc://pub-sub", "other", "source", Options);
+  Transmitter Sender("inproc://pub-sub", "topic", "source", Options);
+  // the subscriptions are forwarded while the receiver polls
+  ZmqMessageBatch Batch;
+  Receiver.consume(Batch, 1, 100);
+  std::vector<char> Message{'a'};
+  // received in order: the message of the other topic is dropped first
+  Other.send(Message);
+  Sender.send(Message);
+  auto Received = receive(Receiver, 1);
+  EXPECT_EQ(Received.size(), 1u);
+}
+
+TEST(ZmqGenerator, unknown_pattern_throws) {
+  KafkaOptions Options{{"zmq.pattern", "req"}};
+  EXPECT_THROW(Transmitter("inproc://unknown", "topic", "source", Options),
+               std::runtime_error);
+}
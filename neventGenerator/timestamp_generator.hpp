@@ -1,25 +1,99 @@
 #pragma once
 
+#include <algorithm>
 #include <chrono>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
-template <class T>
-void generateTimestamp(std::vector<T> &output, const uint32_t &rate,
-                       const std::chrono::nanoseconds &pulse_time,
-                       const std::string &generation_type) {
-  if (generation_type == "const_timestamp") {
-    std::fill(output.begin(), output.end(), pulse_time.count());
-    return;
-  }
-  if (generation_type == "random_timestamp") {
-    std::uniform_int_distribution<T> distribution{
-        0, static_cast<T>(std::llround(floor(1e-9 / rate)))};
-    std::default_random_engine engine;
-    std::generate(output.begin(), output.end(),
-                  std::bind(distribution, engine));
-    return;
-  }
-  if (generation_type == "none") {
-    return;
+#include "event_synthesis.hpp"
+
+namespace SINQAmorSim {
+
+enum class TimestampPolicy { none, const_timestamp, random_timestamp };
+
+inline TimestampPolicy Str2TimestampPolicy(const std::string &Value) {
+  if (Value == "none") {
+    return TimestampPolicy::none;
+  }
+  if (Value == "const_timestamp") {
+    return TimestampPolicy::const_timestamp;
+  }
+  if (Value == "random_timestamp") {
+    return TimestampPolicy::random_timestamp;
   }
   throw std::runtime_error("Unknown timestamp generation type");
 }
+
+/// Updates the ToF of the events of each pulse. The policy is resolved once
+/// in the constructor into the kernel applied to the ToF array:
+/// - none: leave the ToF untouched
+/// - const_timestamp: every event gets the pulse time
+/// - random_timestamp: ToF uniformly distributed within the pulse period
+/// Each thread must own its instance (random engine and scratch buffer).
+template <class T> class TimestampGenerator {
+public:
+  static const size_t BatchSize = 4096;
+
+  TimestampGenerator(const TimestampPolicy Policy, const double Rate,
+                     const uint64_t Seed = 0)
+      : Policy{Policy}, Engine{Seed} {
+    switch (Policy) {
+    case TimestampPolicy::none:
+      Kernel = &TimestampGenerator::noTimestamp;
+      break;
+    case TimestampPolicy::const_timestamp:
+      Kernel = &TimestampGenerator::constTimestamp;
+      break;
+    case TimestampPolicy::random_timestamp:
+      Kernel = &TimestampGenerator::randomTimestamp;
+      Random.resize(BatchSize);
+      break;
+    }
+    setRate(Rate);
+  }
+
+  bool enabled() const { return Policy != TimestampPolicy::none; }
+
+  /// Rate of the pulses, defines the range of the random ToF
+  void setRate(const double Rate) {
+    Period = Rate > 0 ? std::min(1e9 / Rate, 4294967295.0) : 0;
+  }
+
+  void operator()(T *Tof, const size_t Size,
+                  const std::chrono::nanoseconds &PulseTime) {
+    (this->*Kernel)(Tof, Size, PulseTime);
+  }
+
+private:
+  using kernel_t = void (TimestampGenerator::*)(T *, const size_t,
+                                               const std::chrono::nanoseconds &);
+  TimestampPolicy Policy;
+  kernel_t Kernel;
+  uint64_t Period{0};
+  LaneRandomEngine Engine;
+  std::vector<uint32_t> Random;
+
+  void noTimestamp(T *, const size_t, const std::chrono::nanoseconds &) {}
+
+  void constTimestamp(T *Tof, const size_t Size,
+                      const std::chrono::nanoseconds &PulseTime) {
+    std::fill(Tof, Tof + Size, static_cast<T>(PulseTime.count()));
+  }
+
+  void randomTimestamp(T *Tof, const size_t Size,
+                       const std::chrono::nanoseconds &) {
+    const uint64_t Range = Period;
+    for (size_t Start = 0; Start < Size; Start += BatchSize) {
+      size_t Batch = Size - Start < BatchSize ? Size - Start : BatchSize;
+      Engine.fill(Random.data(), Random.size());
+      const uint32_t *R = Random.data();
+      T *BatchTof = Tof + Start;
+      for (size_t i = 0; i < Batch; ++i) {
+        BatchTof[i] = static_cast<T>((R[i] * Range) >> 32);
+      }
+    }
+  }
+};
+
+} // namespace SINQAmorSim
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "load_profile.hpp"
+#include "pulse_scheduler.hpp"
+
+namespace SINQAmorSim {
+
+/// What the generator rate limit counts
+enum class RateUnit { messages, bytes, events };
+
+inline RateUnit Str2RateUnit(const std::string &Value) {
+  if (Value == "messages") {
+    return RateUnit::messages;
+  }
+  if (Value == "bytes") {
+    return RateUnit::bytes;
+  }
+  if (Value == "events") {
+    return RateUnit::events;
+  }
+  throw std::runtime_error("Unknown rate limit unit: " + Value);
+}
+
+/// Token bucket shared by the generator threads, stored as the time at
+/// which the bucket is empty (GCRA): tokens accrue at Rate per second and
+/// at most Burst worth of them are kept. A sender waits until the bucket
+/// is not in debt, sends, then takes the actual cost of the message, so
+/// that sizes need not be known in advance. Lock free; the rate can be
+/// changed at any time. A rate of zero disables the limit.
+class TokenBucket {
+  using steady_clock = std::chrono::steady_clock;
+  using nanoseconds = std::chrono::nanoseconds;
+
+public:
+  explicit TokenBucket(const double Rate = 0,
+                       const nanoseconds Burst = std::chrono::milliseconds(1))
+      : Burst{Burst.count()} {
+    setRate(Rate);
+  }
+
+  void setRate(const double Value) {
+    if (Value < 0) {
+      throw std::runtime_error("Rate limit must not be negative");
+    }
+    double Old = Rate.exchange(Value);
+    // the debt is in tokens: convert it to the new rate
+    int64_t Now = now();
+    int64_t Current = Empty.load();
+    if (Current > Now && Old > 0 && Value > 0) {
+      Empty.compare_exchange_strong(
+          Current, Now + int64_t((Current - Now) * Old / Value));
+    }
+  }
+  double rate() const { return Rate.load(); }
+  bool enabled() const { return rate() > 0; }
+
+  /// Block until the bucket is not in debt. The last SpinTime is
+  /// busy-waited. Returns how late the caller is released after the debt
+  /// is paid: zero if the bucket was not in debt after the last take, as
+  /// the time since then is spent by the senders, not by the bucket.
+  nanoseconds wait(const nanoseconds SpinTime = nanoseconds(0)) const {
+    if (!enabled()) {
+      return nanoseconds(0);
+    }
+    int64_t Due = Empty.load();
+    bool InDebt = Due > Taken.load();
+    auto Release = steady_clock::time_point(nanoseconds(Due));
+    auto Now = steady_clock::now();
+    if (Now < Release) {
+      if (Release - Now > SpinTime) {
+        std::this_thread::sleep_until(Release - SpinTime);
+      }
+      while ((Now = steady_clock::now()) < Release) {
+      }
+    }
+    if (!InDebt) {
+      return nanoseconds(0);
+    }
+    return std::chrono::duration_cast<nanoseconds>(Now - Release);
+  }
+
+  /// Take Tokens, possibly leaving the bucket in debt
+  void take(const uint64_t Tokens) {
+    double Current = rate();
+    if (Current <= 0) {
+      return;
+    }
+    int64_t Cost = int64_t(Tokens * 1e9 / Current);
+    int64_t Now = now();
+    int64_t Value = Empty.load();
+    while (!Empty.compare_exchange_weak(
+        Value, std::max(Value, Now - Burst) + Cost)) {
+    }
+    Taken.store(Now);
+  }
+
+private:
+  std::atomic<double> Rate{0};
+  int64_t Burst;
+  // steady clock time, in ns, at which the bucket holds no token
+  std::atomic<int64_t> Empty{now()};
+  // steady clock time, in ns, of the last take
+  std::atomic<int64_t> Taken{0};
+
+  static int64_t now() {
+    return std::chrono::duration_cast<nanoseconds>(
+               steady_clock::now().time_since_epoch())
+        .count();
+  }
+};
+
+/// Releases the pulses of a generator thread: with a rate limit as soon as
+/// the shared bucket allows, otherwise at the pulse rate of Scheduler. An
+/// empty pulse (e.g. paused) takes no token from the bucket, so it is always
+/// paced by the scheduler.
+class PulsePacer {
+  using nanoseconds = std::chrono::nanoseconds;
+
+public:
+  PulsePacer(PulseScheduler &Scheduler, TokenBucket &Limit,
+             const nanoseconds SpinTime = nanoseconds(0))
+      : Scheduler(Scheduler), Limit(Limit), SpinTime{SpinTime} {}
+
+  /// Block until the next pulse is due
+  void wait(const bool Empty) {
+    if (Limit.enabled() && !Empty) {
+      Lateness = Limit.wait(SpinTime);
+      PulseTime = std::chrono::duration_cast<nanoseconds>(
+          std::chrono::system_clock::now().time_since_epoch());
+      Limited = true;
+      return;
+    }
+    // the deadlines were not followed while the bucket paced the pulses
+    if (Limited) {
+      Scheduler.reset();
+      Limited = false;
+    }
+    Scheduler.wait();
+    PulseTime = Scheduler.pulseTime();
+    Lateness = Scheduler.lastLateness();
+  }
+
+  /// Block until the next pulse of a generator thread is due. Level
+  /// scales the pulse Rate and the RateLimit of the shared bucket; the
+  /// pulse is empty when not Running or with the beam off. Returns true
+  /// if the pulse is empty.
+  bool wait(const LoadLevel &Level, const double Rate, const double RateLimit,
+            const bool Running) {
+    if (Rate * Level.Rate != Scheduler.rate()) {
+      Scheduler.setRate(Rate * Level.Rate);
+    }
+    if (RateLimit * Level.Rate != Limit.rate()) {
+      Limit.setRate(RateLimit * Level.Rate);
+    }
+    const bool Empty = !Running || Level.Events <= 0;
+    wait(Empty);
+    return Empty;
+  }
+
+  /// Time of the pulse released by the last wait()
+  nanoseconds pulseTime() const { return PulseTime; }
+  /// How late the last wait() released the pulse
+  nanoseconds lateness() const { return Lateness; }
+
+private:
+  PulseScheduler &Scheduler;
+  TokenBucket &Limit;
+  nanoseconds SpinTime;
+  nanoseconds PulseTime{0};
+  nanoseconds Lateness{0};
+  bool Limited{false};
+};
+
+} // namespace SINQAmorSim
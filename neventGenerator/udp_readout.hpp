@@ -0,0 +1,531 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <nlohmann/json.hpp>
+
+#include "event_view.hpp"
+#include "memory_transmitter.hpp"
+
+namespace SINQAmorSim {
+
+/// Header of a readout packet, in host byte order. It is followed by
+/// NumEvents times of flight and NumEvents detector ids (uint32_t each).
+/// Sequence counts the packets of a sender (one socket, i.e. one source
+/// port), so that the receiver detects the lost ones; the Fragments
+/// packets of a pulse carry the same PulseId and PulseTime.
+struct UdpReadoutHeader {
+  uint32_t Magic;
+  uint16_t Version;
+  uint16_t NumEvents;
+  uint64_t Sequence;
+  int64_t PulseTime;
+  uint64_t PulseId;
+  uint32_t Fragment;
+  uint32_t Fragments;
+};
+static_assert(sizeof(UdpReadoutHeader) == 40, "UDP readout header layout");
+
+namespace UdpReadout {
+const uint32_t Magic = 0x55524d41; // "AMRU"
+const uint16_t Version = 1;
+const size_t EventBytes = 2 * sizeof(uint32_t);
+// payload of a 1500 bytes MTU: IPv4 and UDP headers take 28 bytes
+const size_t DefaultPacketBytes = 1472;
+const size_t MaxPacketBytes = 65507;
+// receive buffers keep the events aligned
+const size_t BufferStride = (MaxPacketBytes + 7) / 8 * 8;
+
+inline size_t eventsPerPacket(const size_t PacketBytes) {
+  if (PacketBytes < sizeof(UdpReadoutHeader) + EventBytes ||
+      PacketBytes > MaxPacketBytes) {
+    throw std::runtime_error("Invalid UDP packet size " +
+                             std::to_string(PacketBytes));
+  }
+  return (PacketBytes - sizeof(UdpReadoutHeader)) / EventBytes;
+}
+
+/// Socket bound to (Bind) or connected to host:port; the host may be empty
+/// when binding, an IPv6 address is given in brackets
+inline int socket(const std::string &Endpoint, const bool Bind) {
+  auto Colon = Endpoint.rfind(':');
+  if (Colon == std::string::npos || Colon + 1 == Endpoint.size()) {
+    throw std::runtime_error("UDP endpoint " + Endpoint +
+                             " is not host:port");
+  }
+  auto Host = Endpoint.substr(0, Colon);
+  auto Port = Endpoint.substr(Colon + 1);
+  if (Host.size() >= 2 && Host.front() == '[' && Host.back() == ']') {
+    Host = Host.substr(1, Host.size() - 2);
+  }
+  addrinfo Hints;
+  std::memset(&Hints, 0, sizeof(Hints));
+  Hints.ai_family = AF_UNSPEC;
+  Hints.ai_socktype = SOCK_DGRAM;
+  Hints.ai_flags = Bind ? AI_PASSIVE : 0;
+  addrinfo *Addresses{nullptr};
+  int Error = getaddrinfo(Host.empty() ? nullptr : Host.c_str(),
+                          Port.c_str(), &Hints, &Addresses);
+  if (Error) {
+    throw std::runtime_error("Can't resolve " + Endpoint + ": " +
+                             gai_strerror(Error));
+  }
+  int Result{-1};
+  for (auto Address = Addresses; Address; Address = Address->ai_next) {
+    Result = ::socket(Address->ai_family, Address->ai_socktype,
+                      Address->ai_protocol);
+    if (Result < 0) {
+      Error = errno;
+      continue;
+    }
+    if (!(Bind ? ::bind(Result, Address->ai_addr, Address->ai_addrlen)
+               : ::connect(Result, Address->ai_addr, Address->ai_addrlen))) {
+      break;
+    }
+    Error = errno;
+    ::close(Result);
+    Result = -1;
+  }
+  freeaddrinfo(Addresses);
+  if (Result < 0) {
+    const std::string What = Bind ? "Can't bind " : "Can't reach ";
+    throw std::runtime_error(What + Endpoint + ": " + std::strerror(Error));
+  }
+  return Result;
+}
+
+/// Counters of the kernel for all the UDP sockets of the host, from
+/// /proc/net/snmp: the drops on loopback show up as receive buffer errors
+inline std::map<std::string, uint64_t> kernelCounters() {
+  std::ifstream Snmp("/proc/net/snmp");
+  std::string Names, Values;
+  std::map<std::string, uint64_t> Result;
+  while (std::getline(Snmp, Names)) {
+    if (Names.compare(0, 4, "Udp:") || !std::getline(Snmp, Values)) {
+      continue;
+    }
+    std::istringstream NameStream(Names.substr(4)),
+        ValueStream(Values.substr(4));
+    std::string Name;
+    uint64_t Value;
+    while (NameStream >> Name && ValueStream >> Value) {
+      Result[Name] = Value;
+    }
+    break;
+  }
+  return Result;
+}
+} // namespace UdpReadout
+
+/// Packets sent by all the UDP senders of the process, for the statistics.
+/// The senders add their totals after each batch; report() returns the
+/// rates since the previous call.
+class UdpCounters {
+  using steady_clock = std::chrono::steady_clock;
+
+public:
+  static UdpCounters &instance() {
+    static UdpCounters Counters;
+    return Counters;
+  }
+
+  void sent(const uint64_t NumPackets, const uint64_t NumBytes,
+            const uint64_t NumDropped) {
+    Packets.fetch_add(NumPackets, std::memory_order_relaxed);
+    Bytes.fetch_add(NumBytes, std::memory_order_relaxed);
+    Dropped.fetch_add(NumDropped, std::memory_order_relaxed);
+    Batches.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  nlohmann::json report() {
+    auto Now = steady_clock::now();
+    double Elapsed = std::chrono::duration<double>(Now - Last).count();
+    Last = Now;
+    uint64_t NowPackets = Packets, NowBytes = Bytes, NowDropped = Dropped,
+             NowBatches = Batches;
+    auto Kernel = UdpReadout::kernelCounters();
+    nlohmann::json Result;
+    Result["packets"] = NowPackets - PreviousPackets;
+    Result["packets/s"] = (NowPackets - PreviousPackets) / Elapsed;
+    Result["Gbit/s"] = (NowBytes - PreviousBytes) * 8e-9 / Elapsed;
+    Result["packets/batch"] =
+        NowBatches > PreviousBatches
+            ? double(NowPackets - PreviousPackets) /
+                  (NowBatches - PreviousBatches)
+            : 0.0;
+    Result["dropped"] = NowDropped - PreviousDropped;
+    Result["rcvbuf_errors"] =
+        Kernel["RcvbufErrors"] - PreviousKernel["RcvbufErrors"];
+    Result["sndbuf_errors"] =
+        Kernel["SndbufErrors"] - PreviousKernel["SndbufErrors"];
+    PreviousPackets = NowPackets;
+    PreviousBytes = NowBytes;
+    PreviousDropped = NowDropped;
+    PreviousBatches = NowBatches;
+    PreviousKernel = std::move(Kernel);
+    return Result;
+  }
+
+private:
+  UdpCounters()
+      : Last{steady_clock::now()},
+        PreviousKernel{UdpReadout::kernelCounters()} {}
+
+  std::atomic<uint64_t> Packets{0};
+  std::atomic<uint64_t> Bytes{0};
+  std::atomic<uint64_t> Dropped{0};
+  std::atomic<uint64_t> Batches{0};
+  // used by report() only
+  steady_clock::time_point Last;
+  uint64_t PreviousPackets{0};
+  uint64_t PreviousBytes{0};
+  uint64_t PreviousDropped{0};
+  uint64_t PreviousBatches{0};
+  std::map<std::string, uint64_t> PreviousKernel;
+};
+
+/// Splits the events of each pulse into readout packets of at most
+/// PacketBytes and sends them to host:port, up to Batch packets per
+/// sendmmsg. The packets are gathered from the header and the event
+/// arrays of the caller, the events are copied only by the kernel. The
+/// socket blocks when its buffer is full; a packet the kernel refuses
+/// (no receiver, no buffer space) is dropped and counted.
+class UdpReadoutSender {
+public:
+  UdpReadoutSender(const std::string &Endpoint,
+                   const size_t PacketBytes = UdpReadout::DefaultPacketBytes,
+                   const size_t Batch = 64, const int SendBuffer = 0)
+      : Endpoint{Endpoint},
+        EventsPerPacket{UdpReadout::eventsPerPacket(PacketBytes)},
+        Headers(std::max<size_t>(Batch, 1)), Vectors(3 * Headers.size()),
+        Messages(Headers.size()) {
+    Socket = UdpReadout::socket(Endpoint, false);
+    if (SendBuffer > 0) {
+      setsockopt(Socket, SOL_SOCKET, SO_SNDBUF, &SendBuffer,
+                 sizeof(SendBuffer));
+    }
+    std::memset(Messages.data(), 0, Messages.size() * sizeof(mmsghdr));
+    for (size_t i = 0; i < Messages.size(); ++i) {
+      Messages[i].msg_hdr.msg_iov = &Vectors[3 * i];
+      Messages[i].msg_hdr.msg_iovlen = 3;
+    }
+  }
+  UdpReadoutSender(const UdpReadoutSender &) = delete;
+  UdpReadoutSender &operator=(const UdpReadoutSender &) = delete;
+  ~UdpReadoutSender() { ::close(Socket); }
+
+  /// Send the events of a pulse, as many packets as needed (one without
+  /// events if there are none). The arrays may be released on return.
+  void send(const uint64_t PulseId, const std::chrono::nanoseconds &PulseTime,
+            const Span<uint32_t> &TimeOfFlight,
+            const Span<uint32_t> &DetectorId) {
+    const size_t NumEvents =
+        std::min(TimeOfFlight.size(), DetectorId.size());
+    const size_t Fragments =
+        std::max<size_t>(1, (NumEvents + EventsPerPacket - 1) /
+                                EventsPerPacket);
+    size_t Event{0};
+    for (size_t Fragment = 0; Fragment < Fragments; ++Fragment) {
+      const size_t Count = std::min(EventsPerPacket, NumEvents - Event);
+      auto &Header = Headers[Used];
+      Header = UdpReadoutHeader{UdpReadout::Magic,
+                                UdpReadout::Version,
+                                uint16_t(Count),
+                                Sequence++,
+                                int64_t(PulseTime.count()),
+                                PulseId,
+                                uint32_t(Fragment),
+                                uint32_t(Fragments)};
+      iovec *Vector = &Vectors[3 * Used];
+      Vector[0] = iovec{&Header, sizeof(Header)};
+      Vector[1] = iovec{const_cast<uint32_t *>(TimeOfFlight.data() + Event),
+                        Count * sizeof(uint32_t)};
+      Vector[2] = iovec{const_cast<uint32_t *>(DetectorId.data() + Event),
+                        Count * sizeof(uint32_t)};
+      Event += Count;
+      if (++Used == Headers.size()) {
+        flush();
+      }
+    }
+    flush();
+  }
+
+  uint64_t packets() const { return Sequence; }
+  size_t eventsPerPacket() const { return EventsPerPacket; }
+
+  /// Bytes sent for a pulse of NumEvents events, headers included
+  size_t bytes(const size_t NumEvents) const {
+    const size_t Fragments =
+        std::max<size_t>(1, (NumEvents + EventsPerPacket - 1) /
+                                EventsPerPacket);
+    return Fragments * sizeof(UdpReadoutHeader) +
+           NumEvents * UdpReadout::EventBytes;
+  }
+
+private:
+  std::string Endpoint;
+  size_t EventsPerPacket;
+  std::vector<UdpReadoutHeader> Headers;
+  std::vector<iovec> Vectors;
+  std::vector<mmsghdr> Messages;
+  size_t Used{0};
+  uint64_t Sequence{0};
+  int Socket{-1};
+
+  void flush() {
+    size_t Sent{0}, Dropped{0}, Bytes{0};
+    while (Sent < Used) {
+      int Result = sendmmsg(Socket, &Messages[Sent], Used - Sent, 0);
+      if (Result < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        if (errno == ECONNREFUSED || errno == ENOBUFS || errno == EAGAIN) {
+          ++Dropped;
+          ++Sent;
+          continue;
+        }
+        Used = 0;
+        throw std::runtime_error("Error sending to " + Endpoint + ": " +
+                                 std::strerror(errno));
+      }
+      for (size_t i = Sent; i < Sent + Result; ++i) {
+        Bytes += Messages[i].msg_len;
+      }
+      Sent += Result;
+    }
+    if (Used > 0) {
+      UdpCounters::instance().sent(Used - Dropped, Bytes, Dropped);
+    }
+    Used = 0;
+  }
+};
+
+/// A readout packet read in place, valid until the next receive()
+struct UdpReadoutView {
+  UdpReadoutHeader Header;
+  Span<uint32_t> TimeOfFlight;
+  Span<uint32_t> DetectorId;
+};
+
+/// Receives the readout packets on host:port (the host may be empty, the
+/// port 0 for any free port) with recvmmsg, as the event formation units
+/// do, and counts the packets lost by each sender from the gaps in its
+/// sequence numbers.
+class UdpReadoutReceiver {
+public:
+  explicit UdpReadoutReceiver(const std::string &Endpoint,
+                              const size_t Batch = 64,
+                              const int ReceiveBuffer = 8 << 20)
+      : Buffers(std::max<size_t>(Batch, 1) * UdpReadout::BufferStride),
+        Vectors(std::max<size_t>(Batch, 1)), Messages(Vectors.size()),
+        Senders(Vectors.size()), Packets(Vectors.size()) {
+    Socket = UdpReadout::socket(Endpoint, true);
+    setsockopt(Socket, SOL_SOCKET, SO_RCVBUF, &ReceiveBuffer,
+               sizeof(ReceiveBuffer));
+    std::memset(Messages.data(), 0, Messages.size() * sizeof(mmsghdr));
+    for (size_t i = 0; i < Messages.size(); ++i) {
+      Vectors[i] = iovec{&Buffers[i * UdpReadout::BufferStride],
+                         UdpReadout::MaxPacketBytes};
+      Messages[i].msg_hdr.msg_iov = &Vectors[i];
+      Messages[i].msg_hdr.msg_iovlen = 1;
+    }
+  }
+  UdpReadoutReceiver(const UdpReadoutReceiver &) = delete;
+  UdpReadoutReceiver &operator=(const UdpReadoutReceiver &) = delete;
+  ~UdpReadoutReceiver() { ::close(Socket); }
+
+  /// The local port, e.g. when bound to port 0
+  int port() const {
+    sockaddr_storage Address;
+    socklen_t Length = sizeof(Address);
+    getsockname(Socket, reinterpret_cast<sockaddr *>(&Address), &Length);
+    char Port[NI_MAXSERV];
+    getnameinfo(reinterpret_cast<sockaddr *>(&Address), Length, nullptr, 0,
+                Port, sizeof(Port), NI_NUMERICSERV);
+    return std::stoi(Port);
+  }
+
+  /// Receive up to Batch packets, waiting at most TimeoutMs for the first
+  /// one; returns the number of valid packets, read with packet()
+  size_t receive(const int TimeoutMs) {
+    NumPackets = 0;
+    pollfd Ready{Socket, POLLIN, 0};
+    if (::poll(&Ready, 1, TimeoutMs) <= 0) {
+      return 0;
+    }
+    for (size_t i = 0; i < Messages.size(); ++i) {
+      Messages[i].msg_hdr.msg_name = &Senders[i];
+      Messages[i].msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+    }
+    int Result =
+        recvmmsg(Socket, Messages.data(), Messages.size(), MSG_DONTWAIT,
+                 nullptr);
+    if (Result < 0) {
+      if (errno == EAGAIN || errno == EINTR) {
+        return 0;
+      }
+      throw std::runtime_error(std::string("Error receiving: ") +
+                               std::strerror(errno));
+    }
+    for (int i = 0; i < Result; ++i) {
+      auto &View = Packets[NumPackets];
+      if (!decode(Messages[i], View)) {
+        ++Invalid;
+        continue;
+      }
+      auto &Expected = NextSequence[sender(Messages[i])];
+      if (View.Header.Sequence > Expected) {
+        Lost += View.Header.Sequence - Expected;
+      }
+      Expected = std::max(Expected, View.Header.Sequence + 1);
+      Events += View.Header.NumEvents;
+      ++NumPackets;
+    }
+    Received += NumPackets;
+    return NumPackets;
+  }
+
+  const UdpReadoutView &packet(const size_t i) const { return Packets[i]; }
+
+  uint64_t packets() const { return Received; }
+  uint64_t events() const { return Events; }
+  uint64_t lost() const { return Lost; }
+  uint64_t invalid() const { return Invalid; }
+
+private:
+  std::vector<char> Buffers;
+  std::vector<iovec> Vectors;
+  std::vector<mmsghdr> Messages;
+  std::vector<sockaddr_storage> Senders;
+  std::vector<UdpReadoutView> Packets;
+  size_t NumPackets{0};
+  std::map<std::string, uint64_t> NextSequence;
+  uint64_t Received{0};
+  uint64_t Events{0};
+  uint64_t Lost{0};
+  uint64_t Invalid{0};
+  int Socket{-1};
+
+  static std::string sender(const mmsghdr &Message) {
+    return std::string(static_cast<const char *>(Message.msg_hdr.msg_name),
+                       Message.msg_hdr.msg_namelen);
+  }
+
+  static bool decode(const mmsghdr &Message, UdpReadoutView &View) {
+    auto Data = static_cast<const char *>(Message.msg_hdr.msg_iov->iov_base);
+    if (Message.msg_len < sizeof(UdpReadoutHeader)) {
+      return false;
+    }
+    std::memcpy(&View.Header, Data, sizeof(UdpReadoutHeader));
+    const size_t NumEvents = View.Header.NumEvents;
+    if (View.Header.Magic != UdpReadout::Magic ||
+        View.Header.Version != UdpReadout::Version ||
+        Message.msg_len !=
+            sizeof(UdpReadoutHeader) + NumEvents * UdpReadout::EventBytes) {
+      return false;
+    }
+    auto Events =
+        reinterpret_cast<const uint32_t *>(Data + sizeof(UdpReadoutHeader));
+    View.TimeOfFlight = Span<uint32_t>(Events, NumEvents);
+    View.DetectorId = Span<uint32_t>(Events + NumEvents, NumEvents);
+    return true;
+  }
+};
+
+/// Emulates the detector readout: the events of each pulse are sent as raw
+/// UDP readout packets to the endpoint given in place of the brokers, the
+/// topic is not used. The options udp.packet.bytes (default 1472, up to
+/// 8972 for jumbo frames on a 9000 bytes MTU), udp.batch (packets per
+/// sendmmsg, default 64) and udp.sndbuf (socket buffer, by default the
+/// system's) tune the sender. The packets point into the event arrays of
+/// the pulse, no ev42 message is built; serialised messages (e.g. the
+/// recordings replayed) are read in place.
+template <class Serialiser>
+class UdpTransmitter : public LocalTransmitter<Serialiser> {
+public:
+  UdpTransmitter(const std::string &Endpoint, const std::string &TopicName,
+                 const std::string &SourceName,
+                 const KafkaOptions &Options = {})
+      : LocalTransmitter<Serialiser>(Endpoint, TopicName, SourceName,
+                                     Options),
+        Sender{Endpoint,
+               findSizeOption(Options, "udp.packet.bytes",
+                              UdpReadout::DefaultPacketBytes),
+               findSizeOption(Options, "udp.batch", 64),
+               int(findSizeOption(Options, "udp.sndbuf", 0))} {}
+
+  using LocalTransmitter<Serialiser>::send;
+
+  /// Events holds the times of flight followed by the detector ids
+  template <class EventArray>
+  size_t send(const uint64_t &PacketID,
+              const std::chrono::nanoseconds &PulseTime,
+              const EventArray &Events, const int NumEvents = 1) {
+    if (!NumEvents) {
+      return 0;
+    }
+    return sendEvents(PacketID, PulseTime, Events,
+                      std::is_same<typename EventArray::value_type,
+                                   uint32_t>());
+  }
+
+protected:
+  bool write(const void *Data, const size_t Size,
+             const std::chrono::nanoseconds &PulseTime) override {
+    EventMessageView View;
+    if (!decodeView(Data, Size, View)) {
+      throw std::runtime_error("Invalid message for " + this->Topic);
+    }
+    Sender.send(View.MessageID, PulseTime, View.TimeOfFlight,
+                View.DetectorId);
+    return true;
+  }
+
+private:
+  UdpReadoutSender Sender;
+
+  template <class EventArray>
+  size_t sendEvents(const uint64_t PacketID,
+                    const std::chrono::nanoseconds &PulseTime,
+                    const EventArray &Events, std::true_type) {
+    const size_t NumEvents = Events.size() / 2;
+    const Span<uint32_t> TimeOfFlight(Events.data(), NumEvents);
+    const Span<uint32_t> DetectorId(Events.data() + NumEvents, NumEvents);
+    return this->transmit(Sender.bytes(NumEvents), nullptr, [&]() {
+      Sender.send(PacketID, PulseTime, TimeOfFlight, DetectorId);
+      return true;
+    });
+  }
+
+  // the readout has 32 bits fields: other events go through ev42
+  template <class EventArray>
+  size_t sendEvents(const uint64_t PacketID,
+                    const std::chrono::nanoseconds &PulseTime,
+                    const EventArray &Events, std::false_type) {
+    return LocalTransmitter<Serialiser>::send(PacketID, PulseTime, Events);
+  }
+};
+
+} // namespace SINQAmorSim
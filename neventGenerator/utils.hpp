@@ -12,4 +12,24 @@ using ESSformat = StreamFormat<uint32_t>;
 
 using KafkaOptions = std::vector<std::pair<std::string, std::string>>;
 
+/// Value of Key in the options, Default if not set. The transports other
+/// than Kafka read their settings from the same list.
+inline std::string findOption(const KafkaOptions &Options,
+                              const std::string &Key,
+                              const std::string &Default) {
+  for (auto &Option : Options) {
+    if (Option.first == Key) {
+      return Option.second;
+    }
+  }
+  return Default;
+}
+
+/// As findOption, for a size or a count
+inline size_t findSizeOption(const KafkaOptions &Options,
+                             const std::string &Key, const size_t Default) {
+  auto Value = findOption(Options, Key, "");
+  return Value.empty() ? Default : std::stoull(Value);
+}
+
 } // namespace SINQAmorSim
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace SINQAmorSim {
+
+/// Fixed set of threads, each with its own task queue. A task is pushed to
+/// the queue of a given worker (its home, for cache locality); a worker runs
+/// the tasks of its queue in order and, when it is empty, steals from the
+/// back of the queues of the others. The destructor runs the tasks still
+/// queued before joining the threads.
+class WorkStealingPool {
+public:
+  using task_t = std::function<void()>;
+
+  /// Init(Id) runs first on each worker, e.g. to set its CPU affinity
+  explicit WorkStealingPool(const int NumWorkers,
+                            std::function<void(size_t)> Init = nullptr)
+      : Init{std::move(Init)} {
+    for (int i = 0; i < NumWorkers; ++i) {
+      Queues.emplace_back(new Queue);
+    }
+    for (int i = 0; i < NumWorkers; ++i) {
+      Workers.emplace_back(&WorkStealingPool::work, this, i);
+    }
+  }
+  WorkStealingPool(const WorkStealingPool &) = delete;
+  WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+  ~WorkStealingPool() {
+    {
+      std::lock_guard<std::mutex> Lock(SleepGuard);
+      Stopping = true;
+    }
+    Wake.notify_all();
+    for (auto &Worker : Workers) {
+      Worker.join();
+    }
+  }
+
+  /// Queue Task on worker Home % size()
+  void push(task_t Task, const size_t Home) {
+    auto &Target = *Queues[Home % Queues.size()];
+    {
+      std::lock_guard<std::mutex> Lock(Target.Guard);
+      Target.Tasks.push_back(std::move(Task));
+    }
+    {
+      std::lock_guard<std::mutex> Lock(SleepGuard);
+      ++Pending;
+    }
+    Wake.notify_one();
+  }
+
+  size_t size() const { return Workers.size(); }
+  /// Tasks run by a worker other than their home
+  uint64_t steals() const { return Steals.load(); }
+
+private:
+  struct Queue {
+    std::mutex Guard;
+    std::deque<task_t> Tasks;
+  };
+
+  std::function<void(size_t)> Init;
+  std::vector<std::unique_ptr<Queue>> Queues;
+  std::vector<std::thread> Workers;
+  std::mutex SleepGuard;
+  std::condition_variable Wake;
+  // tasks queued and not yet taken, guarded by SleepGuard
+  size_t Pending{0};
+  bool Stopping{false};
+  std::atomic<uint64_t> Steals{0};
+
+  bool take(Queue &From, task_t &Task, const bool Front) {
+    std::lock_guard<std::mutex> Lock(From.Guard);
+    if (From.Tasks.empty()) {
+      return false;
+    }
+    if (Front) {
+      Task = std::move(From.Tasks.front());
+      From.Tasks.pop_front();
+    } else {
+      Task = std::move(From.Tasks.back());
+      From.Tasks.pop_back();
+    }
+    return true;
+  }
+
+  bool next(const size_t Id, task_t &Task) {
+    if (take(*Queues[Id], Task, true)) {
+      return true;
+    }
+    for (size_t i = 1; i < Queues.size(); ++i) {
+      if (take(*Queues[(Id + i) % Queues.size()], Task, false)) {
+        ++Steals;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void work(const size_t Id) {
+    task_t Task;
+    if (Init) {
+      Init(Id);
+    }
+    while (true) {
+      {
+        std::unique_lock<std::mutex> Lock(SleepGuard);
+        Wake.wait(Lock, [this]() { return Stopping || Pending; });
+        if (!Pending) {
+          return;
+        }
+        --Pending;
+      }
+      // a task is reserved for this worker: some queue holds it
+      while (!next(Id, Task)) {
+        std::this_thread::yield();
+      }
+      Task();
+    }
+  }
+};
+
+} // namespace SINQAmorSim
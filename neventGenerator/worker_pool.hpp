@@ -0,0 +1,77 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace SINQAmorSim {
+
+/// Fixed set of threads processing the items pushed in a bounded queue.
+/// push() blocks while the queue is full, so a slow pool slows down the
+/// producer instead of growing without limit. The destructor processes the
+/// items still queued before joining the threads.
+template <class Item> class WorkerPool {
+public:
+  /// Handler(item, worker id), worker id in [0, NumWorkers)
+  using handler_t = std::function<void(Item &, const int)>;
+
+  WorkerPool(const int NumWorkers, handler_t Handler, const size_t Capacity)
+      : Handler{std::move(Handler)}, Capacity{Capacity ? Capacity : 1} {
+    for (int i = 0; i < NumWorkers; ++i) {
+      Workers.emplace_back(&WorkerPool::work, this, i);
+    }
+  }
+  WorkerPool(const WorkerPool &) = delete;
+  WorkerPool &operator=(const WorkerPool &) = delete;
+
+  ~WorkerPool() {
+    {
+      std::lock_guard<std::mutex> Lock(Guard);
+      Stopping = true;
+    }
+    NotEmpty.notify_all();
+    for (auto &Worker : Workers) {
+      Worker.join();
+    }
+  }
+
+  void push(Item &&Value) {
+    std::unique_lock<std::mutex> Lock(Guard);
+    NotFull.wait(Lock, [this]() { return Queue.size() < Capacity; });
+    Queue.push_back(std::move(Value));
+    Lock.unlock();
+    NotEmpty.notify_one();
+  }
+
+  size_t size() const { return Workers.size(); }
+
+private:
+  handler_t Handler;
+  size_t Capacity;
+  std::vector<std::thread> Workers;
+  std::deque<Item> Queue;
+  std::mutex Guard;
+  std::condition_variable NotEmpty;
+  std::condition_variable NotFull;
+  bool Stopping{false};
+
+  void work(const int Id) {
+    while (true) {
+      std::unique_lock<std::mutex> Lock(Guard);
+      NotEmpty.wait(Lock, [this]() { return Stopping || !Queue.empty(); });
+      if (Queue.empty()) {
+        return;
+      }
+      Item Value = std::move(Queue.front());
+      Queue.pop_front();
+      Lock.unlock();
+      NotFull.notify_one();
+      Handler(Value, Id);
+    }
+  }
+};
+
+} // namespace SINQAmorSim
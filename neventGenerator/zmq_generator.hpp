@@ -1,164 +1,474 @@
 #pragma once
 
-#include <assert.h>
-#include <exception>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
 #include <sstream>
+#include <stdexcept>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <zmq.h>
 
-#include "header.hpp"
+#include "flow_control.hpp"
+#include "kafka_generator.hpp"
+#include "ring_buffer.hpp"
 #include "serialiser.hpp"
+#include "utils.hpp"
 
-namespace generator {
-
-/*! \struct ZmqGen
- *  Uses 0MQ as data the streamer.
- *
- *  \author Michele Brambilla <mib.mic@gmail.com>
- *  \date Wed Jun 08 15:19:27 2016
- * @tparam mode_selector transmitter = 0, receiver = 1
- */
-template <int mode_selector> struct ZmqGen {
-  static const int max_header_size = 10000;
-  static const int max_recv_size = 100000000;
-
-  ZmqGen(const std::string &SocketAddress) {
-    context = zmq_ctx_new();
-    int rc;
-    if (!mode_selector) {
-      socket = zmq_socket(context, ZMQ_PUSH);
-      std::cout << "tcp://" << SocketAddress << "\n";
-      rc = zmq_bind(socket, ("tcp://" + SocketAddress).c_str());
-      //    socket.setsockopt(zmq::SNDHWM, 100);
-    } else {
-      socket = zmq_socket(context, ZMQ_PULL);
-      std::cout << "tcp://" << SocketAddress << "\n";
-      rc = zmq_connect(socket, ("tcp://" + SocketAddress).c_str());
-    }
-    assert(rc == 0);
-  }
-
-  /// \brief
-  template <typename T> void send(const T *data, int size, const int flag = 0) {
-    /*! @tparam T data type
-     *  @param data data to be sent
-     *  @param size number of elements
-     *  @param flag optional flag (default = 0) */
-    // std::cout << "->" << data
-    //           << "," << size
-    //           << std::endl;
-    zmq_send(socket, data, size, flag);
-    // std::cout << std::endl;
-  }
-
-  template <typename T>
-  void send(std::string h, T *data, int nev, SINQAmorSim::NoSerialiser<T>) {
-    /*! @tparam T data type
-     *  @param h data header
-     *  @param data pointer to data array to be sent
-     *  @param nev number of elements in data array */
-    /*! Sends two different messages for header and data. If there are no
-        events, data is not sent */
-
-    if (nev > 0) {
-      zmq_send(socket, &h[0], h.size(), ZMQ_SNDMORE);
-      zmq_send(socket, data, nev * sizeof(T), 0);
+namespace SINQAmorSim {
+
+/// Context shared by all the sockets of the process, so that inproc://
+/// endpoints connect transmitters and listeners of the same process
+inline void *zmqContext() {
+  static std::unique_ptr<void, int (*)(void *)> Context{zmq_ctx_new(),
+                                                        zmq_ctx_term};
+  if (!Context) {
+    throw std::runtime_error("Can't create the 0MQ context");
+  }
+  return Context.get();
+}
+
+inline std::runtime_error zmqError(const std::string &What) {
+  return std::runtime_error(What + ": " + zmq_strerror(zmq_errno()));
+}
+
+/// Socket type of the sending side for the zmq.pattern option (push or
+/// pub), or of the receiving side if Receiver
+inline int zmqSocketType(const KafkaOptions &Options, const bool Receiver) {
+  auto Pattern = findOption(Options, "zmq.pattern", "push");
+  if (Pattern == "push") {
+    return Receiver ? ZMQ_PULL : ZMQ_PUSH;
+  }
+  if (Pattern == "pub") {
+    return Receiver ? ZMQ_SUB : ZMQ_PUB;
+  }
+  throw std::runtime_error("Unknown 0MQ pattern " + Pattern);
+}
+
+/// Sends the messages of a topic over 0MQ, with the interface of
+/// KafkaTransmitter. The endpoint (tcp://, ipc:// or inproc://) takes the
+/// place of the brokers; the transmitters connect to it, the listener
+/// binds it. A message is made of two frames, the topic and the ev42
+/// buffer. Buffers owned by a pool are sent without copy: the free
+/// callback of 0MQ returns them to the pool (from the 0MQ I/O thread, the
+/// pools are thread safe) and queues the completion, reported by the next
+/// poll() as the Kafka delivery reports. PUSH blocks when the peer is
+/// slow, PUB drops the messages beyond the high water mark (zmq.hwm).
+/// Only the release of a buffer sent without copy on PUSH is reported as
+/// a delivery; the copied messages, and all those of PUB, which releases
+/// the dropped ones too, are only reported as sent.
+template <class Serialiser> class ZmqTransmitter {
+  using steady_clock = std::chrono::steady_clock;
+  using nanoseconds = std::chrono::nanoseconds;
+
+public:
+  using delivered_t = std::function<void(size_t, const nanoseconds &, int32_t)>;
+
+  ZmqTransmitter(const std::string &Endpoint, const std::string &TopicName,
+                 const std::string &SourceName,
+                 const KafkaOptions &Options = {})
+      : Topic{TopicName}, SerialiserWorker{new Serialiser{SourceName}},
+        Sink{std::make_shared<Completions>()} {
+    if (Topic.empty()) {
+      throw std::runtime_error("Topic not set");
+    }
+    auto Type = zmqSocketType(Options, false);
+    Confirmed = Type == ZMQ_PUSH;
+    Socket = zmq_socket(zmqContext(), Type);
+    if (!Socket) {
+      throw zmqError("Can't create the 0MQ socket");
+    }
+    int HighWaterMark = int(findSizeOption(Options, "zmq.hwm", 1000));
+    zmq_setsockopt(Socket, ZMQ_SNDHWM, &HighWaterMark, sizeof(int));
+    if (zmq_connect(Socket, Endpoint.c_str())) {
+      zmq_close(Socket);
+      throw zmqError("Can't connect to " + Endpoint);
+    }
+    auto Worker = SerialiserWorker.get();
+    Sink->Release = [Worker](void *Opaque) {
+      releaseMessage(*Worker, Opaque);
+    };
+  }
+  ZmqTransmitter(const ZmqTransmitter &) = delete;
+  ZmqTransmitter &operator=(const ZmqTransmitter &) = delete;
+
+  /// Wait up to FlushTimeout for 0MQ to release the buffers in flight
+  ~ZmqTransmitter() {
+    auto Start = steady_clock::now();
+    while (Sink->Outstanding && steady_clock::now() - Start < FlushTimeout) {
+      poll(0);
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    poll(0);
+    if (Sink->Outstanding) {
+      std::cout << "Warning: " << Sink->Outstanding
+                << " messages not sent to " << Topic << "\n";
+      // the serialiser is gone: the late buffers are not returned
+      std::lock_guard<std::mutex> Lock(Sink->Guard);
+      Sink->Release = nullptr;
+    }
+    int Linger{0};
+    zmq_setsockopt(Socket, ZMQ_LINGER, &Linger, sizeof(int));
+    zmq_close(Socket);
+  }
+
+  template <typename T> size_t send(std::vector<T> &Data, const int = -1) {
+    return transmit(Data.data(), Data.size() * sizeof(T), nullptr);
+  }
+
+  template <class EventArray>
+  size_t send(const uint64_t &PacketID, const nanoseconds &PulseTime,
+              const EventArray &Events, const int NumEvents = 1) {
+    if (!NumEvents) {
+      return 0;
+    }
+    auto Message =
+        serialiseMessage(*SerialiserWorker, PacketID, PulseTime, Events);
+    return transmit(Message.Data, Message.Size, Message.Opaque);
+  }
+
+  /// As KafkaTransmitter::sendSerialised
+  size_t sendSerialised(void *Data, const size_t Size, const nanoseconds &,
+                        void *Opaque) {
+    return transmit(Data, Size, Opaque);
+  }
+
+  /// Report the messages released by 0MQ since the last call. Never waits.
+  int poll(const int = -1) {
+    {
+      std::lock_guard<std::mutex> Lock(Sink->Guard);
+      Done.swap(Sink->Done);
+    }
+    for (auto &Item : Done) {
+      ++NumMessages;
+      Mbytes += Item.Size * 1e-6;
+      if (Item.Confirmed) {
+        if (Delivered) {
+          Delivered(Item.Size, Item.Released - Item.Sent, 0);
+        }
+      } else if (SentHook) {
+        SentHook(Item.Size);
+      }
+      Flow.completed(Item.Size);
+    }
+    int Result = Done.size();
+    Done.clear();
+    return Result;
+  }
+  int outqLen() { return Sink->Outstanding; }
+
+  double &getNumMessages() { return NumMessages; }
+  double &getMbytes() { return Mbytes; }
+
+  int numPartitions() const { return 1; }
+  void setPartitioner(const Partitioner &) {}
+
+  void setFlowControl(const size_t MaxMessages, const size_t MaxBytes,
+                      std::function<void(const nanoseconds &)> Blocked =
+                          nullptr) {
+    Flow.setLimits(MaxMessages, MaxBytes);
+    BlockedHook = std::move(Blocked);
+  }
+
+  /// As KafkaTransmitter::setDeliveryHooks. Sent is run for the messages
+  /// 0MQ can't confirm: copied, or sent on PUB.
+  void setDeliveryHooks(delivered_t DeliveredHook, std::function<void()>,
+                        std::function<void(size_t)> Sent = nullptr) {
+    Delivered = std::move(DeliveredHook);
+    SentHook = std::move(Sent);
+  }
+
+  /// As KafkaTransmitter::setRelease. Called from the 0MQ I/O thread.
+  void setRelease(std::function<void(void *)> Release) {
+    std::lock_guard<std::mutex> Lock(Sink->Guard);
+    Sink->Release = std::move(Release);
+  }
+
+private:
+  struct Completion {
+    size_t Size;
+    steady_clock::time_point Sent;
+    steady_clock::time_point Released;
+    bool Confirmed;
+  };
+
+  /// Shared with the free callbacks, which may run after the transmitter
+  /// has given up waiting for them
+  struct Completions {
+    std::mutex Guard;
+    std::vector<Completion> Done;
+    std::function<void(void *)> Release;
+    std::atomic<size_t> Outstanding{0};
+  };
+
+  /// Hint of the free callback of a message
+  struct InFlight {
+    std::shared_ptr<Completions> Sink;
+    void *Opaque;
+    size_t Size;
+    steady_clock::time_point Sent;
+    // false if 0MQ didn't take the message: nothing to report
+    bool Taken;
+    // released once written to a PUSH socket, not dropped
+    bool Confirmed;
+  };
+
+  static void released(void *, void *Hint) {
+    std::unique_ptr<InFlight> Item{static_cast<InFlight *>(Hint)};
+    std::lock_guard<std::mutex> Lock(Item->Sink->Guard);
+    if (Item->Opaque && Item->Sink->Release) {
+      Item->Sink->Release(Item->Opaque);
+    }
+    if (Item->Taken) {
+      Item->Sink->Done.push_back(Completion{Item->Size, Item->Sent,
+                                            steady_clock::now(),
+                                            Item->Confirmed});
+      --Item->Sink->Outstanding;
+    }
+  }
+
+  std::string Topic;
+  void *Socket{nullptr};
+  std::unique_ptr<Serialiser> SerialiserWorker{nullptr};
+  std::shared_ptr<Completions> Sink;
+  std::vector<Completion> Done;
+  FlowController Flow;
+  double NumMessages{0};
+  double Mbytes{0};
+  delivered_t Delivered;
+  std::function<void(size_t)> SentHook;
+  std::function<void(const nanoseconds &)> BlockedHook;
+  bool Confirmed{false};
+  const std::chrono::seconds QueueFullTimeout{10};
+  const std::chrono::seconds FlushTimeout{10};
+
+  /// Send the topic frame, false if the socket would block
+  bool sendTopic() {
+    if (zmq_send(Socket, Topic.data(), Topic.size(),
+                 ZMQ_SNDMORE | ZMQ_DONTWAIT) >= 0) {
+      return true;
+    }
+    if (zmq_errno() != EAGAIN) {
+      throw zmqError("Can't send to " + Topic);
+    }
+    return false;
+  }
+
+  size_t transmit(void *Data, const size_t Size, void *Opaque) {
+    if (!Flow.admit(Size)) {
+      steady_clock::time_point Start = steady_clock::now();
+      IdleBackoff Backoff;
+      while (!Flow.admit(Size)) {
+        poll(0);
+        Backoff.wait();
+      }
+      if (BlockedHook) {
+        BlockedHook(steady_clock::now() - Start);
+      }
+    }
+    steady_clock::time_point Start;
+    bool Blocked{false};
+    IdleBackoff Backoff;
+    while (!sendTopic()) {
+      if (!Blocked) {
+        Start = steady_clock::now();
+        Blocked = true;
+      }
+      if (steady_clock::now() - Start > QueueFullTimeout) {
+        if (Opaque) {
+          Sink->Release(Opaque);
+        }
+        throw std::runtime_error("Queue full : " + Topic);
+      }
+      poll(0);
+      Backoff.wait();
+    }
+    if (Blocked && BlockedHook) {
+      BlockedHook(steady_clock::now() - Start);
+    }
+
+    // a buffer without owner is reused by the serialiser: copy it
+    zmq_msg_t Payload;
+    auto Item = new InFlight{Sink, Opaque, Size, steady_clock::now(), true,
+                             Confirmed && Opaque};
+    if (Opaque) {
+      zmq_msg_init_data(&Payload, Data, Size, &ZmqTransmitter::released,
+                        Item);
     } else {
-      zmq_send(socket, &h[0], h.size(), 0);
-    }
-    // std::cout << "->" << h
-    //           << "," << h.size()
-    //           << "," << nev
-    //           << std::endl;
-  }
-
-  template <typename T>
-  void send(std::string h, T *data, int nev,
-            SINQAmorSim::FlatBufSerialiser<T>) {
-    // /*! @tparam T data type
-    //  *  @param h data header
-    //  *  @param data pointer to data array to be sent
-    //  *  @param nev number of elements in data array */
-    // /*! Serialises the message using FlatBuffers and sends it */
-    // SINQAmorSim::FlatBufSerialiser<T> s;
-    // s(h.c_str(),data,nev);
-    // zmq_send(socket,(char*)s(),s.size(),0);
-    // // std::cout << "->" << h
-    // //           << "," << h.size()
-    // //           << "," << nev
-    // //           << std::endl;
-
-    // // std::ofstream of("first.out",std::ofstream::binary);
-    // // of.write((char*)s(h.c_str(),data,nev),s.size());
-    // // of.close();
-  }
-
-  template <typename T>
-  int recv(std::string &h, std::vector<T> &data, SINQAmorSim::NoSerialiser<T>) {
-    /*! @tparam T data type
-     *  @param h string containing received data header
-     *  @param data vector containing received event data
-     *  @result pid packet ID */
-    /*! Receives the message split into header and events. Parse header to
-        determine the expected number of events. If equal 0 does not wait for
-        events. If greater than 0 and ZMQ_RCVMORE == true receives event
-        data. Otherwise throws an error.
-    */
-    int rcvmore;
-    int s = zmq_recv(socket, &h[0], max_header_size, 0);
-    zmq_getsockopt(socket, ZMQ_RCVMORE, &rcvmore, &optlen);
-
-    auto info = parse_header(h);
-    std::cout << " pid =  " << info.first << std::endl;
-    std::cout << " nev =  " << info.second << std::endl;
-
-    uint64_t *x;
-    if (rcvmore && (info.second > 0)) {
-      if (info.second > data.size()) {
-        data.resize(info.second);
+      zmq_msg_init_size(&Payload, Size);
+      std::memcpy(zmq_msg_data(&Payload), Data, Size);
+    }
+    ++Sink->Outstanding;
+    Flow.sent(Size);
+    if (zmq_msg_send(&Payload, Socket, 0) < 0) {
+      auto Error = zmqError("Can't send to " + Topic);
+      Item->Taken = false;
+      --Sink->Outstanding;
+      Flow.completed(Size);
+      zmq_msg_close(&Payload);
+      if (!Opaque) {
+        delete Item;
       }
-      int s = zmq_recv(socket, &data[0], info.second, 0);
-    } else if (rcvmore != info.second)
-      std::cout << "Error receiving data: "
-                << "recvmore = " << rcvmore << "info.second = " << info.second
-                << std::endl;
-    return info.first;
+      throw Error;
+    }
+    if (!Opaque) {
+      // copied: only sent, 0MQ never tells when it is written
+      released(nullptr, Item);
+    }
+    return Size;
   }
+};
 
-  template <typename T>
-  int recv(std::string &h, std::vector<T> &data,
-           SINQAmorSim::FlatBufSerialiser<T>) {
-    /*! @tparam T data type
-     *  @param h string containing received data header
-     *  @param data vector containing received event data
-     *  @result pid packet ID */
-    /*! Receives the serialised message and unserialise it. */
+/// A message received by ZmqListener, with the accessors of RdKafka::Message
+/// used by the listeners. The payload is not copied out of 0MQ.
+class ZmqMessage {
+public:
+  ZmqMessage() { zmq_msg_init(&Payload); }
+  ZmqMessage(const ZmqMessage &) = delete;
+  ZmqMessage &operator=(const ZmqMessage &) = delete;
+  ~ZmqMessage() { zmq_msg_close(&Payload); }
 
-    // zmq_msg_t msg;
-    // SINQAmorSim::FlatBufSerialiser<T> s;
+  const void *payload() const { return zmq_msg_data(&Payload); }
+  size_t len() const { return zmq_msg_size(&Payload); }
+  const std::string &topic_name() const { return Topic; }
 
-    // int rc = zmq_msg_init (&msg);
-    // assert (rc == 0);
-    // zmq_msg_recv (&msg,socket,0);
+private:
+  friend class ZmqListenerSocket;
+  std::string Topic;
+  mutable zmq_msg_t Payload;
+};
 
-    // std::cout << "\tzmq_recv size: " << zmq_msg_size(&msg) << std::endl;
+/// There is no broker timestamp over 0MQ
+inline std::chrono::nanoseconds kafkaTime(const ZmqMessage &) {
+  return std::chrono::nanoseconds(0);
+}
 
-    // s.extract(reinterpret_cast<char*>(zmq_msg_data(&msg)),h,data);
-    // zmq_msg_close (&msg);
-    // auto info = parse_header(h);
-    // std::cout << " pid =  " << info.first << std::endl;
-    // std::cout << "n events = " << info.second << std::endl;
+struct ZmqMessageBatch {
+  std::vector<std::unique_ptr<ZmqMessage>> Messages;
+  std::chrono::nanoseconds ReceiveTime{0};
+};
 
-    // return info.first;
+/// Receiving socket: binds the endpoint and keeps the messages of the
+/// topics of a comma separated list
+class ZmqListenerSocket {
+public:
+  ZmqListenerSocket(const std::string &Endpoint, const std::string &TopicNames,
+                    const KafkaOptions &Options) {
+    std::stringstream Stream(TopicNames);
+    std::string Name;
+    while (std::getline(Stream, Name, ',')) {
+      if (!Name.empty()) {
+        Topics.push_back(Name);
+      }
+    }
+    if (Topics.empty()) {
+      throw std::runtime_error("Topic required");
+    }
+    int Type = zmqSocketType(Options, true);
+    Socket = zmq_socket(zmqContext(), Type);
+    if (!Socket) {
+      throw zmqError("Can't create the 0MQ socket");
+    }
+    int HighWaterMark = int(findSizeOption(Options, "zmq.hwm", 1000));
+    zmq_setsockopt(Socket, ZMQ_RCVHWM, &HighWaterMark, sizeof(int));
+    if (Type == ZMQ_SUB) {
+      for (auto &Topic : Topics) {
+        zmq_setsockopt(Socket, ZMQ_SUBSCRIBE, Topic.data(), Topic.size());
+      }
+    }
+    if (zmq_bind(Socket, Endpoint.c_str())) {
+      zmq_close(Socket);
+      throw zmqError("Can't bind " + Endpoint);
+    }
+  }
+  ZmqListenerSocket(const ZmqListenerSocket &) = delete;
+  ZmqListenerSocket &operator=(const ZmqListenerSocket &) = delete;
+  ~ZmqListenerSocket() { zmq_close(Socket); }
+
+  /// Wait up to Timeout ms for a message, then take without waiting the
+  /// messages already received, up to MaxSize. Returns the batch size.
+  size_t consume(ZmqMessageBatch &Batch, const size_t MaxSize,
+                 const int Timeout) {
+    Batch.Messages.clear();
+    zmq_pollitem_t Item{Socket, 0, ZMQ_POLLIN, 0};
+    if (zmq_poll(&Item, 1, Timeout) > 0) {
+      while (Batch.Messages.size() < MaxSize) {
+        std::unique_ptr<ZmqMessage> Message{new ZmqMessage};
+        if (!receive(*Message)) {
+          break;
+        }
+        if (std::find(Topics.begin(), Topics.end(), Message->Topic) !=
+            Topics.end()) {
+          Batch.Messages.push_back(std::move(Message));
+        }
+      }
+    }
+    Batch.ReceiveTime = std::chrono::nanoseconds(getCurrentTimestamp());
+    return Batch.Messages.size();
+  }
+
+private:
+  void *Socket{nullptr};
+  std::vector<std::string> Topics;
+
+  /// The next two-frame message, false if none is waiting
+  bool receive(ZmqMessage &Message) {
+    zmq_msg_t Frame;
+    zmq_msg_init(&Frame);
+    if (zmq_msg_recv(&Frame, Socket, ZMQ_DONTWAIT) < 0) {
+      zmq_msg_close(&Frame);
+      if (zmq_errno() != EAGAIN) {
+        throw zmqError("Can't receive");
+      }
+      return false;
+    }
+    Message.Topic.assign(static_cast<const char *>(zmq_msg_data(&Frame)),
+                         zmq_msg_size(&Frame));
+    bool More = zmq_msg_more(&Frame);
+    zmq_msg_close(&Frame);
+    // the frames of a message arrive together
+    if (!More || zmq_msg_recv(&Message.Payload, Socket, 0) < 0) {
+      throw std::runtime_error("Malformed 0MQ message on " + Message.Topic);
+    }
+    return true;
+  }
+};
+
+/// Receives the messages of ZmqTransmitter, with the interface of
+/// KafkaListener. Only one listener can bind an endpoint.
+template <class Serialiser> struct ZmqListener {
+  using batch_t = ZmqMessageBatch;
+
+  ZmqListener(const std::string &Endpoint, const std::string &TopicName,
+              const std::string &SourceName, const KafkaOptions &Options)
+      : Source{SourceName}, Socket{Endpoint, TopicName, Options} {}
+
+  size_t consume(ZmqMessageBatch &Batch, const size_t MaxSize,
+                 const int Timeout) {
+    return Socket.consume(Batch, MaxSize, Timeout);
+  }
+
+  const std::string &source() const { return Source; }
+
+  /// Wait for the next message and decode it in data
+  template <typename T> ReceivedMessage recv(std::vector<T> &data) {
+    ZmqMessageBatch Batch;
+    while (!consume(Batch, 1, 1000)) {
+    }
+    return decodeMessage(*Batch.Messages.front(), Batch.ReceiveTime, data,
+                         Source);
   }
 
 private:
-  void *context; /// pointer to 0MQ context
-  void *socket;  /// pointer to 0MQ socket
-  char *d = NULL;
-  int max_event_size = 0;
-  size_t optlen = sizeof(int);
+  std::string Source;
+  ZmqListenerSocket Socket;
 };
 
-} // namespace generator
+} // namespace SINQAmorSim